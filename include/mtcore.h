@@ -5,6 +5,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <mpi.h>
+#include "mtcore_atomic.h"
+#include "mtcore_am.h"
+#include "mtcore_topo.h"
+#include "mtcore_shm_seg.h"
+#include "mtcore_cmd_ring.h"
+#include "mtcore_p2p.h"
 
 #define MTCORE_ENABLE_GRANT_LOCK_HIDDEN_BYTE
 
@@ -29,6 +35,14 @@
  * when shared segment size of each helper is 0 */
 #define MTCORE_HELPER_SHARED_SG_SIZE 4096
 
+/* Helper 0 contains extra space for sync. */
+#ifdef MTCORE_ENABLE_GRANT_LOCK_HIDDEN_BYTE
+#define MTCORE_ROOT_H_SHARED_SG_SIZE \
+    max(MTCORE_HELPER_SHARED_SG_SIZE, (int) sizeof(MTCORE_GRANT_LOCK_DATATYPE))
+#else
+#define MTCORE_ROOT_H_SHARED_SG_SIZE MTCORE_HELPER_SHARED_SG_SIZE
+#endif
+
 /* Options for lock permission controlling among multiple helpers.
  *
  * Since RMA Ops to a given target may be distributed to different helpers
@@ -124,15 +138,61 @@ typedef enum {
     MTCORE_LOCK_BINDING_SEGMENT,
 } MTCORE_Lock_binding;
 
+/* How helpers are synchronized on internal windows, see sync_strategy.c */
+typedef enum {
+    MTCORE_SYNC_HELPER,         /* lock, unlock and flush every helper of target */
+    MTCORE_SYNC_ALL,            /* lock_all, unlock_all and flush_all on internal windows */
+} MTCORE_Sync_strategy;
+
+/* How helpers wait for new functions and active messages, see progress.c */
+typedef enum {
+    MTCORE_H_PROGRESS_BLOCK,    /* block in MPI, unless active messages need polling */
+    MTCORE_H_PROGRESS_BUSY,     /* busy poll */
+    MTCORE_H_PROGRESS_YIELD,    /* spin, then yield processor on every poll */
+    MTCORE_H_PROGRESS_SLEEP,    /* spin, then sleep with exponential backoff */
+} MTCORE_H_progress_policy;
+
+/* What provides asynchronous progress, see ghost.c */
+typedef enum {
+    MTCORE_GHOST_PROCESS,       /* dedicated helper processes on every node */
+    MTCORE_GHOST_THREAD,        /* a progress thread in one user process per node */
+} MTCORE_Ghost_mode;
+
 #define MTCORE_DEFAULT_SEG_SIZE 4096;
+#define MTCORE_DEFAULT_STRIPE_SIZE (1024 * 1024)  /* bytes */
 #define MTCORE_DEFAULT_NUM_HELPER 1
+#define MTCORE_DEFAULT_H_PROGRESS_SPIN 10000
+#define MTCORE_DEFAULT_H_PROGRESS_SLEEP_MAX 1000        /* us */
 
 typedef struct MTCORE_Env_param {
+    MTCORE_Ghost_mode ghost_mode;
     int num_h;
     int seg_size;               /* segment size in lock segment binding */
+    int stripe_size;            /* larger contiguous put/get are striped over helpers */
+    int h_credit_ops;           /* outstanding operations per helper, 0 means unlimited */
+    int h_credit_bytes;         /* outstanding bytes per helper, 0 means unlimited */
+    int h_credit_stat;          /* report high-water marks of helper queues at win_free */
     MTCORE_Load_opt load_opt;   /* runtime load balancing options */
     MTCORE_Load_lock load_lock; /* how to grant locks for runtime load balancing */
     MTCORE_Lock_binding lock_binding;   /* how to handle locks */
+    MTCORE_Sync_strategy sync_strategy; /* default synchronization of windows */
+    MTCORE_Rma_transport rma_transport; /* default transport of windows */
+    int shm_acc;                /* apply accumulates to same-node targets in shared memory */
+    int shm_numa_bind;          /* place window segments on the NUMA domain of owners */
+    MTCORE_Huge_page huge_page; /* default page kind of window segments */
+    int comm_cache;             /* reuse internal communicators of windows on the same group */
+    int cmd_ring;               /* start helper functions through the shared command ring */
+    int fop_combine;            /* combine fetch_and_op of a node in aggregated AM transport */
+    int p2p_offload;            /* hand offload point-to-point in shared segments to helpers */
+    int p2p_offload_size;       /* smaller offload point-to-point are posted by users */
+    int coll_offload;           /* run window collectives on helpers */
+    int win_free_defer;         /* release internal resources of freed windows in background */
+    MTCORE_H_progress_policy h_progress;        /* progress policy of helpers */
+    int h_progress_spin;        /* idle polls before yield or sleep */
+    int h_progress_sleep_max;   /* upper bound of sleep backoff in us */
+    int h_progress_stat;        /* report time in every progress state at finalize */
+    MTCORE_H_placement h_placement;     /* how to pick helpers among local processes */
+    int *h_local_ranks;         /* helpers specified by local ranks, override placement */
 } MTCORE_Env_param;
 
 
@@ -150,6 +210,13 @@ typedef enum {
     MTCORE_WIN_EPOCH_PSCW,
 } MTCORE_Win_epoch_stat;
 
+/* State of shared-memory accumulate on a same-node target, see shm_acc.c */
+typedef enum {
+    MTCORE_SHM_ACC_DISABLED,
+    MTCORE_SHM_ACC_ENABLED,     /* exclusive lock is issued but may not be granted yet */
+    MTCORE_SHM_ACC_GRANTED,
+} MTCORE_Shm_acc_stat;
+
 typedef enum {
     MTCORE_FUNC_NULL,
     MTCORE_FUNC_WIN_ALLOCATE,
@@ -158,6 +225,7 @@ typedef enum {
     MTCORE_FUNC_UNLOCK_ALL,
     MTCORE_FUNC_ABORT,
     MTCORE_FUNC_FINALIZE,
+    MTCORE_FUNC_COMM_RELEASE,
     MTCORE_FUNC_MAX,
 } MTCORE_Func;
 
@@ -176,6 +244,12 @@ typedef struct MTCORE_H_win_params {
 struct MTCORE_Win_info_args {
     unsigned short no_local_load_store;
     int epoch_type;
+    int num_thread_eps;         /* number of per-thread endpoint windows, 1 means disabled */
+    int rma_transport;          /* MTCORE_Rma_transport */
+    int huge_page;              /* MTCORE_Huge_page of the node shared segment */
+    int no_acc_ordering;        /* accumulate_ordering is none */
+    int acc_same_op_no_op;      /* accumulate_ops is same_op_no_op */
+    int sync_strategy;          /* MTCORE_Sync_strategy */
 };
 
 typedef struct MTCORE_OP_Segment {
@@ -200,7 +274,7 @@ typedef struct MTCORE_Win_target_seg {
     MPI_Win uh_win;
 
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
-    MTCORE_Main_lock_stat main_lock_stat;
+    MTCORE_Main_lock_stat main_lock_stat;       /* atomic */
 #endif
 } MTCORE_Win_target_seg;
 
@@ -209,9 +283,10 @@ typedef struct MTCORE_Win_target {
     int disp_unit;
     MPI_Aint size;
 
-    MPI_Aint *base_h_offsets;   /* MTCORE_ENV.num_h */
-    int *h_ranks_in_uh;         /* MTCORE_ENV.num_h */
+    MPI_Aint *base_h_offsets;   /* num_h of window, indexed by h_off */
+    int *h_ranks_in_uh;         /* num_h of window, indexed by h_off */
     int remote_lock_assert;
+    int remote_lock_exclusive;  /* target is exclusively locked in current epoch */
 
     int local_user_rank;        /* rank in local user communicator */
     int local_user_nprocs;
@@ -226,23 +301,83 @@ typedef struct MTCORE_Win_target {
     MTCORE_Win_target_seg *segs;
     int num_segs;
 
+    int am_lock_granted;        /* lock is granted for AM transport in current epoch, atomic */
+    int am_rma_acc_issued;      /* accumulate-class operations fell back to MPI RMA since
+                                 * the last AM accumulate, atomic */
+
+    void *shm_base;             /* base of shared segment if target is on the same node, otherwise NULL */
+    int shm_acc_stat;           /* MTCORE_Shm_acc_stat in current epoch, atomic */
+    int shm_acc_remote_issued;  /* accumulate-class operations are issued to helpers, atomic */
+
 } MTCORE_Win_target;
 
+/* Injection credits of an origin on a helper, see credit.c */
+typedef struct MTCORE_Credit {
+    int ops;                    /* operations issued since last flush, atomic */
+    unsigned long bytes;        /* bytes issued since last flush, atomic */
+    int max_ops;                /* high-water marks */
+    unsigned long max_bytes;
+    unsigned long num_flushes;  /* intermediate flushes when credits ran out */
+    unsigned long num_redirects;        /* operations moved to another helper */
+} MTCORE_Credit;
+
+/* Internal communicators derived from a user communicator, shared by all the
+ * windows allocated on communicators with the same group. */
+typedef struct MTCORE_Comm_cache {
+    int key;                    /* unique key known by helpers, see MTCORE_Comm_cache_key */
+    int ref_count;              /* number of windows and user communicators referring to it */
+    MPI_Group user_group;
+
+    MPI_Comm local_user_comm;
+    MPI_Comm user_root_comm;
+    int node_id;
+    int num_nodes;
+
+    MPI_Comm uh_comm;
+    MPI_Group uh_group;
+    MPI_Comm local_uh_comm;
+    MPI_Group local_uh_group;
+
+    struct MTCORE_Comm_cache *next;
+} MTCORE_Comm_cache;
+
+struct MTCORE_Win;
+
+/* Synchronization routines of a strategy, selected per window in win_allocate.
+ * The mixed routines synchronize all targets on windows of lock|lockall
+ * epochs, and flush_win flushes all helpers on a single window. */
+typedef struct MTCORE_Sync_fns {
+    int (*lock) (int lock_type, int target_rank, int assert, struct MTCORE_Win * uh_win);
+    int (*unlock) (int target_rank, struct MTCORE_Win * uh_win);
+    int (*flush) (int target_rank, MPI_Win target_uh_win, struct MTCORE_Win * uh_win);
+    int (*mixed_lock_all) (int assert, struct MTCORE_Win * uh_win);
+    int (*mixed_unlock_all) (struct MTCORE_Win * uh_win);
+    int (*mixed_flush_all) (struct MTCORE_Win * uh_win);
+    int (*flush_win) (MPI_Win win, int flush_self, struct MTCORE_Win * uh_win);
+    int (*lock_self) (struct MTCORE_Win * uh_win);
+    int (*unlock_self) (struct MTCORE_Win * uh_win);
+    int (*flush_self) (struct MTCORE_Win * uh_win);
+} MTCORE_Sync_fns;
+
+extern const MTCORE_Sync_fns MTCORE_SYNC_HELPER_FNS;
+extern const MTCORE_Sync_fns MTCORE_SYNC_ALL_FNS;
+
 typedef struct MTCORE_Win {
-    /* communicator including root user processes and all helpers,
-     * used for internal information exchange between users and helpers */
-    MPI_Comm ur_h_comm;
+    int req_id;                 /* control-plane request id of win_allocate */
 
     /* communicator including local process and helpers */
     MPI_Comm local_uh_comm;
     MPI_Group local_uh_group;
     MPI_Win local_uh_win;
+    MTCORE_Shm_seg *shm_seg;    /* NULL if local_uh_win is allocated by MPI */
 
     int num_h_ranks_in_uh;      /* number of unique helper ranks */
-    int *h_ranks_in_uh;         /* unique helper ranks in world, used in lockall only epoches. */
+    int *h_ranks_in_uh;         /* unique helper ranks in uh_comm, used in lockall only epoches. */
+    int num_h;                  /* number of helpers used by this window on every node */
+    int *h_offs;                /* local helper index of every h_off of this window */
     int my_rank_in_uh_comm;     /* remember my rank in internal uh_comm for local RMA. Specified in win_allocate. */
     MPI_Win my_uh_win;          /* Do not free the window, it is referred from another window. Specified in win_allocate. */
-    unsigned short is_self_locked;
+    unsigned short is_self_locked;      /* atomic */
 
     /* communicator including all the user processes and helpers */
     MPI_Comm uh_comm;
@@ -253,6 +388,9 @@ typedef struct MTCORE_Win {
 
     /* communicator including all the user processes */
     MPI_Comm user_comm;
+    int user_comm_dup;          /* duplicated by MTCORE_Win_iallocate, freed in win_free */
+    MTCORE_Comm_cache *comm_cache;      /* if not NULL, all internal communicators are
+                                         * referred from the cache, do not free them. */
     MPI_Group user_group;
     MPI_Comm user_root_comm;
 
@@ -265,12 +403,26 @@ typedef struct MTCORE_Win {
                                          * can send to the correct window. Note that only
                                          * change from lock to NO_EPOCH when lock counter is
                                          * equal to 0, otherwise the whole window is still in
-                                         * LOCK epoch */
-    int lock_counter;
-    int lockall_counter;
+                                         * LOCK epoch. Lock epoch transitions are atomic,
+                                         * see MTCORE_Win_epoch_lock_inc/dec. */
+    int lock_counter;           /* atomic */
+    int lockall_counter;        /* atomic */
 
     MPI_Win active_win;
 
+    /* Per-thread endpoint windows, only allocated when info_args.num_thread_eps > 1.
+     * Every calling thread is bound to one endpoint, thus threads issue put and get
+     * on independent MPI windows. Accumulate-class operations stay on the original
+     * window for atomicity, and flushes complete all endpoints. Index 0 refers to
+     * the original window.
+     *  ep_uh_wins: duplicates of uh_wins[0], only for lockall-only window.
+     *  ep_active_wins: duplicates of active_win, for fence and pscw. */
+    MPI_Win *ep_uh_wins;
+    MPI_Win *ep_active_wins;
+
+    /* Active-message transport, only allocated when info_args.rma_transport is AM. */
+    MTCORE_AM_win *am;
+
     MPI_Group start_group;
     MPI_Group post_group;
     int *start_ranks_in_win_group;
@@ -282,29 +434,75 @@ typedef struct MTCORE_Win {
     MTCORE_Win_target *targets;
 
     unsigned long *h_win_handles;
+    unsigned int coll_seq;      /* sequence number of offloaded collectives, atomic */
 
 #ifdef MTCORE_ENABLE_GRANT_LOCK_HIDDEN_BYTE
     MPI_Aint grant_lock_h_offset;       /* Hidden byte for granting lock on Helper0 */
 #endif
 
     struct MTCORE_Win_info_args info_args;
+    const MTCORE_Sync_fns *sync;        /* synchronization strategy of helpers */
+
+    MTCORE_Credit **h_credits;  /* [internal window][helper rank in uh_comm], NULL if unlimited */
+    int num_credit_wins;
 
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
-    int prev_h_off;
+    /* Load counters are shared by all threads, they are updated atomically
+     * without ordering since they are only hints for helper selection. */
+    unsigned int prev_h_off;
     int *h_ops_counts;          /* cnt = h_ops_counts[h_rank_in_uh] */
     unsigned long *h_bytes_counts;      /* byte = h_ops_bytes[h_rank_in_uh] */
 #endif
 
 } MTCORE_Win;
 
+/* Control message from a user root to local helpers. A function is started by
+ * a single message including the header and packed parameters of the function,
+ * and helpers derive the others locally. Functions needing results reply a
+ * single message to the user root, tagged by the request id.
+ * MTCORE_FUNC_VERSION must be increased whenever the format is changed. */
+#define MTCORE_FUNC_VERSION 2
+
 typedef struct MTCORE_Func_info {
+    int version;
     MTCORE_Func FUNC;
     int user_nprocs;
     int user_local_nprocs;
+    int req_id;
+    int comm_key;               /* key of cached communicators, see MTCORE_Comm_cache_key */
+    int param_size;             /* size in bytes of parameters following the header */
 } MTCORE_Func_info;
 
+/* Parameters of MTCORE_FUNC_WIN_ALLOCATE, followed by num_user_ranks world
+ * ranks of user processes if helpers create new communicators. */
+typedef struct MTCORE_Func_win_allocate_param {
+    int is_user_world;
+    int max_local_user_nprocs;
+    int epoch_type;
+    int num_thread_eps;
+    int rma_transport;
+    int num_user_ranks;
+} MTCORE_Func_win_allocate_param;
+
+/* Parameters of MTCORE_FUNC_WIN_FREE are the handles of helper windows, the
+ * i-th one is for local helper i. Helpers reply the same handles to the
+ * user root in MTCORE_FUNC_WIN_ALLOCATE. */
+
 #define MTCORE_FUNC_TAG 9889
 
+/* Every control-plane request is tagged by an id unique among the requests in
+ * flight, which is used as the tag of replies and communicators created between
+ * users and helpers, thus functions of different windows never match each other. */
+#define MTCORE_FUNC_MAX_REQS 16
+
+/* Key of cached communicators sent to helpers in win_allocate. Keys are unique
+ * in the world (never reused), helpers reuse the cached communicators if the key
+ * is found, otherwise create new ones and cache them with the key, or create
+ * communicators only for this window if it is MTCORE_COMM_CACHE_NONE. */
+#define MTCORE_COMM_CACHE_NONE (-1)
+#define MTCORE_Comm_cache_key(uh_win) ((uh_win)->comm_cache ? (uh_win)->comm_cache->key : \
+                                       MTCORE_COMM_CACHE_NONE)
+
 #define MTCORE_Define_win_cache int UH_WIN_HANDLE_KEY = MPI_KEYVAL_INVALID
 extern int UH_WIN_HANDLE_KEY;
 
@@ -324,16 +522,45 @@ extern int UH_WIN_HANDLE_KEY;
     }   \
 }
 
+/* Per-thread lookup cache of the last accessed mtcore window.
+ * Every thread remembers the last (win, uh_win) pair it fetched together with
+ * the global window generation, which is increased whenever a mtcore window is
+ * allocated or freed. Thus the cached entry can never refer to a freed window,
+ * and concurrent threads do not contend on the attribute lock of MPI. */
+typedef struct MTCORE_Win_tls_cache {
+    MPI_Win win_handle;
+    struct MTCORE_Win *uh_win_ptr;
+    unsigned long gen;
+} MTCORE_Win_tls_cache;
+
+extern __thread MTCORE_Win_tls_cache MTCORE_WIN_TLS_CACHE;
+extern unsigned long MTCORE_WIN_CACHE_GEN;
+
+#define MTCORE_Invalidate_win_tls_cache() MTCORE_Atomic_incr_fetch(&MTCORE_WIN_CACHE_GEN)
+
 #define MTCORE_Fetch_uh_win_from_cache(win, uh_win) { \
     int flag = 0;   \
-    mpi_errno = PMPI_Win_get_attr(win, UH_WIN_HANDLE_KEY, &uh_win, &flag);   \
-    if (!flag || mpi_errno != MPI_SUCCESS){  \
-        MTCORE_DBG_PRINT("Cannot fetch uh_win from win 0x%x\n", win);   \
-        uh_win = NULL; \
+    unsigned long gen = MTCORE_Atomic_load(&MTCORE_WIN_CACHE_GEN);  \
+    if (MTCORE_WIN_TLS_CACHE.win_handle == (win) && MTCORE_WIN_TLS_CACHE.gen == gen \
+            && MTCORE_WIN_TLS_CACHE.uh_win_ptr != NULL) {  \
+        uh_win = MTCORE_WIN_TLS_CACHE.uh_win_ptr;  \
+    }   \
+    else {  \
+        mpi_errno = PMPI_Win_get_attr(win, UH_WIN_HANDLE_KEY, &uh_win, &flag);   \
+        if (!flag || mpi_errno != MPI_SUCCESS){  \
+            MTCORE_DBG_PRINT("Cannot fetch uh_win from win 0x%x\n", win);   \
+            uh_win = NULL; \
+        }   \
+        else {  \
+            MTCORE_WIN_TLS_CACHE.win_handle = (win);    \
+            MTCORE_WIN_TLS_CACHE.uh_win_ptr = uh_win;  \
+            MTCORE_WIN_TLS_CACHE.gen = gen;    \
+        }   \
     }   \
 }
 
 #define MTCORE_Cache_uh_win(win, uh_win) { \
+    MTCORE_Invalidate_win_tls_cache();  \
     mpi_errno = PMPI_Win_set_attr(win, UH_WIN_HANDLE_KEY, uh_win);  \
     if (mpi_errno != MPI_SUCCESS){  \
         MTCORE_ERR_PRINT("Cannot cache uh_win %p for win 0x%x\n", uh_win, win);   \
@@ -343,6 +570,7 @@ extern int UH_WIN_HANDLE_KEY;
 }
 
 #define MTCORE_Remove_uh_win_from_cache(win)  {\
+    MTCORE_Invalidate_win_tls_cache();  \
     mpi_errno = PMPI_Win_delete_attr(win, UH_WIN_HANDLE_KEY);   \
     if (mpi_errno != MPI_SUCCESS){  \
         MTCORE_ERR_PRINT("Cannot remove uh_win cache for win 0x%x\n", win);   \
@@ -367,10 +595,18 @@ extern int *MTCORE_USER_RANKS_IN_WORLD;
 extern int MTCORE_NUM_NODES;
 extern int MTCORE_MY_NODE_ID;
 extern int *MTCORE_ALL_NODE_IDS;
+extern int *MTCORE_ALL_NUMA_IDS;
 extern int MTCORE_MY_RANK_IN_WORLD;
+extern int MTCORE_THREAD_LEVEL;
+extern int MTCORE_THREAD_EP_COUNTER;
+extern __thread int MTCORE_THREAD_EP_ID;
 
 extern MTCORE_Env_param MTCORE_ENV;
 
+/* NULL if the command ring is disabled */
+extern MTCORE_Cmd_ring *MTCORE_CMD_RING;
+extern MPI_Win MTCORE_CMD_RING_WIN;
+
 static inline int MTCORE_Get_node_ids(MPI_Group group, int n, const int ranks[], int node_ids[])
 {
     int mpi_errno = MPI_SUCCESS;
@@ -402,18 +638,18 @@ static inline int MTCORE_Get_node_ids(MPI_Group group, int n, const int ranks[],
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
 #define MTCORE_Reset_win_target_load_opt_op_counting(target_rank, uh_win) {  \
         int h_off, h_rank;  \
-        for (h_off = 0; h_off < MTCORE_ENV.num_h; h_off++) {    \
+        for (h_off = 0; h_off < uh_win->num_h; h_off++) {    \
             h_rank = uh_win->targets[target_rank].h_ranks_in_uh[h_off]; \
-            uh_win->h_ops_counts[h_rank] = 0;    \
+            MTCORE_Atomic_store(&uh_win->h_ops_counts[h_rank], 0);    \
         }   \
         MTCORE_DBG_PRINT("[load_opt_op] reset target %d op counting \n", target_rank); \
     }
 
 #define MTCORE_Reset_win_target_load_opt_bytes_counting(target_rank, uh_win) {  \
         int h_off, h_rank;  \
-        for (h_off = 0; h_off < MTCORE_ENV.num_h; h_off++) {    \
+        for (h_off = 0; h_off < uh_win->num_h; h_off++) {    \
             h_rank = uh_win->targets[target_rank].h_ranks_in_uh[h_off]; \
-            uh_win->h_bytes_counts[h_rank] = 0;    \
+            MTCORE_Atomic_store(&uh_win->h_bytes_counts[h_rank], 0);    \
         }   \
         MTCORE_DBG_PRINT("[load_opt_byte] reset target %d byte counting \n", target_rank); \
     }
@@ -428,12 +664,12 @@ static inline int MTCORE_Get_node_ids(MPI_Group group, int n, const int ranks[],
 
 
 #define MTCORE_Inc_win_target_load_opt_op_counting(h_rank_in_uh, uh_win) {  \
-        uh_win->h_ops_counts[h_rank_in_uh]++;   \
+        MTCORE_Atomic_add(&uh_win->h_ops_counts[h_rank_in_uh], 1);   \
         MTCORE_DBG_PRINT("[load_opt_op] increment helper %d\n", h_rank_in_uh); \
     }
 
 #define MTCORE_Inc_win_target_load_opt_bytes_counting(h_rank_in_uh, size, uh_win) {  \
-        uh_win->h_bytes_counts[h_rank_in_uh] += size;   \
+        MTCORE_Atomic_add(&uh_win->h_bytes_counts[h_rank_in_uh], size);   \
         MTCORE_DBG_PRINT("[load_opt_byte] increment helper %d\n", h_rank_in_uh); \
     }
 #endif
@@ -492,7 +728,8 @@ static inline int MTCORE_Win_grant_local_lock(int target_rank, int lock_type,
             goto fn_fail;
 
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
-        uh_win->targets[target_rank].segs[j].main_lock_stat = MTCORE_MAIN_LOCK_GRANTED;
+        MTCORE_Atomic_store(&uh_win->targets[target_rank].segs[j].main_lock_stat,
+                            MTCORE_MAIN_LOCK_GRANTED);
 #endif
         MTCORE_DBG_PRINT("[%d]grant local lock(Helper(%d), uh_wins 0x%x) seg %d\n", user_rank,
                          target_h_rank_in_uh, uh_win->targets[target_rank].segs[j].uh_win, j);
@@ -508,20 +745,59 @@ static inline int MTCORE_Win_grant_local_lock(int target_rank, int lock_type,
 
 extern const char *MTCORE_Win_epoch_stat_name[4];       /* for debug */
 
+/* Get the endpoint of calling thread. Threads are numbered in the order they
+ * first access any window, and bound to endpoints in round-robin. */
+static inline int MTCORE_Get_thread_ep(MTCORE_Win * uh_win)
+{
+    if (unlikely(MTCORE_THREAD_EP_ID < 0))
+        MTCORE_THREAD_EP_ID = MTCORE_Atomic_fetch_add(&MTCORE_THREAD_EP_COUNTER, 1);
+    return MTCORE_THREAD_EP_ID % uh_win->info_args.num_thread_eps;
+}
+
+/* Get the lock window of calling thread in lockall-only window, or the default one. */
+#define MTCORE_Get_ep_uh_win_ptr(uh_win, default_win_ptr) \
+    (uh_win->ep_uh_wins ? &uh_win->ep_uh_wins[MTCORE_Get_thread_ep(uh_win)] : (default_win_ptr))
+
+#define MTCORE_Get_ep_active_win_ptr(uh_win) \
+    (uh_win->ep_active_wins ? &uh_win->ep_active_wins[MTCORE_Get_thread_ep(uh_win)] \
+        : &uh_win->active_win)
+
 #define MTCORE_Get_epoch_local_win(uh_win, win_ptr) { \
-    switch (uh_win->epoch_stat) {   \
+    switch (MTCORE_Atomic_load(&uh_win->epoch_stat)) {   \
         case MTCORE_WIN_EPOCH_FENCE:    \
         case MTCORE_WIN_EPOCH_PSCW: \
-            win_ptr = &uh_win->active_win;   \
+            win_ptr = MTCORE_Get_ep_active_win_ptr(uh_win);   \
             break;  \
         default:    \
-            win_ptr = &uh_win->my_uh_win;   \
+            win_ptr = MTCORE_Get_ep_uh_win_ptr(uh_win, &uh_win->my_uh_win);   \
             break;  \
     }   \
 }
 
+/* In thread ghost mode, the first local user of a window serves as helper of its
+ * node, thus its internal windows expose the whole node segment in bytes. It always
+ * owns the ghost thread of its node, other windows are normal MPI windows. */
+#define MTCORE_Is_win_host(uh_win, rank) \
+    (MTCORE_ENV.ghost_mode == MTCORE_GHOST_THREAD && (uh_win)->targets[rank].local_user_rank == 0)
+
 #define MTCORE_Get_epoch_win(target_rank, seg, uh_win, win_ptr) { \
-    switch (uh_win->epoch_stat) {   \
+    switch (MTCORE_Atomic_load(&uh_win->epoch_stat)) {   \
+        case MTCORE_WIN_EPOCH_FENCE:    \
+        case MTCORE_WIN_EPOCH_PSCW: \
+            win_ptr = MTCORE_Get_ep_active_win_ptr(uh_win);   \
+            break;  \
+        default:    \
+            win_ptr = MTCORE_Get_ep_uh_win_ptr(uh_win,  \
+                    &uh_win->targets[target_rank].segs[seg].uh_win);   \
+            break;  \
+    }   \
+}
+
+/* Accumulate-class operations are always issued on the original window rather than
+ * on per-thread endpoints, because atomicity is only guaranteed among operations
+ * on the same MPI window. */
+#define MTCORE_Get_epoch_acc_win(target_rank, seg, uh_win, win_ptr) { \
+    switch (MTCORE_Atomic_load(&uh_win->epoch_stat)) {   \
         case MTCORE_WIN_EPOCH_FENCE:    \
         case MTCORE_WIN_EPOCH_PSCW: \
             win_ptr = &uh_win->active_win;   \
@@ -532,11 +808,60 @@ extern const char *MTCORE_Win_epoch_stat_name[4];       /* for debug */
     }   \
 }
 
+/* Enter a lock or lockall epoch, counter points to lock_counter or lockall_counter.
+ * The counter is increased before epoch status is set, thus a concurrent
+ * MTCORE_Win_epoch_lock_dec always observes the new lock. */
+static inline void MTCORE_Win_epoch_lock_inc(int *counter, MTCORE_Win * uh_win)
+{
+    MTCORE_Atomic_incr_fetch(counter);
+    MTCORE_Atomic_store_seq(&uh_win->epoch_stat, MTCORE_WIN_EPOCH_LOCK);
+}
+
+/* Leave a lock or lockall epoch, change epoch status only when both lock and
+ * lockall counters become 0. If another thread opened a new lock concurrently,
+ * the LOCK status is restored. */
+static inline void MTCORE_Win_epoch_lock_dec(int *counter, MTCORE_Win * uh_win)
+{
+    MTCORE_Atomic_decr_fetch(counter);
+    if (MTCORE_Atomic_load_seq(&uh_win->lock_counter) == 0 &&
+        MTCORE_Atomic_load_seq(&uh_win->lockall_counter) == 0) {
+        if (MTCORE_Atomic_cas(&uh_win->epoch_stat, MTCORE_WIN_EPOCH_LOCK, MTCORE_WIN_NO_EPOCH)) {
+            MTCORE_DBG_PRINT("all locks are cleared ! no epoch now\n");
+
+            if (MTCORE_Atomic_load_seq(&uh_win->lock_counter) > 0 ||
+                MTCORE_Atomic_load_seq(&uh_win->lockall_counter) > 0) {
+                MTCORE_Atomic_store_seq(&uh_win->epoch_stat, MTCORE_WIN_EPOCH_LOCK);
+            }
+        }
+    }
+}
+
 extern int run_h_main(void);
 
-extern int MTCORE_Func_start(MTCORE_Func FUNC, int user_nprocs, int user_local_nprocs);
-extern int MTCORE_Func_new_ur_h_comm(MPI_Comm * ur_h_comm);
-extern int MTCORE_Func_set_param(char *func_params, int size, MPI_Comm ur_h_comm);
+extern int MTCORE_Func_new_req_id(void);
+extern int MTCORE_Func_start(MTCORE_Func FUNC, int user_nprocs, int user_local_nprocs, int req_id,
+                             int comm_key, const void *params, int param_size);
+extern int MTCORE_Func_wait_reply(int req_id, void *reply, int reply_size);
+extern int MTCORE_Func_get_helper_ranks(int user_nprocs, const int *user_ranks_in_world,
+                                        int *helper_ranks_in_world);
+
+extern int MTCORE_Win_allocate_impl(MPI_Aint size, int disp_unit, MPI_Info info,
+                                    MPI_Comm user_comm, int user_comm_dup, void *baseptr,
+                                    MPI_Win * win);
+extern int MTCORE_Win_iallocate_wait_all(void);
+extern int MTCORE_Win_release(MTCORE_Win * uh_win, int user_nprocs);
+extern int MTCORE_Win_release_defer(MTCORE_Win * uh_win, int user_nprocs);
+extern int MTCORE_Comm_cache_get(MPI_Comm user_comm, MTCORE_Comm_cache ** cache);
+extern int MTCORE_Comm_cache_new_key(void);
+extern int MTCORE_Comm_cache_add(MTCORE_Win * uh_win, int key);
+extern int MTCORE_Comm_cache_release(MTCORE_Comm_cache * cache);
+extern void MTCORE_Comm_cache_destroy(void);
+extern int MTCORE_Win_iallocate_finalize(void);
+extern int MPIX_Win_iallocate(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm,
+                              void *baseptr, MPI_Win * win, MPI_Request * request);
+extern int MTCORE_Ghost_thread_start(int thread_level);
+extern int MTCORE_Ghost_thread_is_started(void);
+extern int MTCORE_Ghost_thread_stop(void);
 
 
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
@@ -549,7 +874,8 @@ static inline int MTCORE_Win_grant_lock(int target_rank, int target_seg_off, MTC
     mpi_errno = PMPI_Win_flush(uh_win->targets[target_rank].h_ranks_in_uh[main_h_off],
                                uh_win->targets[target_rank].segs[target_seg_off].uh_win);
     if (mpi_errno == MPI_SUCCESS) {
-        uh_win->targets[target_rank].segs[target_seg_off].main_lock_stat = MTCORE_MAIN_LOCK_GRANTED;
+        MTCORE_Atomic_store(&uh_win->targets[target_rank].segs[target_seg_off].main_lock_stat,
+                            MTCORE_MAIN_LOCK_GRANTED);
 
         MTCORE_DBG_PRINT("grant lock(Helper(%d), uh_wins 0x%x) for target %d seg %d\n",
                          uh_win->targets[target_rank].h_ranks_in_uh[main_h_off],
@@ -566,9 +892,9 @@ static inline void MTCORE_Get_helper_rank_load_opt_random(int target_rank, int i
                                                           int *target_h_rank_idx,
                                                           MPI_Aint * target_h_offset)
 {
-    /* Randomly change helper offset every time using a window-level global recorder */
-    int idx = (uh_win->prev_h_off + 1) % MTCORE_ENV.num_h;      /* jump to next helper offset */
-    uh_win->prev_h_off = idx;
+    /* Randomly change helper offset every time using a window-level global recorder.
+     * Concurrent threads jump to different helper offsets. */
+    int idx = (MTCORE_Atomic_fetch_add(&uh_win->prev_h_off, 1) + 1) % uh_win->num_h;
 
     *target_h_rank_in_uh = uh_win->targets[target_rank].h_ranks_in_uh[idx];
     *target_h_offset = uh_win->targets[target_rank].base_h_offsets[idx];
@@ -597,31 +923,29 @@ static inline int MTCORE_Get_helper_rank_load_opt(int target_rank, int target_se
 {
     int mpi_errno = MPI_SUCCESS;
     int main_h_off = uh_win->targets[target_rank].segs[target_seg_off].main_h_off;
+    MTCORE_Main_lock_stat *main_lock_stat =
+        &uh_win->targets[target_rank].segs[target_seg_off].main_lock_stat;
     int h_idx = 0;
 
     /* Force lock when the first operation is issued. Note that nocheck epoch
      * does not need it because no conflicting lock.*/
     if (MTCORE_ENV.load_lock == MTCORE_LOAD_LOCK_FORCE &&
         !(uh_win->targets[target_rank].remote_lock_assert & MPI_MODE_NOCHECK) &&
-        uh_win->targets[target_rank].segs[target_seg_off].main_lock_stat ==
-        MTCORE_MAIN_LOCK_OP_ISSUED) {
+        MTCORE_Atomic_load(main_lock_stat) == MTCORE_MAIN_LOCK_OP_ISSUED) {
         mpi_errno = MTCORE_Win_grant_lock(target_rank, target_seg_off, uh_win);
         if (mpi_errno != MPI_SUCCESS)
             return mpi_errno;
     }
 
-    /* Upgrade main lock status of target if it is the first operation of that target. */
-    if (uh_win->targets[target_rank].segs[target_seg_off].main_lock_stat == MTCORE_MAIN_LOCK_RESET) {
-        uh_win->targets[target_rank].segs[target_seg_off].main_lock_stat =
-            MTCORE_MAIN_LOCK_OP_ISSUED;
-    }
+    /* Upgrade main lock status of target if it is the first operation of that target.
+     * Only one thread can upgrade it, the status may have been granted by another thread. */
+    MTCORE_Atomic_cas(main_lock_stat, MTCORE_MAIN_LOCK_RESET, MTCORE_MAIN_LOCK_OP_ISSUED);
 
     /* If lock has not been granted yet, we can only use the main helper.
      * Accumulate operations have to be always sent to main helper in order to
      * guarantee atomicity and ordering.*/
     if ((!(uh_win->targets[target_rank].remote_lock_assert & MPI_MODE_NOCHECK) &&
-         uh_win->targets[target_rank].segs[target_seg_off].main_lock_stat !=
-         MTCORE_MAIN_LOCK_GRANTED) || is_order_required) {
+         MTCORE_Atomic_load(main_lock_stat) != MTCORE_MAIN_LOCK_GRANTED) || is_order_required) {
         /* Both serial async and byte tracking options specify the first helper as
          * the main helper of that user process.*/
         *target_h_rank_in_uh = uh_win->targets[target_rank].h_ranks_in_uh[main_h_off];
@@ -686,6 +1010,146 @@ static inline int MTCORE_Get_helper_rank_load_opt_non(int target_rank, int targe
             target_h_offset)
 #endif
 
+extern int MTCORE_Put(const void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+                      int target_rank, MPI_Aint target_disp, int target_count,
+                      MPI_Datatype target_datatype, MPI_Win win, MTCORE_Win * uh_win);
+extern int MTCORE_Get(void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+                      int target_rank, MPI_Aint target_disp, int target_count,
+                      MPI_Datatype target_datatype, MPI_Win win, MTCORE_Win * uh_win);
+
+/* Accumulate-class operations which only read (MPI_NO_OP) or only write
+ * (MPI_REPLACE) can be issued as get or put, thus they are balanced over
+ * helpers like other get and put. It is only legal if accumulates are not
+ * ordered, and concurrent accumulates to the same location use only the same
+ * op or no_op (accumulate_ops), or target is exclusively locked. */
+static inline int MTCORE_Acc_is_rewritable(int target_rank, MTCORE_Win * uh_win)
+{
+    return uh_win->info_args.no_acc_ordering &&
+        (uh_win->info_args.acc_same_op_no_op ||
+         uh_win->targets[target_rank].remote_lock_exclusive);
+}
+
+/* Check if operations to target can be issued to any of its helpers, i.e.,
+ * in fence or PSCW epoch, with MPI_MODE_NOCHECK, or once the lock of the main
+ * helper is granted (tracked in runtime load balancing). */
+static inline int MTCORE_Is_any_helper_allowed(int target_rank, MTCORE_Win * uh_win)
+{
+    switch (MTCORE_Atomic_load(&uh_win->epoch_stat)) {
+    case MTCORE_WIN_EPOCH_FENCE:
+    case MTCORE_WIN_EPOCH_PSCW:
+        return 1;
+    case MTCORE_WIN_EPOCH_LOCK:
+        if (uh_win->targets[target_rank].remote_lock_assert & MPI_MODE_NOCHECK)
+            return 1;
+#if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
+        if (MTCORE_Atomic_load(&uh_win->targets[target_rank].segs[0].main_lock_stat) ==
+            MTCORE_MAIN_LOCK_GRANTED)
+            return 1;
+#endif
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+extern int MTCORE_Credit_acquire_impl(int target_rank, int is_order_required, int count,
+                                      MPI_Datatype datatype, MPI_Win win, MTCORE_Win * uh_win,
+                                      int *target_h_rank_in_uh, MPI_Aint * target_h_offset);
+extern int MTCORE_Credit_alloc(int uh_nprocs, MTCORE_Win * uh_win);
+extern void MTCORE_Credit_free(MTCORE_Win * uh_win);
+extern void MTCORE_Credit_reset_target(int target_rank, MPI_Win win, MTCORE_Win * uh_win);
+extern void MTCORE_Credit_reset_all(MTCORE_Win * uh_win);
+extern void MTCORE_Credit_report(MTCORE_Win * uh_win);
+
+static inline int MTCORE_Credit_acquire(int target_rank, int is_order_required, int count,
+                                        MPI_Datatype datatype, MPI_Win win, MTCORE_Win * uh_win,
+                                        int *target_h_rank_in_uh, MPI_Aint * target_h_offset)
+{
+    if (uh_win->h_credits == NULL)
+        return MPI_SUCCESS;
+    return MTCORE_Credit_acquire_impl(target_rank, is_order_required, count, datatype, win,
+                                      uh_win, target_h_rank_in_uh, target_h_offset);
+}
+
+extern int MTCORE_Stripe_is_supported(int origin_count, MPI_Datatype origin_datatype,
+                                      int target_rank, int target_count,
+                                      MPI_Datatype target_datatype, MTCORE_Win * uh_win);
+extern int MTCORE_Stripe_put(const void *origin_addr, int origin_count,
+                             MPI_Datatype origin_datatype, int target_rank, MPI_Aint target_disp,
+                             MPI_Win win, MTCORE_Win * uh_win);
+extern int MTCORE_Stripe_get(void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+                             int target_rank, MPI_Aint target_disp, MPI_Win win,
+                             MTCORE_Win * uh_win);
+
+extern int MTCORE_AM_is_supported(int origin_count, MPI_Datatype origin_datatype,
+                                  int target_count, MPI_Datatype target_datatype, MPI_Op op,
+                                  MTCORE_Win * uh_win);
+extern int MTCORE_AM_put(const void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+                         int target_rank, MPI_Aint target_disp, MTCORE_Win * uh_win);
+extern int MTCORE_AM_get(void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+                         int target_rank, MPI_Aint target_disp, MTCORE_Win * uh_win);
+extern int MTCORE_AM_accumulate(const void *origin_addr, int origin_count,
+                                MPI_Datatype origin_datatype, int target_rank,
+                                MPI_Aint target_disp, MPI_Op op, MTCORE_Win * uh_win);
+extern int MTCORE_AM_fetch_and_op(const void *origin_addr, void *result_addr,
+                                  MPI_Datatype datatype, int target_rank, MPI_Aint target_disp,
+                                  MPI_Op op, MTCORE_Win * uh_win);
+extern int MTCORE_AM_get_accumulate(const void *origin_addr, void *result_addr, int count,
+                                   MPI_Datatype datatype, int target_rank, MPI_Aint target_disp,
+                                   MPI_Op op, MTCORE_Win * uh_win);
+extern int MTCORE_AM_rma_acc_begin(int target_rank, MTCORE_Win * uh_win);
+extern int MTCORE_AM_flush(int target_rank, MTCORE_Win * uh_win);
+extern int MTCORE_AM_flush_all(MTCORE_Win * uh_win);
+extern void MTCORE_AM_reset_lock(int target_rank, MTCORE_Win * uh_win);
+extern int MTCORE_AM_win_init(MTCORE_Win * uh_win);
+extern int MTCORE_AM_win_destroy(MTCORE_Win * uh_win);
+
+/* The offload channel is shared by point-to-point and window collectives. */
+#define MTCORE_P2P_is_enabled() (MTCORE_ENV.p2p_offload || MTCORE_ENV.coll_offload)
+
+extern int MTCORE_P2P_register_win(MTCORE_Win * uh_win);
+extern void MTCORE_P2P_unregister_win(MTCORE_Win * uh_win);
+extern int MTCORE_P2P_progress(void);
+extern int MTCORE_P2P_start_cmd(MTCORE_P2P_cmd * cmd, MPI_Request * request);
+extern int MTCORE_P2P_num_pending;
+extern int MPIX_Isend_offload(const void *buf, int count, MPI_Datatype datatype, int dest,
+                              int tag, MPI_Comm comm, MPI_Request * request);
+extern int MPIX_Irecv_offload(void *buf, int count, MPI_Datatype datatype, int source, int tag,
+                              MPI_Comm comm, MPI_Request * request);
+extern int MPIX_Win_iallreduce(MPI_Aint target_disp, int count, MPI_Datatype datatype, MPI_Op op,
+                               MPI_Win win, MPI_Request * request);
+extern int MPIX_Win_ibcast(MPI_Aint target_disp, int count, MPI_Datatype datatype, int root,
+                           MPI_Win win, MPI_Request * request);
+extern int MPIX_Put_init(const void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+                         int target_rank, MPI_Aint target_disp, int target_count,
+                         MPI_Datatype target_datatype, MPI_Win win, void **plan);
+extern int MPIX_Accumulate_init(const void *origin_addr, int origin_count,
+                                MPI_Datatype origin_datatype, int target_rank,
+                                MPI_Aint target_disp, int target_count,
+                                MPI_Datatype target_datatype, MPI_Op op, MPI_Win win,
+                                void **plan);
+extern int MPIX_Start(void *plan);
+extern int MPIX_Plan_free(void **plan);
+
+extern int MTCORE_Shm_acc_is_supported(int origin_count, MPI_Datatype origin_datatype,
+                                       int target_count, MPI_Datatype target_datatype,
+                                       MPI_Op op, int target_rank, MTCORE_Win * uh_win);
+extern int MTCORE_Shm_accumulate(const void *origin_addr, int origin_count,
+                                 MPI_Datatype origin_datatype, int target_rank,
+                                 MPI_Aint target_disp, MPI_Op op, MTCORE_Win * uh_win);
+extern void MTCORE_Shm_acc_start(int target_rank, int lock_type, int assert, MTCORE_Win * uh_win);
+extern void MTCORE_Shm_acc_reset(int target_rank, MTCORE_Win * uh_win);
+extern int MTCORE_Shm_acc_win_init(MTCORE_Win * uh_win);
+
+/* Remember accumulate-class operations issued to helpers while shared-memory
+ * accumulate is enabled on the target, thus they are completed before any
+ * later accumulate is applied locally to keep accumulate ordering. */
+static inline void MTCORE_Shm_acc_mark_remote(int target_rank, MTCORE_Win * uh_win)
+{
+    if (MTCORE_Atomic_load(&uh_win->targets[target_rank].shm_acc_stat) != MTCORE_SHM_ACC_DISABLED)
+        MTCORE_Atomic_store(&uh_win->targets[target_rank].shm_acc_remote_issued, 1);
+}
+
 extern int MTCORE_Op_segments_decode(const void *origin_addr, int origin_count,
                                      MPI_Datatype origin_datatype,
                                      int target_rank, MPI_Aint target_disp,
@@ -0,0 +1,138 @@
+/*
+ * mtcore_am.h
+ *  <FILE_DESC>
+ *
+ *  Active-message (AM) transport of RMA operations. Instead of issuing MPI
+ *  RMA to helpers, origins send compact operation descriptors to the main
+ *  helper of the target, and the helper applies them directly on the shared
+ *  segment of its node. Only contiguous operations on predefined datatypes
+ *  are handled, all others are issued through MPI RMA as usual.
+ *
+ *  With node-level aggregation (rma_transport=agg), small put and accumulate
+ *  to other nodes are not sent by origins. Origins deposit them into a queue
+ *  in a node shared segment, the root helper forwards the queued operations
+ *  in batches per destination helper, and reports completion to the queues
+ *  when the destination helper acknowledges a batch.
+ *
+ *  If fetch_and_op combining is enabled (MTCORE_FOP_COMBINE), integer
+ *  fetch_and_op with MPI_SUM to other nodes are queued as well. Consecutive
+ *  ones to the same location in a batch are merged into a single operation,
+ *  and the root helper derives the result of every origin from the fetched
+ *  value and the prefix sum of the merged operations.
+ *
+ *  Author: Min Si
+ */
+
+#ifndef MTCORE_AM_H_
+#define MTCORE_AM_H_
+
+#include <pthread.h>
+#include <mpi.h>
+
+/* Users send descriptors on this tag, helpers reply on the tag specified in
+ * every descriptor. Reply tags are picked from a per-window counter, thus
+ * concurrent threads never match each other's replies. */
+#define MTCORE_AM_TAG 9890
+#define MTCORE_AM_REPLY_TAG_BASE 10000
+#define MTCORE_AM_REPLY_TAG_RANGE 20000
+
+/* Batches of aggregated operations between helpers and their acknowledgments */
+#define MTCORE_AM_AGG_TAG 9891
+#define MTCORE_AM_AGG_ACK_TAG 9892
+
+#define MTCORE_AM_AGG_QUEUE_SIZE (256 * 1024)   /* bytes of queue per user process */
+#define MTCORE_AM_AGG_MAX_DATA 1024     /* larger operations are sent directly */
+#define MTCORE_AM_AGG_BATCH_SIZE (64 * 1024)    /* batch is sent once it exceeds this size */
+#define MTCORE_AM_AGG_MAX_FOPS 64       /* outstanding queued fetch_and_op per user process */
+#define MTCORE_AM_AGG_FOP_RESULT_SIZE 16
+
+typedef enum {
+    MTCORE_RMA_TRANSPORT_RMA,
+    MTCORE_RMA_TRANSPORT_AM,
+    MTCORE_RMA_TRANSPORT_AM_AGG,        /* AM with node-level aggregation */
+} MTCORE_Rma_transport;
+
+typedef enum {
+    MTCORE_AM_PKT_PUT,
+    MTCORE_AM_PKT_GET,
+    MTCORE_AM_PKT_ACC,
+    MTCORE_AM_PKT_FOP,          /* fetch_and_op and get_accumulate */
+    MTCORE_AM_PKT_FLUSH,
+} MTCORE_AM_pkt_type;
+
+/* Operation descriptor. The data of put, accumulate and fetch_and_op directly
+ * follows the descriptor in the same message. Datatype and op are encoded as
+ * indexes in the predefined tables, because handles are not portable among
+ * processes in all MPI implementations. */
+typedef struct MTCORE_AM_pkt {
+    int type;
+    int dtype_idx;
+    int op_idx;
+    int count;
+    int reply_tag;
+    MPI_Aint target_offset;     /* offset in bytes from the window base on helper */
+} MTCORE_AM_pkt;
+
+/* Aggregated operation in queues and batches. The descriptor is followed by
+ * data, and the entry is padded to 8 bytes. An entry with negative h_rank
+ * only pads the end of a queue. */
+typedef struct MTCORE_AM_agg_entry {
+    int size;                   /* bytes of the whole entry */
+    int h_rank;                 /* destination helper in uh_comm */
+    MTCORE_AM_pkt pkt;
+} MTCORE_AM_agg_entry;
+
+/* Single-producer single-consumer queue from a user process to the root
+ * helper in the node shared segment. Positions are byte counters increased
+ * forever, the offset in buf is position % MTCORE_AM_AGG_QUEUE_SIZE. */
+typedef struct MTCORE_AM_agg_queue {
+    unsigned long head __attribute__ ((aligned(64)));   /* enqueued bytes, by user, atomic */
+    unsigned long tail __attribute__ ((aligned(64)));   /* forwarded bytes, by helper, atomic */
+    unsigned long completed __attribute__ ((aligned(64)));      /* applied operations, by helper, atomic */
+    char buf[MTCORE_AM_AGG_QUEUE_SIZE] __attribute__ ((aligned(64)));
+
+    /* Results of queued fetch_and_op written by helper, valid once completed
+     * covers the operation. The slot is specified in reply_tag of the
+     * descriptor. */
+    char fop_results[MTCORE_AM_AGG_MAX_FOPS][MTCORE_AM_AGG_FOP_RESULT_SIZE]
+        __attribute__ ((aligned(64)));
+} MTCORE_AM_agg_queue;
+
+/* Per-window state of AM transport on user process. */
+typedef struct MTCORE_AM_win {
+    MPI_Comm comm;              /* duplicated uh_comm, only used by AM transport */
+    int *h_issued;              /* flag per helper rank in uh_comm, atomic */
+    int *h_acc_issued;          /* direct accumulate-class operations since last flush,
+                                 * flag per helper rank in uh_comm, atomic */
+    unsigned int tag_counter;   /* atomic */
+
+    /* Outstanding sends and replies, completed in flush. Buffers of sent
+     * descriptors are freed at completion. */
+    pthread_mutex_t reqs_lock;
+    MPI_Request *reqs;
+    void **bufs;
+    int num_reqs;
+    int max_reqs;
+
+    /* Node-level aggregation, agg_queue is NULL if disabled. Threads enqueue
+     * with agg_lock held, agg_issued counts enqueued operations. */
+    MPI_Win agg_win;
+    MTCORE_AM_agg_queue *agg_queue;
+    pthread_mutex_t agg_lock;
+    unsigned long agg_issued;   /* atomic */
+
+    /* Queued fetch_and_op per result slot, protected by agg_lock. A slot is
+     * free if fop_seqs is 0, otherwise its result is copied to user buffer
+     * once completed reaches fop_seqs. */
+    void *fop_result_addrs[MTCORE_AM_AGG_MAX_FOPS];
+    int fop_sizes[MTCORE_AM_AGG_MAX_FOPS];
+    unsigned long fop_seqs[MTCORE_AM_AGG_MAX_FOPS];
+    int num_fops;               /* atomic */
+} MTCORE_AM_win;
+
+extern MPI_Datatype MTCORE_AM_DTYPES[];
+extern const int MTCORE_AM_NUM_DTYPES;
+extern MPI_Op MTCORE_AM_OPS[];
+extern const int MTCORE_AM_NUM_OPS;
+
+#endif /* MTCORE_AM_H_ */
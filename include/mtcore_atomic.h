@@ -0,0 +1,37 @@
+/*
+ * mtcore_atomic.h
+ *  <FILE_DESC>
+ *
+ *  Lightweight atomic primitives used to protect the mutable state of MTCORE
+ *  windows when user processes issue RMA operations from multiple threads
+ *  (MPI_THREAD_MULTIPLE). Built on the GCC __atomic builtins, thus no lock
+ *  is held on the RMA path.
+ *
+ *  Author: Min Si
+ */
+
+#ifndef MTCORE_ATOMIC_H_
+#define MTCORE_ATOMIC_H_
+
+/* Counters and flags only need atomicity, ordering is provided by MPI calls. */
+#define MTCORE_Atomic_load(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define MTCORE_Atomic_store(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#define MTCORE_Atomic_fetch_add(ptr, val) __atomic_fetch_add((ptr), (val), __ATOMIC_RELAXED)
+#define MTCORE_Atomic_add(ptr, val) ((void) __atomic_add_fetch((ptr), (val), __ATOMIC_RELAXED))
+
+/* Epoch state transitions require sequential consistency between counters
+ * and epoch status, see MTCORE_Win_epoch_lock_inc/dec. */
+#define MTCORE_Atomic_incr_fetch(ptr) __atomic_add_fetch((ptr), 1, __ATOMIC_SEQ_CST)
+#define MTCORE_Atomic_decr_fetch(ptr) __atomic_sub_fetch((ptr), 1, __ATOMIC_SEQ_CST)
+#define MTCORE_Atomic_load_seq(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define MTCORE_Atomic_store_seq(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_SEQ_CST)
+
+/* Compare-and-swap, return 1 if *ptr was equal to oldval and has been
+ * replaced by newval, otherwise 0. */
+#define MTCORE_Atomic_cas(ptr, oldval, newval) ({   \
+        typeof(*(ptr)) _old = (oldval); \
+        __atomic_compare_exchange_n((ptr), &_old, (newval), 0,  \
+                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+    })
+
+#endif /* MTCORE_ATOMIC_H_ */
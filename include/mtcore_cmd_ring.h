@@ -0,0 +1,63 @@
+/*
+ * mtcore_cmd_ring.h
+ *  <FILE_DESC>
+ *
+ *  Command ring between local user processes and the root helper. The ring
+ *  lives in a node-shared segment created at initialization. Any number of
+ *  user processes (and threads) enqueue commands with atomics, and the root
+ *  helper dequeues them without entering MPI. A helper sleeping in its
+ *  progress loop waits on a futex, which is woken by the next enqueue.
+ *
+ *  Author: Min Si
+ */
+
+#ifndef MTCORE_CMD_RING_H_
+#define MTCORE_CMD_RING_H_
+
+#include <mpi.h>
+
+#define MTCORE_CMD_RING_NUM_SLOTS 64    /* must be power of 2 */
+#define MTCORE_CMD_RING_SLOT_SIZE 240   /* bytes of command inlined in a slot */
+
+/* Every slot has its own sequence number. A slot at position pos is free for
+ * the producer if seq == pos, and holds a command for the consumer if
+ * seq == pos + 1. The consumer sets seq = pos + NUM_SLOTS after copying out,
+ * thus the slot becomes free for the next round. */
+typedef struct MTCORE_Cmd_slot {
+    unsigned long seq;
+    int src;                    /* rank of producer in MTCORE_COMM_LOCAL */
+    int size;                   /* bytes of command */
+    char data[MTCORE_CMD_RING_SLOT_SIZE];
+} __attribute__ ((aligned(64))) MTCORE_Cmd_slot;
+
+typedef struct MTCORE_Cmd_ring {
+    unsigned long head __attribute__ ((aligned(64)));   /* next position to enqueue, atomic */
+    unsigned long tail __attribute__ ((aligned(64)));   /* next position to dequeue, consumer only */
+    int sleeping __attribute__ ((aligned(64)));         /* set by sleeping consumer, atomic */
+    int wake_seq;               /* futex word, increased by producers to wake up consumer */
+    MTCORE_Cmd_slot slots[MTCORE_CMD_RING_NUM_SLOTS];
+} MTCORE_Cmd_ring;
+
+/* Collectively create the ring on comm, which is owned by rank 0. */
+extern int MTCORE_Cmd_ring_create(MPI_Comm comm, MTCORE_Cmd_ring ** ring, MPI_Win * win);
+extern int MTCORE_Cmd_ring_free(MTCORE_Cmd_ring ** ring, MPI_Win * win);
+
+/* Enqueue a command of at most MTCORE_CMD_RING_SLOT_SIZE bytes. Wait if the
+ * ring is full. */
+extern void MTCORE_Cmd_ring_enqueue(MTCORE_Cmd_ring * ring, int src, const void *cmd, int size);
+
+/* Dequeue a command into cmd, which must hold MTCORE_CMD_RING_SLOT_SIZE bytes.
+ * Return 1 if a command is dequeued, 0 if the ring is empty. Only called by
+ * the single consumer. */
+extern int MTCORE_Cmd_ring_dequeue(MTCORE_Cmd_ring * ring, void *cmd, int *src, int *size);
+
+/* Sleep until a command is enqueued or timeout_ns nanoseconds elapse. Only
+ * called by the single consumer. */
+extern void MTCORE_Cmd_ring_sleep(MTCORE_Cmd_ring * ring, long timeout_ns);
+
+/* Wake up the consumer if it is sleeping, for events out of the ring (e.g.,
+ * aggregated operations). Such an event is only guaranteed to be seen by the
+ * consumer at the sleep timeout, since it does not check it before sleeping. */
+extern void MTCORE_Cmd_ring_wake(MTCORE_Cmd_ring * ring);
+
+#endif /* MTCORE_CMD_RING_H_ */
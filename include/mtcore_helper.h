@@ -27,13 +27,13 @@
 typedef struct MTCORE_H_win {
     MPI_Aint *user_base_addrs_in_local;
 
-    /* communicator including root user processes and all helpers,
-     * used for internal information exchange between users and helpers */
-    MPI_Comm ur_h_comm;
+    int req_id;                 /* control-plane request id of win_allocate */
+    int comm_cached;            /* uh_comm and local_uh_comm are cached */
 
     /* communicator including local processes and helpers */
     MPI_Comm local_uh_comm;
     MPI_Win local_uh_win;
+    MTCORE_Shm_seg *shm_seg;    /* NULL if local_uh_win is allocated by MPI */
     int max_local_user_nprocs;
 
     /* communicator including all the user processes and helpers */
@@ -45,6 +45,32 @@ typedef struct MTCORE_H_win {
 
     MPI_Win active_win;
 
+    /* Per-thread endpoint windows of user processes, index 0 refers to the
+     * original window. Only allocated when info_args.num_thread_eps > 1. */
+    MPI_Win *ep_uh_wins;
+    MPI_Win *ep_active_wins;
+
+    /* Duplicated uh_comm for receiving active messages, only created when
+     * info_args.rma_transport is AM. */
+    MPI_Comm am_comm;
+
+    /* Node-level aggregation, only when info_args.rma_transport is AM_AGG.
+     * Queues of local users are forwarded by the root helper only, the other
+     * helpers only apply batches. */
+    MPI_Win agg_win;
+    MTCORE_AM_agg_queue **agg_queues;   /* per rank in local_uh_comm, NULL for helpers */
+    int num_agg_queues;
+    struct MTCORE_H_am_batch **agg_batches;     /* filling batch per helper rank in uh_comm,
+                                                 * NULL if not forwarding */
+    struct MTCORE_H_am_batch *agg_inflight;     /* sent batches not acknowledged yet */
+
+    /* Window collectives, only on the root helper when MTCORE_COLL_OFFLOAD is
+     * on. coll_comm includes the root helpers of all nodes in the window. */
+    MPI_Comm coll_comm;
+    int *coll_ranks;            /* rank in coll_comm per node id, -1 if not in the window */
+    int local_user_nprocs;
+    struct MTCORE_H_coll *colls;        /* collectives waiting for local users, in order */
+
     struct MTCORE_Win_info_args info_args;
     unsigned long mtcore_h_win_handle;
 } MTCORE_H_win;
@@ -52,6 +78,15 @@ typedef struct MTCORE_H_win {
 extern hashtable_t *mtcore_h_win_ht;
 #define MTCORE_H_WIN_HT_SIZE 256
 
+/* Communicators cached for the windows allocated on the same user group,
+ * see MTCORE_Comm_cache on user processes. */
+typedef struct MTCORE_H_comm_cache {
+    int key;
+    MPI_Comm uh_comm;
+    MPI_Comm local_uh_comm;
+    struct MTCORE_H_comm_cache *next;
+} MTCORE_H_comm_cache;
+
 typedef struct MTCORE_H_func_info {
     MTCORE_Func_info info;
     int user_root_in_local;
@@ -88,14 +123,39 @@ static inline void destroy_mtcore_h_win_table()
     return ht_destroy(mtcore_h_win_ht);
 }
 
-extern int MTCORE_H_win_allocate(int user_local_root, int user_nprocs, int user_local_nprocs);
-extern int MTCORE_H_win_free(int user_local_root, int user_nprocs, int user_local_nprocs);
+extern int MTCORE_H_win_allocate(int user_local_root, int user_nprocs, int user_local_nprocs,
+                                 int req_id, int comm_key, MTCORE_Func_win_allocate_param * param);
+extern int MTCORE_H_win_free(int user_local_root, int user_nprocs, int user_local_nprocs,
+                             unsigned long *h_win_handles);
 
 extern int MTCORE_H_finalize(void);
 
-extern int MTCORE_H_func_start(MTCORE_Func * FUNC, int *user_local_root, int *user_nprocs,
-                               int *user_local_nprocs);
-extern int MTCORE_H_func_new_ur_h_comm(int user_local_root, MPI_Comm * ur_h_comm);
-extern int MTCORE_H_func_get_param(char *func_params, int size, MPI_Comm ur_h_comm);
+extern int MTCORE_H_am_is_active(void);
+extern int MTCORE_H_am_progress(int *num_handled);
+extern int MTCORE_H_am_win_init(MTCORE_H_win * win);
+extern int MTCORE_H_am_win_destroy(MTCORE_H_win * win);
+
+extern int MTCORE_H_p2p_is_active(void);
+extern int MTCORE_H_p2p_progress(int *num_handled);
+extern void MTCORE_H_p2p_complete_slot(int src, int slot, int mpi_errno, int count);
+
+typedef struct MTCORE_H_coll MTCORE_H_coll;
+extern int MTCORE_H_coll_win_init(MTCORE_H_win * win);
+extern int MTCORE_H_coll_win_destroy(MTCORE_H_win * win);
+extern int MTCORE_H_coll_post(MTCORE_P2P_cmd * cmd, int src, MPI_Request * req,
+                              MTCORE_H_coll ** coll_ptr);
+extern void MTCORE_H_coll_complete(MTCORE_H_coll * coll, int mpi_errno);
+
+extern int MTCORE_H_progress_wait(MPI_Request * req, MPI_Status * status);
+extern int MTCORE_H_progress_wait_cmd(void *cmd, int *src, int *size);
+extern void MTCORE_H_progress_report(void);
+
+extern int MTCORE_H_func_start(MTCORE_H_func_info * h_info, char **params);
+extern int MTCORE_H_func_reply(void *buf, int size, int user_local_root, int req_id);
+
+extern MTCORE_H_comm_cache *MTCORE_H_comm_cache_get(int key);
+extern void MTCORE_H_comm_cache_add(int key, MTCORE_H_win * win);
+extern int MTCORE_H_comm_cache_release(int key);
+extern void MTCORE_H_comm_cache_destroy(void);
 
 #endif /* MTCORE_HELPER_H_ */
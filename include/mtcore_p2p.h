@@ -0,0 +1,143 @@
+/*
+ * mtcore_p2p.h
+ *  <FILE_DESC>
+ *
+ *  Helper-progressed nonblocking point-to-point (MTCORE_P2P_OFFLOAD=on).
+ *  Messages sent by MPIX_Isend_offload and received by MPIX_Irecv_offload
+ *  travel on an internal channel over all processes. Every message is routed
+ *  through the root helper of the receiver, which matches it with receives
+ *  the receiver posted through the command ring, in the order of both:
+ *   - the sender sends a header to that helper, carrying the message inline
+ *     if it is smaller than MTCORE_P2P_OFFLOAD_SIZE bytes;
+ *   - a larger message follows the header as a separate transfer, which is
+ *     posted by the root helper of the sender if the send buffer lies in the
+ *     shared segment of a window allocated by MPI_Win_allocate, otherwise by
+ *     the sender itself.
+ *  If the receive buffer lies in the shared segment of a window, the helper
+ *  receives the message directly into it when the receive is already posted,
+ *  otherwise copies it there from a bounce buffer, and completes the receive
+ *  in a completion slot. Other receives are posted by the receiver on the
+ *  tag of their slot, and the helper forwards the message to it. Bounce
+ *  buffers are reused and limited to MTCORE_P2P_RELAY_BUF_SIZE bytes in
+ *  total, the data of a message waits at its sender until a buffer is free.
+ *  Thus the route is decided by the sender only, large rendezvous transfers
+ *  progress while users compute, and messages of a source, a communicator and
+ *  a tag never overtake each other.
+ *
+ *  The header carries the source, an id of the communicator and the user tag.
+ *  Communicators get an id when a window is allocated on them (world always
+ *  has one), messages on other communicators are issued as normal nonblocking
+ *  point-to-point. Wildcard source or tag is not supported.
+ *
+ *  Window collectives (MTCORE_COLL_OFFLOAD=on, MPIX_Win_iallreduce and
+ *  MPIX_Win_ibcast) are handed to the root helper through the same ring and
+ *  slots. Once all local users of the window joined, the helper reduces or
+ *  copies their buffers in shared memory, and runs the inter-node phase with
+ *  the root helpers of other nodes. Only predefined datatypes and operations
+ *  are offloaded, others are issued by users as nonblocking collectives.
+ *
+ *  Author: Min Si
+ */
+
+#ifndef MTCORE_P2P_H_
+#define MTCORE_P2P_H_
+
+#include <mpi.h>
+
+#define MTCORE_P2P_MAX_REQS 64  /* offloaded requests in flight per user process */
+#define MTCORE_DEFAULT_P2P_OFFLOAD_SIZE (64 * 1024)     /* bytes */
+#define MTCORE_COLL_COMM_TAG 9893       /* creation of communicators among root helpers */
+
+#define MTCORE_P2P_MAX_COMMS 16  /* communicators with an id, including world */
+#define MTCORE_P2P_HDR_TAG 0    /* headers to the root helper of receiver */
+#define MTCORE_P2P_RELAY_BUF_SIZE (64 * 1024 * 1024)   /* bytes of bounce buffers per helper */
+#define MTCORE_P2P_MAX_RELAY_BUFS 64
+
+typedef enum {
+    MTCORE_P2P_CMD_ISEND,       /* send data of a message to the root helper of receiver */
+    MTCORE_P2P_CMD_IRECV,       /* post a receive to match messages with */
+    MTCORE_P2P_CMD_ALLREDUCE,   /* window collectives, in place on the buffer */
+    MTCORE_P2P_CMD_BCAST,
+} MTCORE_P2P_cmd_type;
+
+/* Command from a user to the root helper through the P2P command ring. */
+typedef struct MTCORE_P2P_cmd {
+    MTCORE_P2P_cmd_type type;
+    int slot;                   /* completion slot of the user */
+    unsigned long h_win_handle; /* window of root helper holding the buffer, 0 if
+                                 * a receive is forwarded to the user */
+    MPI_Aint h_offset;          /* offset of buffer to the window base of helper */
+    int size;                   /* bytes */
+    int peer;                   /* rank in world */
+    int tag;                    /* data tag on the channel in send, see MTCORE_P2P_data_tag,
+                                 * user tag in receive */
+    int dst;                    /* receiver, rank in world, only in receive */
+    int comm_id;                /* only in receive */
+
+    /* Window collectives only. Commands of the same collective on a window
+     * carry the same sequence number. */
+    unsigned int seq;
+    int count;
+    int dtype_idx;              /* index in MTCORE_AM_DTYPES */
+    int op_idx;                 /* index in MTCORE_AM_OPS, only in allreduce */
+    int root_node;              /* node of root user, only in bcast */
+    int is_root;
+} MTCORE_P2P_cmd;
+
+/* Header of a message to the root helper of receiver, followed by the message
+ * if it is inline. */
+typedef struct MTCORE_P2P_hdr {
+    int dst;                    /* receiver, rank in world */
+    int src;                    /* sender, rank in world */
+    int comm_id;
+    int tag;                    /* user tag */
+    int size;                   /* bytes */
+    int data_src;               /* rank in world posting the data, -1 if inline */
+} MTCORE_P2P_hdr;
+
+typedef enum {
+    MTCORE_P2P_SLOT_FREE,
+    MTCORE_P2P_SLOT_ISSUED,     /* set by user when the command is enqueued */
+    MTCORE_P2P_SLOT_DONE,       /* set by helper when the transfer or forwarding completes */
+} MTCORE_P2P_slot_state;
+
+typedef struct MTCORE_P2P_slot {
+    int state;                  /* MTCORE_P2P_slot_state, atomic */
+    int mpi_errno;
+    int count;                  /* received bytes */
+} MTCORE_P2P_slot;
+
+typedef struct MTCORE_P2P_channel {
+    MPI_Comm comm;              /* duplicate of world, including helpers */
+    int tag_ub;                 /* user tags are in [0, tag_ub] */
+    unsigned int comm_ids;      /* ids in use by my communicators, bit per id */
+    int comm_keyval;            /* id of communicator as attribute */
+    MTCORE_Cmd_ring *ring;      /* owned by root helper, separate from the function ring */
+    MPI_Win ring_win;
+    MPI_Win slot_win;
+    MTCORE_P2P_slot *slots;     /* my MTCORE_P2P_MAX_REQS slots, NULL on helpers */
+    MTCORE_P2P_slot **local_slots;      /* slots per rank in MTCORE_COMM_LOCAL, only on helpers */
+} MTCORE_P2P_channel;
+
+/* Only valid when MTCORE_ENV.p2p_offload is set. */
+extern MTCORE_P2P_channel MTCORE_P2P;
+
+/* Data of large messages from a source arrive at the root helper of receiver
+ * on the tag of that source, in the same order as the headers. */
+static inline int MTCORE_P2P_data_tag(int src_rank_in_world)
+{
+    return MTCORE_P2P_HDR_TAG + 1 + src_rank_in_world;
+}
+
+/* A receive not in a window gets its message from the root helper of receiver
+ * on the tag of its completion slot. */
+static inline int MTCORE_P2P_reply_tag(int slot)
+{
+    return MTCORE_P2P_HDR_TAG + 1 + slot;
+}
+
+/* Collective over world, called by all users and helpers in initialization. */
+extern int MTCORE_P2P_init(void);
+extern int MTCORE_P2P_destroy(void);
+
+#endif /* MTCORE_P2P_H_ */
@@ -0,0 +1,53 @@
+/*
+ * mtcore_shm_seg.h
+ *  <FILE_DESC>
+ *
+ *  Node-wide shared segment behind a window. By default the segment is
+ *  allocated by MPI_Win_allocate_shared. With huge pages enabled, MTCORE maps
+ *  a memfd shared by all local processes instead, backed by hugetlbfs pages
+ *  or by transparent huge pages, and falls back to MPI when huge pages are
+ *  unavailable. The layout is the same in both cases: slices are contiguous
+ *  in rank order of the communicator.
+ *
+ *  Author: Min Si
+ */
+
+#ifndef MTCORE_SHM_SEG_H_
+#define MTCORE_SHM_SEG_H_
+
+#include <mpi.h>
+
+#define MTCORE_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef enum {
+    MTCORE_HUGE_PAGE_OFF,
+    MTCORE_HUGE_PAGE_THP,       /* transparent huge pages */
+    MTCORE_HUGE_PAGE_HUGETLB,   /* hugetlbfs pages, falls back to THP */
+} MTCORE_Huge_page;
+
+typedef struct MTCORE_Shm_seg {
+    void *map_base;
+    size_t map_size;
+    MTCORE_Huge_page huge_page; /* kind of pages actually mapped */
+    int nprocs;
+    MPI_Aint *sizes;
+    MPI_Aint *offsets;
+    int *disp_units;
+} MTCORE_Shm_seg;
+
+/* Collectively allocate the shared segment on comm. Every process specifies
+ * its huge page request, or -1 if it has no preference (i.e., helpers), and
+ * the highest request is applied on all processes. If the segment is mapped
+ * by MTCORE, *win is set to MPI_WIN_NULL and *seg is allocated, otherwise the
+ * segment is allocated by MPI_Win_allocate_shared and *seg is NULL. */
+extern int MTCORE_Shm_seg_allocate(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm,
+                                   int huge_page, void **base, MPI_Win * win,
+                                   MTCORE_Shm_seg ** seg);
+
+/* Same as MPI_Win_shared_query for segments allocated by either way. */
+extern int MTCORE_Shm_seg_query(MPI_Win win, MTCORE_Shm_seg * seg, int rank, MPI_Aint * size,
+                                int *disp_unit, void *base);
+
+extern int MTCORE_Shm_seg_free(MPI_Win * win, MTCORE_Shm_seg ** seg);
+
+#endif /* MTCORE_SHM_SEG_H_ */
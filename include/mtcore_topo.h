@@ -0,0 +1,55 @@
+/*
+ * mtcore_topo.h
+ *  <FILE_DESC>
+ *
+ *  Node topology used for helper placement. Every process derives its NUMA
+ *  domain from its CPU affinity and the NUMA nodes exposed by the kernel in
+ *  /sys/devices/system/node, and SMT siblings of its CPU from
+ *  /sys/devices/system/cpu, thus no external topology library is required.
+ *
+ *  Author: Min Si
+ */
+
+#ifndef MTCORE_TOPO_H_
+#define MTCORE_TOPO_H_
+
+#include <stddef.h>
+
+#define MTCORE_TOPO_NUMA_UNKNOWN (-1)
+
+typedef enum {
+    MTCORE_H_PLACEMENT_FIRST,   /* the first local processes are helpers */
+    MTCORE_H_PLACEMENT_NUMA,    /* spread helpers over NUMA domains */
+    MTCORE_H_PLACEMENT_SMT,     /* pin helpers onto SMT siblings of user cores */
+} MTCORE_H_placement;
+
+/* Return the NUMA domain covering most CPUs in the affinity mask of the calling
+ * process, or MTCORE_TOPO_NUMA_UNKNOWN if it cannot be determined or the
+ * process is bound equally to multiple domains. */
+extern int MTCORE_Topo_get_numa_id(void);
+
+/* Pick num_h helpers among local_nprocs processes given the NUMA domain of
+ * every local process. Helpers are assigned to domains in a round-robin
+ * manner, the lowest local rank in a domain becomes its helper first. The
+ * first num_h processes are picked if the domains are unknown or not distinct. */
+extern void MTCORE_Topo_select_helpers(int num_h, int local_nprocs, const int *local_numa_ids,
+                                       int *h_ranks_in_local);
+
+/* Return the lowest CPU in the affinity mask of the calling process if the
+ * process is bound within a single core, otherwise -1. */
+extern int MTCORE_Topo_get_home_cpu(void);
+
+/* Return an SMT sibling of cpu which is not in used_cpus, otherwise -1. */
+extern int MTCORE_Topo_get_free_sibling(int cpu, const int *used_cpus, int num_used);
+
+/* Bind the calling process to a single CPU. */
+extern int MTCORE_Topo_bind_cpu(int cpu);
+
+/* Place the pages of a memory region on a NUMA domain. Pages are bound to the
+ * domain and migrated if already allocated elsewhere, then touched by the
+ * calling process. Only pages fully covered by the region are placed. Return
+ * 0 if the pages are bound, -1 if they are only first-touched because the
+ * domain is unknown or binding is not supported. */
+extern int MTCORE_Topo_place_memory(void *addr, size_t size, int numa_id);
+
+#endif /* MTCORE_TOPO_H_ */
@@ -0,0 +1,273 @@
+/*
+ * coll.c
+ *  <FILE_DESC>
+ *
+ *  Window collectives on the root helper. Commands of a collective are
+ *  collected until all local users of the window joined, then the local phase
+ *  is done in shared memory (reduce all buffers into the first one, or pick
+ *  the buffer of root), and the inter-node phase is issued as a nonblocking
+ *  collective among the root helpers of the window. Once it completes, the
+ *  result is copied into the buffers of the other local users and their slots
+ *  are completed.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mtcore_helper.h"
+
+struct MTCORE_H_coll {
+    MTCORE_P2P_cmd_type type;
+    unsigned int seq;
+    int count;
+    int size;                   /* bytes */
+    int dtype_idx;
+    int op_idx;
+    int root_node;
+
+    int num_joined;
+    int *srcs;                  /* rank of user in MTCORE_COMM_LOCAL */
+    int *slots;
+    char **bufs;                /* buffer of user in the window of this helper */
+    int data_idx;               /* buffer holding the result of inter-node phase */
+
+    struct MTCORE_H_coll *next;
+};
+
+/**
+ * Create the communicator among the root helpers of all nodes in the window.
+ * Only called by the root helper, and collective over the root helpers.
+ */
+int MTCORE_H_coll_win_init(MTCORE_H_win * win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MPI_Group uh_group = MPI_GROUP_NULL, coll_group = MPI_GROUP_NULL;
+    int *uh_ranks = NULL, *ranks_in_world = NULL, *coll_uh_ranks = NULL;
+    int uh_nprocs, local_uh_nprocs, num_roots = 0, node_id, i;
+
+    PMPI_Comm_size(win->uh_comm, &uh_nprocs);
+    PMPI_Comm_size(win->local_uh_comm, &local_uh_nprocs);
+    win->local_user_nprocs = local_uh_nprocs - MTCORE_ENV.num_h;
+
+    uh_ranks = calloc(uh_nprocs, sizeof(int));
+    ranks_in_world = calloc(uh_nprocs, sizeof(int));
+    coll_uh_ranks = calloc(uh_nprocs, sizeof(int));
+    win->coll_ranks = calloc(MTCORE_NUM_NODES, sizeof(int));
+    for (i = 0; i < MTCORE_NUM_NODES; i++)
+        win->coll_ranks[i] = -1;
+
+    PMPI_Comm_group(win->uh_comm, &uh_group);
+    for (i = 0; i < uh_nprocs; i++)
+        uh_ranks[i] = i;
+    mpi_errno = PMPI_Group_translate_ranks(uh_group, uh_nprocs, uh_ranks, MTCORE_GROUP_WORLD,
+                                           ranks_in_world);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    /* The root helper of a node is its first helper. */
+    for (i = 0; i < uh_nprocs; i++) {
+        node_id = MTCORE_ALL_NODE_IDS[ranks_in_world[i]];
+        if (ranks_in_world[i] == MTCORE_ALL_UNIQUE_H_RANKS_IN_WORLD[node_id * MTCORE_ENV.num_h]) {
+            win->coll_ranks[node_id] = num_roots;
+            coll_uh_ranks[num_roots++] = i;
+        }
+    }
+
+    PMPI_Group_incl(uh_group, num_roots, coll_uh_ranks, &coll_group);
+    mpi_errno = PMPI_Comm_create_group(win->uh_comm, coll_group, MTCORE_COLL_COMM_TAG,
+                                       &win->coll_comm);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    MTCORE_H_DBG_PRINT(" created coll_comm of %d root helpers, %d local users\n", num_roots,
+                       win->local_user_nprocs);
+
+  fn_exit:
+    if (uh_group != MPI_GROUP_NULL)
+        PMPI_Group_free(&uh_group);
+    if (coll_group != MPI_GROUP_NULL)
+        PMPI_Group_free(&coll_group);
+    if (uh_ranks)
+        free(uh_ranks);
+    if (ranks_in_world)
+        free(ranks_in_world);
+    if (coll_uh_ranks)
+        free(coll_uh_ranks);
+    return mpi_errno;
+
+  fn_fail:
+    goto fn_exit;
+}
+
+static void free_coll(MTCORE_H_coll * coll)
+{
+    free(coll->srcs);
+    free(coll->slots);
+    free(coll->bufs);
+    free(coll);
+}
+
+int MTCORE_H_coll_win_destroy(MTCORE_H_win * win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_H_coll *coll, *next;
+
+    /* Collectives not joined by all local users are erroneous. */
+    for (coll = win->colls; coll != NULL; coll = next) {
+        next = coll->next;
+        free_coll(coll);
+    }
+    win->colls = NULL;
+
+    if (win->coll_ranks) {
+        free(win->coll_ranks);
+        win->coll_ranks = NULL;
+    }
+    if (win->coll_comm != MPI_COMM_NULL)
+        mpi_errno = PMPI_Comm_free(&win->coll_comm);
+
+    return mpi_errno;
+}
+
+/* Copy the result to all the other local buffers and complete every user.
+ * Users are completed only after all copies, because the owner of the result
+ * buffer may reuse it at once. */
+void MTCORE_H_coll_complete(MTCORE_H_coll * coll, int mpi_errno)
+{
+    int i;
+
+    for (i = 0; i < coll->num_joined && mpi_errno == MPI_SUCCESS; i++) {
+        if (i != coll->data_idx)
+            memcpy(coll->bufs[i], coll->bufs[coll->data_idx], coll->size);
+    }
+    for (i = 0; i < coll->num_joined; i++)
+        MTCORE_H_p2p_complete_slot(coll->srcs[i], coll->slots[i], mpi_errno, coll->size);
+
+    MTCORE_H_DBG_PRINT(" coll %s seq %u completed, %d bytes, error %d\n",
+                       coll->type == MTCORE_P2P_CMD_ALLREDUCE ? "allreduce" : "bcast",
+                       coll->seq, coll->size, mpi_errno);
+    free_coll(coll);
+}
+
+/* Local phase, reduce all local buffers into the first one in shared memory. */
+static int reduce_local(MTCORE_H_coll * coll)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int i;
+
+    coll->data_idx = 0;
+    for (i = 1; i < coll->num_joined; i++) {
+        mpi_errno = PMPI_Reduce_local(coll->bufs[i], coll->bufs[0], coll->count,
+                                      MTCORE_AM_DTYPES[coll->dtype_idx],
+                                      MTCORE_AM_OPS[coll->op_idx]);
+        if (mpi_errno != MPI_SUCCESS)
+            break;
+    }
+    return mpi_errno;
+}
+
+/* Inter-node phase among root helpers, on the buffer at data_idx. */
+static int start_inter_node(MTCORE_H_win * win, MTCORE_H_coll * coll, MPI_Request * req)
+{
+    MPI_Datatype datatype = MTCORE_AM_DTYPES[coll->dtype_idx];
+
+    if (coll->type == MTCORE_P2P_CMD_ALLREDUCE)
+        return PMPI_Iallreduce(MPI_IN_PLACE, coll->bufs[coll->data_idx], coll->count, datatype,
+                               MTCORE_AM_OPS[coll->op_idx], win->coll_comm, req);
+
+    MTCORE_H_assert(win->coll_ranks[coll->root_node] >= 0);
+    return PMPI_Ibcast(coll->bufs[coll->data_idx], coll->count, datatype,
+                       win->coll_ranks[coll->root_node], win->coll_comm, req);
+}
+
+/**
+ * Join a local user into a collective. Once all local users joined, the
+ * inter-node phase is started and returned in coll_ptr with its request, or
+ * the collective is completed at once if the window is on a single node.
+ * Errors in the command are reported to the user by the caller.
+ */
+int MTCORE_H_coll_post(MTCORE_P2P_cmd * cmd, int src, MPI_Request * req,
+                       MTCORE_H_coll ** coll_ptr)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_H_win *win = NULL;
+    MTCORE_H_coll *coll = NULL, *prev = NULL;
+    int coll_nprocs = 0, idx;
+
+    *coll_ptr = NULL;
+
+    /* The handle is the address of window, see MTCORE_H_win_free. */
+    win = (MTCORE_H_win *) cmd->h_win_handle;
+    if (win == NULL || win->mtcore_h_win_handle != cmd->h_win_handle ||
+        win->coll_comm == MPI_COMM_NULL) {
+        MTCORE_H_ERR_PRINT("[MTCORE-H] coll from local rank %d on wrong window 0x%lx\n",
+                           src, cmd->h_win_handle);
+        return MPI_ERR_WIN;
+    }
+    if (cmd->dtype_idx < 0 || cmd->dtype_idx >= MTCORE_AM_NUM_DTYPES ||
+        (cmd->type == MTCORE_P2P_CMD_ALLREDUCE &&
+         (cmd->op_idx < 0 || cmd->op_idx >= MTCORE_AM_NUM_OPS)))
+        return MPI_ERR_ARG;
+
+    for (coll = win->colls; coll != NULL; prev = coll, coll = coll->next) {
+        if (coll->seq == cmd->seq)
+            break;
+    }
+
+    /* Appended to the waiting list, thus collectives are started in order. */
+    if (coll == NULL) {
+        coll = calloc(1, sizeof(MTCORE_H_coll));
+        coll->srcs = calloc(win->local_user_nprocs, sizeof(int));
+        coll->slots = calloc(win->local_user_nprocs, sizeof(int));
+        coll->bufs = calloc(win->local_user_nprocs, sizeof(char *));
+        coll->type = cmd->type;
+        coll->seq = cmd->seq;
+        coll->count = cmd->count;
+        coll->size = cmd->size;
+        coll->dtype_idx = cmd->dtype_idx;
+        coll->op_idx = cmd->op_idx;
+        coll->root_node = cmd->root_node;
+
+        if (prev)
+            prev->next = coll;
+        else
+            win->colls = coll;
+    }
+
+    idx = coll->num_joined++;
+    coll->srcs[idx] = src;
+    coll->slots[idx] = cmd->slot;
+    coll->bufs[idx] = (char *) win->base + cmd->h_offset;
+    if (cmd->type == MTCORE_P2P_CMD_BCAST && cmd->is_root)
+        coll->data_idx = idx;
+
+    MTCORE_H_DBG_PRINT(" coll %s seq %u joined by local rank %d (%d/%d)\n",
+                       cmd->type == MTCORE_P2P_CMD_ALLREDUCE ? "allreduce" : "bcast",
+                       cmd->seq, src, coll->num_joined, win->local_user_nprocs);
+
+    if (coll->num_joined < win->local_user_nprocs)
+        return mpi_errno;
+
+    /* All local users joined, remove it from the waiting list. */
+    if (prev)
+        prev->next = coll->next;
+    else
+        win->colls = coll->next;
+
+    if (coll->type == MTCORE_P2P_CMD_ALLREDUCE)
+        mpi_errno = reduce_local(coll);
+
+    PMPI_Comm_size(win->coll_comm, &coll_nprocs);
+    if (mpi_errno == MPI_SUCCESS && coll_nprocs > 1)
+        mpi_errno = start_inter_node(win, coll, req);
+
+    if (mpi_errno != MPI_SUCCESS || coll_nprocs == 1) {
+        MTCORE_H_coll_complete(coll, mpi_errno);
+        return MPI_SUCCESS;
+    }
+
+    *coll_ptr = coll;
+    return mpi_errno;
+}
@@ -0,0 +1,81 @@
+/*
+ * comm_cache.c
+ *  <FILE_DESC>
+ *
+ *  Communicators created with user processes in win_allocate, which are cached
+ *  for later windows allocated on the same user group. The user root decides
+ *  the key of each window and releases the cache when it is not used by users.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mtcore_helper.h"
+
+static MTCORE_H_comm_cache *h_comm_cache_list = NULL;
+
+static void free_cache(MTCORE_H_comm_cache * cache)
+{
+    if (cache->local_uh_comm != MPI_COMM_NULL && cache->local_uh_comm != MTCORE_COMM_LOCAL)
+        PMPI_Comm_free(&cache->local_uh_comm);
+    if (cache->uh_comm != MPI_COMM_NULL && cache->uh_comm != MPI_COMM_WORLD)
+        PMPI_Comm_free(&cache->uh_comm);
+    free(cache);
+}
+
+MTCORE_H_comm_cache *MTCORE_H_comm_cache_get(int key)
+{
+    MTCORE_H_comm_cache *cache;
+
+    for (cache = h_comm_cache_list; cache != NULL; cache = cache->next) {
+        if (cache->key == key)
+            return cache;
+    }
+    return NULL;
+}
+
+void MTCORE_H_comm_cache_add(int key, MTCORE_H_win * win)
+{
+    MTCORE_H_comm_cache *cache = calloc(1, sizeof(MTCORE_H_comm_cache));
+
+    cache->key = key;
+    cache->uh_comm = win->uh_comm;
+    cache->local_uh_comm = win->local_uh_comm;
+    cache->next = h_comm_cache_list;
+    h_comm_cache_list = cache;
+
+    MTCORE_H_DBG_PRINT(" add communicator cache %d\n", key);
+}
+
+int MTCORE_H_comm_cache_release(int key)
+{
+    MTCORE_H_comm_cache **prev, *cache;
+
+    for (prev = &h_comm_cache_list; *prev != NULL; prev = &(*prev)->next) {
+        if ((*prev)->key == key)
+            break;
+    }
+    if (*prev == NULL) {
+        MTCORE_H_ERR_PRINT(" Wrong communicator cache %d, not exist\n", key);
+        return -1;
+    }
+
+    cache = *prev;
+    *prev = cache->next;
+    free_cache(cache);
+
+    MTCORE_H_DBG_PRINT(" Freed communicator cache %d\n", key);
+    return MPI_SUCCESS;
+}
+
+void MTCORE_H_comm_cache_destroy(void)
+{
+    MTCORE_H_comm_cache *cache;
+
+    while (h_comm_cache_list) {
+        cache = h_comm_cache_list;
+        h_comm_cache_list = cache->next;
+        free_cache(cache);
+    }
+}
@@ -7,103 +7,172 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "mtcore_helper.h"
 
+/* Buffer of the start message, large enough for the parameters of any function. */
+static char *func_buf = NULL;
+static int func_buf_size = 0;
+
+static void init_func_buf(void)
+{
+    int world_nprocs = 0, param_size, free_param_size;
+
+    PMPI_Comm_size(MPI_COMM_WORLD, &world_nprocs);
+    param_size = sizeof(MTCORE_Func_win_allocate_param) + sizeof(int) * world_nprocs;
+    free_param_size = sizeof(unsigned long) * MTCORE_ENV.num_h;
+    if (free_param_size > param_size)
+        param_size = free_param_size;
+
+    func_buf_size = sizeof(MTCORE_Func_info) + param_size;
+    func_buf_size = max(func_buf_size, MTCORE_CMD_RING_SLOT_SIZE);
+    func_buf = calloc(1, func_buf_size);
+}
+
+/* Receive the start message from the command ring into func_buf. Parameters
+ * that do not fit in a slot follow by MPI, tagged by request id. */
+static int recv_from_cmd_ring(MTCORE_H_func_info * h_info)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MPI_Request req = MPI_REQUEST_NULL;
+    MTCORE_Func_info *info = (MTCORE_Func_info *) func_buf;
+    int src = 0, size = 0;
+
+    mpi_errno = MTCORE_H_progress_wait_cmd(func_buf, &src, &size);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+    h_info->user_root_in_local = src;
+
+    if (info->version == MTCORE_FUNC_VERSION &&
+        size < sizeof(MTCORE_Func_info) + info->param_size) {
+        mpi_errno = PMPI_Irecv(func_buf + sizeof(MTCORE_Func_info), info->param_size, MPI_CHAR,
+                               src, info->req_id, MTCORE_COMM_LOCAL, &req);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        mpi_errno = MTCORE_H_progress_wait(&req, MPI_STATUS_IGNORE);
+    }
+
+    return mpi_errno;
+}
+
 /**
- * Helpers receive a new function from user root process
+ * Helpers receive a new function from user root process. The start message
+ * contains all the parameters of the function, *params points to them.
  */
-int MTCORE_H_func_start(MTCORE_Func * FUNC, int *user_local_root, int *user_nprocs,
-                        int *user_local_nprocs)
+int MTCORE_H_func_start(MTCORE_H_func_info * h_info, char **params)
 {
     int mpi_errno = MPI_SUCCESS;
     MPI_Status status;
-    MTCORE_H_func_info h_info;
+    MPI_Request req = MPI_REQUEST_NULL;
     int local_helper_rank = 0;
 
+    if (func_buf == NULL)
+        init_func_buf();
+
     PMPI_Comm_rank(MTCORE_COMM_HELPER_LOCAL, &local_helper_rank);
-    memset(&h_info, 0, sizeof(h_info));
+    memset(h_info, 0, sizeof(MTCORE_H_func_info));
 
     /* Only root helper receives start request from user roots.
      * Otherwise deadlock may happen if multiple user roots send request to
      * helpers concurrently and some helpers are locked in different communicator creation. */
     if (local_helper_rank == 0) {
-        mpi_errno = PMPI_Recv((char *) &h_info, sizeof(MTCORE_Func_info), MPI_CHAR,
-                              MPI_ANY_SOURCE, MTCORE_FUNC_TAG, MTCORE_COMM_LOCAL, &status);
+        if (MTCORE_CMD_RING) {
+            mpi_errno = recv_from_cmd_ring(h_info);
+        }
+        else {
+            mpi_errno = PMPI_Irecv(func_buf, func_buf_size, MPI_CHAR, MPI_ANY_SOURCE,
+                                   MTCORE_FUNC_TAG, MTCORE_COMM_LOCAL, &req);
+            if (mpi_errno != MPI_SUCCESS)
+                return mpi_errno;
+            mpi_errno = MTCORE_H_progress_wait(&req, &status);
+            h_info->user_root_in_local = status.MPI_SOURCE;
+        }
         if (mpi_errno != MPI_SUCCESS)
             return mpi_errno;
 
-        MTCORE_H_DBG_PRINT(" received Func start request from local rank %d\n", status.MPI_SOURCE);
+        MTCORE_H_DBG_PRINT(" received Func start request from local rank %d\n",
+                           h_info->user_root_in_local);
 
-        h_info.user_root_in_local = status.MPI_SOURCE;
+        memcpy(&h_info->info, func_buf, sizeof(MTCORE_Func_info));
+        if (h_info->info.version != MTCORE_FUNC_VERSION) {
+            MTCORE_H_ERR_PRINT("[MTCORE-H] Wrong Func version %d from local rank %d, "
+                               "expected %d\n", h_info->info.version,
+                               h_info->user_root_in_local, MTCORE_FUNC_VERSION);
+            PMPI_Abort(MPI_COMM_WORLD, 1);
+        }
     }
 
-    /* All other helpers start from here */
-    mpi_errno = PMPI_Bcast((char *) &h_info, sizeof(MTCORE_H_func_info), MPI_CHAR, 0,
-                           MTCORE_COMM_HELPER_LOCAL);
+    /* All other helpers start from here. */
+    mpi_errno = PMPI_Ibcast((char *) h_info, sizeof(MTCORE_H_func_info), MPI_CHAR, 0,
+                            MTCORE_COMM_HELPER_LOCAL, &req);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+    mpi_errno = MTCORE_H_progress_wait(&req, MPI_STATUS_IGNORE);
     if (mpi_errno != MPI_SUCCESS)
         return mpi_errno;
 
-    *FUNC = h_info.info.FUNC;
-    *user_nprocs = h_info.info.user_nprocs;
-    *user_local_nprocs = h_info.info.user_local_nprocs;
-    *user_local_root = h_info.user_root_in_local;
+    if (h_info->info.param_size > 0 && MTCORE_ENV.num_h > 1) {
+        mpi_errno = PMPI_Ibcast(func_buf + sizeof(MTCORE_Func_info), h_info->info.param_size,
+                                MPI_CHAR, 0, MTCORE_COMM_HELPER_LOCAL, &req);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        mpi_errno = MTCORE_H_progress_wait(&req, MPI_STATUS_IGNORE);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    *params = func_buf + sizeof(MTCORE_Func_info);
 
-    MTCORE_H_DBG_PRINT(" all helpers started for Func %d, user nprocs %d, local_nprocs %d,"
-                       "user_local_root %d\n", *FUNC, *user_nprocs, *user_local_nprocs,
-                       *user_local_root);
+    MTCORE_H_DBG_PRINT(" all helpers started for Func %d (request %d, comm_key %d), "
+                       "user nprocs %d, local_nprocs %d, user_local_root %d, param_size %d\n",
+                       h_info->info.FUNC, h_info->info.req_id, h_info->info.comm_key,
+                       h_info->info.user_nprocs, h_info->info.user_local_nprocs,
+                       h_info->user_root_in_local, h_info->info.param_size);
 
-  fn_exit:
     return mpi_errno;
-
-  fn_fail:
-    goto fn_exit;
 }
 
-int MTCORE_H_func_new_ur_h_comm(int user_local_root, MPI_Comm * ur_h_comm)
+/**
+ * Reply the result of a function to user root. Every helper contributes size
+ * bytes, which are sent by root helper in a single message in the order of
+ * local helper ranks.
+ */
+int MTCORE_H_func_reply(void *buf, int size, int user_local_root, int req_id)
 {
     int mpi_errno = MPI_SUCCESS;
-    int *ur_h_ranks_in_local = NULL;
-    MPI_Group ur_h_group = MPI_GROUP_NULL;
-    int i;
-
-    /* Create a user root + all helpers communicator for later information exchanges. */
-    ur_h_ranks_in_local = calloc(sizeof(int), MTCORE_ENV.num_h + 1);
-    /* Helpers' rank are always start from 0 */
-    for (i = 0; i < MTCORE_ENV.num_h; i++)
-        ur_h_ranks_in_local[i] = i;
-    ur_h_ranks_in_local[MTCORE_ENV.num_h] = user_local_root;
-
-    PMPI_Group_incl(MTCORE_GROUP_LOCAL, MTCORE_ENV.num_h + 1, ur_h_ranks_in_local, &ur_h_group);
-    mpi_errno = PMPI_Comm_create_group(MTCORE_COMM_LOCAL, ur_h_group, 0, ur_h_comm);
+    MPI_Request req = MPI_REQUEST_NULL;
+    char *reply_buf = NULL;
+    int local_helper_rank = 0;
+
+    PMPI_Comm_rank(MTCORE_COMM_HELPER_LOCAL, &local_helper_rank);
+    if (local_helper_rank == 0)
+        reply_buf = calloc(MTCORE_ENV.num_h, size);
+
+    mpi_errno = PMPI_Igather(buf, size, MPI_CHAR, reply_buf, size, MPI_CHAR, 0,
+                             MTCORE_COMM_HELPER_LOCAL, &req);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+    mpi_errno = MTCORE_H_progress_wait(&req, MPI_STATUS_IGNORE);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
 
-#ifdef DEBUG
-    int ur_h_rank, ur_h_nprocs;
-    PMPI_Comm_rank(*ur_h_comm, &ur_h_rank);
-    PMPI_Comm_size(*ur_h_comm, &ur_h_nprocs);
-    MTCORE_H_DBG_PRINT(" created ur_h comm, my rank %d/%d \n", ur_h_rank, ur_h_nprocs);
-#endif
+    if (local_helper_rank == 0) {
+        mpi_errno = PMPI_Isend(reply_buf, size * MTCORE_ENV.num_h, MPI_CHAR, user_local_root,
+                               req_id, MTCORE_COMM_LOCAL, &req);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+        mpi_errno = MTCORE_H_progress_wait(&req, MPI_STATUS_IGNORE);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
 
-  fn_exit:
-    if (ur_h_ranks_in_local)
-        free(ur_h_ranks_in_local);
-    if (ur_h_group != MPI_GROUP_NULL)
-        PMPI_Group_free(&ur_h_group);
+        MTCORE_H_DBG_PRINT(" replied %d bytes to user root %d (request %d)\n",
+                           size * MTCORE_ENV.num_h, user_local_root, req_id);
+    }
 
+  fn_exit:
+    if (reply_buf)
+        free(reply_buf);
     return mpi_errno;
 
   fn_fail:
     goto fn_exit;
 }
-
-int MTCORE_H_func_get_param(char *func_params, int size, MPI_Comm ur_h_comm)
-{
-    int local_user_rank, i;
-    MPI_Status status;
-    int mpi_errno = MPI_SUCCESS;
-
-    /* User root is always the last rank in user root + helpers communicator */
-    MTCORE_H_DBG_PRINT("get param from user root: size %d\n", size);
-    return PMPI_Bcast(func_params, size, MPI_CHAR, MTCORE_ENV.num_h, ur_h_comm);
-}
@@ -7,8 +7,8 @@ hashtable_t *mtcore_h_win_ht;
 int run_h_main(void)
 {
     int mpi_errno = MPI_SUCCESS;
-    MTCORE_Func FUNC;
-    int user_local_root, user_nprocs, user_local_nprocs;
+    MTCORE_H_func_info h_info;
+    char *params = NULL;
 
     MTCORE_H_DBG_PRINT(" main start\n");
     mtcore_init_h_win_table();
@@ -16,17 +16,26 @@ int run_h_main(void)
     /*TODO: init in user app or here ? */
     /*    MPI_Init(&argc, &argv); */
     while (1) {
-        mpi_errno = MTCORE_H_func_start(&FUNC, &user_local_root, &user_nprocs, &user_local_nprocs);
+        mpi_errno = MTCORE_H_func_start(&h_info, &params);
         if (mpi_errno != MPI_SUCCESS)
             break;
 
-        switch (FUNC) {
+        switch (h_info.info.FUNC) {
         case MTCORE_FUNC_WIN_ALLOCATE:
-            mpi_errno = MTCORE_H_win_allocate(user_local_root, user_nprocs, user_local_nprocs);
+            mpi_errno = MTCORE_H_win_allocate(h_info.user_root_in_local, h_info.info.user_nprocs,
+                                              h_info.info.user_local_nprocs, h_info.info.req_id,
+                                              h_info.info.comm_key,
+                                              (MTCORE_Func_win_allocate_param *) params);
             break;
 
         case MTCORE_FUNC_WIN_FREE:
-            mpi_errno = MTCORE_H_win_free(user_local_root, user_nprocs, user_local_nprocs);
+            mpi_errno = MTCORE_H_win_free(h_info.user_root_in_local, h_info.info.user_nprocs,
+                                          h_info.info.user_local_nprocs,
+                                          (unsigned long *) params);
+            break;
+
+        case MTCORE_FUNC_COMM_RELEASE:
+            mpi_errno = MTCORE_H_comm_cache_release(h_info.info.comm_key);
             break;
 
             /* other commands */
@@ -43,7 +52,7 @@ int run_h_main(void)
             break;
 
         default:
-            MTCORE_H_DBG_PRINT(" FUNC %d not supported\n", FUNC);
+            MTCORE_H_DBG_PRINT(" FUNC %d not supported\n", h_info.info.FUNC);
             break;
         }
     }
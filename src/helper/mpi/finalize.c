@@ -14,6 +14,13 @@ int MTCORE_H_finalize(void)
     int mpi_errno = MPI_SUCCESS;
     int rank, nprocs, local_rank, local_nprocs;
 
+    MTCORE_H_progress_report();
+
+    MTCORE_H_comm_cache_destroy();
+    MTCORE_Cmd_ring_free(&MTCORE_CMD_RING, &MTCORE_CMD_RING_WIN);
+    if (MTCORE_P2P_is_enabled())
+        MTCORE_P2P_destroy();
+
     if (MTCORE_COMM_LOCAL != MPI_COMM_NULL) {
         MTCORE_H_DBG_PRINT(" free MTCORE_COMM_LOCAL\n");
         PMPI_Comm_free(&MTCORE_COMM_LOCAL);
@@ -57,6 +64,12 @@ int MTCORE_H_finalize(void)
     if (MTCORE_ALL_NODE_IDS)
         free(MTCORE_ALL_NODE_IDS);
 
+    if (MTCORE_ALL_NUMA_IDS)
+        free(MTCORE_ALL_NUMA_IDS);
+
+    if (MTCORE_ENV.h_local_ranks)
+        free(MTCORE_ENV.h_local_ranks);
+
     MTCORE_H_DBG_PRINT(" PMPI_Finalize\n");
     mpi_errno = PMPI_Finalize();
     if (mpi_errno != MPI_SUCCESS)
@@ -0,0 +1,516 @@
+/*
+ * p2p.c
+ *  <FILE_DESC>
+ *
+ *  Root helper side of helper-progressed point-to-point. Commands of local
+ *  users are dequeued in the progress loop, the helper posts the data send on
+ *  its mapping of the user buffer in the shared segment of a window, and
+ *  reports the result into the completion slot of the user once the transfer
+ *  completes. Headers of messages to local users are probed in the same loop
+ *  and matched with the receives posted by users, both in their order. The
+ *  message is received directly into a matched receive buffer in a window, or
+ *  into a bounce buffer (or taken from the header), and then copied into the
+ *  receive buffer or forwarded to the user. The inter-node phase of window
+ *  collectives is completed here as well, see coll.c.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mtcore_helper.h"
+
+typedef enum {
+    MTCORE_H_P2P_OP_SEND,       /* data send of a local user, or collective */
+    MTCORE_H_P2P_OP_RELAY_WAIT, /* waiting for a buffer to receive the message into */
+    MTCORE_H_P2P_OP_RELAY_RECV, /* receiving a message */
+    MTCORE_H_P2P_OP_RELAY_READY,        /* arrived, waiting for a matching receive */
+    MTCORE_H_P2P_OP_RELAY_SEND, /* forwarding to the receiver */
+    MTCORE_H_P2P_OP_DONE,
+} MTCORE_H_p2p_op_state;
+
+/* Receive posted by a local user. */
+typedef struct MTCORE_H_p2p_recv {
+    MTCORE_P2P_cmd cmd;
+    int src;                    /* rank of user in MTCORE_COMM_LOCAL */
+    char *addr;                 /* receive buffer in a window, NULL if forwarded */
+    struct MTCORE_H_p2p_recv *next;
+} MTCORE_H_p2p_recv;
+
+typedef struct MTCORE_H_p2p_op {
+    MTCORE_H_p2p_op_state state;
+    int src;                    /* rank of user in MTCORE_COMM_LOCAL, not used in relay */
+    int slot;                   /* -1 in relay */
+    MTCORE_P2P_hdr *hdr;        /* header followed by inline message in relay, otherwise NULL */
+    char *data;                 /* message in relay, after header, in a bounce buffer
+                                 * or in the receive buffer */
+    int buf;                    /* bounce buffer of relay, -1 if none */
+    MTCORE_H_p2p_recv *recv;    /* matched receive of relay, NULL if not yet */
+    MTCORE_H_coll *coll;        /* inter-node phase of collective, otherwise NULL */
+} MTCORE_H_p2p_op;
+
+/* Bounce buffers are kept for reuse. */
+typedef struct MTCORE_H_p2p_buf {
+    char *addr;
+    int size;
+    int in_use;
+} MTCORE_H_p2p_buf;
+
+static int is_root = -1;
+static MPI_Request *reqs = NULL;
+static MTCORE_H_p2p_op *ops = NULL;
+static MPI_Status *statuses = NULL;
+static int *indices = NULL;
+static int num_ops = 0, max_ops = 0;
+static MTCORE_H_p2p_recv *recvs_head = NULL, *recvs_tail = NULL;   /* not matched yet */
+static MTCORE_H_p2p_buf bufs[MTCORE_P2P_MAX_RELAY_BUFS];
+static long bufs_size = 0;
+
+int MTCORE_H_p2p_is_active(void)
+{
+    int local_rank = 0;
+
+    if (MTCORE_P2P.ring == NULL)
+        return 0;
+    if (is_root < 0) {
+        PMPI_Comm_rank(MTCORE_COMM_LOCAL, &local_rank);
+        is_root = (local_rank == 0);
+    }
+    return is_root;
+}
+
+void MTCORE_H_p2p_complete_slot(int src, int slot, int mpi_errno, int count)
+{
+    MTCORE_P2P_slot *s = &MTCORE_P2P.local_slots[src][slot];
+
+    s->mpi_errno = mpi_errno;
+    s->count = count;
+    MTCORE_Atomic_store_seq(&s->state, MTCORE_P2P_SLOT_DONE);
+}
+
+static int add_op(int src, int slot)
+{
+    if (num_ops == max_ops) {
+        int new_max = max(max_ops * 2, MTCORE_P2P_MAX_REQS);
+
+        reqs = realloc(reqs, sizeof(MPI_Request) * new_max);
+        ops = realloc(ops, sizeof(MTCORE_H_p2p_op) * new_max);
+        statuses = realloc(statuses, sizeof(MPI_Status) * new_max);
+        indices = realloc(indices, sizeof(int) * new_max);
+        if (!reqs || !ops || !statuses || !indices)
+            return -1;
+        max_ops = new_max;
+    }
+
+    memset(&ops[num_ops], 0, sizeof(MTCORE_H_p2p_op));
+    ops[num_ops].src = src;
+    ops[num_ops].slot = slot;
+    ops[num_ops].buf = -1;
+    reqs[num_ops] = MPI_REQUEST_NULL;
+    return num_ops++;
+}
+
+/* Get a free bounce buffer of at least size bytes, -1 if none is available.
+ * A message larger than the limit is buffered only if no other message is. */
+static int get_buf(int size)
+{
+    int i, idx = -1, num_in_use = 0;
+
+    for (i = 0; i < MTCORE_P2P_MAX_RELAY_BUFS; i++) {
+        if (bufs[i].in_use)
+            num_in_use++;
+        else if (bufs[i].addr && bufs[i].size >= size &&
+                 (idx < 0 || bufs[i].size < bufs[idx].size))
+            idx = i;
+    }
+    if (idx >= 0)
+        goto fn_exit;
+
+    /* Release free buffers which are too small to make room. */
+    for (i = 0; i < MTCORE_P2P_MAX_RELAY_BUFS && bufs_size + size > MTCORE_P2P_RELAY_BUF_SIZE;
+         i++) {
+        if (!bufs[i].in_use && bufs[i].addr) {
+            free(bufs[i].addr);
+            bufs[i].addr = NULL;
+            bufs_size -= bufs[i].size;
+        }
+    }
+    if (bufs_size + size > MTCORE_P2P_RELAY_BUF_SIZE && num_in_use > 0)
+        return -1;
+
+    for (i = 0; i < MTCORE_P2P_MAX_RELAY_BUFS && (bufs[i].in_use || bufs[i].addr); i++);
+    if (i == MTCORE_P2P_MAX_RELAY_BUFS)
+        return -1;
+    bufs[i].addr = malloc(max(size, 1));
+    if (bufs[i].addr == NULL)
+        return -1;
+    bufs[i].size = size;
+    bufs_size += size;
+    idx = i;
+
+  fn_exit:
+    bufs[idx].in_use = 1;
+    return idx;
+}
+
+static void put_buf(int idx)
+{
+    bufs[idx].in_use = 0;
+    if (bufs_size > MTCORE_P2P_RELAY_BUF_SIZE) {
+        free(bufs[idx].addr);
+        bufs[idx].addr = NULL;
+        bufs_size -= bufs[idx].size;
+    }
+}
+
+static inline int is_match(MTCORE_P2P_hdr * hdr, MTCORE_P2P_cmd * cmd)
+{
+    return hdr->dst == cmd->dst && hdr->src == cmd->peer && hdr->comm_id == cmd->comm_id &&
+        hdr->tag == cmd->tag;
+}
+
+/* Receive a header of message to a local user, and match it with the first
+ * posted receive of the same source, communicator and tag. The data of a
+ * message which is not inline is received later, see advance_relays. */
+static void post_relay(MPI_Message * msg, MPI_Status * status)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_P2P_hdr *hdr = NULL;
+    MTCORE_H_p2p_recv *recv, *prev = NULL;
+    int idx, count = 0;
+
+    PMPI_Get_count(status, MPI_BYTE, &count);
+    hdr = malloc(max(count, (int) sizeof(MTCORE_P2P_hdr)));
+    if (hdr == NULL)
+        goto fn_fail;
+    mpi_errno = PMPI_Mrecv(hdr, count, MPI_BYTE, msg, MPI_STATUS_IGNORE);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    idx = add_op(-1, -1);
+    if (idx < 0)
+        goto fn_fail;
+    ops[idx].hdr = hdr;
+    if (hdr->data_src >= 0) {
+        ops[idx].state = MTCORE_H_P2P_OP_RELAY_WAIT;
+    }
+    else {
+        ops[idx].data = (char *) (hdr + 1);
+        ops[idx].state = MTCORE_H_P2P_OP_RELAY_READY;
+    }
+
+    for (recv = recvs_head; recv != NULL; prev = recv, recv = recv->next) {
+        if (is_match(hdr, &recv->cmd)) {
+            if (prev)
+                prev->next = recv->next;
+            else
+                recvs_head = recv->next;
+            if (recvs_tail == recv)
+                recvs_tail = prev;
+            ops[idx].recv = recv;
+            break;
+        }
+    }
+
+    MTCORE_H_DBG_PRINT(" p2p relay %d bytes from %d to %d, comm %d, tag %d, data from %d, "
+                       "%s\n", hdr->size, hdr->src, hdr->dst, hdr->comm_id, hdr->tag,
+                       hdr->data_src, ops[idx].recv ? "matched" : "unexpected");
+    return;
+
+  fn_fail:
+    /* The receiver waits for the message, nothing else can be done. */
+    MTCORE_H_ERR_PRINT("[MTCORE-H] cannot relay message from %d\n", status->MPI_SOURCE);
+    PMPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+/* Match a receive of local user with the first unmatched message of the same
+ * source, communicator and tag, or keep it for later messages. */
+static void post_recv(MTCORE_P2P_cmd * cmd, int src)
+{
+    MTCORE_H_p2p_recv *recv = NULL;
+    MTCORE_H_win *win = NULL;
+    int i;
+
+    recv = calloc(1, sizeof(MTCORE_H_p2p_recv));
+    if (recv == NULL) {
+        MTCORE_H_p2p_complete_slot(src, cmd->slot, MPI_ERR_NO_MEM, 0);
+        return;
+    }
+    memcpy(&recv->cmd, cmd, sizeof(MTCORE_P2P_cmd));
+    recv->src = src;
+
+    if (cmd->h_win_handle != 0) {
+        /* The handle is the address of window, see MTCORE_H_win_free. */
+        win = (MTCORE_H_win *) cmd->h_win_handle;
+        if (win->mtcore_h_win_handle != cmd->h_win_handle) {
+            MTCORE_H_ERR_PRINT("[MTCORE-H] p2p from local rank %d on wrong window 0x%lx\n",
+                               src, cmd->h_win_handle);
+            MTCORE_H_p2p_complete_slot(src, cmd->slot, MPI_ERR_WIN, 0);
+            free(recv);
+            return;
+        }
+        recv->addr = (char *) win->base + cmd->h_offset;
+    }
+
+    MTCORE_H_DBG_PRINT(" p2p irecv %d bytes at %p, peer %d, comm %d, tag %d for local rank %d "
+                       "slot %d\n", cmd->size, recv->addr, cmd->peer, cmd->comm_id, cmd->tag,
+                       src, cmd->slot);
+
+    for (i = 0; i < num_ops; i++) {
+        if (ops[i].hdr && ops[i].recv == NULL && ops[i].state != MTCORE_H_P2P_OP_DONE &&
+            is_match(ops[i].hdr, cmd)) {
+            ops[i].recv = recv;
+            return;
+        }
+    }
+
+    if (recvs_tail)
+        recvs_tail->next = recv;
+    else
+        recvs_head = recv;
+    recvs_tail = recv;
+}
+
+/* Report a relayed message to the receiver and release it. */
+static void complete_relay(MTCORE_H_p2p_op * op)
+{
+    MTCORE_H_p2p_recv *recv = op->recv;
+
+    MTCORE_H_p2p_complete_slot(recv->src, recv->cmd.slot,
+                               op->hdr->size > recv->cmd.size ? MPI_ERR_TRUNCATE : MPI_SUCCESS,
+                               min(op->hdr->size, recv->cmd.size));
+    if (op->buf >= 0)
+        put_buf(op->buf);
+    free(recv);
+    free(op->hdr);
+    op->recv = NULL;
+    op->hdr = NULL;
+    op->state = MTCORE_H_P2P_OP_DONE;
+}
+
+/* Post the data receive of a waiting message, directly into the matched
+ * receive buffer if it is in a window and large enough, otherwise into a
+ * bounce buffer. It keeps waiting if no buffer is available. */
+static int post_relay_data(int idx)
+{
+    MTCORE_H_p2p_op *op = &ops[idx];
+    MTCORE_P2P_hdr *hdr = op->hdr;
+
+    if (op->recv && op->recv->addr && hdr->size <= op->recv->cmd.size) {
+        op->data = op->recv->addr;
+    }
+    else {
+        op->buf = get_buf(hdr->size);
+        if (op->buf < 0)
+            return MPI_SUCCESS;
+        op->data = bufs[op->buf].addr;
+    }
+
+    op->state = MTCORE_H_P2P_OP_RELAY_RECV;
+    return PMPI_Irecv(op->data, hdr->size, MPI_BYTE, hdr->data_src,
+                      MTCORE_P2P_data_tag(hdr->src), MTCORE_P2P.comm, &reqs[idx]);
+}
+
+/* Post data receives of waiting messages, and deliver arrived messages to
+ * their matched receives. Data of a source from the same process arrives in
+ * the order of headers, thus it is received in that order. */
+static int advance_relays(void)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_P2P_hdr *hdr, *prev_hdr;
+    MTCORE_H_p2p_recv *recv;
+    int i, j, blocked;
+
+    for (i = 0; i < num_ops; i++) {
+        hdr = ops[i].hdr;
+        recv = ops[i].recv;
+
+        if (ops[i].state == MTCORE_H_P2P_OP_RELAY_WAIT) {
+            blocked = 0;
+            for (j = 0; j < i && !blocked; j++) {
+                prev_hdr = ops[j].hdr;
+                blocked = (ops[j].state == MTCORE_H_P2P_OP_RELAY_WAIT &&
+                           prev_hdr->src == hdr->src && prev_hdr->data_src == hdr->data_src);
+            }
+            if (!blocked) {
+                mpi_errno = post_relay_data(i);
+                if (mpi_errno != MPI_SUCCESS)
+                    return mpi_errno;
+            }
+        }
+        else if (ops[i].state == MTCORE_H_P2P_OP_RELAY_READY && recv != NULL) {
+            if (recv->addr) {
+                if (ops[i].data != recv->addr)
+                    memcpy(recv->addr, ops[i].data, min(hdr->size, recv->cmd.size));
+                complete_relay(&ops[i]);
+            }
+            else {
+                mpi_errno = PMPI_Isend(ops[i].data, min(hdr->size, recv->cmd.size), MPI_BYTE,
+                                       recv->cmd.dst, MTCORE_P2P_reply_tag(recv->cmd.slot),
+                                       MTCORE_P2P.comm, &reqs[i]);
+                if (mpi_errno != MPI_SUCCESS)
+                    return mpi_errno;
+                ops[i].state = MTCORE_H_P2P_OP_RELAY_SEND;
+            }
+        }
+    }
+
+    return mpi_errno;
+}
+
+static void post_coll(MTCORE_P2P_cmd * cmd, int src)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MPI_Request req = MPI_REQUEST_NULL;
+    MTCORE_H_coll *coll = NULL;
+    int idx;
+
+    mpi_errno = MTCORE_H_coll_post(cmd, src, &req, &coll);
+    if (mpi_errno != MPI_SUCCESS) {
+        MTCORE_H_p2p_complete_slot(src, cmd->slot, mpi_errno, 0);
+        return;
+    }
+    if (coll == NULL)
+        return;
+
+    idx = add_op(src, -1);
+    if (idx < 0) {
+        /* The collective cannot be abandoned once started. */
+        MTCORE_H_ERR_PRINT("[MTCORE-H] cannot track collective for local rank %d\n", src);
+        PMPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    reqs[idx] = req;
+    ops[idx].coll = coll;
+}
+
+static void post_cmd(MTCORE_P2P_cmd * cmd, int src)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_H_win *win = NULL;
+    char *addr = NULL;
+    int idx;
+
+    if (cmd->type == MTCORE_P2P_CMD_ALLREDUCE || cmd->type == MTCORE_P2P_CMD_BCAST) {
+        post_coll(cmd, src);
+        return;
+    }
+    if (cmd->type == MTCORE_P2P_CMD_IRECV) {
+        post_recv(cmd, src);
+        return;
+    }
+
+    /* The handle is the address of window, see MTCORE_H_win_free. */
+    win = (MTCORE_H_win *) cmd->h_win_handle;
+    if (win == NULL || win->mtcore_h_win_handle != cmd->h_win_handle) {
+        MTCORE_H_ERR_PRINT("[MTCORE-H] p2p from local rank %d on wrong window 0x%lx\n",
+                           src, cmd->h_win_handle);
+        MTCORE_H_p2p_complete_slot(src, cmd->slot, MPI_ERR_WIN, 0);
+        return;
+    }
+    addr = (char *) win->base + cmd->h_offset;
+
+    idx = add_op(src, cmd->slot);
+    if (idx < 0) {
+        MTCORE_H_p2p_complete_slot(src, cmd->slot, MPI_ERR_NO_MEM, 0);
+        return;
+    }
+
+    mpi_errno = PMPI_Isend(addr, cmd->size, MPI_BYTE, cmd->peer, cmd->tag, MTCORE_P2P.comm,
+                           &reqs[idx]);
+
+    MTCORE_H_DBG_PRINT(" p2p isend %d bytes at %p, peer %d, tag %d for local rank %d slot %d\n",
+                       cmd->size, addr, cmd->peer, cmd->tag, src, cmd->slot);
+
+    if (mpi_errno != MPI_SUCCESS) {
+        num_ops--;
+        MTCORE_H_p2p_complete_slot(src, cmd->slot, mpi_errno, 0);
+    }
+}
+
+/* Complete an operation. A relayed message waits for its receive once it
+ * arrived, and is released after it is forwarded. */
+static void complete_op(int idx, MPI_Status * status)
+{
+    MTCORE_H_p2p_op *op = &ops[idx];
+    int count = 0;
+
+    if (op->state == MTCORE_H_P2P_OP_RELAY_RECV) {
+        /* The sender reported the size in the header. */
+        op->state = MTCORE_H_P2P_OP_RELAY_READY;
+        return;
+    }
+    if (op->state == MTCORE_H_P2P_OP_RELAY_SEND) {
+        complete_relay(op);
+        return;
+    }
+
+    op->state = MTCORE_H_P2P_OP_DONE;
+    if (op->coll) {
+        MTCORE_H_coll_complete(op->coll, MPI_SUCCESS);
+        op->coll = NULL;
+    }
+    else if (op->slot >= 0) {
+        PMPI_Get_count(status, MPI_BYTE, &count);
+        MTCORE_H_p2p_complete_slot(op->src, op->slot, MPI_SUCCESS, count);
+    }
+}
+
+/**
+ * Post commands of local users and complete transfers in flight. Transfers in
+ * flight count as a handled event, thus the helper keeps polling MPI for them.
+ */
+int MTCORE_H_p2p_progress(int *num_handled)
+{
+    int mpi_errno = MPI_SUCCESS;
+    char cmd[MTCORE_CMD_RING_SLOT_SIZE];
+    MPI_Message msg;
+    MPI_Status status;
+    int src = 0, size = 0, outcount = 0, flag = 0;
+    int i, j;
+
+    while (MTCORE_Cmd_ring_dequeue(MTCORE_P2P.ring, cmd, &src, &size)) {
+        post_cmd((MTCORE_P2P_cmd *) cmd, src);
+        (*num_handled)++;
+    }
+
+    while (1) {
+        mpi_errno = PMPI_Improbe(MPI_ANY_SOURCE, MTCORE_P2P_HDR_TAG, MTCORE_P2P.comm, &flag,
+                                 &msg, &status);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        if (!flag)
+            break;
+        post_relay(&msg, &status);
+        (*num_handled)++;
+    }
+
+    if (num_ops == 0)
+        return mpi_errno;
+
+    mpi_errno = PMPI_Testsome(num_ops, reqs, &outcount, indices, statuses);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+    if (outcount == MPI_UNDEFINED)
+        outcount = 0;
+
+    for (i = 0; i < outcount; i++)
+        complete_op(indices[i], &statuses[i]);
+
+    mpi_errno = advance_relays();
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    /* Remove completed operations, keeping the order of the others. */
+    for (i = 0, j = 0; i < num_ops; i++) {
+        if (ops[i].state == MTCORE_H_P2P_OP_DONE)
+            continue;
+        reqs[j] = reqs[i];
+        ops[j] = ops[i];
+        j++;
+    }
+    num_ops = j;
+
+    (*num_handled)++;
+    return mpi_errno;
+}
@@ -0,0 +1,199 @@
+/*
+ * progress.c
+ *  <FILE_DESC>
+ *
+ *  Progress loop of helper processes. Helpers wait for new functions by
+ *  polling the request with PMPI_Test, which also drives the progress engine
+ *  of MPI for RMA operations, and apply active messages in between. When no
+ *  event arrives for a number of polls, the helper either keeps polling,
+ *  yields its processor, or sleeps with exponential backoff, which trades
+ *  helper core usage against RMA completion latency. The root helper waits
+ *  for new functions in the command ring instead if it is enabled, and sleeps
+ *  on the ring so that it is woken up by the next command. The root helper
+ *  also posts point-to-point offloaded by local users in the loop.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include "mtcore_helper.h"
+
+typedef enum {
+    MTCORE_H_STATE_BLOCK,
+    MTCORE_H_STATE_POLL,
+    MTCORE_H_STATE_YIELD,
+    MTCORE_H_STATE_SLEEP,
+    MTCORE_H_STATE_MAX,
+} MTCORE_H_progress_state;
+
+static const char *MTCORE_H_progress_state_name[MTCORE_H_STATE_MAX] = {
+    "block", "poll", "yield", "sleep"
+};
+
+static const char *MTCORE_H_progress_policy_name[] = {
+    "block", "busy", "yield", "sleep"
+};
+
+/* Time is only accounted at state transitions, thus polling stays cheap. */
+static double state_time[MTCORE_H_STATE_MAX];
+static unsigned long state_cnt[MTCORE_H_STATE_MAX];
+static double progress_start_time = -1.0;
+
+static inline void switch_state(MTCORE_H_progress_state * state, double *t_state,
+                                MTCORE_H_progress_state new_state)
+{
+    double t = PMPI_Wtime();
+
+    state_time[*state] += t - *t_state;
+    state_cnt[new_state]++;
+    *state = new_state;
+    *t_state = t;
+}
+
+static inline void sleep_backoff(long *sleep_ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = *sleep_ns / 1000000000L;
+    ts.tv_nsec = *sleep_ns % 1000000000L;
+    nanosleep(&ts, NULL);
+
+    *sleep_ns = min(*sleep_ns * 2, (long) MTCORE_ENV.h_progress_sleep_max * 1000);
+}
+
+/* Wait for either completion of a request, or a command in the command ring if
+ * req is NULL. */
+static int progress_wait(MPI_Request * req, MPI_Status * status, void *cmd, int *src, int *size)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_H_progress_state state = MTCORE_H_STATE_POLL;
+    int flag = 0, probe_flag = 0, num_idle = 0, num_handled = 0;
+    long sleep_ns = 1000;
+    double t_state = PMPI_Wtime();
+
+    if (progress_start_time < 0)
+        progress_start_time = t_state;
+
+    /* Active messages and offloaded point-to-point can only be handled by polling. */
+    if (req && MTCORE_ENV.h_progress == MTCORE_H_PROGRESS_BLOCK && !MTCORE_H_am_is_active() &&
+        !MTCORE_H_p2p_is_active()) {
+        state_cnt[MTCORE_H_STATE_BLOCK]++;
+        mpi_errno = PMPI_Wait(req, status);
+        state_time[MTCORE_H_STATE_BLOCK] += PMPI_Wtime() - t_state;
+        return mpi_errno;
+    }
+
+    state_cnt[MTCORE_H_STATE_POLL]++;
+    while (1) {
+        if (req) {
+            mpi_errno = PMPI_Test(req, &flag, status);
+        }
+        else {
+            /* Commands are dequeued without entering MPI, but MPI progress is
+             * still driven for RMA operations to helpers. */
+            flag = MTCORE_Cmd_ring_dequeue(MTCORE_CMD_RING, cmd, src, size);
+            if (!flag)
+                mpi_errno = PMPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MTCORE_COMM_LOCAL,
+                                        &probe_flag, MPI_STATUS_IGNORE);
+        }
+        if (mpi_errno != MPI_SUCCESS || flag)
+            break;
+
+        num_handled = 0;
+        if (MTCORE_H_am_is_active()) {
+            mpi_errno = MTCORE_H_am_progress(&num_handled);
+            if (mpi_errno != MPI_SUCCESS)
+                break;
+        }
+        if (MTCORE_H_p2p_is_active()) {
+            mpi_errno = MTCORE_H_p2p_progress(&num_handled);
+            if (mpi_errno != MPI_SUCCESS)
+                break;
+        }
+
+        /* Go back to polling once an event arrives. */
+        if (num_handled > 0) {
+            num_idle = 0;
+            sleep_ns = 1000;
+            if (state != MTCORE_H_STATE_POLL)
+                switch_state(&state, &t_state, MTCORE_H_STATE_POLL);
+            continue;
+        }
+
+        if (MTCORE_ENV.h_progress == MTCORE_H_PROGRESS_BUSY ||
+            (req && MTCORE_ENV.h_progress == MTCORE_H_PROGRESS_BLOCK) ||
+            num_idle++ < MTCORE_ENV.h_progress_spin)
+            continue;
+
+        if (MTCORE_ENV.h_progress == MTCORE_H_PROGRESS_YIELD) {
+            if (state != MTCORE_H_STATE_YIELD)
+                switch_state(&state, &t_state, MTCORE_H_STATE_YIELD);
+            sched_yield();
+        }
+        else {
+            /* Blocking on the command ring is sleeping with backoff as well,
+             * but the helper is woken up as soon as a command arrives. */
+            if (state != MTCORE_H_STATE_SLEEP)
+                switch_state(&state, &t_state, MTCORE_H_STATE_SLEEP);
+            if (req) {
+                sleep_backoff(&sleep_ns);
+            }
+            else {
+                MTCORE_Cmd_ring_sleep(MTCORE_CMD_RING, sleep_ns);
+                sleep_ns = min(sleep_ns * 2, (long) MTCORE_ENV.h_progress_sleep_max * 1000);
+            }
+        }
+    }
+
+    state_time[state] += PMPI_Wtime() - t_state;
+    return mpi_errno;
+}
+
+/**
+ * Wait for completion of a request while driving MPI progress and active
+ * messages, following the progress policy specified by MTCORE_H_PROGRESS.
+ */
+int MTCORE_H_progress_wait(MPI_Request * req, MPI_Status * status)
+{
+    return progress_wait(req, status, NULL, NULL, NULL);
+}
+
+/**
+ * Wait for a command in the command ring in the same way as for a request,
+ * cmd must hold MTCORE_CMD_RING_SLOT_SIZE bytes.
+ */
+int MTCORE_H_progress_wait_cmd(void *cmd, int *src, int *size)
+{
+    return progress_wait(NULL, NULL, cmd, src, size);
+}
+
+/**
+ * Report time spent in every progress state, the remaining time is spent
+ * in handling functions.
+ */
+void MTCORE_H_progress_report(void)
+{
+    double total = 0.0, wait = 0.0;
+    int i;
+
+    if (!MTCORE_ENV.h_progress_stat || progress_start_time < 0)
+        return;
+
+    total = PMPI_Wtime() - progress_start_time;
+    for (i = 0; i < MTCORE_H_STATE_MAX; i++)
+        wait += state_time[i];
+
+    fprintf(stdout, "[MTCORE-H][N-%d, %d] progress policy %s: total %.3lf s, work %.3lf s",
+            MTCORE_MY_NODE_ID, MTCORE_MY_RANK_IN_WORLD,
+            MTCORE_H_progress_policy_name[MTCORE_ENV.h_progress], total, total - wait);
+    for (i = 0; i < MTCORE_H_STATE_MAX; i++) {
+        if (state_cnt[i] > 0)
+            fprintf(stdout, ", %s %.3lf s (%lu)", MTCORE_H_progress_state_name[i],
+                    state_time[i], state_cnt[i]);
+    }
+    fprintf(stdout, "\n");
+    fflush(stdout);
+}
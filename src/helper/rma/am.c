@@ -0,0 +1,754 @@
+/*
+ * am.c
+ *  <FILE_DESC>
+ *
+ *  Active-message transport on helper processes. Helpers poll descriptors of
+ *  all AM-enabled windows while waiting for new functions, apply them on the
+ *  shared segment of local user processes, and reply for get, fetch_and_op
+ *  and flush.
+ *
+ *  With node-level aggregation, the root helper moves operations from the
+ *  queues of local users into one batch per destination helper, which applies
+ *  the whole batch and acknowledges it. Operations are reported completed to
+ *  their queues at acknowledgment. Consecutive fetch_and_op with MPI_SUM to
+ *  the same location are merged in a batch, and the result of each origin is
+ *  the fetched value plus the sum of the merged operations before it.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mtcore_helper.h"
+
+/* AM-enabled windows on this helper */
+static MTCORE_H_win **am_wins = NULL;
+static int num_am_wins = 0;
+static int max_am_wins = 0;
+
+/* Outstanding replies, buffers are freed at completion */
+static MPI_Request *reply_reqs = NULL;
+static void **reply_bufs = NULL;
+static int num_replies = 0;
+static int max_replies = 0;
+
+/* Receive buffer of descriptors, grows on demand */
+static char *pkt_buf = NULL;
+static int pkt_buf_size = 0;
+
+/* Queued fetch_and_op in a batch. Result of the origin is the fetched value
+ * of its (combined) operation, plus prefix if it is merged into a previous
+ * one. */
+typedef struct MTCORE_H_am_fop {
+    int queue;
+    int slot;                   /* result slot in queue */
+    int dtype_idx;
+    int result_off;             /* offset of fetched value in acknowledgment */
+    int has_prefix;
+    char prefix[MTCORE_AM_AGG_FOP_RESULT_SIZE];
+} MTCORE_H_am_fop;
+
+/* Batch of aggregated operations to a destination helper */
+typedef struct MTCORE_H_am_batch {
+    char *buf;
+    int size;
+    int last_off;               /* offset of the last entry, -1 if empty */
+    unsigned long *counts;      /* number of operations from each queue */
+    MPI_Request reqs[2];        /* send of batch and receive of acknowledgment */
+
+    /* Acknowledgment carries fetched values of all fetch_and_op in batch */
+    char *ack;
+    int ack_size;
+    MTCORE_H_am_fop *fops;
+    int num_fops;
+    int max_fops;
+    struct MTCORE_H_am_batch *next;
+} MTCORE_H_am_batch;
+
+int MTCORE_H_am_is_active(void)
+{
+    return num_am_wins > 0;
+}
+
+static int add_reply(MPI_Request req, void *buf)
+{
+    if (num_replies == max_replies) {
+        int new_max = max(max_replies * 2, 64);
+        MPI_Request *reqs = realloc(reply_reqs, sizeof(MPI_Request) * new_max);
+        void **bufs = realloc(reply_bufs, sizeof(void *) * new_max);
+
+        if (reqs)
+            reply_reqs = reqs;
+        if (bufs)
+            reply_bufs = bufs;
+        if (reqs == NULL || bufs == NULL)
+            return MPI_ERR_NO_MEM;
+        max_replies = new_max;
+    }
+    reply_reqs[num_replies] = req;
+    reply_bufs[num_replies] = buf;
+    num_replies++;
+
+    return MPI_SUCCESS;
+}
+
+/* Free completed replies and compact the list. */
+static int test_replies(void)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int i, cnt = 0, flag = 0;
+
+    for (i = 0; i < num_replies; i++) {
+        mpi_errno = PMPI_Test(&reply_reqs[i], &flag, MPI_STATUS_IGNORE);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+
+        if (flag) {
+            if (reply_bufs[i])
+                free(reply_bufs[i]);
+        }
+        else {
+            reply_reqs[cnt] = reply_reqs[i];
+            reply_bufs[cnt] = reply_bufs[i];
+            cnt++;
+        }
+    }
+    num_replies = cnt;
+
+    return mpi_errno;
+}
+
+static int reply(const void *buf, int size, int free_buf, int src, int tag, MPI_Comm comm)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MPI_Request req = MPI_REQUEST_NULL;
+
+    mpi_errno = PMPI_Isend(buf, size, MPI_BYTE, src, tag, comm, &req);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    return add_reply(req, free_buf ? (void *) buf : NULL);
+}
+
+/* Apply a descriptor. Fetched value of fetch_and_op is written to fop_result
+ * in a batch, otherwise it is replied to the origin. */
+static int handle_pkt(MTCORE_AM_pkt * pkt, int src, void *fop_result, MTCORE_H_win * win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    void *data = (char *) pkt + sizeof(MTCORE_AM_pkt);
+    void *target_addr = (char *) win->base + pkt->target_offset;
+    MPI_Datatype datatype = MPI_DATATYPE_NULL;
+    MPI_Op op = MPI_OP_NULL;
+    int dtsize = 0, size = 0;
+
+    if (pkt->type != MTCORE_AM_PKT_FLUSH) {
+        MTCORE_H_assert(pkt->dtype_idx >= 0 && pkt->dtype_idx < MTCORE_AM_NUM_DTYPES);
+        datatype = MTCORE_AM_DTYPES[pkt->dtype_idx];
+        if (pkt->op_idx >= 0)
+            op = MTCORE_AM_OPS[pkt->op_idx];
+        PMPI_Type_size(datatype, &dtsize);
+        size = dtsize * pkt->count;
+    }
+
+    switch (pkt->type) {
+    case MTCORE_AM_PKT_PUT:
+        memcpy(target_addr, data, size);
+        break;
+
+    case MTCORE_AM_PKT_ACC:
+        if (op == MPI_REPLACE)
+            memcpy(target_addr, data, size);
+        else if (op != MPI_NO_OP)
+            mpi_errno = PMPI_Reduce_local(data, target_addr, pkt->count, datatype, op);
+        break;
+
+    case MTCORE_AM_PKT_GET:
+        /* Reply directly from shared segment */
+        mpi_errno = reply(target_addr, size, 0, src, pkt->reply_tag, win->am_comm);
+        break;
+
+    case MTCORE_AM_PKT_FOP:
+        {
+            void *result = fop_result ? fop_result : malloc(size);
+            if (result == NULL)
+                return MPI_ERR_NO_MEM;
+            memcpy(result, target_addr, size);
+
+            if (op == MPI_REPLACE)
+                memcpy(target_addr, data, size);
+            else if (op != MPI_NO_OP)
+                mpi_errno = PMPI_Reduce_local(data, target_addr, pkt->count, datatype, op);
+            if (mpi_errno != MPI_SUCCESS) {
+                if (fop_result == NULL)
+                    free(result);
+                return mpi_errno;
+            }
+
+            if (fop_result == NULL)
+                mpi_errno = reply(result, size, 1, src, pkt->reply_tag, win->am_comm);
+        }
+        break;
+
+    case MTCORE_AM_PKT_FLUSH:
+        {
+            /* All previous descriptors of this origin have been applied */
+            char *ack = malloc(sizeof(char));
+            if (ack == NULL)
+                return MPI_ERR_NO_MEM;
+            mpi_errno = reply(ack, 1, 1, src, pkt->reply_tag, win->am_comm);
+        }
+        break;
+
+    default:
+        MTCORE_H_ERR_PRINT("[MTCORE-H] unknown AM pkt type %d\n", pkt->type);
+        mpi_errno = -1;
+        break;
+    }
+
+    MTCORE_H_DBG_PRINT(" handled AM pkt %d from %d, offset 0x%lx, size %d\n",
+                       pkt->type, src, pkt->target_offset, size);
+
+    return mpi_errno;
+}
+
+static int recv_pkt(MPI_Status * status, int tag, MPI_Comm comm)
+{
+    int size = 0;
+
+    PMPI_Get_count(status, MPI_BYTE, &size);
+    if (size > pkt_buf_size) {
+        char *buf = realloc(pkt_buf, size);
+        if (buf == NULL)
+            return MPI_ERR_NO_MEM;
+        pkt_buf = buf;
+        pkt_buf_size = size;
+    }
+
+    return PMPI_Recv(pkt_buf, size, MPI_BYTE, status->MPI_SOURCE, tag, comm, MPI_STATUS_IGNORE);
+}
+
+static inline int get_dtype_size(int dtype_idx)
+{
+    int dtsize = 0;
+    PMPI_Type_size(MTCORE_AM_DTYPES[dtype_idx], &dtsize);
+    return dtsize;
+}
+
+/* Apply a received batch of aggregated operations in order, and acknowledge
+ * it to the forwarding helper with the fetched values of fetch_and_op. */
+static int handle_batch(MPI_Status * status, MTCORE_H_win * win, int *num_handled)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_AM_agg_entry *entry;
+    char *ack = NULL;
+    int size = 0, off = 0, ack_size = 0, ack_off = 0;
+
+    PMPI_Get_count(status, MPI_BYTE, &size);
+    for (off = 0; off < size; off += entry->size) {
+        entry = (MTCORE_AM_agg_entry *) (pkt_buf + off);
+        if (entry->pkt.type == MTCORE_AM_PKT_FOP)
+            ack_size += get_dtype_size(entry->pkt.dtype_idx);
+    }
+
+    ack = malloc(max(ack_size, 1));
+    if (ack == NULL)
+        return MPI_ERR_NO_MEM;
+
+    for (off = 0; off < size; off += entry->size) {
+        entry = (MTCORE_AM_agg_entry *) (pkt_buf + off);
+        if (entry->pkt.type == MTCORE_AM_PKT_FOP) {
+            mpi_errno = handle_pkt(&entry->pkt, status->MPI_SOURCE, ack + ack_off, win);
+            ack_off += get_dtype_size(entry->pkt.dtype_idx);
+        }
+        else {
+            mpi_errno = handle_pkt(&entry->pkt, status->MPI_SOURCE, NULL, win);
+        }
+        if (mpi_errno != MPI_SUCCESS) {
+            free(ack);
+            return mpi_errno;
+        }
+        (*num_handled)++;
+    }
+
+    return reply(ack, max(ack_size, 1), 1, status->MPI_SOURCE, MTCORE_AM_AGG_ACK_TAG,
+                 win->am_comm);
+}
+
+static int send_batch(int h_rank, MTCORE_H_win * win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_H_am_batch *batch = win->agg_batches[h_rank];
+
+    /* Post receive of acknowledgment first, so that it never goes unexpected
+     * path. Acknowledgments from the same helper match in order. */
+    batch->ack = malloc(max(batch->ack_size, 1));
+    if (batch->ack == NULL)
+        return MPI_ERR_NO_MEM;
+    mpi_errno = PMPI_Irecv(batch->ack, max(batch->ack_size, 1), MPI_BYTE, h_rank,
+                           MTCORE_AM_AGG_ACK_TAG, win->am_comm, &batch->reqs[1]);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+    mpi_errno = PMPI_Isend(batch->buf, batch->size, MPI_BYTE, h_rank, MTCORE_AM_AGG_TAG,
+                           win->am_comm, &batch->reqs[0]);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    MTCORE_H_DBG_PRINT(" forwarded AM batch of %d bytes to %d\n", batch->size, h_rank);
+
+    win->agg_batches[h_rank] = NULL;
+    batch->next = win->agg_inflight;
+    win->agg_inflight = batch;
+
+    return mpi_errno;
+}
+
+static void free_batch(MTCORE_H_am_batch * batch)
+{
+    free(batch->buf);
+    free(batch->counts);
+    if (batch->ack)
+        free(batch->ack);
+    if (batch->fops)
+        free(batch->fops);
+    free(batch);
+}
+
+static MTCORE_H_am_fop *add_batch_fop(MTCORE_H_am_batch * batch)
+{
+    if (batch->num_fops == batch->max_fops) {
+        int new_max = max(batch->max_fops * 2, 16);
+        MTCORE_H_am_fop *fops = realloc(batch->fops, sizeof(MTCORE_H_am_fop) * new_max);
+        if (fops == NULL)
+            return NULL;
+        batch->fops = fops;
+        batch->max_fops = new_max;
+    }
+    return &batch->fops[batch->num_fops++];
+}
+
+/* Queued fetch_and_op can be merged into the last entry of batch if both are
+ * MPI_SUM to the same location, no other operation is applied in between. */
+static inline int is_fop_combinable(MTCORE_AM_agg_entry * entry, MTCORE_H_am_batch * batch)
+{
+    MTCORE_AM_agg_entry *last;
+
+    if (batch->last_off < 0 || entry->pkt.type != MTCORE_AM_PKT_FOP ||
+        MTCORE_AM_OPS[entry->pkt.op_idx] != MPI_SUM)
+        return 0;
+
+    last = (MTCORE_AM_agg_entry *) (batch->buf + batch->last_off);
+    return last->pkt.type == MTCORE_AM_PKT_FOP && last->pkt.op_idx == entry->pkt.op_idx &&
+        last->pkt.dtype_idx == entry->pkt.dtype_idx &&
+        last->pkt.target_offset == entry->pkt.target_offset;
+}
+
+/* Add a queued fetch_and_op to batch. It is either merged into the last entry
+ * with its prefix taken from the combined value so far, or appended. */
+static int add_fop_entry(MTCORE_AM_agg_entry * entry, int queue, MTCORE_H_am_batch * batch)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_H_am_fop *fop = NULL;
+    MTCORE_AM_agg_entry *last;
+    int dtsize = get_dtype_size(entry->pkt.dtype_idx);
+    void *data = (char *) entry + sizeof(MTCORE_AM_agg_entry);
+
+    fop = add_batch_fop(batch);
+    if (fop == NULL)
+        return MPI_ERR_NO_MEM;
+    fop->queue = queue;
+    fop->slot = entry->pkt.reply_tag;
+    fop->dtype_idx = entry->pkt.dtype_idx;
+
+    if (is_fop_combinable(entry, batch)) {
+        last = (MTCORE_AM_agg_entry *) (batch->buf + batch->last_off);
+        fop->result_off = batch->fops[batch->num_fops - 2].result_off;
+        fop->has_prefix = 1;
+        memcpy(fop->prefix, (char *) last + sizeof(MTCORE_AM_agg_entry), dtsize);
+        mpi_errno = PMPI_Reduce_local(data, (char *) last + sizeof(MTCORE_AM_agg_entry), 1,
+                                      MTCORE_AM_DTYPES[entry->pkt.dtype_idx], MPI_SUM);
+        return mpi_errno;
+    }
+
+    fop->result_off = batch->ack_size;
+    fop->has_prefix = 0;
+    batch->ack_size += dtsize;
+
+    batch->last_off = batch->size;
+    memcpy(batch->buf + batch->size, entry, entry->size);
+    batch->size += entry->size;
+
+    return mpi_errno;
+}
+
+/* Write results of fetch_and_op in an acknowledged batch to their queues. */
+static int complete_batch_fops(MTCORE_H_am_batch * batch, MTCORE_H_win * win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_H_am_fop *fop;
+    char *result;
+    int i;
+
+    for (i = 0; i < batch->num_fops; i++) {
+        fop = &batch->fops[i];
+        result = win->agg_queues[fop->queue]->fop_results[fop->slot];
+        memcpy(result, batch->ack + fop->result_off, get_dtype_size(fop->dtype_idx));
+        if (fop->has_prefix) {
+            mpi_errno = PMPI_Reduce_local(fop->prefix, result, 1,
+                                          MTCORE_AM_DTYPES[fop->dtype_idx], MPI_SUM);
+            if (mpi_errno != MPI_SUCCESS)
+                return mpi_errno;
+        }
+    }
+
+    if (batch->num_fops > 0)
+        MTCORE_H_DBG_PRINT(" completed %d fetch_and_op in AM batch, %d bytes fetched\n",
+                           batch->num_fops, batch->ack_size);
+    return mpi_errno;
+}
+
+/* Move all queued operations into batches and send them. A batch is sent
+ * once it is full, and partially filled batches are sent at the end, thus
+ * operations are batched as much as they were queued since last poll. */
+static int forward_queues(MTCORE_H_win * win, int *num_handled)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_AM_agg_queue *queue;
+    MTCORE_AM_agg_entry *entry;
+    MTCORE_H_am_batch *batch;
+    unsigned long head, tail;
+    int i, uh_nprocs = 0;
+
+    for (i = 0; i < win->num_agg_queues; i++) {
+        queue = win->agg_queues[i];
+        if (queue == NULL)
+            continue;
+
+        head = MTCORE_Atomic_load(&queue->head);
+        tail = queue->tail;
+        while (tail < head) {
+            entry = (MTCORE_AM_agg_entry *) &queue->buf[tail % MTCORE_AM_AGG_QUEUE_SIZE];
+            tail += entry->size;
+            if (entry->h_rank < 0)
+                continue;
+
+            batch = win->agg_batches[entry->h_rank];
+            if (batch && batch->size + entry->size > MTCORE_AM_AGG_BATCH_SIZE) {
+                mpi_errno = send_batch(entry->h_rank, win);
+                if (mpi_errno != MPI_SUCCESS)
+                    return mpi_errno;
+                batch = NULL;
+            }
+            if (batch == NULL) {
+                batch = calloc(1, sizeof(MTCORE_H_am_batch));
+                if (batch == NULL)
+                    return MPI_ERR_NO_MEM;
+                batch->buf = malloc(MTCORE_AM_AGG_BATCH_SIZE);
+                batch->counts = calloc(win->num_agg_queues, sizeof(unsigned long));
+                if (batch->buf == NULL || batch->counts == NULL) {
+                    free_batch(batch);
+                    return MPI_ERR_NO_MEM;
+                }
+                batch->last_off = -1;
+                win->agg_batches[entry->h_rank] = batch;
+            }
+
+            if (entry->pkt.type == MTCORE_AM_PKT_FOP) {
+                mpi_errno = add_fop_entry(entry, i, batch);
+                if (mpi_errno != MPI_SUCCESS)
+                    return mpi_errno;
+            }
+            else {
+                batch->last_off = batch->size;
+                memcpy(batch->buf + batch->size, entry, entry->size);
+                batch->size += entry->size;
+            }
+            batch->counts[i]++;
+            (*num_handled)++;
+        }
+
+        /* Entries have been copied out, release the space to user. */
+        MTCORE_Atomic_store(&queue->tail, tail);
+    }
+
+    PMPI_Comm_size(win->am_comm, &uh_nprocs);
+    for (i = 0; i < uh_nprocs; i++) {
+        if (win->agg_batches[i] == NULL)
+            continue;
+        mpi_errno = send_batch(i, win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+
+    return mpi_errno;
+}
+
+/* Report operations of acknowledged batches completed to their queues. */
+static int test_batches(MTCORE_H_win * win, int *num_handled)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_H_am_batch **prev = &win->agg_inflight, *batch;
+    int i, flag = 0;
+
+    while (*prev != NULL) {
+        batch = *prev;
+        mpi_errno = PMPI_Testall(2, batch->reqs, &flag, MPI_STATUSES_IGNORE);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        if (!flag) {
+            prev = &batch->next;
+            continue;
+        }
+
+        mpi_errno = complete_batch_fops(batch, win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+
+        /* Only this helper updates the counters, results are visible before */
+        for (i = 0; i < win->num_agg_queues; i++) {
+            if (batch->counts[i] > 0)
+                MTCORE_Atomic_store(&win->agg_queues[i]->completed,
+                                    win->agg_queues[i]->completed + batch->counts[i]);
+        }
+        *prev = batch->next;
+        free_batch(batch);
+        (*num_handled)++;
+    }
+
+    return mpi_errno;
+}
+
+/**
+ * Poll and apply all arrived descriptors of every AM-enabled window, and
+ * forward queued operations if aggregation is enabled. Number of handled
+ * descriptors is returned in num_handled.
+ */
+int MTCORE_H_am_progress(int *num_handled)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MPI_Status status;
+    int i, flag;
+
+    *num_handled = 0;
+    for (i = 0; i < num_am_wins; i++) {
+        MTCORE_H_win *win = am_wins[i];
+
+        while (1) {
+            mpi_errno = PMPI_Iprobe(MPI_ANY_SOURCE, MTCORE_AM_TAG, win->am_comm, &flag, &status);
+            if (mpi_errno != MPI_SUCCESS)
+                return mpi_errno;
+            if (!flag)
+                break;
+
+            mpi_errno = recv_pkt(&status, MTCORE_AM_TAG, win->am_comm);
+            if (mpi_errno != MPI_SUCCESS)
+                return mpi_errno;
+
+            mpi_errno = handle_pkt((MTCORE_AM_pkt *) pkt_buf, status.MPI_SOURCE, NULL, win);
+            if (mpi_errno != MPI_SUCCESS)
+                return mpi_errno;
+            (*num_handled)++;
+        }
+
+        if (win->info_args.rma_transport != MTCORE_RMA_TRANSPORT_AM_AGG)
+            continue;
+
+        while (1) {
+            mpi_errno = PMPI_Iprobe(MPI_ANY_SOURCE, MTCORE_AM_AGG_TAG, win->am_comm, &flag,
+                                    &status);
+            if (mpi_errno != MPI_SUCCESS)
+                return mpi_errno;
+            if (!flag)
+                break;
+
+            mpi_errno = recv_pkt(&status, MTCORE_AM_AGG_TAG, win->am_comm);
+            if (mpi_errno != MPI_SUCCESS)
+                return mpi_errno;
+
+            mpi_errno = handle_batch(&status, win, num_handled);
+            if (mpi_errno != MPI_SUCCESS)
+                return mpi_errno;
+        }
+
+        if (win->agg_batches == NULL)
+            continue;
+
+        mpi_errno = forward_queues(win, num_handled);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        mpi_errno = test_batches(win, num_handled);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+
+        /* Keep polling for acknowledgments, users are waiting for them. */
+        if (win->agg_inflight != NULL && *num_handled == 0)
+            (*num_handled)++;
+    }
+
+    if (num_replies > 0)
+        mpi_errno = test_replies();
+
+    return mpi_errno;
+}
+
+/* Attach queues of local users in the node shared segment. Matched with
+ * init_agg_queue on users. */
+static int init_agg(MTCORE_H_win * win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_AM_agg_queue *queue = NULL;
+    MPI_Aint size = 0;
+    int i, disp_unit = 0, local_rank = 0, uh_nprocs = 0;
+
+    mpi_errno = PMPI_Win_allocate_shared(0, 1, MPI_INFO_NULL, win->local_uh_comm, &queue,
+                                         &win->agg_win);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    PMPI_Comm_size(win->local_uh_comm, &win->num_agg_queues);
+    win->agg_queues = calloc(win->num_agg_queues, sizeof(MTCORE_AM_agg_queue *));
+    if (win->agg_queues == NULL)
+        return MPI_ERR_NO_MEM;
+
+    for (i = 0; i < win->num_agg_queues; i++) {
+        mpi_errno = PMPI_Win_shared_query(win->agg_win, i, &size, &disp_unit, &queue);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        if (size > 0)
+            win->agg_queues[i] = queue;
+    }
+
+    PMPI_Comm_rank(MTCORE_COMM_LOCAL, &local_rank);
+    if (local_rank == 0) {
+        PMPI_Comm_size(win->uh_comm, &uh_nprocs);
+        win->agg_batches = calloc(uh_nprocs, sizeof(MTCORE_H_am_batch *));
+        if (win->agg_batches == NULL)
+            return MPI_ERR_NO_MEM;
+    }
+
+    /* Queues are initialized by users before the barrier */
+    mpi_errno = PMPI_Barrier(win->local_uh_comm);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    MTCORE_H_DBG_PRINT(" Created AM aggregation queues, forwarding %d\n", local_rank == 0);
+    return mpi_errno;
+}
+
+static int destroy_agg(MTCORE_H_win * win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_H_am_batch *batch;
+
+    /* All batches have been acknowledged since users completed all
+     * operations, only wait for local completion of the last ones. */
+    while (win->agg_inflight) {
+        batch = win->agg_inflight;
+        mpi_errno = PMPI_Waitall(2, batch->reqs, MPI_STATUSES_IGNORE);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        win->agg_inflight = batch->next;
+        free_batch(batch);
+    }
+
+    if (win->agg_batches) {
+        free(win->agg_batches);
+        win->agg_batches = NULL;
+    }
+    if (win->agg_queues) {
+        free(win->agg_queues);
+        win->agg_queues = NULL;
+    }
+    if (win->agg_win != MPI_WIN_NULL)
+        mpi_errno = PMPI_Win_free(&win->agg_win);
+
+    return mpi_errno;
+}
+
+/**
+ * Create AM transport of the window, matched with MTCORE_AM_win_init on users.
+ */
+int MTCORE_H_am_win_init(MTCORE_H_win * win)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    mpi_errno = PMPI_Comm_dup(win->uh_comm, &win->am_comm);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    win->agg_win = MPI_WIN_NULL;
+    if (win->info_args.rma_transport == MTCORE_RMA_TRANSPORT_AM_AGG) {
+        mpi_errno = init_agg(win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+
+    if (num_am_wins == max_am_wins) {
+        int new_max = max(max_am_wins * 2, 4);
+        MTCORE_H_win **wins = realloc(am_wins, sizeof(MTCORE_H_win *) * new_max);
+        if (wins == NULL)
+            return MPI_ERR_NO_MEM;
+        am_wins = wins;
+        max_am_wins = new_max;
+    }
+    am_wins[num_am_wins++] = win;
+
+    MTCORE_H_DBG_PRINT(" Created AM transport comm 0x%x\n", win->am_comm);
+    return mpi_errno;
+}
+
+int MTCORE_H_am_win_destroy(MTCORE_H_win * win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int i, j;
+
+    if (win->info_args.rma_transport == MTCORE_RMA_TRANSPORT_RMA)
+        return mpi_errno;
+
+    for (i = 0; i < num_am_wins; i++) {
+        if (am_wins[i] == win) {
+            for (j = i; j < num_am_wins - 1; j++)
+                am_wins[j] = am_wins[j + 1];
+            num_am_wins--;
+            break;
+        }
+    }
+
+    /* Replies may still refer to shared segment of this window */
+    if (num_replies > 0) {
+        mpi_errno = PMPI_Waitall(num_replies, reply_reqs, MPI_STATUSES_IGNORE);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        for (i = 0; i < num_replies; i++) {
+            if (reply_bufs[i])
+                free(reply_bufs[i]);
+        }
+        num_replies = 0;
+    }
+
+    if (win->info_args.rma_transport == MTCORE_RMA_TRANSPORT_AM_AGG) {
+        mpi_errno = destroy_agg(win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+
+    mpi_errno = PMPI_Comm_free(&win->am_comm);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    if (num_am_wins == 0) {
+        free(am_wins);
+        am_wins = NULL;
+        max_am_wins = 0;
+        free(reply_reqs);
+        free(reply_bufs);
+        reply_reqs = NULL;
+        reply_bufs = NULL;
+        max_replies = 0;
+        free(pkt_buf);
+        pkt_buf = NULL;
+        pkt_buf_size = 0;
+    }
+
+    return mpi_errno;
+}
@@ -39,7 +39,7 @@ static int create_uh_comm(int user_nprocs, int *user_ranks_in_world, int num_hel
 
     /* -Create uh communicator. */
     PMPI_Group_incl(MTCORE_GROUP_WORLD, num_uh_ranks, uh_ranks_in_world, &uh_group);
-    mpi_errno = PMPI_Comm_create_group(MPI_COMM_WORLD, uh_group, 0, &win->uh_comm);
+    mpi_errno = PMPI_Comm_create_group(MPI_COMM_WORLD, uh_group, win->req_id, &win->uh_comm);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
 
@@ -59,28 +59,15 @@ static int create_uh_comm(int user_nprocs, int *user_ranks_in_world, int num_hel
     goto fn_exit;
 }
 
-static int create_communicators(int user_nprocs, int user_local_nprocs, MTCORE_H_win * win)
+static int create_communicators(int user_nprocs, int user_local_nprocs,
+                                MTCORE_Func_win_allocate_param * param, MTCORE_H_win * win)
 {
     int mpi_errno = MPI_SUCCESS;
-    int *func_params = NULL, func_param_size = 0;
     int is_user_world;
     int *user_ranks_in_world = NULL;
     int *helper_ranks_in_world = NULL, num_helpers = 0, max_num_helpers;
 
-    user_ranks_in_world = calloc(user_nprocs, sizeof(int));
-    max_num_helpers = MTCORE_ENV.num_h * MTCORE_NUM_NODES;
-    helper_ranks_in_world = calloc(max_num_helpers, sizeof(int));
-    func_param_size = user_nprocs + max_num_helpers + 2;
-    func_params = calloc(func_param_size, sizeof(int));
-
-    mpi_errno = MTCORE_H_func_get_param((char *) func_params, sizeof(int) * func_param_size,
-                                        win->ur_h_comm);
-    if (mpi_errno != MPI_SUCCESS)
-        goto fn_fail;
-
-    /* Get parameters from local User_root
-     *  [0]: is_comm_user_world */
-    is_user_world = func_params[0];
+    is_user_world = param->is_user_world;
 
     if (is_user_world) {
         MTCORE_H_DBG_PRINT(" Received parameters: is_user_world %d\n", is_user_world);
@@ -94,15 +81,14 @@ static int create_communicators(int user_nprocs, int user_local_nprocs, MTCORE_H
     }
     else {
 
-        /*  [2:N+1]: user ranks in comm_world
-         *  [N+2:]: helper ranks in comm_world
-         */
-        int pidx;
-        num_helpers = func_params[1];
-        pidx = 2;
-        memcpy(user_ranks_in_world, &func_params[pidx], sizeof(int) * user_nprocs);
-        pidx += user_nprocs;
-        memcpy(helper_ranks_in_world, &func_params[pidx], sizeof(int) * num_helpers);
+        /* User ranks in comm_world follow the parameters, helper ranks are
+         * derived from them in the same order as user processes. */
+        MTCORE_H_assert(param->num_user_ranks == user_nprocs);
+        user_ranks_in_world = (int *) (param + 1);
+        max_num_helpers = MTCORE_ENV.num_h * MTCORE_NUM_NODES;
+        helper_ranks_in_world = calloc(max_num_helpers, sizeof(int));
+        num_helpers = MTCORE_Func_get_helper_ranks(user_nprocs, user_ranks_in_world,
+                                                   helper_ranks_in_world);
 
         MTCORE_H_DBG_PRINT(" Received parameters: is_user_world %d, num_helpers %d\n",
                            is_user_world, num_helpers);
@@ -140,10 +126,6 @@ static int create_communicators(int user_nprocs, int user_local_nprocs, MTCORE_H
     }
 
   fn_exit:
-    if (func_params)
-        free(func_params);
-    if (user_ranks_in_world)
-        free(user_ranks_in_world);
     if (helper_ranks_in_world)
         free(helper_ranks_in_world);
     return mpi_errno;
@@ -177,6 +159,21 @@ static int create_lock_windows(MPI_Aint size, MTCORE_H_win * win)
         MTCORE_H_DBG_PRINT(" Created uh windows[%d] 0x%x\n", i, win->uh_wins[i]);
     }
 
+    /* Duplicate the single lock_all window for per-thread endpoints of users,
+     * only in lock_all only epoch (see user side). */
+    if (win->info_args.num_thread_eps > 1 && win->num_uh_wins == 1 &&
+        !(win->info_args.epoch_type & MTCORE_EPOCH_LOCK)) {
+        win->ep_uh_wins = calloc(win->info_args.num_thread_eps, sizeof(MPI_Win));
+        win->ep_uh_wins[0] = win->uh_wins[0];
+        for (i = 1; i < win->info_args.num_thread_eps; i++) {
+            mpi_errno = PMPI_Win_create(win->base, size, 1, MPI_INFO_NULL,
+                                        win->uh_comm, &win->ep_uh_wins[i]);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
+        MTCORE_H_DBG_PRINT(" Created %d endpoint uh windows\n", win->info_args.num_thread_eps);
+    }
+
   fn_exit:
     return mpi_errno;
 
@@ -185,7 +182,8 @@ static int create_lock_windows(MPI_Aint size, MTCORE_H_win * win)
 }
 
 
-int MTCORE_H_win_allocate(int user_local_root, int user_nprocs, int user_local_nprocs)
+int MTCORE_H_win_allocate(int user_local_root, int user_nprocs, int user_local_nprocs,
+                          int req_id, int comm_key, MTCORE_Func_win_allocate_param * param)
 {
     int mpi_errno = MPI_SUCCESS;
     MPI_Status status;
@@ -197,20 +195,34 @@ int MTCORE_H_win_allocate(int user_local_root, int user_nprocs, int user_local_n
     void **user_bases = NULL;
     int i;
     int mtcore_buf_size = MTCORE_HELPER_SHARED_SG_SIZE;
+    MTCORE_H_comm_cache *comm_cache = NULL;
 
     win = calloc(1, sizeof(MTCORE_H_win));
+    win->req_id = req_id;
 
-    /* Create user root + helpers communicator for
-     * internal information exchange between users and helpers. */
-    mpi_errno = MTCORE_H_func_new_ur_h_comm(user_local_root, &win->ur_h_comm);
-    if (mpi_errno != MPI_SUCCESS)
-        goto fn_fail;
+    if (comm_key != MTCORE_COMM_CACHE_NONE)
+        comm_cache = MTCORE_H_comm_cache_get(comm_key);
 
-    /* Create communicators
-     *  uh_comm: including all USER and Helper processes
-     *  local_uh_comm: including local USER and Helper processes
-     */
-    create_communicators(user_nprocs, user_local_nprocs, win);
+    if (comm_cache) {
+        /* Reuse communicators of previous windows on the same user group. */
+        win->uh_comm = comm_cache->uh_comm;
+        win->local_uh_comm = comm_cache->local_uh_comm;
+        win->comm_cached = 1;
+    }
+    else {
+        /* Create communicators
+         *  uh_comm: including all USER and Helper processes
+         *  local_uh_comm: including local USER and Helper processes
+         */
+        mpi_errno = create_communicators(user_nprocs, user_local_nprocs, param, win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        if (comm_key != MTCORE_COMM_CACHE_NONE) {
+            MTCORE_H_comm_cache_add(comm_key, win);
+            win->comm_cached = 1;
+        }
+    }
 
     PMPI_Comm_rank(win->local_uh_comm, &local_uh_rank);
     PMPI_Comm_size(win->local_uh_comm, &local_uh_nprocs);
@@ -230,8 +242,8 @@ int MTCORE_H_win_allocate(int user_local_root, int user_nprocs, int user_local_n
 
     /* -Allocate shared window in CHAR type
      * (No local buffer, only need shared buffer on user processes) */
-    mpi_errno = PMPI_Win_allocate_shared(mtcore_buf_size, 1, MPI_INFO_NULL,
-                                         win->local_uh_comm, &win->base, &win->local_uh_win);
+    mpi_errno = MTCORE_Shm_seg_allocate(mtcore_buf_size, 1, MPI_INFO_NULL, win->local_uh_comm,
+                                        -1, &win->base, &win->local_uh_win, &win->shm_seg);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
     MTCORE_H_DBG_PRINT(" Created local_uh_win, base=%p, size=%d\n", win->base, mtcore_buf_size);
@@ -241,8 +253,8 @@ int MTCORE_H_win_allocate(int user_local_root, int user_nprocs, int user_local_n
     win->user_base_addrs_in_local = calloc(local_uh_nprocs, sizeof(MPI_Aint));
 
     for (dst = 0; dst < local_uh_nprocs; dst++) {
-        mpi_errno = PMPI_Win_shared_query(win->local_uh_win, dst, &r_size,
-                                          &r_disp_unit, &user_bases[dst]);
+        mpi_errno = MTCORE_Shm_seg_query(win->local_uh_win, win->shm_seg, dst, &r_size,
+                                         &r_disp_unit, &user_bases[dst]);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
 
@@ -268,14 +280,14 @@ int MTCORE_H_win_allocate(int user_local_root, int user_nprocs, int user_local_n
      * User processes in different nodes can share a window.
      *  i.e., win[x] can be shared by processes whose local rank is x.
      */
-    int func_params[2];
-    mpi_errno = MTCORE_H_func_get_param((char *) func_params, sizeof(func_params), win->ur_h_comm);
-    if (mpi_errno != MPI_SUCCESS)
-        goto fn_fail;
-    win->max_local_user_nprocs = func_params[0];
-    win->info_args.epoch_type = func_params[1];
-    MTCORE_H_DBG_PRINT(" Received parameters: max_local_user_nprocs = %d, epoch_type=%d\n",
-                       win->max_local_user_nprocs, win->info_args.epoch_type);
+    win->max_local_user_nprocs = param->max_local_user_nprocs;
+    win->info_args.epoch_type = param->epoch_type;
+    win->info_args.num_thread_eps = param->num_thread_eps;
+    win->info_args.rma_transport = param->rma_transport;
+    MTCORE_H_DBG_PRINT(" Received parameters: max_local_user_nprocs = %d, epoch_type=%d, "
+                       "num_thread_eps=%d, rma_transport=%d\n", win->max_local_user_nprocs,
+                       win->info_args.epoch_type, win->info_args.num_thread_eps,
+                       win->info_args.rma_transport);
 
     /* - Create lock/lockall windows */
     if ((win->info_args.epoch_type & MTCORE_EPOCH_LOCK) ||
@@ -294,14 +306,41 @@ int MTCORE_H_win_allocate(int user_local_root, int user_nprocs, int user_local_n
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
         MTCORE_H_DBG_PRINT(" Created active windows 0x%x\n", win->active_win);
+
+        if (win->info_args.num_thread_eps > 1) {
+            win->ep_active_wins = calloc(win->info_args.num_thread_eps, sizeof(MPI_Win));
+            win->ep_active_wins[0] = win->active_win;
+            for (i = 1; i < win->info_args.num_thread_eps; i++) {
+                mpi_errno = PMPI_Win_create(win->base, size, 1, MPI_INFO_NULL, win->uh_comm,
+                                            &win->ep_active_wins[i]);
+                if (mpi_errno != MPI_SUCCESS)
+                    goto fn_fail;
+            }
+            MTCORE_H_DBG_PRINT(" Created %d endpoint active windows\n",
+                               win->info_args.num_thread_eps);
+        }
+    }
+
+    /* - Create active-message transport */
+    if (win->info_args.rma_transport != MTCORE_RMA_TRANSPORT_RMA) {
+        mpi_errno = MTCORE_H_am_win_init(win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
+
+    /* - Create communicator of window collectives among root helpers */
+    win->coll_comm = MPI_COMM_NULL;
+    if (MTCORE_ENV.coll_offload && MTCORE_H_p2p_is_active()) {
+        mpi_errno = MTCORE_H_coll_win_init(win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
     }
 
     win->mtcore_h_win_handle = (unsigned long) win;
 
-    /* Notify user root the handle of helper win. User root is always rank num_h in
-     * user root + helpers communicator */
-    mpi_errno = PMPI_Gather(&win->mtcore_h_win_handle, 1, MPI_UNSIGNED_LONG, NULL,
-                            0, MPI_UNSIGNED_LONG, MTCORE_ENV.num_h, win->ur_h_comm);
+    /* Notify user root the handle of helper win. */
+    mpi_errno = MTCORE_H_func_reply(&win->mtcore_h_win_handle, sizeof(unsigned long),
+                                    user_local_root, req_id);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
     MTCORE_H_DBG_PRINT(" Define mtcore_h_win_handle=0x%lx\n", win->mtcore_h_win_handle);
@@ -321,6 +360,10 @@ int MTCORE_H_win_allocate(int user_local_root, int user_nprocs, int user_local_n
         free(win->user_base_addrs_in_local);
     if (win->uh_wins)
         free(win->uh_wins);
+    if (win->ep_uh_wins)
+        free(win->ep_uh_wins);
+    if (win->ep_active_wins)
+        free(win->ep_active_wins);
     if (win)
         free(win);
 
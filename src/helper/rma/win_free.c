@@ -5,21 +5,20 @@
 #undef FUNCNAME
 #define FUNCNAME MTCORE_H_win_free
 
-int MTCORE_H_win_free(int user_local_root, int user_nprocs, int user_local_nprocs)
+int MTCORE_H_win_free(int user_local_root, int user_nprocs, int user_local_nprocs,
+                      unsigned long *h_win_handles)
 {
     int mpi_errno = MPI_SUCCESS;
     int dst;
     int uh_nprocs, uh_rank;
     MTCORE_H_win *win;
     unsigned long mtcore_h_win_handle = 0UL;
-    MPI_Status stat;
+    int local_helper_rank = 0;
     int i;
 
-    /* Receive the handle of helper win. */
-    mpi_errno = PMPI_Recv(&mtcore_h_win_handle, 1, MPI_UNSIGNED_LONG,
-                          user_local_root, 0, MTCORE_COMM_LOCAL, &stat);
-    if (mpi_errno != 0)
-        goto fn_fail;
+    /* The handle of my helper win is received in the start message. */
+    PMPI_Comm_rank(MTCORE_COMM_HELPER_LOCAL, &local_helper_rank);
+    mtcore_h_win_handle = h_win_handles[local_helper_rank];
     MTCORE_H_DBG_PRINT(" Received window handler 0x%lx\n", mtcore_h_win_handle);
 
     win = (MTCORE_H_win *) mtcore_h_win_handle;
@@ -37,6 +36,17 @@ int MTCORE_H_win_free(int user_local_root, int user_nprocs, int user_local_nproc
     /* Release MTCORE resources if there is a corresponding MTCORE-window */
     if (win > 0) {
 
+        /* Stop polling active messages, all operations have been completed
+         * in the last epoch. */
+        mpi_errno = MTCORE_H_am_win_destroy(win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        /* All collectives have been completed before free. */
+        mpi_errno = MTCORE_H_coll_win_destroy(win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
         /* Free uh_win before local_uh_win, because all the incoming operations
          * should be done before free shared buffers.
          *
@@ -55,6 +65,24 @@ int MTCORE_H_win_free(int user_local_root, int user_nprocs, int user_local_nproc
             }
         }
 
+        if (win->ep_uh_wins) {
+            MTCORE_H_DBG_PRINT(" free endpoint uh windows\n");
+            for (i = 1; i < win->info_args.num_thread_eps; i++) {
+                mpi_errno = PMPI_Win_free(&win->ep_uh_wins[i]);
+                if (mpi_errno != MPI_SUCCESS)
+                    goto fn_fail;
+            }
+        }
+
+        if (win->ep_active_wins) {
+            MTCORE_H_DBG_PRINT(" free endpoint active windows\n");
+            for (i = 1; i < win->info_args.num_thread_eps; i++) {
+                mpi_errno = PMPI_Win_free(&win->ep_active_wins[i]);
+                if (mpi_errno != MPI_SUCCESS)
+                    goto fn_fail;
+            }
+        }
+
         if (win->active_win) {
             MTCORE_H_DBG_PRINT(" free active window\n");
             mpi_errno = PMPI_Win_free(&win->active_win);
@@ -64,36 +92,36 @@ int MTCORE_H_win_free(int user_local_root, int user_nprocs, int user_local_nproc
 
         if (win->local_uh_win) {
             MTCORE_H_DBG_PRINT(" free shared window\n");
-            mpi_errno = PMPI_Win_free(&win->local_uh_win);
-            if (mpi_errno != MPI_SUCCESS)
-                goto fn_fail;
-        }
-
-        if (win->ur_h_comm && win->ur_h_comm != MPI_COMM_NULL) {
-            MTCORE_H_DBG_PRINT(" free user root + helpers communicator\n");
-            mpi_errno = PMPI_Comm_free(&win->ur_h_comm);
+            mpi_errno = MTCORE_Shm_seg_free(&win->local_uh_win, &win->shm_seg);
             if (mpi_errno != MPI_SUCCESS)
                 goto fn_fail;
         }
 
-        if (win->local_uh_comm && win->local_uh_comm != MTCORE_COMM_LOCAL) {
-            MTCORE_H_DBG_PRINT(" free shared communicator\n");
-            mpi_errno = PMPI_Comm_free(&win->local_uh_comm);
-            if (mpi_errno != MPI_SUCCESS)
-                goto fn_fail;
-        }
+        /* Cached communicators are freed when user root releases the cache. */
+        if (!win->comm_cached) {
+            if (win->local_uh_comm && win->local_uh_comm != MTCORE_COMM_LOCAL) {
+                MTCORE_H_DBG_PRINT(" free shared communicator\n");
+                mpi_errno = PMPI_Comm_free(&win->local_uh_comm);
+                if (mpi_errno != MPI_SUCCESS)
+                    goto fn_fail;
+            }
 
-        if (win->uh_comm && win->uh_comm != MPI_COMM_WORLD) {
-            MTCORE_H_DBG_PRINT(" free uh communicator\n");
-            mpi_errno = PMPI_Comm_free(&win->uh_comm);
-            if (mpi_errno != MPI_SUCCESS)
-                goto fn_fail;
+            if (win->uh_comm && win->uh_comm != MPI_COMM_WORLD) {
+                MTCORE_H_DBG_PRINT(" free uh communicator\n");
+                mpi_errno = PMPI_Comm_free(&win->uh_comm);
+                if (mpi_errno != MPI_SUCCESS)
+                    goto fn_fail;
+            }
         }
 
         if (win->user_base_addrs_in_local)
             free(win->user_base_addrs_in_local);
         if (win->uh_wins)
             free(win->uh_wins);
+        if (win->ep_uh_wins)
+            free(win->ep_uh_wins);
+        if (win->ep_active_wins)
+            free(win->ep_active_wins);
 
         free(win);
 
@@ -0,0 +1,258 @@
+/*
+ * comm_cache.c
+ *  <FILE_DESC>
+ *
+ *  Cache of internal communicators derived from a user communicator in
+ *  win_allocate (local user, user root, users + helpers and local users +
+ *  helpers communicators). Windows allocated on any
+ *  communicator with the same group (i.e., congruent communicators) reuse the
+ *  cached communicators instead of creating new ones on both users and helpers.
+ *
+ *  A cache is referred by the windows using it and by the user communicators
+ *  it was looked up from (through an attribute). It is released when all the
+ *  windows and user communicators are freed, or at finalize.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "mtcore.h"
+
+static MTCORE_Comm_cache *comm_cache_list = NULL;
+static pthread_mutex_t comm_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static int comm_cache_keyval = MPI_KEYVAL_INVALID;
+static int comm_cache_destroyed = 0;
+static int comm_cache_seq = 0;
+
+static void free_cache(MTCORE_Comm_cache * cache)
+{
+    if (cache->local_uh_comm != MPI_COMM_NULL)
+        PMPI_Comm_free(&cache->local_uh_comm);
+    if (cache->local_uh_group != MPI_GROUP_NULL)
+        PMPI_Group_free(&cache->local_uh_group);
+    if (cache->uh_comm != MPI_COMM_NULL)
+        PMPI_Comm_free(&cache->uh_comm);
+    if (cache->uh_group != MPI_GROUP_NULL)
+        PMPI_Group_free(&cache->uh_group);
+    if (cache->local_user_comm != MPI_COMM_NULL)
+        PMPI_Comm_free(&cache->local_user_comm);
+    if (cache->user_root_comm != MPI_COMM_NULL)
+        PMPI_Comm_free(&cache->user_root_comm);
+    if (cache->user_group != MPI_GROUP_NULL)
+        PMPI_Group_free(&cache->user_group);
+    free(cache);
+}
+
+static int comm_cache_delete_fn(MPI_Comm comm, int keyval, void *attribute_val,
+                                void *extra_state)
+{
+    /* All caches have been freed at finalize. */
+    if (comm_cache_destroyed)
+        return MPI_SUCCESS;
+
+    MTCORE_DBG_PRINT("release communicator cache %p from freed comm\n", attribute_val);
+    return MTCORE_Comm_cache_release((MTCORE_Comm_cache *) attribute_val);
+}
+
+/* Refer the cache from user communicator, so that it is kept until the
+ * communicator is freed. */
+static int attach_to_comm(MPI_Comm user_comm, MTCORE_Comm_cache * cache)
+{
+    int flag = 0;
+    void *val = NULL;
+
+    PMPI_Comm_get_attr(user_comm, comm_cache_keyval, &val, &flag);
+    if (flag)
+        return MPI_SUCCESS;
+
+    pthread_mutex_lock(&comm_cache_lock);
+    cache->ref_count++;
+    pthread_mutex_unlock(&comm_cache_lock);
+
+    return PMPI_Comm_set_attr(user_comm, comm_cache_keyval, cache);
+}
+
+/* Find the cache attached to user communicator, or any cache with the same
+ * group. Must be called with lock held. */
+static MTCORE_Comm_cache *lookup_cache(MPI_Comm user_comm)
+{
+    MTCORE_Comm_cache *cache = NULL;
+    MPI_Group group = MPI_GROUP_NULL;
+    int flag = 0, result = MPI_UNEQUAL;
+    void *val = NULL;
+
+    if (comm_cache_keyval == MPI_KEYVAL_INVALID)
+        return NULL;
+
+    PMPI_Comm_get_attr(user_comm, comm_cache_keyval, &val, &flag);
+    if (flag)
+        return (MTCORE_Comm_cache *) val;
+
+    PMPI_Comm_group(user_comm, &group);
+    for (cache = comm_cache_list; cache != NULL; cache = cache->next) {
+        PMPI_Group_compare(group, cache->user_group, &result);
+        if (result == MPI_IDENT)
+            break;
+    }
+    PMPI_Group_free(&group);
+
+    return cache;
+}
+
+/**
+ * Collectively look up the cached communicators for a new window on user
+ * communicator. *cache is set to NULL if any process does not find the same
+ * cache, otherwise it is referred by the new window.
+ */
+int MTCORE_Comm_cache_get(MPI_Comm user_comm, MTCORE_Comm_cache ** cache_ptr)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Comm_cache *cache = NULL;
+    int keys[2], max_keys[2];
+
+    *cache_ptr = NULL;
+
+    pthread_mutex_lock(&comm_cache_lock);
+    cache = lookup_cache(user_comm);
+    if (cache)
+        cache->ref_count++;
+    pthread_mutex_unlock(&comm_cache_lock);
+
+    /* Reuse only if all processes find the same key. */
+    keys[0] = cache ? cache->key : MTCORE_COMM_CACHE_NONE;
+    keys[1] = -keys[0];
+    mpi_errno = PMPI_Allreduce(keys, max_keys, 2, MPI_INT, MPI_MAX, user_comm);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    if (cache == NULL)
+        goto fn_exit;
+
+    if (max_keys[0] != -max_keys[1]) {
+        MTCORE_DBG_PRINT("communicator cache %d is not found on all processes\n", cache->key);
+        mpi_errno = MTCORE_Comm_cache_release(cache);
+        goto fn_exit;
+    }
+
+    mpi_errno = attach_to_comm(user_comm, cache);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    *cache_ptr = cache;
+    MTCORE_DBG_PRINT("reuse communicator cache %d, ref_count %d\n", cache->key,
+                     cache->ref_count);
+
+  fn_exit:
+    return mpi_errno;
+
+  fn_fail:
+    if (cache)
+        MTCORE_Comm_cache_release(cache);
+    goto fn_exit;
+}
+
+/**
+ * Generate a new cache key, which is unique in the world because it is
+ * interleaved by world rank. Only user rank 0 of the communicator generates it.
+ */
+int MTCORE_Comm_cache_new_key(void)
+{
+    int seq, world_nprocs;
+
+    seq = MTCORE_Atomic_fetch_add(&comm_cache_seq, 1);
+    PMPI_Comm_size(MPI_COMM_WORLD, &world_nprocs);
+
+    return seq * world_nprocs + MTCORE_MY_RANK_IN_WORLD;
+}
+
+/**
+ * Cache the internal communicators created for a window with the key, the window
+ * refers the new cache thereafter.
+ */
+int MTCORE_Comm_cache_add(MTCORE_Win * uh_win, int key)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Comm_cache *cache = NULL;
+
+    cache = calloc(1, sizeof(MTCORE_Comm_cache));
+    cache->key = key;
+    cache->ref_count = 1;
+    PMPI_Comm_group(uh_win->user_comm, &cache->user_group);
+
+    cache->local_user_comm = uh_win->local_user_comm;
+    cache->user_root_comm = uh_win->user_root_comm;
+    cache->node_id = uh_win->node_id;
+    cache->num_nodes = uh_win->num_nodes;
+    cache->uh_comm = uh_win->uh_comm;
+    cache->uh_group = uh_win->uh_group;
+    cache->local_uh_comm = uh_win->local_uh_comm;
+    cache->local_uh_group = uh_win->local_uh_group;
+
+    pthread_mutex_lock(&comm_cache_lock);
+    if (comm_cache_keyval == MPI_KEYVAL_INVALID) {
+        mpi_errno = PMPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, comm_cache_delete_fn,
+                                            &comm_cache_keyval, NULL);
+        if (mpi_errno != MPI_SUCCESS) {
+            pthread_mutex_unlock(&comm_cache_lock);
+            free(cache);
+            return mpi_errno;
+        }
+    }
+    cache->next = comm_cache_list;
+    comm_cache_list = cache;
+    pthread_mutex_unlock(&comm_cache_lock);
+
+    uh_win->comm_cache = cache;
+    MTCORE_DBG_PRINT("add communicator cache %d\n", cache->key);
+
+    return attach_to_comm(uh_win->user_comm, cache);
+}
+
+/**
+ * Drop a reference of the cache. The last reference frees the communicators,
+ * and the user root asks local helpers to free theirs.
+ */
+int MTCORE_Comm_cache_release(MTCORE_Comm_cache * cache)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Comm_cache **prev;
+    int user_local_rank = -1;
+
+    pthread_mutex_lock(&comm_cache_lock);
+    if (--cache->ref_count > 0) {
+        pthread_mutex_unlock(&comm_cache_lock);
+        return MPI_SUCCESS;
+    }
+    for (prev = &comm_cache_list; *prev != cache; prev = &(*prev)->next);
+    *prev = cache->next;
+    pthread_mutex_unlock(&comm_cache_lock);
+
+    MTCORE_DBG_PRINT("free communicator cache %d\n", cache->key);
+    PMPI_Comm_rank(cache->local_user_comm, &user_local_rank);
+    if (user_local_rank == 0) {
+        mpi_errno = MTCORE_Func_start(MTCORE_FUNC_COMM_RELEASE, 0, 0, cache->key, cache->key,
+                                      NULL, 0);
+    }
+    free_cache(cache);
+
+    return mpi_errno;
+}
+
+/* Free all caches at finalize, helpers free theirs in finalize as well. */
+void MTCORE_Comm_cache_destroy(void)
+{
+    MTCORE_Comm_cache *cache;
+
+    pthread_mutex_lock(&comm_cache_lock);
+    comm_cache_destroyed = 1;
+    while (comm_cache_list) {
+        cache = comm_cache_list;
+        comm_cache_list = cache->next;
+        free_cache(cache);
+    }
+    if (comm_cache_keyval != MPI_KEYVAL_INVALID)
+        PMPI_Comm_free_keyval(&comm_cache_keyval);
+    pthread_mutex_unlock(&comm_cache_lock);
+}
@@ -9,75 +9,131 @@
 #include <stdlib.h>
 #include "mtcore.h"
 
+static int func_req_seq = 0;
+
 /**
- * The root process in current local user communicator ask helpers to start a new
- * function. A user root + helpers communicator will be created for later information
- * exchanges.
+ * Generate a new request id for a control-plane function. The id is unique in
+ * the world as long as each process has at most MTCORE_FUNC_MAX_REQS requests in
+ * flight, because it is interleaved by world rank.
  */
-int MTCORE_Func_start(MTCORE_Func FUNC, int user_nprocs, int user_local_nprocs)
+int MTCORE_Func_new_req_id(void)
 {
-    int mpi_errno = MPI_SUCCESS;
-    MTCORE_Func_info info;
+    int seq, world_nprocs, flag = 0;
+    int *tag_ub = NULL;
+    long req_id;
 
-    info.FUNC = FUNC;
-    info.user_nprocs = user_nprocs;
-    info.user_local_nprocs = user_local_nprocs;
+    seq = MTCORE_Atomic_fetch_add(&func_req_seq, 1) % MTCORE_FUNC_MAX_REQS;
+    PMPI_Comm_size(MPI_COMM_WORLD, &world_nprocs);
 
-    MTCORE_DBG_PRINT("[%d] send Func start request to helper local %d\n",
-                     MTCORE_MY_RANK_IN_WORLD, MTCORE_H_RANKS_IN_LOCAL[0]);
-    /* Only send start request to root helper. */
-    mpi_errno = PMPI_Send((char *) &info, sizeof(MTCORE_Func_info), MPI_CHAR,
-                          MTCORE_H_RANKS_IN_LOCAL[0], MTCORE_FUNC_TAG, MTCORE_COMM_LOCAL);
-    return mpi_errno;
+    req_id = (long) seq * world_nprocs + MTCORE_MY_RANK_IN_WORLD;
+    PMPI_Comm_get_attr(MPI_COMM_WORLD, MPI_TAG_UB, &tag_ub, &flag);
+    if (flag && req_id > *tag_ub)
+        req_id %= (long) (*tag_ub) + 1;
+
+    return (int) req_id;
 }
 
+/* Enqueue the start message into the command ring. Parameters that do not fit
+ * in a slot are sent to root helper after the header, tagged by request id. */
+static int start_by_cmd_ring(char *buf, int size, int req_id)
+{
+    int local_rank = 0;
 
-int MTCORE_Func_new_ur_h_comm(MPI_Comm * ur_h_comm)
+    PMPI_Comm_rank(MTCORE_COMM_LOCAL, &local_rank);
+    if (size <= MTCORE_CMD_RING_SLOT_SIZE) {
+        MTCORE_Cmd_ring_enqueue(MTCORE_CMD_RING, local_rank, buf, size);
+        return MPI_SUCCESS;
+    }
+
+    MTCORE_Cmd_ring_enqueue(MTCORE_CMD_RING, local_rank, buf, sizeof(MTCORE_Func_info));
+    return PMPI_Send(buf + sizeof(MTCORE_Func_info), size - sizeof(MTCORE_Func_info), MPI_CHAR,
+                     MTCORE_H_RANKS_IN_LOCAL[0], req_id, MTCORE_COMM_LOCAL);
+}
+
+/**
+ * The root process in current local user communicator ask helpers to start a new
+ * function. The header and parameters of the function are packed in a single
+ * message, which is only sent to the root helper.
+ */
+int MTCORE_Func_start(MTCORE_Func FUNC, int user_nprocs, int user_local_nprocs, int req_id,
+                      int comm_key, const void *params, int param_size)
 {
     int mpi_errno = MPI_SUCCESS;
-    int local_rank;
-    int *ur_h_ranks_in_local = NULL;
-    MPI_Group ur_h_group = MPI_GROUP_NULL;
-    int i;
+    MTCORE_Func_info *info = NULL;
+    char *buf = NULL;
 
-    PMPI_Comm_rank(MTCORE_COMM_LOCAL, &local_rank);
+    buf = malloc(sizeof(MTCORE_Func_info) + param_size);
+    info = (MTCORE_Func_info *) buf;
+    info->version = MTCORE_FUNC_VERSION;
+    info->FUNC = FUNC;
+    info->user_nprocs = user_nprocs;
+    info->user_local_nprocs = user_local_nprocs;
+    info->req_id = req_id;
+    info->comm_key = comm_key;
+    info->param_size = param_size;
+    if (param_size > 0)
+        memcpy(buf + sizeof(MTCORE_Func_info), params, param_size);
 
-    /* Create a user root + all helpers communicator for later information exchanges. */
-    ur_h_ranks_in_local = calloc(sizeof(int), MTCORE_ENV.num_h + 1);
-    /* Helpers' rank are always start from 0 */
-    for (i = 0; i < MTCORE_ENV.num_h; i++)
-        ur_h_ranks_in_local[i] = i;
-    ur_h_ranks_in_local[MTCORE_ENV.num_h] = local_rank;
-
-    PMPI_Group_incl(MTCORE_GROUP_LOCAL, MTCORE_ENV.num_h + 1, ur_h_ranks_in_local, &ur_h_group);
-    mpi_errno = PMPI_Comm_create_group(MTCORE_COMM_LOCAL, ur_h_group, 0, ur_h_comm);
-    if (mpi_errno != MPI_SUCCESS)
-        goto fn_fail;
-
-#ifdef DEBUG
-    int ur_h_rank, ur_h_nprocs;
-    PMPI_Comm_rank(*ur_h_comm, &ur_h_rank);
-    PMPI_Comm_size(*ur_h_comm, &ur_h_nprocs);
-    MTCORE_DBG_PRINT("[%d] created ur_h comm, my rank %d/%d \n", MTCORE_MY_RANK_IN_WORLD,
-                     ur_h_rank, ur_h_nprocs);
-#endif
-
-  fn_exit:
-    if (ur_h_ranks_in_local)
-        free(ur_h_ranks_in_local);
-    if (ur_h_group != MPI_GROUP_NULL)
-        PMPI_Group_free(&ur_h_group);
+    MTCORE_DBG_PRINT("[%d] send Func %d start request %d (%d bytes param) to helper local %d%s\n",
+                     MTCORE_MY_RANK_IN_WORLD, FUNC, req_id, param_size,
+                     MTCORE_H_RANKS_IN_LOCAL[0], MTCORE_CMD_RING ? " by command ring" : "");
+
+    /* Only send start request to root helper. */
+    if (MTCORE_CMD_RING) {
+        mpi_errno = start_by_cmd_ring(buf, sizeof(MTCORE_Func_info) + param_size, req_id);
+    }
+    else {
+        mpi_errno = PMPI_Send(buf, sizeof(MTCORE_Func_info) + param_size, MPI_CHAR,
+                              MTCORE_H_RANKS_IN_LOCAL[0], MTCORE_FUNC_TAG, MTCORE_COMM_LOCAL);
+    }
+    free(buf);
     return mpi_errno;
+}
+
+/**
+ * The root process in current local user communicator waits for the reply of
+ * a function from the root helper, which includes the results of all local
+ * helpers in the order of helper local ranks.
+ */
+int MTCORE_Func_wait_reply(int req_id, void *reply, int reply_size)
+{
+    MTCORE_DBG_PRINT("[%d] wait reply of request %d from helper local %d\n",
+                     MTCORE_MY_RANK_IN_WORLD, req_id, MTCORE_H_RANKS_IN_LOCAL[0]);
+    return PMPI_Recv(reply, reply_size, MPI_CHAR, MTCORE_H_RANKS_IN_LOCAL[0], req_id,
+                     MTCORE_COMM_LOCAL, MPI_STATUS_IGNORE);
+}
 
-  fn_fail:
-    goto fn_exit;
+static int comp_int(const void *a, const void *b)
+{
+    return *(const int *) a - *(const int *) b;
 }
 
-int MTCORE_Func_set_param(char *func_params, int size, MPI_Comm ur_h_comm)
+/**
+ * Get the unique helper ranks in world of the given user processes, which are
+ * all the helpers on the nodes of these users. Users and helpers derive the same
+ * list locally, ordered by the first user on each node and by rank on a node.
+ * Return the number of helpers.
+ */
+int MTCORE_Func_get_helper_ranks(int user_nprocs, const int *user_ranks_in_world,
+                                 int *helper_ranks_in_world)
 {
-    /* Simply broadcast parameters to all the helpers, because all of them are
-     * guaranteed to be in current function.
-     * User + all helpers communicator is organized as h0, h1,...,user root */
-    MTCORE_DBG_PRINT("set param to helpers: size %d\n", size);
-    return PMPI_Bcast(func_params, size, MPI_CHAR, MTCORE_ENV.num_h, ur_h_comm);
+    int i, node_id, num_helpers = 0;
+    int *node_bitmap = NULL;
+
+    node_bitmap = calloc(MTCORE_NUM_NODES, sizeof(int));
+    for (i = 0; i < user_nprocs; i++) {
+        node_id = MTCORE_ALL_NODE_IDS[user_ranks_in_world[i]];
+        if (node_bitmap[node_id])
+            continue;
+        node_bitmap[node_id] = 1;
+
+        memcpy(&helper_ranks_in_world[num_helpers],
+               &MTCORE_ALL_UNIQUE_H_RANKS_IN_WORLD[node_id * MTCORE_ENV.num_h],
+               sizeof(int) * MTCORE_ENV.num_h);
+        qsort(&helper_ranks_in_world[num_helpers], MTCORE_ENV.num_h, sizeof(int), comp_int);
+        num_helpers += MTCORE_ENV.num_h;
+    }
+    free(node_bitmap);
+
+    return num_helpers;
 }
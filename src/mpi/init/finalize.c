@@ -12,11 +12,22 @@ int MPI_Finalize(void)
 
     MTCORE_DBG_PRINT_FCNAME();
 
+    /* Complete window allocations in flight and stop the allocation thread. */
+    MTCORE_Win_iallocate_finalize();
+    MTCORE_Comm_cache_destroy();
+    MTCORE_Ghost_thread_stop();
+
     /* Helpers do not need user process information because it is a global call. */
-    if (user_local_rank == 0) {
-        MTCORE_Func_start(MTCORE_FUNC_FINALIZE, 0, 0);
+    if (user_local_rank == 0 && MTCORE_ENV.ghost_mode == MTCORE_GHOST_PROCESS) {
+        MTCORE_Func_start(MTCORE_FUNC_FINALIZE, 0, 0, MTCORE_Func_new_req_id(),
+                          MTCORE_COMM_CACHE_NONE, NULL, 0);
     }
 
+    /* Helpers free the command ring after receiving finalize. */
+    MTCORE_Cmd_ring_free(&MTCORE_CMD_RING, &MTCORE_CMD_RING_WIN);
+    if (MTCORE_P2P_is_enabled())
+        MTCORE_P2P_destroy();
+
     if (MTCORE_COMM_USER_WORLD != MPI_COMM_NULL) {
         MTCORE_DBG_PRINT(" free MTCORE_COMM_USER_WORLD\n");
         PMPI_Comm_free(&MTCORE_COMM_USER_WORLD);
@@ -66,6 +77,12 @@ int MPI_Finalize(void)
     if (MTCORE_ALL_NODE_IDS)
         free(MTCORE_ALL_NODE_IDS);
 
+    if (MTCORE_ALL_NUMA_IDS)
+        free(MTCORE_ALL_NUMA_IDS);
+
+    if (MTCORE_ENV.h_local_ranks)
+        free(MTCORE_ENV.h_local_ranks);
+
     if (MTCORE_USER_RANKS_IN_WORLD)
         free(MTCORE_USER_RANKS_IN_WORLD);
 
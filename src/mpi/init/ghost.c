@@ -0,0 +1,115 @@
+/*
+ * ghost.c
+ *  <FILE_DESC>
+ *
+ *  Progress thread of the thread ghost mode (MTCORE_GHOST_MODE=thread). No
+ *  process is taken as helper, instead local rank 0 of every node serves as
+ *  helper of that node (see MTCORE_Is_win_host). Its internal windows expose
+ *  the shared segment of the whole node, thus RMA operations to the node are
+ *  routed to it through uh_comm/uh_wins as in the process mode, and its thread
+ *  keeps entering MPI so that they complete while all users compute. Only this
+ *  process requires MPI_THREAD_MULTIPLE, otherwise the node runs without
+ *  asynchronous progress. The thread waits for a stop message sent to itself on
+ *  a private communicator, blocked in MPI by default or by polling with the
+ *  policy of helpers (see MTCORE_H_PROGRESS).
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "mtcore.h"
+
+#define MTCORE_GHOST_STOP_TAG 9894
+
+static struct {
+    pthread_t thread;
+    MPI_Comm comm;              /* duplicated MPI_COMM_SELF, only carries the stop message */
+    int started;
+} ghost = { 0, MPI_COMM_NULL, 0 };
+
+static void *ghost_thread_fn(void *arg)
+{
+    int flag = 0, num_idle = 0;
+    long sleep_ns = 1000;
+    struct timespec ts;
+
+    /* A blocking receive drives the progress engine of MPI until stopped. */
+    if (MTCORE_ENV.h_progress == MTCORE_H_PROGRESS_BLOCK) {
+        PMPI_Recv(NULL, 0, MPI_BYTE, 0, MTCORE_GHOST_STOP_TAG, ghost.comm, MPI_STATUS_IGNORE);
+        return NULL;
+    }
+
+    while (1) {
+        PMPI_Iprobe(0, MTCORE_GHOST_STOP_TAG, ghost.comm, &flag, MPI_STATUS_IGNORE);
+        if (flag)
+            break;
+
+        if (MTCORE_ENV.h_progress == MTCORE_H_PROGRESS_BUSY ||
+            num_idle++ < MTCORE_ENV.h_progress_spin)
+            continue;
+
+        if (MTCORE_ENV.h_progress == MTCORE_H_PROGRESS_YIELD) {
+            sched_yield();
+        }
+        else {
+            ts.tv_sec = sleep_ns / 1000000000L;
+            ts.tv_nsec = sleep_ns % 1000000000L;
+            nanosleep(&ts, NULL);
+            sleep_ns = min(sleep_ns * 2, (long) MTCORE_ENV.h_progress_sleep_max * 1000);
+        }
+    }
+
+    PMPI_Recv(NULL, 0, MPI_BYTE, 0, MTCORE_GHOST_STOP_TAG, ghost.comm, MPI_STATUS_IGNORE);
+    return NULL;
+}
+
+int MTCORE_Ghost_thread_start(int thread_level)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    if (thread_level != MPI_THREAD_MULTIPLE) {
+        MTCORE_WARN_PRINT("MPI_THREAD_MULTIPLE is not provided on local rank 0, no "
+                          "asynchronous progress on this node in thread ghost mode\n");
+        return mpi_errno;
+    }
+
+    mpi_errno = PMPI_Comm_dup(MPI_COMM_SELF, &ghost.comm);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    if (pthread_create(&ghost.thread, NULL, ghost_thread_fn, NULL) != 0) {
+        MTCORE_ERR_PRINT("Cannot create ghost thread\n");
+        PMPI_Comm_free(&ghost.comm);
+        return MPI_ERR_INTERN;
+    }
+    ghost.started = 1;
+
+    MTCORE_DBG_PRINT("started ghost thread, progress policy %d\n", MTCORE_ENV.h_progress);
+    return mpi_errno;
+}
+
+int MTCORE_Ghost_thread_is_started(void)
+{
+    return ghost.started;
+}
+
+int MTCORE_Ghost_thread_stop(void)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    if (!ghost.started)
+        return mpi_errno;
+
+    mpi_errno = PMPI_Send(NULL, 0, MPI_BYTE, 0, MTCORE_GHOST_STOP_TAG, ghost.comm);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+    pthread_join(ghost.thread, NULL);
+    ghost.started = 0;
+
+    MTCORE_DBG_PRINT("stopped ghost thread\n");
+    return PMPI_Comm_free(&ghost.comm);
+}
@@ -23,9 +23,18 @@ int *MTCORE_USER_RANKS_IN_WORLD = NULL;
 int MTCORE_MY_NODE_ID = -1;
 int MTCORE_NUM_NODES = 0;
 int *MTCORE_ALL_NODE_IDS = NULL;
+int *MTCORE_ALL_NUMA_IDS = NULL;
 int MTCORE_MY_RANK_IN_WORLD = -1;
+int MTCORE_THREAD_LEVEL = MPI_THREAD_SINGLE;
+int MTCORE_THREAD_EP_COUNTER = 0;
+__thread int MTCORE_THREAD_EP_ID = -1;
+
+MTCORE_Cmd_ring *MTCORE_CMD_RING = NULL;
+MPI_Win MTCORE_CMD_RING_WIN = MPI_WIN_NULL;
 
 MTCORE_Define_win_cache;
+__thread MTCORE_Win_tls_cache MTCORE_WIN_TLS_CACHE = { MPI_WIN_NULL, NULL, 0 };
+unsigned long MTCORE_WIN_CACHE_GEN = 0;
 
 /* TODO: Move load balancing option into env setting */
 MTCORE_Env_param MTCORE_ENV;
@@ -37,6 +46,21 @@ static int MTCORE_Initialize_env()
 
     memset(&MTCORE_ENV, 0, sizeof(MTCORE_ENV));
 
+    MTCORE_ENV.ghost_mode = MTCORE_GHOST_PROCESS;
+    val = getenv("MTCORE_GHOST_MODE");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "process", strlen("process"))) {
+            MTCORE_ENV.ghost_mode = MTCORE_GHOST_PROCESS;
+        }
+        else if (!strncmp(val, "thread", strlen("thread"))) {
+            MTCORE_ENV.ghost_mode = MTCORE_GHOST_THREAD;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_GHOST_MODE %s\n", val);
+            return -1;
+        }
+    }
+
     MTCORE_ENV.seg_size = MTCORE_DEFAULT_SEG_SIZE;
     val = getenv("MTCORE_SEG_SIZE");
     if (val && strlen(val)) {
@@ -47,6 +71,16 @@ static int MTCORE_Initialize_env()
         return -1;
     }
 
+    MTCORE_ENV.stripe_size = MTCORE_DEFAULT_STRIPE_SIZE;
+    val = getenv("MTCORE_STRIPE_SIZE");
+    if (val && strlen(val)) {
+        MTCORE_ENV.stripe_size = atoi(val);
+    }
+    if (MTCORE_ENV.stripe_size < 0) {
+        fprintf(stderr, "Wrong MTCORE_STRIPE_SIZE %d\n", MTCORE_ENV.stripe_size);
+        return -1;
+    }
+
     MTCORE_ENV.num_h = MTCORE_DEFAULT_NUM_HELPER;
     val = getenv("MTCORE_NUM_HELPER");
     if (val && strlen(val)) {
@@ -58,6 +92,13 @@ static int MTCORE_Initialize_env()
     }
     MTCORE_NUM_H = MTCORE_ENV.num_h;    /* expose to outside programs */
 
+    /* In thread ghost mode, a user process on every node serves as the only helper
+     * of that node, and no process is taken from users. */
+    if (MTCORE_ENV.ghost_mode == MTCORE_GHOST_THREAD) {
+        MTCORE_ENV.num_h = 1;
+        MTCORE_NUM_H = 0;
+    }
+
     MTCORE_ENV.lock_binding = MTCORE_LOCK_BINDING_RANK;
     val = getenv("MTCORE_LOCK_METHOD");
     if (val && strlen(val)) {
@@ -73,6 +114,335 @@ static int MTCORE_Initialize_env()
         }
     }
 
+    MTCORE_ENV.sync_strategy = MTCORE_SYNC_HELPER;
+    val = getenv("MTCORE_SYNC_STRATEGY");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "helper", strlen("helper"))) {
+            MTCORE_ENV.sync_strategy = MTCORE_SYNC_HELPER;
+        }
+        else if (!strncmp(val, "all", strlen("all"))) {
+            MTCORE_ENV.sync_strategy = MTCORE_SYNC_ALL;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_SYNC_STRATEGY %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.rma_transport = MTCORE_RMA_TRANSPORT_RMA;
+    val = getenv("MTCORE_RMA_TRANSPORT");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "rma", strlen("rma"))) {
+            MTCORE_ENV.rma_transport = MTCORE_RMA_TRANSPORT_RMA;
+        }
+        else if (!strncmp(val, "am", strlen("am"))) {
+            MTCORE_ENV.rma_transport = MTCORE_RMA_TRANSPORT_AM;
+        }
+        else if (!strncmp(val, "agg", strlen("agg"))) {
+            MTCORE_ENV.rma_transport = MTCORE_RMA_TRANSPORT_AM_AGG;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_RMA_TRANSPORT %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.shm_acc = 1;
+    val = getenv("MTCORE_SHM_ACC");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "on", strlen("on"))) {
+            MTCORE_ENV.shm_acc = 1;
+        }
+        else if (!strncmp(val, "off", strlen("off"))) {
+            MTCORE_ENV.shm_acc = 0;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_SHM_ACC %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.shm_numa_bind = 1;
+    val = getenv("MTCORE_SHM_NUMA_BIND");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "on", strlen("on"))) {
+            MTCORE_ENV.shm_numa_bind = 1;
+        }
+        else if (!strncmp(val, "off", strlen("off"))) {
+            MTCORE_ENV.shm_numa_bind = 0;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_SHM_NUMA_BIND %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.huge_page = MTCORE_HUGE_PAGE_OFF;
+    val = getenv("MTCORE_WIN_HUGE_PAGE");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "off", strlen("off"))) {
+            MTCORE_ENV.huge_page = MTCORE_HUGE_PAGE_OFF;
+        }
+        else if (!strncmp(val, "thp", strlen("thp"))) {
+            MTCORE_ENV.huge_page = MTCORE_HUGE_PAGE_THP;
+        }
+        else if (!strncmp(val, "hugetlb", strlen("hugetlb"))) {
+            MTCORE_ENV.huge_page = MTCORE_HUGE_PAGE_HUGETLB;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_WIN_HUGE_PAGE %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.comm_cache = 1;
+    val = getenv("MTCORE_COMM_CACHE");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "on", strlen("on"))) {
+            MTCORE_ENV.comm_cache = 1;
+        }
+        else if (!strncmp(val, "off", strlen("off"))) {
+            MTCORE_ENV.comm_cache = 0;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_COMM_CACHE %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.cmd_ring = 1;
+    val = getenv("MTCORE_CMD_RING");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "on", strlen("on"))) {
+            MTCORE_ENV.cmd_ring = 1;
+        }
+        else if (!strncmp(val, "off", strlen("off"))) {
+            MTCORE_ENV.cmd_ring = 0;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_CMD_RING %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.fop_combine = 0;
+    val = getenv("MTCORE_FOP_COMBINE");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "on", strlen("on"))) {
+            MTCORE_ENV.fop_combine = 1;
+        }
+        else if (!strncmp(val, "off", strlen("off"))) {
+            MTCORE_ENV.fop_combine = 0;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_FOP_COMBINE %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.p2p_offload = 0;
+    val = getenv("MTCORE_P2P_OFFLOAD");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "on", strlen("on"))) {
+            MTCORE_ENV.p2p_offload = 1;
+        }
+        else if (!strncmp(val, "off", strlen("off"))) {
+            MTCORE_ENV.p2p_offload = 0;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_P2P_OFFLOAD %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.p2p_offload_size = MTCORE_DEFAULT_P2P_OFFLOAD_SIZE;
+    val = getenv("MTCORE_P2P_OFFLOAD_SIZE");
+    if (val && strlen(val)) {
+        MTCORE_ENV.p2p_offload_size = atoi(val);
+    }
+    if (MTCORE_ENV.p2p_offload_size < 0) {
+        fprintf(stderr, "Wrong MTCORE_P2P_OFFLOAD_SIZE %d\n", MTCORE_ENV.p2p_offload_size);
+        return -1;
+    }
+
+    MTCORE_ENV.coll_offload = 0;
+    val = getenv("MTCORE_COLL_OFFLOAD");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "on", strlen("on"))) {
+            MTCORE_ENV.coll_offload = 1;
+        }
+        else if (!strncmp(val, "off", strlen("off"))) {
+            MTCORE_ENV.coll_offload = 0;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_COLL_OFFLOAD %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.win_free_defer = 1;
+    val = getenv("MTCORE_WIN_FREE_DEFER");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "on", strlen("on"))) {
+            MTCORE_ENV.win_free_defer = 1;
+        }
+        else if (!strncmp(val, "off", strlen("off"))) {
+            MTCORE_ENV.win_free_defer = 0;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_WIN_FREE_DEFER %s\n", val);
+            return -1;
+        }
+    }
+
+    /* The ghost thread shares cores with the user computation, thus it blocks by default. */
+    MTCORE_ENV.h_progress = MTCORE_ENV.ghost_mode == MTCORE_GHOST_THREAD ?
+        MTCORE_H_PROGRESS_BLOCK : MTCORE_H_PROGRESS_BUSY;
+    val = getenv("MTCORE_H_PROGRESS");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "block", strlen("block"))) {
+            MTCORE_ENV.h_progress = MTCORE_H_PROGRESS_BLOCK;
+        }
+        else if (!strncmp(val, "busy", strlen("busy"))) {
+            MTCORE_ENV.h_progress = MTCORE_H_PROGRESS_BUSY;
+        }
+        else if (!strncmp(val, "yield", strlen("yield"))) {
+            MTCORE_ENV.h_progress = MTCORE_H_PROGRESS_YIELD;
+        }
+        else if (!strncmp(val, "sleep", strlen("sleep"))) {
+            MTCORE_ENV.h_progress = MTCORE_H_PROGRESS_SLEEP;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_H_PROGRESS %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.h_progress_spin = MTCORE_DEFAULT_H_PROGRESS_SPIN;
+    val = getenv("MTCORE_H_PROGRESS_SPIN");
+    if (val && strlen(val)) {
+        MTCORE_ENV.h_progress_spin = atoi(val);
+    }
+    if (MTCORE_ENV.h_progress_spin < 0) {
+        fprintf(stderr, "Wrong MTCORE_H_PROGRESS_SPIN %d\n", MTCORE_ENV.h_progress_spin);
+        return -1;
+    }
+
+    MTCORE_ENV.h_progress_sleep_max = MTCORE_DEFAULT_H_PROGRESS_SLEEP_MAX;
+    val = getenv("MTCORE_H_PROGRESS_SLEEP_MAX");
+    if (val && strlen(val)) {
+        MTCORE_ENV.h_progress_sleep_max = atoi(val);
+    }
+    if (MTCORE_ENV.h_progress_sleep_max <= 0) {
+        fprintf(stderr, "Wrong MTCORE_H_PROGRESS_SLEEP_MAX %d\n",
+                MTCORE_ENV.h_progress_sleep_max);
+        return -1;
+    }
+
+    MTCORE_ENV.h_progress_stat = 0;
+    val = getenv("MTCORE_H_PROGRESS_STAT");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "on", strlen("on"))) {
+            MTCORE_ENV.h_progress_stat = 1;
+        }
+        else if (!strncmp(val, "off", strlen("off"))) {
+            MTCORE_ENV.h_progress_stat = 0;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_H_PROGRESS_STAT %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.h_credit_ops = 0;
+    val = getenv("MTCORE_H_CREDIT_OPS");
+    if (val && strlen(val)) {
+        MTCORE_ENV.h_credit_ops = atoi(val);
+    }
+    if (MTCORE_ENV.h_credit_ops < 0) {
+        fprintf(stderr, "Wrong MTCORE_H_CREDIT_OPS %d\n", MTCORE_ENV.h_credit_ops);
+        return -1;
+    }
+
+    MTCORE_ENV.h_credit_bytes = 0;
+    val = getenv("MTCORE_H_CREDIT_BYTES");
+    if (val && strlen(val)) {
+        MTCORE_ENV.h_credit_bytes = atoi(val);
+    }
+    if (MTCORE_ENV.h_credit_bytes < 0) {
+        fprintf(stderr, "Wrong MTCORE_H_CREDIT_BYTES %d\n", MTCORE_ENV.h_credit_bytes);
+        return -1;
+    }
+
+    MTCORE_ENV.h_credit_stat = 0;
+    val = getenv("MTCORE_H_CREDIT_STAT");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "on", strlen("on"))) {
+            MTCORE_ENV.h_credit_stat = 1;
+        }
+        else if (!strncmp(val, "off", strlen("off"))) {
+            MTCORE_ENV.h_credit_stat = 0;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_H_CREDIT_STAT %s\n", val);
+            return -1;
+        }
+    }
+
+    MTCORE_ENV.h_placement = MTCORE_H_PLACEMENT_NUMA;
+    val = getenv("MTCORE_HELPER_PLACEMENT");
+    if (val && strlen(val)) {
+        if (!strncmp(val, "first", strlen("first"))) {
+            MTCORE_ENV.h_placement = MTCORE_H_PLACEMENT_FIRST;
+        }
+        else if (!strncmp(val, "numa", strlen("numa"))) {
+            MTCORE_ENV.h_placement = MTCORE_H_PLACEMENT_NUMA;
+        }
+        else if (!strncmp(val, "smt", strlen("smt"))) {
+            MTCORE_ENV.h_placement = MTCORE_H_PLACEMENT_SMT;
+        }
+        else {
+            fprintf(stderr, "Unknown MTCORE_HELPER_PLACEMENT %s\n", val);
+            return -1;
+        }
+    }
+
+    /* Comma separated local ranks of helpers, e.g., "0,8" */
+    MTCORE_ENV.h_local_ranks = NULL;
+    val = getenv("MTCORE_HELPER_LOCAL_RANKS");
+    if (val && strlen(val)) {
+        char *p = val, *end = NULL;
+        int i, j;
+
+        MTCORE_ENV.h_local_ranks = calloc(MTCORE_ENV.num_h, sizeof(int));
+        for (i = 0; i < MTCORE_ENV.num_h; i++) {
+            MTCORE_ENV.h_local_ranks[i] = (int) strtol(p, &end, 10);
+            if (end == p || MTCORE_ENV.h_local_ranks[i] < 0 || (*end != ',' && *end != '\0'))
+                break;
+            for (j = 0; j < i && MTCORE_ENV.h_local_ranks[j] != MTCORE_ENV.h_local_ranks[i]; j++);
+            if (j < i)
+                break;
+            p = (*end == ',') ? end + 1 : end;
+        }
+        if (i < MTCORE_ENV.num_h || *p != '\0') {
+            fprintf(stderr, "Wrong MTCORE_HELPER_LOCAL_RANKS %s, expect %d distinct local ranks\n",
+                    val, MTCORE_ENV.num_h);
+            free(MTCORE_ENV.h_local_ranks);
+            MTCORE_ENV.h_local_ranks = NULL;
+            return -1;
+        }
+    }
+
+    /* Functions served by helper processes are not available in thread ghost mode,
+     * the ghost thread only keeps entering MPI. */
+    if (MTCORE_ENV.ghost_mode == MTCORE_GHOST_THREAD) {
+        MTCORE_ENV.cmd_ring = 0;
+        MTCORE_ENV.comm_cache = 0;
+        MTCORE_ENV.rma_transport = MTCORE_RMA_TRANSPORT_RMA;
+        MTCORE_ENV.p2p_offload = 0;
+        MTCORE_ENV.coll_offload = 0;
+    }
+
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
     MTCORE_ENV.load_opt = MTCORE_LOAD_OPT_RANDOM;
 
@@ -112,26 +482,316 @@ static int MTCORE_Initialize_env()
     MTCORE_ENV.load_lock = MTCORE_LOAD_LOCK_NATURE;
 #endif
 
-    MTCORE_DBG_PRINT("ENV: seg_size=%d, lock_binding=%d, load_lock=%d, load_opt=%d, "
-                     "num_h=%d\n", MTCORE_ENV.seg_size, MTCORE_ENV.lock_binding,
-                     MTCORE_ENV.load_lock, MTCORE_ENV.load_opt, MTCORE_ENV.num_h);
+    MTCORE_DBG_PRINT("ENV: ghost_mode=%d, seg_size=%d, stripe_size=%d, lock_binding=%d, "
+                     "sync_strategy=%d, load_lock=%d, load_opt=%d, num_h=%d, thread_level=%d, "
+                     "rma_transport=%d, "
+                     "shm_acc=%d, shm_numa_bind=%d, huge_page=%d, comm_cache=%d, cmd_ring=%d, "
+                     "fop_combine=%d, p2p_offload=%d(size %d), coll_offload=%d, "
+                     "win_free_defer=%d, h_progress=%d(spin %d, sleep_max %d us, stat %d), "
+                     "h_credit=%d ops/%d bytes(stat %d), h_placement=%d%s\n",
+                     MTCORE_ENV.ghost_mode, MTCORE_ENV.seg_size, MTCORE_ENV.stripe_size,
+                     MTCORE_ENV.lock_binding, MTCORE_ENV.sync_strategy, MTCORE_ENV.load_lock,
+                     MTCORE_ENV.load_opt, MTCORE_ENV.num_h, MTCORE_THREAD_LEVEL,
+                     MTCORE_ENV.rma_transport,
+                     MTCORE_ENV.shm_acc, MTCORE_ENV.shm_numa_bind, MTCORE_ENV.huge_page,
+                     MTCORE_ENV.comm_cache, MTCORE_ENV.cmd_ring, MTCORE_ENV.fop_combine,
+                     MTCORE_ENV.p2p_offload, MTCORE_ENV.p2p_offload_size, MTCORE_ENV.coll_offload,
+                     MTCORE_ENV.win_free_defer,
+                     MTCORE_ENV.h_progress,
+                     MTCORE_ENV.h_progress_spin, MTCORE_ENV.h_progress_sleep_max,
+                     MTCORE_ENV.h_progress_stat, MTCORE_ENV.h_credit_ops,
+                     MTCORE_ENV.h_credit_bytes, MTCORE_ENV.h_credit_stat, MTCORE_ENV.h_placement,
+                     MTCORE_ENV.h_local_ranks ? "(by local ranks)" : "");
 
     return mpi_errno;
 }
 
-int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)
+/* Pin a helper onto a free SMT sibling of the cores of users it serves. Users
+ * are bound to helpers in local rank order (see binding by ranks in window
+ * allocation), thus every helper picks a sibling following the same order. All
+ * helpers go through the same steps, so that no CPU is picked twice. */
+static void pin_helper_to_sibling(int local_rank, int local_nprocs, const int *home_cpus,
+                                  const int *h_ranks_in_local)
+{
+    int *users = NULL, *used_cpus = NULL;
+    int num_users = 0, num_used = 0, np_per_helper;
+    int i, k, u, first, last, cpu = -1;
+
+    users = calloc(local_nprocs, sizeof(int));
+    used_cpus = calloc(local_nprocs + MTCORE_ENV.num_h, sizeof(int));
+    for (i = 0; i < local_nprocs; i++) {
+        for (k = 0; k < MTCORE_ENV.num_h && h_ranks_in_local[k] != i; k++);
+        if (k < MTCORE_ENV.num_h)
+            continue;
+        users[num_users++] = i;
+        if (home_cpus[i] >= 0)
+            used_cpus[num_used++] = home_cpus[i];
+    }
+
+    np_per_helper = num_users / MTCORE_ENV.num_h;
+    for (k = 0; k < MTCORE_ENV.num_h; k++) {
+        first = k * np_per_helper;
+        last = (k == MTCORE_ENV.num_h - 1) ? num_users : first + np_per_helper;
+
+        /* Prefer users served by this helper, then any user on the node. */
+        cpu = -1;
+        for (u = first; u < last && cpu < 0; u++)
+            cpu = MTCORE_Topo_get_free_sibling(home_cpus[users[u]], used_cpus, num_used);
+        for (u = 0; u < num_users && cpu < 0; u++)
+            cpu = MTCORE_Topo_get_free_sibling(home_cpus[users[u]], used_cpus, num_used);
+        if (cpu >= 0)
+            used_cpus[num_used++] = cpu;
+
+        if (h_ranks_in_local[k] == local_rank)
+            break;
+    }
+
+    if (cpu < 0) {
+        MTCORE_WARN_PRINT("No free SMT sibling of user cores found for helper, "
+                          "keep its affinity. Users need to be bound to cores.\n");
+    }
+    else if (MTCORE_Topo_bind_cpu(cpu) != 0) {
+        MTCORE_WARN_PRINT("Failed to bind helper to cpu %d, keep its affinity\n", cpu);
+    }
+    else {
+        MTCORE_DBG_PRINT("helper %d bound to SMT sibling cpu %d\n", k, cpu);
+    }
+
+    free(users);
+    free(used_cpus);
+}
+
+/* Pick Helper processes on this node, either specified by MTCORE_HELPER_LOCAL_RANKS
+ * or placed according to the NUMA domains of local processes (with SMT placement,
+ * the first N processes are picked and pinned onto SMT siblings), then reorder
+ * MTCORE_COMM_LOCAL to place helpers first and users in their original order.
+ * The remaining initialization thus always treats the first N local processes
+ * as helpers. */
+static int place_helpers(int *local_rank, int local_nprocs, int *my_numa_id)
 {
     int mpi_errno = MPI_SUCCESS;
+    int *local_numa_ids = NULL, *local_home_cpus = NULL, *h_ranks_in_local = NULL;
+    int *tmp_gather_buf = NULL;
+    int i, key, reorder = 0;
+    MPI_Comm new_comm = MPI_COMM_NULL;
+
+    *my_numa_id = MTCORE_Topo_get_numa_id();
+
+    /* Every local process contributes [numa_id, home_cpu] */
+    tmp_gather_buf = calloc(local_nprocs * 2, sizeof(int));
+    local_numa_ids = calloc(local_nprocs, sizeof(int));
+    local_home_cpus = calloc(local_nprocs, sizeof(int));
+    h_ranks_in_local = calloc(MTCORE_ENV.num_h, sizeof(int));
+    tmp_gather_buf[*local_rank * 2] = *my_numa_id;
+    tmp_gather_buf[*local_rank * 2 + 1] = MTCORE_Topo_get_home_cpu();
+    mpi_errno = PMPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                               tmp_gather_buf, 2, MPI_INT, MTCORE_COMM_LOCAL);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+    for (i = 0; i < local_nprocs; i++) {
+        local_numa_ids[i] = tmp_gather_buf[i * 2];
+        local_home_cpus[i] = tmp_gather_buf[i * 2 + 1];
+    }
+
+    if (MTCORE_ENV.h_local_ranks) {
+        for (i = 0; i < MTCORE_ENV.num_h; i++) {
+            if (MTCORE_ENV.h_local_ranks[i] >= local_nprocs) {
+                fprintf(stderr, "Wrong MTCORE_HELPER_LOCAL_RANKS, %d ge %d local processes\n",
+                        MTCORE_ENV.h_local_ranks[i], local_nprocs);
+                mpi_errno = -1;
+                goto fn_fail;
+            }
+            h_ranks_in_local[i] = MTCORE_ENV.h_local_ranks[i];
+        }
+    }
+    else if (MTCORE_ENV.h_placement == MTCORE_H_PLACEMENT_NUMA) {
+        MTCORE_Topo_select_helpers(MTCORE_ENV.num_h, local_nprocs, local_numa_ids,
+                                   h_ranks_in_local);
+    }
+    else {
+        for (i = 0; i < MTCORE_ENV.num_h; i++)
+            h_ranks_in_local[i] = i;
+    }
+
+    key = MTCORE_ENV.num_h + *local_rank;
+    for (i = 0; i < MTCORE_ENV.num_h; i++) {
+        if (h_ranks_in_local[i] != i)
+            reorder = 1;
+        if (h_ranks_in_local[i] == *local_rank)
+            key = i;
+    }
+
+    if (MTCORE_ENV.h_placement == MTCORE_H_PLACEMENT_SMT && key < MTCORE_ENV.num_h)
+        pin_helper_to_sibling(*local_rank, local_nprocs, local_home_cpus, h_ranks_in_local);
+
+    if (reorder) {
+        mpi_errno = PMPI_Comm_split(MTCORE_COMM_LOCAL, 0, key, &new_comm);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+        PMPI_Comm_free(&MTCORE_COMM_LOCAL);
+        MTCORE_COMM_LOCAL = new_comm;
+        PMPI_Comm_rank(MTCORE_COMM_LOCAL, local_rank);
+    }
+
+    MTCORE_DBG_PRINT("helper placement: numa_id %d, local rank %d%s\n", *my_numa_id,
+                     *local_rank, reorder ? " (reordered)" : "");
+
+  fn_exit:
+    if (tmp_gather_buf)
+        free(tmp_gather_buf);
+    if (local_numa_ids)
+        free(local_numa_ids);
+    if (local_home_cpus)
+        free(local_home_cpus);
+    if (h_ranks_in_local)
+        free(h_ranks_in_local);
+    return mpi_errno;
+
+  fn_fail:
+    goto fn_exit;
+}
+
+/* Whether this process may host the ghost thread of its node in thread ghost mode.
+ * It is known before MPI is initialized only from the local rank set by launchers,
+ * otherwise every process may be the host and requires MPI_THREAD_MULTIPLE. */
+static int is_ghost_host_candidate(void)
+{
+    const char *local_rank_vars[] = { "MPI_LOCALRANKID", "OMPI_COMM_WORLD_LOCAL_RANK",
+        "SLURM_LOCALID"
+    };
+    char *val;
+    int i;
+
+    for (i = 0; i < sizeof(local_rank_vars) / sizeof(local_rank_vars[0]); i++) {
+        val = getenv(local_rank_vars[i]);
+        if (val && strlen(val))
+            return atoi(val) == 0;
+    }
+    return 1;
+}
+
+/* Thread ghost mode. All processes are users, and local rank 0 of every node is
+ * the single helper of that node on the user world (see MTCORE_Is_win_host). Helper
+ * ranks are set as in the process mode, and only local rank 0 starts the ghost
+ * thread, if ghost_level is MPI_THREAD_MULTIPLE. */
+static int init_thread_ghost(int rank, int nprocs, int ghost_level)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int local_rank, i;
+    int tmp_bcast_buf[2] = { 0, 0 };
+    int *tmp_gather_buf = NULL;
+
+    mpi_errno = PMPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+                                     MPI_INFO_NULL, &MTCORE_COMM_LOCAL);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+    PMPI_Comm_rank(MTCORE_COMM_LOCAL, &local_rank);
+
+    mpi_errno = PMPI_Comm_dup(MPI_COMM_WORLD, &MTCORE_COMM_USER_WORLD);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+    mpi_errno = PMPI_Comm_dup(MTCORE_COMM_LOCAL, &MTCORE_COMM_USER_LOCAL);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+    mpi_errno = PMPI_Comm_split(MTCORE_COMM_USER_WORLD, local_rank == 0, 1,
+                                &MTCORE_COMM_UR_WORLD);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    PMPI_Comm_group(MPI_COMM_WORLD, &MTCORE_GROUP_WORLD);
+    PMPI_Comm_group(MTCORE_COMM_LOCAL, &MTCORE_GROUP_LOCAL);
+    PMPI_Comm_group(MTCORE_COMM_USER_WORLD, &MTCORE_GROUP_USER_WORLD);
+
+    MTCORE_H_RANKS_IN_LOCAL = calloc(1, sizeof(int));
+    MTCORE_H_RANKS_IN_WORLD = calloc(1, sizeof(int));
+    mpi_errno = PMPI_Group_translate_ranks(MTCORE_GROUP_LOCAL, 1, MTCORE_H_RANKS_IN_LOCAL,
+                                           MTCORE_GROUP_WORLD, MTCORE_H_RANKS_IN_WORLD);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    if (local_rank == 0) {
+        PMPI_Comm_rank(MTCORE_COMM_UR_WORLD, &tmp_bcast_buf[0]);
+        PMPI_Comm_size(MTCORE_COMM_UR_WORLD, &tmp_bcast_buf[1]);
+    }
+    PMPI_Bcast(tmp_bcast_buf, 2, MPI_INT, 0, MTCORE_COMM_LOCAL);
+    MTCORE_MY_NODE_ID = tmp_bcast_buf[0];
+    MTCORE_NUM_NODES = tmp_bcast_buf[1];
+
+    /* Every process contributes [node_id, helper rank], ranks in world and in user
+     * world are the same. */
+    MTCORE_ALL_NODE_IDS = calloc(nprocs, sizeof(int));
+    MTCORE_ALL_NUMA_IDS = calloc(nprocs, sizeof(int));
+    MTCORE_ALL_H_RANKS_IN_WORLD = calloc(nprocs, sizeof(int));
+    MTCORE_ALL_UNIQUE_H_RANKS_IN_WORLD = calloc(MTCORE_NUM_NODES, sizeof(int));
+    tmp_gather_buf = calloc(nprocs * 2, sizeof(int));
+
+    tmp_gather_buf[rank * 2] = MTCORE_MY_NODE_ID;
+    tmp_gather_buf[rank * 2 + 1] = MTCORE_H_RANKS_IN_WORLD[0];
+    mpi_errno = PMPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                               tmp_gather_buf, 2, MPI_INT, MPI_COMM_WORLD);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    for (i = 0; i < nprocs; i++) {
+        MTCORE_ALL_NODE_IDS[i] = tmp_gather_buf[i * 2];
+        MTCORE_ALL_NUMA_IDS[i] = MTCORE_TOPO_NUMA_UNKNOWN;
+        MTCORE_ALL_H_RANKS_IN_WORLD[i] = tmp_gather_buf[i * 2 + 1];
+        MTCORE_ALL_UNIQUE_H_RANKS_IN_WORLD[MTCORE_ALL_NODE_IDS[i]] = tmp_gather_buf[i * 2 + 1];
+    }
+
+    MTCORE_USER_RANKS_IN_WORLD = calloc(nprocs, sizeof(int));
+    for (i = 0; i < nprocs; i++)
+        MTCORE_USER_RANKS_IN_WORLD[i] = i;
+
+    MTCORE_DBG_PRINT("I am user in thread ghost mode, %d/%d in world, %d in local, "
+                     "node_id %d, helper %d, thread level %d\n", rank, nprocs, local_rank,
+                     MTCORE_MY_NODE_ID, MTCORE_H_RANKS_IN_WORLD[0], ghost_level);
+
+    MTCORE_Init_win_cache();
+
+    if (local_rank == 0)
+        mpi_errno = MTCORE_Ghost_thread_start(ghost_level);
+
+  fn_exit:
+    if (tmp_gather_buf)
+        free(tmp_gather_buf);
+    return mpi_errno;
+
+  fn_fail:
+    goto fn_exit;
+}
+
+int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)
+{
+    int mpi_errno = MPI_SUCCESS, env_errno = MPI_SUCCESS;
+    int ghost_level = MPI_THREAD_SINGLE;
     int i, j;
     int local_rank, local_nprocs, rank, nprocs, user_rank, user_nprocs;
     int local_user_rank = -1, local_user_nprocs = -1;
-    int *tmp_gather_buf = NULL, node_id = 0;
+    int *tmp_gather_buf = NULL, node_id = 0, my_numa_id = MTCORE_TOPO_NUMA_UNKNOWN;
+    int gather_stride = 0;
     int tmp_bcast_buf[2];
     int *ranks_in_user_world = NULL, *ranks_in_world = NULL;
 
     MTCORE_DBG_PRINT_FCNAME();
 
-    if (required == 0 && provided == NULL) {
+    /* The environment is loaded before MPI is initialized, because the host of
+     * the ghost thread requires MPI_THREAD_MULTIPLE. Errors are reported after. */
+    env_errno = MTCORE_Initialize_env();
+
+    if (env_errno == MPI_SUCCESS && MTCORE_ENV.ghost_mode == MTCORE_GHOST_THREAD &&
+        is_ghost_host_candidate()) {
+        mpi_errno = PMPI_Init_thread(argc, argv, MPI_THREAD_MULTIPLE, &ghost_level);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        /* Only the ghost thread uses the higher level, users see the same level
+         * on every process. */
+        MTCORE_THREAD_LEVEL = min(required, ghost_level);
+        if (provided)
+            *provided = MTCORE_THREAD_LEVEL;
+    }
+    else if (required == 0 && provided == NULL) {
         /* default init */
         mpi_errno = PMPI_Init(argc, argv);
         if (mpi_errno != MPI_SUCCESS)
@@ -142,15 +802,27 @@ int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)
         mpi_errno = PMPI_Init_thread(argc, argv, required, provided);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
+
+        /* Window state is protected by atomics, thus every thread level provided
+         * by MPI is also supported by MTCORE. */
+        MTCORE_THREAD_LEVEL = *provided;
     }
 
     PMPI_Comm_size(MPI_COMM_WORLD, &nprocs);
     PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MTCORE_MY_RANK_IN_WORLD = rank;
 
-    mpi_errno = MTCORE_Initialize_env();
-    if (mpi_errno != MPI_SUCCESS)
+    if (env_errno != MPI_SUCCESS) {
+        mpi_errno = env_errno;
         goto fn_fail;
+    }
+
+    if (MTCORE_ENV.ghost_mode == MTCORE_GHOST_THREAD) {
+        mpi_errno = init_thread_ghost(rank, nprocs, max(ghost_level, MTCORE_THREAD_LEVEL));
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+        goto fn_exit;
+    }
 
     /* Get a communicator only containing processes with shared memory */
     mpi_errno = PMPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
@@ -163,7 +835,8 @@ int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)
     PMPI_Comm_size(MTCORE_COMM_LOCAL, &local_nprocs);
 
     if (local_nprocs < 2) {
-        fprintf(stderr, "No user process found, please run with more than 2 process per node\n");
+        fprintf(stderr, "No user process found, please run with more than 2 process per node "
+                "or set MTCORE_GHOST_MODE=thread\n");
         mpi_errno = -1;
         goto fn_fail;
     }
@@ -174,7 +847,12 @@ int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)
         goto fn_fail;
     }
 
-    /* Specify the first N local processes to be Helper processes */
+    /* Pick Helper processes and reorder the local communicator so that they are
+     * always the first N local processes */
+    mpi_errno = place_helpers(&local_rank, local_nprocs, &my_numa_id);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
     MTCORE_H_RANKS_IN_LOCAL = calloc(MTCORE_ENV.num_h, sizeof(int));
     MTCORE_H_RANKS_IN_WORLD = calloc(MTCORE_ENV.num_h, sizeof(int));
     for (i = 0; i < MTCORE_ENV.num_h; i++) {
@@ -249,33 +927,38 @@ int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
 
+    /* Every process contributes [node_id, numa_id, helper ranks] */
+    gather_stride = 2 + MTCORE_ENV.num_h;
     MTCORE_ALL_NODE_IDS = calloc(nprocs, sizeof(int));
+    MTCORE_ALL_NUMA_IDS = calloc(nprocs, sizeof(int));
     MTCORE_ALL_H_RANKS_IN_WORLD = calloc(user_nprocs * MTCORE_ENV.num_h, sizeof(int));
     MTCORE_ALL_UNIQUE_H_RANKS_IN_WORLD = calloc(MTCORE_NUM_NODES * MTCORE_ENV.num_h, sizeof(int));
-    tmp_gather_buf = calloc(nprocs * (1 + MTCORE_ENV.num_h), sizeof(int));
+    tmp_gather_buf = calloc(nprocs * gather_stride, sizeof(int));
 
-    tmp_gather_buf[rank * (1 + MTCORE_ENV.num_h)] = MTCORE_MY_NODE_ID;
+    tmp_gather_buf[rank * gather_stride] = MTCORE_MY_NODE_ID;
+    tmp_gather_buf[rank * gather_stride + 1] = my_numa_id;
     for (i = 0; i < MTCORE_ENV.num_h; i++) {
-        tmp_gather_buf[rank * (1 + MTCORE_ENV.num_h) + i + 1] = MTCORE_H_RANKS_IN_WORLD[i];
+        tmp_gather_buf[rank * gather_stride + i + 2] = MTCORE_H_RANKS_IN_WORLD[i];
     }
     mpi_errno = PMPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
-                               tmp_gather_buf, 1 + MTCORE_ENV.num_h, MPI_INT, MPI_COMM_WORLD);
+                               tmp_gather_buf, gather_stride, MPI_INT, MPI_COMM_WORLD);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
 
     for (i = 0; i < nprocs; i++) {
         int i_user_rank = 0;
-        node_id = tmp_gather_buf[i * (1 + MTCORE_ENV.num_h)];
+        node_id = tmp_gather_buf[i * gather_stride];
         MTCORE_ALL_NODE_IDS[i] = node_id;
+        MTCORE_ALL_NUMA_IDS[i] = tmp_gather_buf[i * gather_stride + 1];
 
         /* Only copy helper ranks for user processes */
         i_user_rank = ranks_in_user_world[i];
         if (i_user_rank != MPI_UNDEFINED) {
             for (j = 0; j < MTCORE_ENV.num_h; j++) {
                 MTCORE_ALL_H_RANKS_IN_WORLD[i_user_rank * MTCORE_ENV.num_h + j] =
-                    tmp_gather_buf[i * (1 + MTCORE_ENV.num_h) + j + 1];
+                    tmp_gather_buf[i * gather_stride + j + 2];
                 MTCORE_ALL_UNIQUE_H_RANKS_IN_WORLD[node_id * MTCORE_ENV.num_h + j] =
-                    tmp_gather_buf[i * (1 + MTCORE_ENV.num_h) + j + 1];
+                    tmp_gather_buf[i * gather_stride + j + 2];
             }
         }
     }
@@ -283,10 +966,26 @@ int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)
 #ifdef DEBUG
     MTCORE_DBG_PRINT("Debug gathered info ***** \n");
     for (i = 0; i < nprocs; i++) {
-        MTCORE_DBG_PRINT("node_id[%d]: %d\n", i, MTCORE_ALL_NODE_IDS[i]);
+        MTCORE_DBG_PRINT("node_id[%d]: %d, numa_id %d\n", i, MTCORE_ALL_NODE_IDS[i],
+                         MTCORE_ALL_NUMA_IDS[i]);
     }
 #endif
 
+    /* Create the command ring owned by the root helper, which is local rank 0. */
+    if (MTCORE_ENV.cmd_ring) {
+        mpi_errno = MTCORE_Cmd_ring_create(MTCORE_COMM_LOCAL, &MTCORE_CMD_RING,
+                                           &MTCORE_CMD_RING_WIN);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
+
+    /* Create the channel of helper-progressed point-to-point and collectives. */
+    if (MTCORE_P2P_is_enabled()) {
+        mpi_errno = MTCORE_P2P_init();
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
+
     /* USER processes */
     if (local_rank >= MTCORE_ENV.num_h) {
         /* Get user ranks in world */
@@ -381,8 +1080,12 @@ int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)
         free(MTCORE_ALL_UNIQUE_H_RANKS_IN_WORLD);
     if (MTCORE_ALL_NODE_IDS)
         free(MTCORE_ALL_NODE_IDS);
+    if (MTCORE_ALL_NUMA_IDS)
+        free(MTCORE_ALL_NUMA_IDS);
     if (MTCORE_USER_RANKS_IN_WORLD)
         free(MTCORE_USER_RANKS_IN_WORLD);
+    if (MTCORE_ENV.h_local_ranks)
+        free(MTCORE_ENV.h_local_ranks);
 
     MTCORE_Destroy_win_cache();
 
@@ -393,6 +1096,8 @@ int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)
 
     MTCORE_ALL_H_RANKS_IN_WORLD = NULL;
     MTCORE_ALL_NODE_IDS = NULL;
+    MTCORE_ALL_NUMA_IDS = NULL;
+    MTCORE_ENV.h_local_ranks = NULL;
 
     PMPI_Abort(MPI_COMM_WORLD, 0);
 
@@ -0,0 +1,649 @@
+/*
+ * offload.c
+ *  <FILE_DESC>
+ *
+ *  Helper-progressed nonblocking point-to-point on user processes, see
+ *  mtcore_p2p.h. Sends and receives return a generalized request, which is
+ *  completed by MTCORE_P2P_progress once the transfers posted by the user are
+ *  done and, for data handed to the root helper or receives matched by it, the
+ *  helper marks the completion slot. The status of a receive reports the source and tag in the
+ *  user communicator. Progress is polled by the wrappers of MPI_Wait/MPI_Test
+ *  and their variants whenever such requests are pending.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include "mtcore.h"
+
+typedef struct MTCORE_P2P_req {
+    MPI_Request greq;
+    MPI_Request reqs[2];        /* header and data sent, or message received, by user */
+    int slot;                   /* slot of data or receive handed to helper, -1 if none */
+    int is_recv;
+    int source;                 /* rank in user communicator */
+    int tag;
+    int count;                  /* bytes received */
+    int mpi_errno;
+    void *tmp_buf;              /* header or packed data, freed at completion */
+
+    /* Noncontiguous receive, unpacked from tmp_buf at completion. */
+    void *buf;
+    int ucount;
+    MPI_Datatype datatype;
+    struct MTCORE_P2P_req *next;
+} MTCORE_P2P_req;
+
+/* Windows that offloaded buffers may lie in. */
+typedef struct MTCORE_P2P_win {
+    MTCORE_Win *uh_win;
+    struct MTCORE_P2P_win *next;
+} MTCORE_P2P_win;
+
+int MTCORE_P2P_num_pending = 0;        /* atomic */
+static MTCORE_P2P_req *pending_reqs = NULL;
+static MTCORE_P2P_win *p2p_wins = NULL;
+static pthread_mutex_t p2p_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int p2p_query_fn(void *extra_state, MPI_Status * status)
+{
+    MTCORE_P2P_req *r = (MTCORE_P2P_req *) extra_state;
+
+    PMPI_Status_set_elements(status, MPI_BYTE, r->count);
+    PMPI_Status_set_cancelled(status, 0);
+    status->MPI_SOURCE = r->source;
+    status->MPI_TAG = r->tag;
+
+    return r->mpi_errno;
+}
+
+static int p2p_free_fn(void *extra_state)
+{
+    free(extra_state);
+    return MPI_SUCCESS;
+}
+
+static int p2p_cancel_fn(void *extra_state, int complete)
+{
+    /* Transfers posted by helpers cannot be cancelled. */
+    return MPI_SUCCESS;
+}
+
+static int comm_id_delete_fn(MPI_Comm comm, int keyval, void *attribute_val,
+                             void *extra_state)
+{
+    int id = *(int *) attribute_val;
+
+    pthread_mutex_lock(&p2p_lock);
+    if (id > 0)
+        MTCORE_P2P.comm_ids &= ~(1U << id);
+    pthread_mutex_unlock(&p2p_lock);
+
+    free(attribute_val);
+    return MPI_SUCCESS;
+}
+
+/* Give the user communicator of window an id on the channel, which is not used
+ * by any other communicator of its processes. Collective over the window, the
+ * communicator keeps no id (-1) if all are in use. */
+static int register_comm_id(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    unsigned int ids = 0, all_ids = 0;
+    int *id = NULL, flag = 0;
+    void *val = NULL;
+
+    if (uh_win->user_comm == MTCORE_COMM_USER_WORLD)
+        return mpi_errno;
+
+    pthread_mutex_lock(&p2p_lock);
+    if (MTCORE_P2P.comm_keyval == MPI_KEYVAL_INVALID)
+        mpi_errno = PMPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, comm_id_delete_fn,
+                                            &MTCORE_P2P.comm_keyval, NULL);
+    ids = MTCORE_P2P.comm_ids;
+    pthread_mutex_unlock(&p2p_lock);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    /* The attribute is set on all processes at once. */
+    PMPI_Comm_get_attr(uh_win->user_comm, MTCORE_P2P.comm_keyval, &val, &flag);
+    if (flag)
+        return mpi_errno;
+
+    mpi_errno = PMPI_Allreduce(&ids, &all_ids, 1, MPI_UNSIGNED, MPI_BOR, uh_win->user_comm);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    id = malloc(sizeof(int));
+    for (*id = 1; *id < MTCORE_P2P_MAX_COMMS && (all_ids & (1U << *id)); (*id)++);
+    if (*id == MTCORE_P2P_MAX_COMMS)
+        *id = -1;
+
+    pthread_mutex_lock(&p2p_lock);
+    if (*id > 0)
+        MTCORE_P2P.comm_ids |= (1U << *id);
+    pthread_mutex_unlock(&p2p_lock);
+
+    MTCORE_DBG_PRINT("offload id %d for user comm 0x%x\n", *id, uh_win->user_comm);
+    return PMPI_Comm_set_attr(uh_win->user_comm, MTCORE_P2P.comm_keyval, id);
+}
+
+/* Get the channel id of communicator, -1 if it has none. */
+static int get_comm_id(MPI_Comm comm)
+{
+    int flag = 0;
+    void *val = NULL;
+
+    if (comm == MTCORE_COMM_USER_WORLD)
+        return 0;
+    if (MTCORE_P2P.comm_keyval == MPI_KEYVAL_INVALID)
+        return -1;
+    PMPI_Comm_get_attr(comm, MTCORE_P2P.comm_keyval, &val, &flag);
+
+    return flag ? *(int *) val : -1;
+}
+
+/**
+ * Broadcast the window handles of helpers to all local users, and remember the
+ * window for looking up buffers. Collective over the window.
+ */
+int MTCORE_P2P_register_win(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_P2P_win *w = NULL;
+
+    if (uh_win->h_win_handles == NULL)
+        uh_win->h_win_handles = calloc(MTCORE_ENV.num_h, sizeof(unsigned long));
+    mpi_errno = PMPI_Bcast(uh_win->h_win_handles, MTCORE_ENV.num_h, MPI_UNSIGNED_LONG, 0,
+                           uh_win->local_user_comm);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    if (MTCORE_ENV.p2p_offload) {
+        mpi_errno = register_comm_id(uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+
+    w = calloc(1, sizeof(MTCORE_P2P_win));
+    w->uh_win = uh_win;
+
+    pthread_mutex_lock(&p2p_lock);
+    w->next = p2p_wins;
+    p2p_wins = w;
+    pthread_mutex_unlock(&p2p_lock);
+
+    return mpi_errno;
+}
+
+void MTCORE_P2P_unregister_win(MTCORE_Win * uh_win)
+{
+    MTCORE_P2P_win *w, *prev = NULL;
+
+    pthread_mutex_lock(&p2p_lock);
+    for (w = p2p_wins; w != NULL; prev = w, w = w->next) {
+        if (w->uh_win == uh_win) {
+            if (prev)
+                prev->next = w->next;
+            else
+                p2p_wins = w->next;
+            free(w);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&p2p_lock);
+}
+
+/* Find the window whose local segment holds [addr, addr + size), and get the
+ * offset of addr to the window base of the root helper. */
+static int lookup_win(const char *addr, MPI_Aint size, unsigned long *h_win_handle,
+                      MPI_Aint * h_offset)
+{
+    MTCORE_P2P_win *w;
+    MTCORE_Win *uh_win;
+    int user_rank = 0, found = 0;
+
+    pthread_mutex_lock(&p2p_lock);
+    for (w = p2p_wins; w != NULL && !found; w = w->next) {
+        uh_win = w->uh_win;
+        PMPI_Comm_rank(uh_win->user_comm, &user_rank);
+        if (addr >= (char *) uh_win->base &&
+            addr + size <= (char *) uh_win->base + uh_win->targets[user_rank].size) {
+            *h_win_handle = uh_win->h_win_handles[0];
+            *h_offset = uh_win->targets[user_rank].base_h_offsets[0] +
+                (addr - (char *) uh_win->base);
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&p2p_lock);
+
+    return found;
+}
+
+static int alloc_slot(void)
+{
+    int i;
+
+    for (i = 0; i < MTCORE_P2P_MAX_REQS; i++) {
+        if (MTCORE_Atomic_load(&MTCORE_P2P.slots[i].state) == MTCORE_P2P_SLOT_FREE &&
+            MTCORE_Atomic_cas(&MTCORE_P2P.slots[i].state, MTCORE_P2P_SLOT_FREE,
+                              MTCORE_P2P_SLOT_ISSUED))
+            return i;
+    }
+    return -1;
+}
+
+/* Wait for a free slot if all are in use. */
+static int wait_slot(int *slot)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    while ((*slot = alloc_slot()) < 0) {
+        mpi_errno = MTCORE_P2P_progress();
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return mpi_errno;
+}
+
+static int start_greq(MTCORE_P2P_req * r, MPI_Request * request)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    mpi_errno = PMPI_Grequest_start(p2p_query_fn, p2p_free_fn, p2p_cancel_fn, r, &r->greq);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    pthread_mutex_lock(&p2p_lock);
+    r->next = pending_reqs;
+    pending_reqs = r;
+    MTCORE_Atomic_add(&MTCORE_P2P_num_pending, 1);
+    pthread_mutex_unlock(&p2p_lock);
+
+    *request = r->greq;
+    return mpi_errno;
+}
+
+static void enqueue_cmd(MTCORE_P2P_cmd * cmd)
+{
+    int local_rank = 0;
+
+    PMPI_Comm_rank(MTCORE_COMM_LOCAL, &local_rank);
+    MTCORE_Cmd_ring_enqueue(MTCORE_P2P.ring, local_rank, cmd, sizeof(MTCORE_P2P_cmd));
+
+    /* The helper may sleep on the function ring. */
+    if (MTCORE_CMD_RING)
+        MTCORE_Cmd_ring_wake(MTCORE_CMD_RING);
+
+    MTCORE_DBG_PRINT("offload command %d, %d bytes, peer %d, tag %d, slot %d\n", cmd->type,
+                     cmd->size, cmd->peer, cmd->tag, cmd->slot);
+}
+
+/* Hand the data of a message in a window to the root helper, return 0 if the
+ * buffer is not in any window or no slot is available. */
+static int offload_data(const char *addr, int size, int helper_in_world, MTCORE_P2P_req * r)
+{
+    MTCORE_P2P_cmd cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    if (!lookup_win(addr, size, &cmd.h_win_handle, &cmd.h_offset))
+        return 0;
+    r->slot = alloc_slot();
+    if (r->slot < 0)
+        return 0;
+
+    cmd.type = MTCORE_P2P_CMD_ISEND;
+    cmd.slot = r->slot;
+    cmd.size = size;
+    cmd.peer = helper_in_world;
+    cmd.tag = MTCORE_P2P_data_tag(MTCORE_MY_RANK_IN_WORLD);
+    enqueue_cmd(&cmd);
+
+    return 1;
+}
+
+static MTCORE_P2P_req *new_req(void)
+{
+    MTCORE_P2P_req *r = calloc(1, sizeof(MTCORE_P2P_req));
+
+    r->reqs[0] = r->reqs[1] = MPI_REQUEST_NULL;
+    r->slot = -1;
+    r->datatype = MPI_DATATYPE_NULL;
+    return r;
+}
+
+static void free_req(MTCORE_P2P_req * r)
+{
+    if (r->tmp_buf)
+        free(r->tmp_buf);
+    if (r->datatype != MPI_DATATYPE_NULL)
+        PMPI_Type_free(&r->datatype);
+    free(r);
+}
+
+/**
+ * Hand a command to the root helper and return a generalized request, which
+ * is completed once the helper marks the slot of the command. Wait for a free
+ * slot if all are in use.
+ */
+int MTCORE_P2P_start_cmd(MTCORE_P2P_cmd * cmd, MPI_Request * request)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_P2P_req *r = NULL;
+
+    r = new_req();
+    r->source = MPI_ANY_SOURCE;
+    r->tag = MPI_ANY_TAG;
+    r->count = cmd->size;
+
+    mpi_errno = wait_slot(&r->slot);
+    if (mpi_errno != MPI_SUCCESS) {
+        free(r);
+        return mpi_errno;
+    }
+
+    /* Start the request before the command, thus a failure never leaves a
+     * command in flight. */
+    mpi_errno = start_greq(r, request);
+    if (mpi_errno != MPI_SUCCESS) {
+        MTCORE_Atomic_store(&MTCORE_P2P.slots[r->slot].state, MTCORE_P2P_SLOT_FREE);
+        free(r);
+        return mpi_errno;
+    }
+
+    cmd->slot = r->slot;
+    enqueue_cmd(cmd);
+
+    return mpi_errno;
+}
+
+/* Send a header to the root helper of receiver, followed by the message
+ * inline if it is small, otherwise by the data from the sender or its helper. */
+static int issue_send(void *buf, int count, MPI_Datatype datatype, int contig, char *addr,
+                      int bytes, int peer_in_world, int peer_in_user_world, int comm_id,
+                      int tag, MTCORE_P2P_req * r)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int helper = MTCORE_ALL_H_RANKS_IN_WORLD[peer_in_user_world * MTCORE_ENV.num_h];
+    int inline_size = bytes < MTCORE_ENV.p2p_offload_size ? bytes : 0;
+    int data_tag = MTCORE_P2P_data_tag(MTCORE_MY_RANK_IN_WORLD);
+    int position = 0;
+    MTCORE_P2P_hdr *hdr = NULL;
+    char *data = addr;
+
+    hdr = malloc(sizeof(MTCORE_P2P_hdr) + inline_size);
+    if (hdr == NULL)
+        return MPI_ERR_NO_MEM;
+    r->tmp_buf = hdr;
+    hdr->dst = peer_in_world;
+    hdr->src = MTCORE_MY_RANK_IN_WORLD;
+    hdr->comm_id = comm_id;
+    hdr->tag = tag;
+    hdr->size = bytes;
+    hdr->data_src = MTCORE_MY_RANK_IN_WORLD;
+
+    if (bytes < MTCORE_ENV.p2p_offload_size) {
+        hdr->data_src = -1;
+        if (contig)
+            memcpy(hdr + 1, addr, bytes);
+        else
+            PMPI_Pack(buf, count, datatype, hdr + 1, bytes, &position, MPI_COMM_SELF);
+    }
+    else if (contig && offload_data(addr, bytes, helper, r)) {
+        hdr->data_src = MTCORE_H_RANKS_IN_WORLD[0];
+    }
+    else if (!contig) {
+        /* Packed behind the header, thus freed together. */
+        hdr = realloc(hdr, sizeof(MTCORE_P2P_hdr) + bytes);
+        if (hdr == NULL)
+            return MPI_ERR_NO_MEM;
+        r->tmp_buf = hdr;
+        data = (char *) (hdr + 1);
+        PMPI_Pack(buf, count, datatype, data, bytes, &position, MPI_COMM_SELF);
+    }
+
+    MTCORE_DBG_PRINT("offload send %d bytes to %d through helper %d, comm %d, tag %d, "
+                     "data from %d\n", bytes, peer_in_world, helper, comm_id, tag, hdr->data_src);
+
+    mpi_errno = PMPI_Isend(hdr, (int) sizeof(MTCORE_P2P_hdr) + inline_size, MPI_BYTE, helper,
+                           MTCORE_P2P_HDR_TAG, MTCORE_P2P.comm, &r->reqs[0]);
+    if (mpi_errno != MPI_SUCCESS || hdr->data_src != MTCORE_MY_RANK_IN_WORLD)
+        return mpi_errno;
+
+    return PMPI_Isend(data, bytes, MPI_BYTE, helper, data_tag, MTCORE_P2P.comm, &r->reqs[1]);
+}
+
+/* Post a receive on my root helper, which matches it with messages. A buffer
+ * in a window is filled by the helper, otherwise the message is forwarded by
+ * the helper and a noncontiguous one is unpacked at completion. */
+static int issue_recv(void *buf, int count, MPI_Datatype datatype, int contig, char *addr,
+                      int bytes, int peer_in_world, int comm_id, int tag, MTCORE_P2P_req * r)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_P2P_cmd cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = MTCORE_P2P_CMD_IRECV;
+    cmd.size = bytes;
+    cmd.peer = peer_in_world;
+    cmd.tag = tag;
+    cmd.dst = MTCORE_MY_RANK_IN_WORLD;
+    cmd.comm_id = comm_id;
+
+    if (!contig || !lookup_win(addr, bytes, &cmd.h_win_handle, &cmd.h_offset)) {
+        cmd.h_win_handle = 0;
+        if (!contig) {
+            r->tmp_buf = malloc(max(bytes, 1));
+            if (r->tmp_buf == NULL)
+                return MPI_ERR_NO_MEM;
+            r->buf = buf;
+            r->ucount = count;
+            mpi_errno = PMPI_Type_dup(datatype, &r->datatype);
+            if (mpi_errno != MPI_SUCCESS)
+                return mpi_errno;
+            addr = r->tmp_buf;
+        }
+    }
+
+    mpi_errno = wait_slot(&cmd.slot);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    if (cmd.h_win_handle == 0) {
+        mpi_errno = PMPI_Irecv(addr, bytes, MPI_BYTE, MTCORE_H_RANKS_IN_WORLD[0],
+                               MTCORE_P2P_reply_tag(cmd.slot), MTCORE_P2P.comm, &r->reqs[0]);
+        if (mpi_errno != MPI_SUCCESS) {
+            MTCORE_Atomic_store(&MTCORE_P2P.slots[cmd.slot].state, MTCORE_P2P_SLOT_FREE);
+            return mpi_errno;
+        }
+    }
+
+    r->slot = cmd.slot;
+    enqueue_cmd(&cmd);
+
+    return mpi_errno;
+}
+
+static int issue(int is_recv, void *buf, int count, MPI_Datatype datatype,
+                 int peer, int tag, MPI_Comm comm, MPI_Request * request)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MPI_Group group = MPI_GROUP_NULL;
+    MPI_Aint lb, extent, true_lb, true_extent, bytes;
+    MTCORE_P2P_req *r = NULL;
+    char *addr = NULL;
+    int peer_in_world = 0, peer_in_user_world = 0, comm_id = -1;
+    int type_size = 0, contig;
+
+    if (comm == MPI_COMM_WORLD)
+        comm = MTCORE_COMM_USER_WORLD;
+
+    /* Messages on a communicator without id are issued by the user on the
+     * communicator itself, on all processes of it. */
+    if (MTCORE_ENV.p2p_offload && peer != MPI_PROC_NULL)
+        comm_id = get_comm_id(comm);
+    if (comm_id < 0) {
+        if (is_recv)
+            return PMPI_Irecv(buf, count, datatype, peer, tag, comm, request);
+        return PMPI_Isend(buf, count, datatype, peer, tag, comm, request);
+    }
+
+    if (tag < 0 || tag > MTCORE_P2P.tag_ub)
+        return MPI_ERR_TAG;
+    if (peer < 0)
+        return MPI_ERR_RANK;
+
+    /* Contiguous data is transferred in bytes, thus a helper can post it
+     * without the datatype. Other data is packed. */
+    PMPI_Type_size(datatype, &type_size);
+    PMPI_Type_get_extent(datatype, &lb, &extent);
+    PMPI_Type_get_true_extent(datatype, &true_lb, &true_extent);
+    contig = (extent == type_size && true_extent == type_size);
+    bytes = (MPI_Aint) count *type_size;
+    addr = (char *) buf + true_lb;
+
+    if (bytes > INT_MAX)
+        return MPI_ERR_COUNT;
+
+    mpi_errno = PMPI_Comm_group(comm, &group);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+    mpi_errno = PMPI_Group_translate_ranks(group, 1, &peer, MTCORE_GROUP_WORLD, &peer_in_world);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+    mpi_errno = PMPI_Group_translate_ranks(group, 1, &peer, MTCORE_GROUP_USER_WORLD,
+                                           &peer_in_user_world);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    r = new_req();
+    r->is_recv = is_recv;
+    r->source = peer;
+    r->tag = tag;
+    r->count = (int) bytes;
+
+    if (is_recv)
+        mpi_errno = issue_recv(buf, count, datatype, contig, addr, (int) bytes, peer_in_world,
+                               comm_id, tag, r);
+    else
+        mpi_errno = issue_send(buf, count, datatype, contig, addr, (int) bytes, peer_in_world,
+                               peer_in_user_world, comm_id, tag, r);
+
+    /* A slot or transfer already in flight cannot be taken back. */
+    if (mpi_errno == MPI_SUCCESS || r->slot >= 0 || r->reqs[0] != MPI_REQUEST_NULL) {
+        if (mpi_errno != MPI_SUCCESS)
+            r->mpi_errno = mpi_errno;
+        mpi_errno = start_greq(r, request);
+    }
+    else {
+        free_req(r);
+    }
+
+  fn_exit:
+    if (group != MPI_GROUP_NULL)
+        PMPI_Group_free(&group);
+    return mpi_errno;
+
+  fn_fail:
+    goto fn_exit;
+}
+
+/**
+ * Complete pending requests whose transfers are done, either marked by the
+ * helper in the slot or tested on the requests posted by user.
+ */
+int MTCORE_P2P_progress(void)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_P2P_req *r, *prev = NULL, *next;
+    MPI_Status status;
+    MTCORE_P2P_slot *slot;
+    int flag, i, position;
+
+    pthread_mutex_lock(&p2p_lock);
+    for (r = pending_reqs; r != NULL; r = next) {
+        next = r->next;
+        flag = 1;
+
+        if (r->slot >= 0) {
+            slot = &MTCORE_P2P.slots[r->slot];
+            if (MTCORE_Atomic_load_seq(&slot->state) == MTCORE_P2P_SLOT_DONE) {
+                r->count = slot->count;
+                if (slot->mpi_errno != MPI_SUCCESS)
+                    r->mpi_errno = slot->mpi_errno;
+                MTCORE_Atomic_store(&slot->state, MTCORE_P2P_SLOT_FREE);
+                r->slot = -1;
+            }
+            else {
+                flag = 0;
+            }
+        }
+
+        for (i = 0; i < 2; i++) {
+            int done = 0;
+
+            if (r->reqs[i] == MPI_REQUEST_NULL)
+                continue;
+            mpi_errno = PMPI_Test(&r->reqs[i], &done, &status);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_exit;
+            if (!done) {
+                flag = 0;
+                continue;
+            }
+
+            if (r->is_recv) {
+                PMPI_Get_count(&status, MPI_BYTE, &r->count);
+                if (r->datatype != MPI_DATATYPE_NULL) {
+                    position = 0;
+                    PMPI_Unpack(r->tmp_buf, r->count, &position, r->buf, r->ucount,
+                                r->datatype, MPI_COMM_SELF);
+                }
+            }
+        }
+
+        if (!flag) {
+            prev = r;
+            continue;
+        }
+
+        if (prev)
+            prev->next = next;
+        else
+            pending_reqs = next;
+        MTCORE_Atomic_add(&MTCORE_P2P_num_pending, -1);
+
+        if (r->tmp_buf) {
+            free(r->tmp_buf);
+            r->tmp_buf = NULL;
+        }
+        if (r->datatype != MPI_DATATYPE_NULL)
+            PMPI_Type_free(&r->datatype);
+
+        /* The request is freed by the free function once the user frees it. */
+        mpi_errno = PMPI_Grequest_complete(r->greq);
+        if (mpi_errno != MPI_SUCCESS)
+            break;
+    }
+
+  fn_exit:
+    pthread_mutex_unlock(&p2p_lock);
+    return mpi_errno;
+}
+
+int MPIX_Isend_offload(const void *buf, int count, MPI_Datatype datatype, int dest, int tag,
+                       MPI_Comm comm, MPI_Request * request)
+{
+    MTCORE_DBG_PRINT_FCNAME();
+    return issue(0, (void *) buf, count, datatype, dest, tag, comm, request);
+}
+
+int MPIX_Irecv_offload(void *buf, int count, MPI_Datatype datatype, int source, int tag,
+                       MPI_Comm comm, MPI_Request * request)
+{
+    MTCORE_DBG_PRINT_FCNAME();
+    return issue(1, buf, count, datatype, source, tag, comm, request);
+}
@@ -0,0 +1,65 @@
+/*
+ * test.c
+ *  <FILE_DESC>
+ *
+ *  Tests complete offloaded point-to-point whose transfer is done before
+ *  testing the requests, see wait.c.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mtcore.h"
+
+int MPI_Test(MPI_Request * request, int *flag, MPI_Status * status)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    if (MTCORE_Atomic_load(&MTCORE_P2P_num_pending) > 0) {
+        mpi_errno = MTCORE_P2P_progress();
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return PMPI_Test(request, flag, status);
+}
+
+int MPI_Testall(int count, MPI_Request array_of_requests[], int *flag,
+                MPI_Status array_of_statuses[])
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    if (MTCORE_Atomic_load(&MTCORE_P2P_num_pending) > 0) {
+        mpi_errno = MTCORE_P2P_progress();
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return PMPI_Testall(count, array_of_requests, flag, array_of_statuses);
+}
+
+int MPI_Testany(int count, MPI_Request array_of_requests[], int *index, int *flag,
+                MPI_Status * status)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    if (MTCORE_Atomic_load(&MTCORE_P2P_num_pending) > 0) {
+        mpi_errno = MTCORE_P2P_progress();
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return PMPI_Testany(count, array_of_requests, index, flag, status);
+}
+
+int MPI_Testsome(int incount, MPI_Request array_of_requests[], int *outcount,
+                 int array_of_indices[], MPI_Status array_of_statuses[])
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    if (MTCORE_Atomic_load(&MTCORE_P2P_num_pending) > 0) {
+        mpi_errno = MTCORE_P2P_progress();
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return PMPI_Testsome(incount, array_of_requests, outcount, array_of_indices,
+                         array_of_statuses);
+}
@@ -0,0 +1,93 @@
+/*
+ * wait.c
+ *  <FILE_DESC>
+ *
+ *  Requests of offloaded point-to-point are only completed by polling, thus
+ *  waits turn into test loops while any of them is pending.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mtcore.h"
+
+int MPI_Wait(MPI_Request * request, MPI_Status * status)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int flag = 0;
+
+    if (MTCORE_Atomic_load(&MTCORE_P2P_num_pending) == 0)
+        return PMPI_Wait(request, status);
+
+    while (!flag) {
+        mpi_errno = MTCORE_P2P_progress();
+        if (mpi_errno != MPI_SUCCESS)
+            break;
+        mpi_errno = PMPI_Test(request, &flag, status);
+        if (mpi_errno != MPI_SUCCESS)
+            break;
+    }
+    return mpi_errno;
+}
+
+int MPI_Waitall(int count, MPI_Request array_of_requests[], MPI_Status array_of_statuses[])
+{
+    int mpi_errno = MPI_SUCCESS;
+    int flag = 0;
+
+    if (MTCORE_Atomic_load(&MTCORE_P2P_num_pending) == 0)
+        return PMPI_Waitall(count, array_of_requests, array_of_statuses);
+
+    while (!flag) {
+        mpi_errno = MTCORE_P2P_progress();
+        if (mpi_errno != MPI_SUCCESS)
+            break;
+        mpi_errno = PMPI_Testall(count, array_of_requests, &flag, array_of_statuses);
+        if (mpi_errno != MPI_SUCCESS)
+            break;
+    }
+    return mpi_errno;
+}
+
+int MPI_Waitany(int count, MPI_Request array_of_requests[], int *index, MPI_Status * status)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int flag = 0;
+
+    if (MTCORE_Atomic_load(&MTCORE_P2P_num_pending) == 0)
+        return PMPI_Waitany(count, array_of_requests, index, status);
+
+    while (!flag) {
+        mpi_errno = MTCORE_P2P_progress();
+        if (mpi_errno != MPI_SUCCESS)
+            break;
+        mpi_errno = PMPI_Testany(count, array_of_requests, index, &flag, status);
+        if (mpi_errno != MPI_SUCCESS)
+            break;
+    }
+    return mpi_errno;
+}
+
+int MPI_Waitsome(int incount, MPI_Request array_of_requests[], int *outcount,
+                 int array_of_indices[], MPI_Status array_of_statuses[])
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    if (MTCORE_Atomic_load(&MTCORE_P2P_num_pending) == 0)
+        return PMPI_Waitsome(incount, array_of_requests, outcount, array_of_indices,
+                             array_of_statuses);
+
+    /* outcount is MPI_UNDEFINED if no request is active. */
+    *outcount = 0;
+    while (*outcount == 0) {
+        mpi_errno = MTCORE_P2P_progress();
+        if (mpi_errno != MPI_SUCCESS)
+            break;
+        mpi_errno = PMPI_Testsome(incount, array_of_requests, outcount, array_of_indices,
+                                  array_of_statuses);
+        if (mpi_errno != MPI_SUCCESS)
+            break;
+    }
+    return mpi_errno;
+}
@@ -35,6 +35,12 @@ static int MTCORE_Accumulate_segment_impl(const void *origin_addr,
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
 
+        mpi_errno = MTCORE_Credit_acquire(target_rank, 1, decoded_ops[i].target_count,
+                                          decoded_ops[i].target_datatype, seg_uh_win, uh_win,
+                                          &target_h_rank_in_uh, &target_h_offset);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
         uh_target_disp = target_h_offset
             + uh_win->targets[target_rank].disp_unit * decoded_ops[i].target_disp;
 
@@ -80,13 +86,15 @@ static int MTCORE_Accumulate_impl(const void *origin_addr, int origin_count,
 
     PMPI_Comm_rank(uh_win->user_comm, &rank);
 
-    /* Should not do local RMA in accumulate because of atomicity issue */
+    /* Should not do local RMA in accumulate because of atomicity issue, except
+     * in exclusive lock epoch, see MTCORE_Shm_accumulate. */
 
     /* TODO: Do we need segment load balancing in fence ?
      * 1. No lock issue.
      * 2. overhead of data range checking and division */
     if (MTCORE_ENV.lock_binding == MTCORE_LOCK_BINDING_SEGMENT &&
-        uh_win->targets[target_rank].num_segs > 1 && uh_win->epoch_stat == MTCORE_WIN_EPOCH_LOCK) {
+        uh_win->targets[target_rank].num_segs > 1 &&
+        MTCORE_Atomic_load(&uh_win->epoch_stat) == MTCORE_WIN_EPOCH_LOCK) {
         mpi_errno = MTCORE_Accumulate_segment_impl(origin_addr, origin_count,
                                                    origin_datatype, target_rank, target_disp,
                                                    target_count, target_datatype, op, win, uh_win);
@@ -107,7 +115,7 @@ static int MTCORE_Accumulate_impl(const void *origin_addr, int origin_count,
         MPI_Aint target_h_offset = 0;
         MPI_Win *win_ptr = NULL;
 
-        MTCORE_Get_epoch_win(target_rank, 0, uh_win, win_ptr);
+        MTCORE_Get_epoch_acc_win(target_rank, 0, uh_win, win_ptr);
 
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
         if (MTCORE_ENV.load_opt == MTCORE_LOAD_BYTE_COUNTING) {
@@ -120,6 +128,11 @@ static int MTCORE_Accumulate_impl(const void *origin_addr, int origin_count,
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
 
+        mpi_errno = MTCORE_Credit_acquire(target_rank, 1, target_count, target_datatype, *win_ptr,
+                                          uh_win, &target_h_rank_in_uh, &target_h_offset);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
         uh_target_disp = target_h_offset + uh_win->targets[target_rank].disp_unit * target_disp;
 
         /* Issue operation to the helper process in corresponding uh-window of target process. */
@@ -157,8 +170,30 @@ int MPI_Accumulate(const void *origin_addr, int origin_count,
 
     MTCORE_Fetch_uh_win_from_cache(win, uh_win);
 
-    if (uh_win) {
+    if (uh_win && MTCORE_Shm_acc_is_supported(origin_count, origin_datatype, target_count,
+                                              target_datatype, op, target_rank, uh_win)) {
+        /* mtcore window, same-node target in exclusive lock epoch */
+        mpi_errno = MTCORE_Shm_accumulate(origin_addr, origin_count, origin_datatype,
+                                          target_rank, target_disp, op, uh_win);
+    }
+    else if (uh_win && op == MPI_REPLACE && MTCORE_Acc_is_rewritable(target_rank, uh_win)) {
+        /* mtcore window, write-only accumulate is issued as put */
+        mpi_errno = MTCORE_Put(origin_addr, origin_count, origin_datatype, target_rank,
+                               target_disp, target_count, target_datatype, win, uh_win);
+    }
+    else if (uh_win && MTCORE_AM_is_supported(origin_count, origin_datatype, target_count,
+                                              target_datatype, op, uh_win)) {
+        /* mtcore window with active-message transport */
+        MTCORE_Shm_acc_mark_remote(target_rank, uh_win);
+        mpi_errno = MTCORE_AM_accumulate(origin_addr, origin_count, origin_datatype,
+                                         target_rank, target_disp, op, uh_win);
+    }
+    else if (uh_win) {
         /* mtcore window */
+        MTCORE_Shm_acc_mark_remote(target_rank, uh_win);
+        mpi_errno = MTCORE_AM_rma_acc_begin(target_rank, uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
         mpi_errno = MTCORE_Accumulate_impl(origin_addr, origin_count,
                                            origin_datatype, target_rank, target_disp, target_count,
                                            target_datatype, op, win, uh_win);
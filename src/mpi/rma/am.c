@@ -0,0 +1,759 @@
+/*
+ * am.c
+ *  <FILE_DESC>
+ *
+ *  Active-message transport on user processes. Operations are sent to the
+ *  main helper of segment 0 of the target, thus all AM operations to a given
+ *  target are applied by the same helper in arrival order, which guarantees
+ *  atomicity and ordering of accumulates.
+ *
+ *  With node-level aggregation, small put and accumulate to other nodes are
+ *  deposited into the queue of this process instead, and forwarded by the root
+ *  helper to the same main helper. Accumulates sent directly wait for the
+ *  queued operations to complete first, and queued accumulates wait for the
+ *  direct ones to the same helper to be flushed, thus ordering is kept. Queued
+ *  fetch_and_op get their results from the queue at completion.
+ *
+ *  Accumulate-class operations with derived datatypes fall back to MPI RMA on
+ *  internal windows. Each path flushes the other one to the same target
+ *  first, thus operations of the same origin are still ordered, but they are
+ *  not atomic with concurrent AM accumulates of other origins.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "mtcore.h"
+
+MPI_Datatype MTCORE_AM_DTYPES[] = {
+    MPI_CHAR, MPI_SIGNED_CHAR, MPI_UNSIGNED_CHAR, MPI_BYTE,
+    MPI_SHORT, MPI_UNSIGNED_SHORT, MPI_INT, MPI_UNSIGNED,
+    MPI_LONG, MPI_UNSIGNED_LONG, MPI_LONG_LONG, MPI_UNSIGNED_LONG_LONG,
+    MPI_FLOAT, MPI_DOUBLE, MPI_LONG_DOUBLE,
+    MPI_INT8_T, MPI_INT16_T, MPI_INT32_T, MPI_INT64_T,
+    MPI_UINT8_T, MPI_UINT16_T, MPI_UINT32_T, MPI_UINT64_T
+};
+
+const int MTCORE_AM_NUM_DTYPES = sizeof(MTCORE_AM_DTYPES) / sizeof(MPI_Datatype);
+
+MPI_Op MTCORE_AM_OPS[] = {
+    MPI_SUM, MPI_PROD, MPI_MAX, MPI_MIN,
+    MPI_LAND, MPI_LOR, MPI_LXOR, MPI_BAND, MPI_BOR, MPI_BXOR,
+    MPI_REPLACE, MPI_NO_OP
+};
+
+const int MTCORE_AM_NUM_OPS = sizeof(MTCORE_AM_OPS) / sizeof(MPI_Op);
+
+static inline int get_dtype_idx(MPI_Datatype datatype)
+{
+    int i;
+    for (i = 0; i < MTCORE_AM_NUM_DTYPES; i++) {
+        if (MTCORE_AM_DTYPES[i] == datatype)
+            return i;
+    }
+    return -1;
+}
+
+static inline int get_op_idx(MPI_Op op)
+{
+    int i;
+    for (i = 0; i < MTCORE_AM_NUM_OPS; i++) {
+        if (MTCORE_AM_OPS[i] == op)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Check whether an operation can be issued through AM transport. Only
+ * contiguous buffers of the same predefined datatype are handled.
+ */
+int MTCORE_AM_is_supported(int origin_count, MPI_Datatype origin_datatype,
+                           int target_count, MPI_Datatype target_datatype, MPI_Op op,
+                           MTCORE_Win * uh_win)
+{
+    if (uh_win->am == NULL)
+        return 0;
+    if (origin_datatype != target_datatype || origin_count != target_count)
+        return 0;
+    if (get_dtype_idx(origin_datatype) < 0)
+        return 0;
+    if (op != MPI_OP_NULL && get_op_idx(op) < 0)
+        return 0;
+    return 1;
+}
+
+static int add_pending_req(MPI_Request req, void *buf, MTCORE_AM_win * am)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    pthread_mutex_lock(&am->reqs_lock);
+    if (am->num_reqs == am->max_reqs) {
+        int max_reqs = max(am->max_reqs * 2, 64);
+        MPI_Request *reqs = realloc(am->reqs, sizeof(MPI_Request) * max_reqs);
+        void **bufs = realloc(am->bufs, sizeof(void *) * max_reqs);
+
+        if (reqs)
+            am->reqs = reqs;
+        if (bufs)
+            am->bufs = bufs;
+        if (reqs == NULL || bufs == NULL) {
+            pthread_mutex_unlock(&am->reqs_lock);
+            return MPI_ERR_NO_MEM;
+        }
+        am->max_reqs = max_reqs;
+    }
+    am->reqs[am->num_reqs] = req;
+    am->bufs[am->num_reqs] = buf;
+    am->num_reqs++;
+    pthread_mutex_unlock(&am->reqs_lock);
+
+    return mpi_errno;
+}
+
+/* Complete all outstanding requests of this window. Requests are detached
+ * from the window before waiting, thus other threads can keep issuing. */
+static int complete_pending_reqs(MTCORE_AM_win * am)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MPI_Request *reqs;
+    void **bufs;
+    int num_reqs, i;
+
+    pthread_mutex_lock(&am->reqs_lock);
+    reqs = am->reqs;
+    bufs = am->bufs;
+    num_reqs = am->num_reqs;
+    am->reqs = NULL;
+    am->bufs = NULL;
+    am->num_reqs = 0;
+    am->max_reqs = 0;
+    pthread_mutex_unlock(&am->reqs_lock);
+
+    if (num_reqs > 0) {
+        mpi_errno = PMPI_Waitall(num_reqs, reqs, MPI_STATUSES_IGNORE);
+        for (i = 0; i < num_reqs; i++) {
+            if (bufs[i])
+                free(bufs[i]);
+        }
+    }
+    if (reqs)
+        free(reqs);
+    if (bufs)
+        free(bufs);
+
+    return mpi_errno;
+}
+
+static inline int get_reply_tag(MTCORE_AM_win * am)
+{
+    unsigned int cnt = MTCORE_Atomic_fetch_add(&am->tag_counter, 1);
+    return MTCORE_AM_REPLY_TAG_BASE + (int) (cnt % MTCORE_AM_REPLY_TAG_RANGE);
+}
+
+static inline int get_am_helper(int target_rank, MTCORE_Win * uh_win, MPI_Aint * h_offset)
+{
+    int main_h_off = uh_win->targets[target_rank].segs[0].main_h_off;
+    *h_offset = uh_win->targets[target_rank].base_h_offsets[main_h_off];
+    return uh_win->targets[target_rank].h_ranks_in_uh[main_h_off];
+}
+
+/* In passive target epoch, lock has to be granted on helpers before any
+ * descriptor is applied, since helpers do not check lock permission. Thus an
+ * exclusive lock of another origin can never overlap with AM operations. */
+static inline int grant_am_lock(int target_rank, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    if (MTCORE_Atomic_load(&uh_win->epoch_stat) != MTCORE_WIN_EPOCH_LOCK ||
+        (uh_win->targets[target_rank].remote_lock_assert & MPI_MODE_NOCHECK) ||
+        MTCORE_Atomic_load(&uh_win->targets[target_rank].am_lock_granted))
+        return mpi_errno;
+
+    mpi_errno = MTCORE_Win_grant_local_lock(target_rank, MPI_LOCK_SHARED, 0, uh_win);
+    if (mpi_errno == MPI_SUCCESS)
+        MTCORE_Atomic_store(&uh_win->targets[target_rank].am_lock_granted, 1);
+
+    return mpi_errno;
+}
+
+static inline int is_agg_pkt(int type, int count, int data_size, MPI_Datatype datatype,
+                             MPI_Op op, int target_rank, MTCORE_Win * uh_win)
+{
+    if (uh_win->am->agg_queue == NULL ||
+        uh_win->targets[target_rank].node_id == uh_win->node_id)
+        return 0;
+
+    switch (type) {
+    case MTCORE_AM_PKT_PUT:
+    case MTCORE_AM_PKT_ACC:
+        return data_size <= MTCORE_AM_AGG_MAX_DATA;
+    case MTCORE_AM_PKT_FOP:
+        /* Combined by root helper, which is only exact for integers */
+        return count == 1 && MTCORE_ENV.fop_combine && op == MPI_SUM && datatype != MPI_FLOAT &&
+            datatype != MPI_DOUBLE && datatype != MPI_LONG_DOUBLE;
+    default:
+        return 0;
+    }
+}
+
+/* Copy results of completed fetch_and_op to user buffers and free their
+ * slots. */
+static void complete_agg_fops(MTCORE_AM_win * am)
+{
+    unsigned long completed;
+    int i;
+
+    if (MTCORE_Atomic_load(&am->num_fops) == 0)
+        return;
+
+    pthread_mutex_lock(&am->agg_lock);
+    completed = MTCORE_Atomic_load(&am->agg_queue->completed);
+    for (i = 0; i < MTCORE_AM_AGG_MAX_FOPS; i++) {
+        if (am->fop_seqs[i] == 0 || am->fop_seqs[i] > completed)
+            continue;
+        memcpy(am->fop_result_addrs[i], am->agg_queue->fop_results[i], am->fop_sizes[i]);
+        am->fop_seqs[i] = 0;
+        MTCORE_Atomic_store(&am->num_fops, am->num_fops - 1);
+    }
+    pthread_mutex_unlock(&am->agg_lock);
+}
+
+/* Wait until all queued operations of this process have been applied at
+ * targets, which is reported by the root helper. */
+static void wait_agg_completion(MTCORE_AM_win * am)
+{
+    unsigned long issued;
+
+    if (am->agg_queue == NULL)
+        return;
+
+    issued = MTCORE_Atomic_load(&am->agg_issued);
+    if (MTCORE_Atomic_load(&am->agg_queue->completed) < issued) {
+        MTCORE_DBG_PRINT("MTCORE AM wait for %lu aggregated operations\n",
+                         issued - MTCORE_Atomic_load(&am->agg_queue->completed));
+        if (MTCORE_CMD_RING)
+            MTCORE_Cmd_ring_wake(MTCORE_CMD_RING);
+        while (MTCORE_Atomic_load(&am->agg_queue->completed) < issued)
+            sched_yield();
+    }
+
+    complete_agg_fops(am);
+}
+
+static inline int get_free_fop_slot(MTCORE_AM_win * am)
+{
+    int i;
+    for (i = 0; i < MTCORE_AM_AGG_MAX_FOPS; i++) {
+        if (am->fop_seqs[i] == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* Deposit an operation into the queue of this process, wait if the queue is
+ * full. An entry never wraps around, the end of queue is padded instead. The
+ * result of fetch_and_op is copied to result_addr at completion. */
+static void enqueue_agg_pkt(const MTCORE_AM_pkt * pkt, const void *data, int data_size,
+                            int h_rank, void *result_addr, int result_size, MTCORE_AM_win * am)
+{
+    MTCORE_AM_agg_queue *queue = am->agg_queue;
+    MTCORE_AM_agg_entry *entry;
+    unsigned long head, off, pad;
+    int size = (sizeof(MTCORE_AM_agg_entry) + data_size + 7) & ~7;
+    int slot = 0;
+
+    pthread_mutex_lock(&am->agg_lock);
+
+    if (result_addr) {
+        while ((slot = get_free_fop_slot(am)) < 0) {
+            pthread_mutex_unlock(&am->agg_lock);
+            wait_agg_completion(am);
+            pthread_mutex_lock(&am->agg_lock);
+        }
+    }
+
+    head = queue->head;
+    off = head % MTCORE_AM_AGG_QUEUE_SIZE;
+    pad = off + size > MTCORE_AM_AGG_QUEUE_SIZE ? MTCORE_AM_AGG_QUEUE_SIZE - off : 0;
+    while (head + pad + size - MTCORE_Atomic_load(&queue->tail) > MTCORE_AM_AGG_QUEUE_SIZE) {
+        if (MTCORE_CMD_RING)
+            MTCORE_Cmd_ring_wake(MTCORE_CMD_RING);
+        sched_yield();
+    }
+
+    if (pad > 0) {
+        entry = (MTCORE_AM_agg_entry *) & queue->buf[off];
+        entry->size = (int) pad;
+        entry->h_rank = -1;
+        head += pad;
+        off = 0;
+    }
+
+    entry = (MTCORE_AM_agg_entry *) & queue->buf[off];
+    entry->size = size;
+    entry->h_rank = h_rank;
+    entry->pkt = *pkt;
+    if (data_size > 0)
+        memcpy((char *) entry + sizeof(MTCORE_AM_agg_entry), data, data_size);
+
+    if (result_addr) {
+        entry->pkt.reply_tag = slot;
+        am->fop_result_addrs[slot] = result_addr;
+        am->fop_sizes[slot] = result_size;
+        am->fop_seqs[slot] = am->agg_issued + 1;
+        MTCORE_Atomic_store(&am->num_fops, am->num_fops + 1);
+    }
+
+    MTCORE_Atomic_store(&queue->head, head + size);
+    MTCORE_Atomic_store(&am->agg_issued, am->agg_issued + 1);
+
+    pthread_mutex_unlock(&am->agg_lock);
+
+    /* Root helper may be sleeping on the command ring */
+    if (MTCORE_CMD_RING)
+        MTCORE_Cmd_ring_wake(MTCORE_CMD_RING);
+}
+
+static int flush_helpers(int num_h, const int *h_ranks, MTCORE_Win * uh_win);
+
+/* Complete accumulate-class operations issued to target through MPI RMA, on
+ * the window they were issued on (see MTCORE_Get_epoch_acc_win). */
+static int flush_rma_acc(int target_rank, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int k;
+
+    switch (MTCORE_Atomic_load(&uh_win->epoch_stat)) {
+    case MTCORE_WIN_EPOCH_FENCE:
+    case MTCORE_WIN_EPOCH_PSCW:
+        for (k = 0; k < uh_win->num_h; k++) {
+            mpi_errno = PMPI_Win_flush(uh_win->targets[target_rank].h_ranks_in_uh[k],
+                                       uh_win->active_win);
+            if (mpi_errno != MPI_SUCCESS)
+                return mpi_errno;
+        }
+        break;
+    default:
+        mpi_errno = uh_win->sync->flush(target_rank, uh_win->targets[target_rank].uh_win,
+                                        uh_win);
+        break;
+    }
+
+    MTCORE_DBG_PRINT("MTCORE AM flushed MPI RMA accumulates to target %d\n", target_rank);
+    return mpi_errno;
+}
+
+/* Issue a descriptor to the main helper of target. Replies of get and direct
+ * fetch_and_op are posted by callers with reply_tag, whereas the result of
+ * queued fetch_and_op is copied to result_addr at completion. */
+static int issue_pkt(int type, const void *origin_addr, int count, MPI_Datatype datatype,
+                     MPI_Op op, int target_rank, MPI_Aint target_disp, int reply_tag,
+                     void *result_addr, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_AM_win *am = uh_win->am;
+    MTCORE_AM_pkt *pkt = NULL, agg_pkt;
+    MPI_Request req = MPI_REQUEST_NULL;
+    MPI_Aint h_offset = 0;
+    int h_rank, dtsize = 0, data_size = 0;
+
+    mpi_errno = grant_am_lock(target_rank, uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    h_rank = get_am_helper(target_rank, uh_win, &h_offset);
+
+    PMPI_Type_size(datatype, &dtsize);
+    if (origin_addr != NULL)
+        data_size = dtsize * count;
+
+    /* Accumulate-class operations must not overtake those issued through MPI RMA */
+    if ((type == MTCORE_AM_PKT_ACC || type == MTCORE_AM_PKT_FOP) &&
+        MTCORE_Atomic_cas(&uh_win->targets[target_rank].am_rma_acc_issued, 1, 0)) {
+        mpi_errno = flush_rma_acc(target_rank, uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
+
+    if (is_agg_pkt(type, count, data_size, datatype, op, target_rank, uh_win)) {
+        /* Accumulate-class operations must not overtake direct ones */
+        if ((type == MTCORE_AM_PKT_ACC || type == MTCORE_AM_PKT_FOP) &&
+            MTCORE_Atomic_load(&am->h_acc_issued[h_rank])) {
+            mpi_errno = flush_helpers(1, &h_rank, uh_win);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
+        pkt = &agg_pkt;
+    }
+    else {
+        /* Accumulate-class operations must not overtake queued ones */
+        if (type == MTCORE_AM_PKT_ACC || type == MTCORE_AM_PKT_FOP)
+            wait_agg_completion(am);
+
+        pkt = malloc(sizeof(MTCORE_AM_pkt) + data_size);
+        if (pkt == NULL) {
+            mpi_errno = MPI_ERR_NO_MEM;
+            goto fn_fail;
+        }
+    }
+
+    pkt->type = type;
+    pkt->dtype_idx = get_dtype_idx(datatype);
+    pkt->op_idx = op != MPI_OP_NULL ? get_op_idx(op) : -1;
+    pkt->count = count;
+    pkt->reply_tag = reply_tag;
+    pkt->target_offset = h_offset + uh_win->targets[target_rank].disp_unit * target_disp;
+
+    if (pkt == &agg_pkt) {
+        enqueue_agg_pkt(pkt, origin_addr, data_size, h_rank, result_addr, dtsize, am);
+        MTCORE_DBG_PRINT("MTCORE AM pkt %d to (helper %d) instead of target %d queued, "
+                         "offset 0x%lx, count %d\n", type, h_rank, target_rank,
+                         pkt->target_offset, count);
+        goto fn_exit;
+    }
+
+    if (data_size > 0)
+        memcpy((char *) pkt + sizeof(MTCORE_AM_pkt), origin_addr, data_size);
+
+    mpi_errno = PMPI_Isend(pkt, sizeof(MTCORE_AM_pkt) + data_size, MPI_BYTE, h_rank,
+                           MTCORE_AM_TAG, am->comm, &req);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    MTCORE_Atomic_store(&am->h_issued[h_rank], 1);
+    if (type == MTCORE_AM_PKT_ACC || type == MTCORE_AM_PKT_FOP)
+        MTCORE_Atomic_store(&am->h_acc_issued[h_rank], 1);
+
+    MTCORE_DBG_PRINT("MTCORE AM pkt %d to (helper %d) instead of target %d, "
+                     "offset 0x%lx, count %d, dtype_idx %d, op_idx %d, reply_tag %d\n",
+                     type, h_rank, target_rank, pkt->target_offset, count, pkt->dtype_idx,
+                     pkt->op_idx, reply_tag);
+
+    mpi_errno = add_pending_req(req, pkt, am);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+  fn_exit:
+    return mpi_errno;
+
+  fn_fail:
+    if (req == MPI_REQUEST_NULL && pkt && pkt != &agg_pkt)
+        free(pkt);
+    goto fn_exit;
+}
+
+int MTCORE_AM_put(const void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+                  int target_rank, MPI_Aint target_disp, MTCORE_Win * uh_win)
+{
+    return issue_pkt(MTCORE_AM_PKT_PUT, origin_addr, origin_count, origin_datatype,
+                     MPI_OP_NULL, target_rank, target_disp, 0, NULL, uh_win);
+}
+
+int MTCORE_AM_accumulate(const void *origin_addr, int origin_count,
+                         MPI_Datatype origin_datatype, int target_rank, MPI_Aint target_disp,
+                         MPI_Op op, MTCORE_Win * uh_win)
+{
+    return issue_pkt(MTCORE_AM_PKT_ACC, origin_addr, origin_count, origin_datatype,
+                     op, target_rank, target_disp, 0, NULL, uh_win);
+}
+
+static int post_reply(void *result_addr, int count, MPI_Datatype datatype, int target_rank,
+                      int reply_tag, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MPI_Request req = MPI_REQUEST_NULL;
+    MPI_Aint h_offset = 0;
+    int h_rank = get_am_helper(target_rank, uh_win, &h_offset);
+
+    /* Post receive before issuing descriptor, so that reply never goes
+     * unexpected path. */
+    mpi_errno = PMPI_Irecv(result_addr, count, datatype, h_rank, reply_tag,
+                           uh_win->am->comm, &req);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    return add_pending_req(req, NULL, uh_win->am);
+}
+
+int MTCORE_AM_get(void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+                  int target_rank, MPI_Aint target_disp, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int reply_tag = get_reply_tag(uh_win->am);
+
+    mpi_errno = post_reply(origin_addr, origin_count, origin_datatype, target_rank,
+                           reply_tag, uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    return issue_pkt(MTCORE_AM_PKT_GET, NULL, origin_count, origin_datatype, MPI_OP_NULL,
+                     target_rank, target_disp, reply_tag, NULL, uh_win);
+}
+
+int MTCORE_AM_fetch_and_op(const void *origin_addr, void *result_addr,
+                           MPI_Datatype datatype, int target_rank, MPI_Aint target_disp,
+                           MPI_Op op, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int reply_tag;
+
+    if (is_agg_pkt(MTCORE_AM_PKT_FOP, 1, 0, datatype, op, target_rank, uh_win))
+        return issue_pkt(MTCORE_AM_PKT_FOP, origin_addr, 1, datatype, op, target_rank,
+                         target_disp, 0, result_addr, uh_win);
+
+    reply_tag = get_reply_tag(uh_win->am);
+    mpi_errno = post_reply(result_addr, 1, datatype, target_rank, reply_tag, uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    /* origin buffer is ignored in NO_OP */
+    return issue_pkt(MTCORE_AM_PKT_FOP, op == MPI_NO_OP ? NULL : origin_addr, 1, datatype,
+                     op, target_rank, target_disp, reply_tag, NULL, uh_win);
+}
+
+/* Issue get_accumulate as a fetch descriptor of count elements, which is never
+ * queued for aggregation. */
+int MTCORE_AM_get_accumulate(const void *origin_addr, void *result_addr, int count,
+                             MPI_Datatype datatype, int target_rank, MPI_Aint target_disp,
+                             MPI_Op op, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int reply_tag = get_reply_tag(uh_win->am);
+
+    mpi_errno = post_reply(result_addr, count, datatype, target_rank, reply_tag, uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    /* origin buffer is ignored in NO_OP */
+    return issue_pkt(MTCORE_AM_PKT_FOP, op == MPI_NO_OP ? NULL : origin_addr, count, datatype,
+                     op, target_rank, target_disp, reply_tag, NULL, uh_win);
+}
+
+/* Called before an accumulate-class operation to target is issued through MPI
+ * RMA on a window with AM transport. Completes previous AM operations to
+ * target, and the next AM accumulate completes this one first. */
+int MTCORE_AM_rma_acc_begin(int target_rank, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    if (uh_win->am == NULL)
+        return mpi_errno;
+
+    mpi_errno = MTCORE_AM_flush(target_rank, uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    MTCORE_Atomic_store(&uh_win->targets[target_rank].am_rma_acc_issued, 1);
+    return mpi_errno;
+}
+
+/* Send flush descriptors to the given helpers and wait for acknowledgments.
+ * Helpers apply descriptors in arrival order, thus every acknowledgment
+ * means all previous operations to that helper have been applied. */
+static int flush_helpers(int num_h, const int *h_ranks, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_AM_win *am = uh_win->am;
+    MTCORE_AM_pkt *pkts = NULL;
+    MPI_Request *reqs = NULL;
+    char *acks = NULL;
+    int i, num_flush = 0;
+
+    /* Queued operations are applied by the same helpers, but are completed
+     * only at acknowledgment of their batches. */
+    wait_agg_completion(am);
+
+    pkts = calloc(num_h, sizeof(MTCORE_AM_pkt));
+    reqs = calloc(num_h * 2, sizeof(MPI_Request));
+    acks = calloc(num_h, sizeof(char));
+
+    for (i = 0; i < num_h; i++) {
+        int h_rank = h_ranks[i];
+
+        /* Only flush helpers that received operations */
+        if (!MTCORE_Atomic_cas(&am->h_issued[h_rank], 1, 0))
+            continue;
+        MTCORE_Atomic_store(&am->h_acc_issued[h_rank], 0);
+
+        pkts[num_flush].type = MTCORE_AM_PKT_FLUSH;
+        pkts[num_flush].reply_tag = get_reply_tag(am);
+
+        mpi_errno = PMPI_Irecv(&acks[num_flush], 1, MPI_CHAR, h_rank,
+                               pkts[num_flush].reply_tag, am->comm, &reqs[num_flush * 2]);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+        mpi_errno = PMPI_Isend(&pkts[num_flush], sizeof(MTCORE_AM_pkt), MPI_BYTE, h_rank,
+                               MTCORE_AM_TAG, am->comm, &reqs[num_flush * 2 + 1]);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        MTCORE_DBG_PRINT("MTCORE AM flush helper %d, reply_tag %d\n", h_rank,
+                         pkts[num_flush].reply_tag);
+        num_flush++;
+    }
+
+    if (num_flush > 0) {
+        mpi_errno = PMPI_Waitall(num_flush * 2, reqs, MPI_STATUSES_IGNORE);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
+
+    /* Complete local buffers and replies of get and fetch_and_op */
+    mpi_errno = complete_pending_reqs(am);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+  fn_exit:
+    if (pkts)
+        free(pkts);
+    if (reqs)
+        free(reqs);
+    if (acks)
+        free(acks);
+    return mpi_errno;
+
+  fn_fail:
+    goto fn_exit;
+}
+
+int MTCORE_AM_flush(int target_rank, MTCORE_Win * uh_win)
+{
+    MPI_Aint h_offset = 0;
+    int h_rank;
+
+    if (uh_win->am == NULL)
+        return MPI_SUCCESS;
+
+    h_rank = get_am_helper(target_rank, uh_win, &h_offset);
+    return flush_helpers(1, &h_rank, uh_win);
+}
+
+int MTCORE_AM_flush_all(MTCORE_Win * uh_win)
+{
+    if (uh_win->am == NULL)
+        return MPI_SUCCESS;
+
+    return flush_helpers(uh_win->num_h_ranks_in_uh, uh_win->h_ranks_in_uh, uh_win);
+}
+
+/* Reset lock granting status at the beginning of a passive target epoch. */
+void MTCORE_AM_reset_lock(int target_rank, MTCORE_Win * uh_win)
+{
+    if (uh_win->am == NULL)
+        return;
+    MTCORE_Atomic_store(&uh_win->targets[target_rank].am_lock_granted, 0);
+}
+
+/* Allocate the queue of this process in the node shared segment, which is
+ * collective on local_uh_comm with helpers. */
+static int init_agg_queue(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_AM_win *am = uh_win->am;
+
+    mpi_errno = PMPI_Win_allocate_shared(sizeof(MTCORE_AM_agg_queue), 1, MPI_INFO_NULL,
+                                         uh_win->local_uh_comm, &am->agg_queue, &am->agg_win);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    am->agg_queue->head = 0;
+    am->agg_queue->tail = 0;
+    am->agg_queue->completed = 0;
+    am->agg_issued = 0;
+    pthread_mutex_init(&am->agg_lock, NULL);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    /* Helpers start to poll the queue after the barrier */
+    mpi_errno = PMPI_Barrier(uh_win->local_uh_comm);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    MTCORE_DBG_PRINT("Created AM aggregation queue %p\n", am->agg_queue);
+    return mpi_errno;
+}
+
+/**
+ * Create AM transport of the window, it is collective on uh_comm and must be
+ * matched with MTCORE_H_am_win_init on helpers.
+ */
+int MTCORE_AM_win_init(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int uh_nprocs = 0;
+    MTCORE_AM_win *am = NULL;
+
+    am = calloc(1, sizeof(MTCORE_AM_win));
+    if (am == NULL) {
+        mpi_errno = MPI_ERR_NO_MEM;
+        goto fn_fail;
+    }
+    am->agg_win = MPI_WIN_NULL;
+
+    mpi_errno = PMPI_Comm_dup(uh_win->uh_comm, &am->comm);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    PMPI_Comm_size(am->comm, &uh_nprocs);
+    am->h_issued = calloc(uh_nprocs, sizeof(int));
+    am->h_acc_issued = calloc(uh_nprocs, sizeof(int));
+    pthread_mutex_init(&am->reqs_lock, NULL);
+
+    uh_win->am = am;
+    MTCORE_DBG_PRINT("Created AM transport comm 0x%x\n", am->comm);
+
+    if (uh_win->info_args.rma_transport == MTCORE_RMA_TRANSPORT_AM_AGG) {
+        mpi_errno = init_agg_queue(uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_exit;
+    }
+
+  fn_exit:
+    return mpi_errno;
+
+  fn_fail:
+    if (am)
+        free(am);
+    goto fn_exit;
+}
+
+int MTCORE_AM_win_destroy(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_AM_win *am = uh_win->am;
+
+    if (am == NULL)
+        return mpi_errno;
+
+    /* All operations must have been completed in the last epoch */
+    mpi_errno = complete_pending_reqs(am);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    if (am->agg_win != MPI_WIN_NULL) {
+        mpi_errno = PMPI_Win_free(&am->agg_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        pthread_mutex_destroy(&am->agg_lock);
+        am->agg_queue = NULL;
+    }
+
+    if (am->comm != MPI_COMM_NULL) {
+        mpi_errno = PMPI_Comm_free(&am->comm);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+
+    pthread_mutex_destroy(&am->reqs_lock);
+    if (am->h_issued)
+        free(am->h_issued);
+    if (am->h_acc_issued)
+        free(am->h_acc_issued);
+    free(am);
+    uh_win->am = NULL;
+
+    return mpi_errno;
+}
@@ -0,0 +1,205 @@
+/*
+ * credit.c
+ *  <FILE_DESC>
+ *
+ *  Injection flow control per helper. Every origin counts the operations and
+ *  bytes it issued to each helper on each internal window since that helper
+ *  was last flushed on that window. Once the credits of a helper
+ *  (MTCORE_H_CREDIT_OPS, MTCORE_H_CREDIT_BYTES) run out, the next operation is
+ *  redirected to another helper of the target which still has credits if
+ *  ordering allows, otherwise the helper is flushed first. Thus a helper never
+ *  queues more than the given amount from one origin on one internal window,
+ *  e.g., in all-to-one patterns. Counters are cleared by user flushes and
+ *  unlocks of the windows they cover as well. They are updated without
+ *  locking, thus only approximate in multithreaded epochs. Active messages
+ *  are not counted, they are not completed by flushes of internal windows
+ *  but by MTCORE_AM_flush.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mtcore.h"
+
+static inline int is_credit_exhausted(MTCORE_Credit * credit, int size)
+{
+    int ops = MTCORE_Atomic_load(&credit->ops);
+    unsigned long bytes = MTCORE_Atomic_load(&credit->bytes);
+
+    /* A single operation larger than the byte credits is still issued. */
+    return (MTCORE_ENV.h_credit_ops > 0 && ops >= MTCORE_ENV.h_credit_ops) ||
+        (MTCORE_ENV.h_credit_bytes > 0 && bytes > 0 &&
+         bytes + size > (unsigned long) MTCORE_ENV.h_credit_bytes);
+}
+
+static inline void reset_credit(MTCORE_Credit * credit)
+{
+    MTCORE_Atomic_store(&credit->ops, 0);
+    MTCORE_Atomic_store(&credit->bytes, 0);
+}
+
+/* Get the credits of a helper on an internal window. Lock windows and their
+ * endpoints are counted separately, active windows share the first counters
+ * since they are only flushed all at once. */
+static inline MTCORE_Credit *get_credit(int h_rank, MPI_Win win, MTCORE_Win * uh_win)
+{
+    int w;
+
+    for (w = 0; w < uh_win->num_uh_wins; w++) {
+        if (uh_win->uh_wins[w] == win)
+            return &uh_win->h_credits[w][h_rank];
+    }
+    if (uh_win->ep_uh_wins) {
+        for (w = 1; w < uh_win->info_args.num_thread_eps; w++) {
+            if (uh_win->ep_uh_wins[w] == win)
+                return &uh_win->h_credits[w][h_rank];
+        }
+    }
+    return &uh_win->h_credits[0][h_rank];
+}
+
+/* Allocate counters of every helper on every internal window, called before
+ * internal windows are created. There are at most one lock window per local
+ * user, or one endpoint window per thread. */
+int MTCORE_Credit_alloc(int uh_nprocs, MTCORE_Win * uh_win)
+{
+    int w;
+
+    uh_win->num_credit_wins = max(uh_win->max_local_user_nprocs,
+                                  uh_win->info_args.num_thread_eps);
+    uh_win->num_credit_wins = max(uh_win->num_credit_wins, 1);
+    uh_win->h_credits = calloc(uh_win->num_credit_wins, sizeof(MTCORE_Credit *));
+    if (uh_win->h_credits == NULL)
+        return MPI_ERR_NO_MEM;
+    for (w = 0; w < uh_win->num_credit_wins; w++) {
+        uh_win->h_credits[w] = calloc(uh_nprocs, sizeof(MTCORE_Credit));
+        if (uh_win->h_credits[w] == NULL)
+            return MPI_ERR_NO_MEM;
+    }
+    return MPI_SUCCESS;
+}
+
+void MTCORE_Credit_free(MTCORE_Win * uh_win)
+{
+    int w;
+
+    if (uh_win->h_credits == NULL)
+        return;
+    for (w = 0; w < uh_win->num_credit_wins; w++) {
+        if (uh_win->h_credits[w])
+            free(uh_win->h_credits[w]);
+    }
+    free(uh_win->h_credits);
+    uh_win->h_credits = NULL;
+}
+
+/**
+ * Take credits of the helper chosen for an operation to target. The helper
+ * may be changed to another helper of the target if the operation is not
+ * ordered, or flushed in win if no helper has enough credits.
+ */
+int MTCORE_Credit_acquire_impl(int target_rank, int is_order_required, int count,
+                               MPI_Datatype datatype, MPI_Win win, MTCORE_Win * uh_win,
+                               int *target_h_rank_in_uh, MPI_Aint * target_h_offset)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int type_size = 0, size, ops, k;
+    unsigned long bytes;
+    MTCORE_Credit *credit;
+
+    PMPI_Type_size(datatype, &type_size);
+    size = type_size * count;
+    credit = get_credit(*target_h_rank_in_uh, win, uh_win);
+
+    if (is_credit_exhausted(credit, size)) {
+        if (!is_order_required && MTCORE_Is_any_helper_allowed(target_rank, uh_win)) {
+            for (k = 0; k < uh_win->num_h; k++) {
+                int h_rank = uh_win->targets[target_rank].h_ranks_in_uh[k];
+                if (!is_credit_exhausted(get_credit(h_rank, win, uh_win), size)) {
+                    MTCORE_DBG_PRINT("credit: redirect from helper %d to %d for target %d\n",
+                                     *target_h_rank_in_uh, h_rank, target_rank);
+                    *target_h_rank_in_uh = h_rank;
+                    *target_h_offset = uh_win->targets[target_rank].base_h_offsets[k];
+                    credit->num_redirects++;
+                    credit = get_credit(h_rank, win, uh_win);
+                    goto issue;
+                }
+            }
+        }
+
+        mpi_errno = PMPI_Win_flush(*target_h_rank_in_uh, win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        reset_credit(credit);
+        credit->num_flushes++;
+        MTCORE_DBG_PRINT("credit: flushed helper %d for target %d\n", *target_h_rank_in_uh,
+                         target_rank);
+    }
+
+  issue:
+    ops = MTCORE_Atomic_fetch_add(&credit->ops, 1) + 1;
+    bytes = MTCORE_Atomic_fetch_add(&credit->bytes, (unsigned long) size) + size;
+    if (ops > credit->max_ops)
+        credit->max_ops = ops;
+    if (bytes > credit->max_bytes)
+        credit->max_bytes = bytes;
+
+    return mpi_errno;
+}
+
+/* Clear credits of all helpers of target on win after they are flushed or
+ * unlocked on win. Operations of other targets sharing those helpers on win
+ * are completed as well. */
+void MTCORE_Credit_reset_target(int target_rank, MPI_Win win, MTCORE_Win * uh_win)
+{
+    int k;
+
+    if (uh_win->h_credits == NULL)
+        return;
+    for (k = 0; k < uh_win->num_h; k++)
+        reset_credit(get_credit(uh_win->targets[target_rank].h_ranks_in_uh[k], win, uh_win));
+}
+
+/* Clear credits of all helpers on all windows after a flush of all targets. */
+void MTCORE_Credit_reset_all(MTCORE_Win * uh_win)
+{
+    int i, w;
+
+    if (uh_win->h_credits == NULL)
+        return;
+    for (w = 0; w < uh_win->num_credit_wins; w++) {
+        for (i = 0; i < uh_win->num_h_ranks_in_uh; i++)
+            reset_credit(&uh_win->h_credits[w][uh_win->h_ranks_in_uh[i]]);
+    }
+}
+
+/* Report the high-water marks of queues on every helper of the window, over
+ * all internal windows. */
+void MTCORE_Credit_report(MTCORE_Win * uh_win)
+{
+    int i, w, user_rank, h_rank, max_ops;
+    unsigned long max_bytes, num_flushes, num_redirects;
+    MTCORE_Credit *credit;
+
+    if (uh_win->h_credits == NULL || !MTCORE_ENV.h_credit_stat)
+        return;
+
+    PMPI_Comm_rank(uh_win->user_comm, &user_rank);
+    for (i = 0; i < uh_win->num_h_ranks_in_uh; i++) {
+        h_rank = uh_win->h_ranks_in_uh[i];
+        max_ops = 0;
+        max_bytes = num_flushes = num_redirects = 0;
+        for (w = 0; w < uh_win->num_credit_wins; w++) {
+            credit = &uh_win->h_credits[w][h_rank];
+            max_ops = max(max_ops, credit->max_ops);
+            max_bytes = max(max_bytes, credit->max_bytes);
+            num_flushes += credit->num_flushes;
+            num_redirects += credit->num_redirects;
+        }
+        fprintf(stdout, "[MTCORE][%d] credit of helper %d: max ops %d, max bytes %lu, "
+                "flushes %lu, redirects %lu\n", user_rank, h_rank, max_ops, max_bytes,
+                num_flushes, num_redirects);
+    }
+    fflush(stdout);
+}
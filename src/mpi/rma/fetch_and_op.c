@@ -34,6 +34,11 @@ static int MTCORE_Fetch_and_op_segment_impl(const void *origin_addr, void *resul
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
 
+    mpi_errno = MTCORE_Credit_acquire(target_rank, 1, 1, datatype, seg_uh_win, uh_win,
+                                      &target_h_rank_in_uh, &target_h_offset);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
     /* Fetch_and_op only allows one predefined element which must be contained by
      * a single segmetn, thus we only need translate target displacement according to
      * its segment id. */
@@ -86,7 +91,8 @@ static int MTCORE_Fetch_and_op_impl(const void *origin_addr, void *result_addr,
      * operation, we still need call segmentation routine to get its the segment
      * number if target is divided to multiple segments. */
     if (MTCORE_ENV.lock_binding == MTCORE_LOCK_BINDING_SEGMENT &&
-        uh_win->targets[target_rank].num_segs > 1 && uh_win->epoch_stat == MTCORE_WIN_EPOCH_LOCK) {
+        uh_win->targets[target_rank].num_segs > 1 &&
+        MTCORE_Atomic_load(&uh_win->epoch_stat) == MTCORE_WIN_EPOCH_LOCK) {
         mpi_errno = MTCORE_Fetch_and_op_segment_impl(origin_addr, result_addr,
                                                      datatype, target_rank, target_disp, op,
                                                      win, uh_win);
@@ -107,7 +113,7 @@ static int MTCORE_Fetch_and_op_impl(const void *origin_addr, void *result_addr,
         MPI_Aint target_h_offset = 0;
         MPI_Win *win_ptr = NULL;
 
-        MTCORE_Get_epoch_win(target_rank, 0, uh_win, win_ptr);
+        MTCORE_Get_epoch_acc_win(target_rank, 0, uh_win, win_ptr);
 
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
         if (MTCORE_ENV.load_opt == MTCORE_LOAD_BYTE_COUNTING) {
@@ -119,6 +125,11 @@ static int MTCORE_Fetch_and_op_impl(const void *origin_addr, void *result_addr,
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
 
+        mpi_errno = MTCORE_Credit_acquire(target_rank, 1, 1, datatype, *win_ptr,
+                                          uh_win, &target_h_rank_in_uh, &target_h_offset);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
         uh_target_disp = target_h_offset + uh_win->targets[target_rank].disp_unit * target_disp;
 
         /* Issue operation to the helper process in corresponding uh-window of target process. */
@@ -154,8 +165,23 @@ int MPI_Fetch_and_op(const void *origin_addr, void *result_addr,
 
     MTCORE_Fetch_uh_win_from_cache(win, uh_win);
 
-    if (uh_win) {
+    if (uh_win && op == MPI_NO_OP && MTCORE_Acc_is_rewritable(target_rank, uh_win)) {
+        /* mtcore window, read-only fetch is issued as get */
+        mpi_errno = MTCORE_Get(result_addr, 1, datatype, target_rank, target_disp, 1, datatype,
+                               win, uh_win);
+    }
+    else if (uh_win && MTCORE_AM_is_supported(1, datatype, 1, datatype, op, uh_win)) {
+        /* mtcore window with active-message transport */
+        MTCORE_Shm_acc_mark_remote(target_rank, uh_win);
+        mpi_errno = MTCORE_AM_fetch_and_op(origin_addr, result_addr, datatype, target_rank,
+                                           target_disp, op, uh_win);
+    }
+    else if (uh_win) {
         /* mtcore window */
+        MTCORE_Shm_acc_mark_remote(target_rank, uh_win);
+        mpi_errno = MTCORE_AM_rma_acc_begin(target_rank, uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
         mpi_errno = MTCORE_Fetch_and_op_impl(origin_addr, result_addr, datatype, target_rank,
                                              target_disp, op, win, uh_win);
     }
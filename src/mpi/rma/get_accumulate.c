@@ -37,11 +37,12 @@ static int MTCORE_Get_accumulate_impl(const void *origin_addr, int origin_count,
         MPI_Aint target_h_offset = 0;
         MPI_Win *win_ptr = NULL;
 
-        MTCORE_Get_epoch_win(target_rank, 0, uh_win, win_ptr);
+        MTCORE_Get_epoch_acc_win(target_rank, 0, uh_win, win_ptr);
 
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
         if (MTCORE_ENV.load_opt == MTCORE_LOAD_BYTE_COUNTING) {
-            PMPI_Type_size(datatype, &data_size);
+            PMPI_Type_size(origin_datatype, &data_size);
+            data_size *= origin_count;
         }
 #endif
         mpi_errno = MTCORE_Get_helper_rank(target_rank, 0, 1, data_size, uh_win,
@@ -49,6 +50,11 @@ static int MTCORE_Get_accumulate_impl(const void *origin_addr, int origin_count,
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
 
+        mpi_errno = MTCORE_Credit_acquire(target_rank, 1, target_count, target_datatype, *win_ptr,
+                                          uh_win, &target_h_rank_in_uh, &target_h_offset);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
         uh_target_disp = target_h_offset + uh_win->targets[target_rank].disp_unit * target_disp;
 
         /* Issue operation to the helper process in corresponding uh-window of target process. */
@@ -87,8 +93,27 @@ int MPI_Get_accumulate(const void *origin_addr, int origin_count, MPI_Datatype o
 
     MTCORE_Fetch_uh_win_from_cache(win, uh_win);
 
-    if (uh_win) {
+    if (uh_win && op == MPI_NO_OP && MTCORE_Acc_is_rewritable(target_rank, uh_win)) {
+        /* mtcore window, read-only accumulate is issued as get */
+        mpi_errno = MTCORE_Get(result_addr, result_count, result_datatype, target_rank,
+                               target_disp, target_count, target_datatype, win, uh_win);
+    }
+    else if (uh_win && MTCORE_AM_is_supported(result_count, result_datatype, target_count,
+                                              target_datatype, op, uh_win) &&
+             (op == MPI_NO_OP || (origin_count == target_count &&
+                                  origin_datatype == target_datatype))) {
+        /* mtcore window with active-message transport */
+        MTCORE_Shm_acc_mark_remote(target_rank, uh_win);
+        mpi_errno = MTCORE_AM_get_accumulate(origin_addr, result_addr, target_count,
+                                             target_datatype, target_rank, target_disp, op,
+                                             uh_win);
+    }
+    else if (uh_win) {
         /* mtcore window */
+        MTCORE_Shm_acc_mark_remote(target_rank, uh_win);
+        mpi_errno = MTCORE_AM_rma_acc_begin(target_rank, uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
         mpi_errno = MTCORE_Get_accumulate_impl(origin_addr, origin_count, origin_datatype,
                                                result_addr, result_count, result_datatype,
                                                target_rank, target_disp, target_count,
@@ -14,17 +14,18 @@ void MTCORE_Get_helper_rank_load_opt_counting(int target_rank, int is_order_requ
                                               MTCORE_Win * uh_win, int *target_h_rank_in_uh,
                                               int *target_h_rank_idx, MPI_Aint * target_h_offset)
 {
-    int idx, min_count, h_rank, min_idx;
+    int idx, min_count, count, h_rank, min_idx;
 
     /* Choose the helper who has the lowest value of operation counting. */
     h_rank = uh_win->targets[target_rank].h_ranks_in_uh[0];
-    min_count = uh_win->h_ops_counts[h_rank];
+    min_count = MTCORE_Atomic_load(&uh_win->h_ops_counts[h_rank]);
     min_idx = 0;
 
-    for (idx = 1; idx < MTCORE_ENV.num_h; idx++) {
+    for (idx = 1; idx < uh_win->num_h; idx++) {
         h_rank = uh_win->targets[target_rank].h_ranks_in_uh[idx];
-        if (uh_win->h_ops_counts[h_rank] < min_count) {
-            min_count = uh_win->h_ops_counts[h_rank];
+        count = MTCORE_Atomic_load(&uh_win->h_ops_counts[h_rank]);
+        if (count < min_count) {
+            min_count = count;
             min_idx = idx;
         }
     }
@@ -46,17 +47,19 @@ void MTCORE_Get_helper_rank_load_byte_counting(int target_rank, int is_order_req
                                                MTCORE_Win * uh_win, int *target_h_rank_in_uh,
                                                int *target_h_rank_idx, MPI_Aint * target_h_offset)
 {
-    int idx, min_count, h_rank, min_idx;
+    int idx, h_rank, min_idx;
+    unsigned long min_count, count;
 
     /* Choose the helper who has the lowest value of operation counting. */
     h_rank = uh_win->targets[target_rank].h_ranks_in_uh[0];
-    min_count = uh_win->h_bytes_counts[h_rank];
+    min_count = MTCORE_Atomic_load(&uh_win->h_bytes_counts[h_rank]);
     min_idx = 0;
 
-    for (idx = 1; idx < MTCORE_ENV.num_h; idx++) {
+    for (idx = 1; idx < uh_win->num_h; idx++) {
         h_rank = uh_win->targets[target_rank].h_ranks_in_uh[idx];
-        if (uh_win->h_bytes_counts[h_rank] < min_count) {
-            min_count = uh_win->h_bytes_counts[h_rank];
+        count = MTCORE_Atomic_load(&uh_win->h_bytes_counts[h_rank]);
+        if (count < min_count) {
+            min_count = count;
             min_idx = idx;
         }
     }
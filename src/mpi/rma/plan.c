@@ -0,0 +1,329 @@
+/*
+ * plan.c
+ *  <FILE_DESC>
+ *
+ *  Persistent RMA operations (MPIX_Put_init, MPIX_Accumulate_init and
+ *  MPIX_Start), e.g., for halo exchanges issued every iteration with the same
+ *  arguments. The translation of an operation, i.e., helper rank, internal
+ *  window, displacement and segment division, is resolved once and reused by
+ *  every start. It is only rebuilt when the epoch type of the window changes,
+ *  because the helper binding of a target is fixed at window allocation.
+ *
+ *  Operations whose translation is decided at runtime are issued through the
+ *  normal path on every start: runtime load balancing, thread endpoints,
+ *  active messages, injection credits, striping, local targets in self lock
+ *  epochs, and accumulates done in shared memory or rewritten into put.
+ *
+ *  Buffers and datatypes of a plan must stay valid until it is freed, and a
+ *  plan must be freed before its window.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mtcore.h"
+
+typedef enum {
+    MTCORE_PLAN_PUT,
+    MTCORE_PLAN_ACC,
+} MTCORE_Plan_type;
+
+/* A translated operation issued to a helper. */
+typedef struct MTCORE_Plan_op {
+    void *origin_addr;
+    int origin_count;
+    MPI_Datatype origin_datatype;
+    int target_h_rank_in_uh;
+    MPI_Aint uh_target_disp;
+    int target_count;
+    MPI_Datatype target_datatype;
+    MPI_Win uh_win;
+} MTCORE_Plan_op;
+
+typedef struct MTCORE_Plan {
+    MTCORE_Plan_type type;
+    const void *origin_addr;
+    int origin_count;
+    MPI_Datatype origin_datatype;
+    int target_rank;
+    MPI_Aint target_disp;
+    int target_count;
+    MPI_Datatype target_datatype;
+    MPI_Op op;
+    MPI_Win win;
+
+    MTCORE_Win *uh_win;         /* NULL if win is not a mtcore window */
+    int is_translatable;        /* 0 if every start goes through the normal path */
+    int is_self;
+    int epoch_stat;             /* epoch type the translation is built for, -1 if none */
+    int num_ops;                /* 0 if the operation is not translatable in this epoch */
+    MTCORE_Plan_op *ops;
+} MTCORE_Plan;
+
+static int plan_init(MTCORE_Plan_type type, const void *origin_addr, int origin_count,
+                     MPI_Datatype origin_datatype, int target_rank, MPI_Aint target_disp,
+                     int target_count, MPI_Datatype target_datatype, MPI_Op op, MPI_Win win,
+                     void **plan_ptr)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Win *uh_win = NULL;
+    MTCORE_Plan *plan = NULL;
+    int user_rank = 0;
+
+    MTCORE_Fetch_uh_win_from_cache(win, uh_win);
+
+    plan = calloc(1, sizeof(MTCORE_Plan));
+    if (plan == NULL)
+        return MPI_ERR_NO_MEM;
+
+    plan->type = type;
+    plan->origin_addr = origin_addr;
+    plan->origin_count = origin_count;
+    plan->origin_datatype = origin_datatype;
+    plan->target_rank = target_rank;
+    plan->target_disp = target_disp;
+    plan->target_count = target_count;
+    plan->target_datatype = target_datatype;
+    plan->op = op;
+    plan->win = win;
+    plan->uh_win = uh_win;
+    plan->epoch_stat = -1;
+
+    if (uh_win) {
+        PMPI_Comm_rank(uh_win->user_comm, &user_rank);
+        plan->is_self = (target_rank == user_rank);
+
+#if !defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
+        plan->is_translatable = uh_win->ep_uh_wins == NULL && uh_win->ep_active_wins == NULL &&
+            uh_win->h_credits == NULL &&
+            !MTCORE_AM_is_supported(origin_count, origin_datatype, target_count,
+                                    target_datatype, type == MTCORE_PLAN_ACC ? op : MPI_OP_NULL,
+                                    uh_win);
+#endif
+    }
+
+    MTCORE_DBG_PRINT("plan %p: %s to target %d, disp 0x%lx, count %d, translatable %d\n",
+                     plan, type == MTCORE_PLAN_PUT ? "put" : "accumulate", target_rank,
+                     target_disp, target_count, plan->is_translatable);
+
+    *plan_ptr = plan;
+    return mpi_errno;
+}
+
+/* Resolve helpers and internal windows of the operation for the current epoch. */
+static int plan_build(MTCORE_Plan * plan, int epoch_stat)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Win *uh_win = plan->uh_win;
+    int target_rank = plan->target_rank;
+    MTCORE_OP_Segment *decoded_ops = NULL;
+    int num_segs = 0, i;
+
+    if (plan->ops)
+        free(plan->ops);
+    plan->ops = NULL;
+    plan->num_ops = 0;
+    plan->epoch_stat = epoch_stat;
+
+    if (plan->type == MTCORE_PLAN_PUT &&
+        MTCORE_Stripe_is_supported(plan->origin_count, plan->origin_datatype, target_rank,
+                                   plan->target_count, plan->target_datatype, uh_win))
+        goto fn_exit;
+
+    if (MTCORE_ENV.lock_binding == MTCORE_LOCK_BINDING_SEGMENT &&
+        uh_win->targets[target_rank].num_segs > 1 && epoch_stat == MTCORE_WIN_EPOCH_LOCK) {
+        mpi_errno = MTCORE_Op_segments_decode(plan->origin_addr, plan->origin_count,
+                                              plan->origin_datatype, target_rank,
+                                              plan->target_disp, plan->target_count,
+                                              plan->target_datatype, uh_win, &decoded_ops,
+                                              &num_segs);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        plan->ops = calloc(num_segs, sizeof(MTCORE_Plan_op));
+        for (i = 0; i < num_segs; i++) {
+            MTCORE_Plan_op *plan_op = &plan->ops[i];
+            int seg_off = decoded_ops[i].target_seg_off;
+            MPI_Aint target_h_offset = 0;
+
+            mpi_errno = MTCORE_Get_helper_rank(target_rank, seg_off,
+                                               plan->type == MTCORE_PLAN_ACC,
+                                               decoded_ops[i].target_dtsize, uh_win,
+                                               &plan_op->target_h_rank_in_uh, &target_h_offset);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+
+            plan_op->origin_addr = decoded_ops[i].origin_addr;
+            plan_op->origin_count = decoded_ops[i].origin_count;
+            plan_op->origin_datatype = decoded_ops[i].origin_datatype;
+            plan_op->uh_target_disp = target_h_offset
+                + uh_win->targets[target_rank].disp_unit * decoded_ops[i].target_disp;
+            plan_op->target_count = decoded_ops[i].target_count;
+            plan_op->target_datatype = decoded_ops[i].target_datatype;
+            plan_op->uh_win = uh_win->targets[target_rank].segs[seg_off].uh_win;
+        }
+        plan->num_ops = num_segs;
+    }
+    else {
+        MTCORE_Plan_op *plan_op = NULL;
+        MPI_Aint target_h_offset = 0;
+        MPI_Win *win_ptr = NULL;
+
+        plan->ops = calloc(1, sizeof(MTCORE_Plan_op));
+        plan_op = &plan->ops[0];
+
+        MTCORE_Get_epoch_win(target_rank, 0, uh_win, win_ptr);
+        mpi_errno = MTCORE_Get_helper_rank(target_rank, 0, plan->type == MTCORE_PLAN_ACC, 0,
+                                           uh_win, &plan_op->target_h_rank_in_uh,
+                                           &target_h_offset);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        plan_op->origin_addr = (void *) plan->origin_addr;
+        plan_op->origin_count = plan->origin_count;
+        plan_op->origin_datatype = plan->origin_datatype;
+        plan_op->uh_target_disp = target_h_offset
+            + uh_win->targets[target_rank].disp_unit * plan->target_disp;
+        plan_op->target_count = plan->target_count;
+        plan_op->target_datatype = plan->target_datatype;
+        plan_op->uh_win = *win_ptr;
+        plan->num_ops = 1;
+    }
+
+    MTCORE_DBG_PRINT("plan %p: built %d operations for epoch %s\n", plan, plan->num_ops,
+                     MTCORE_Win_epoch_stat_name[epoch_stat]);
+
+  fn_exit:
+    MTCORE_Op_segments_destroy(&decoded_ops);
+    return mpi_errno;
+
+  fn_fail:
+    if (plan->ops)
+        free(plan->ops);
+    plan->ops = NULL;
+    plan->num_ops = 0;
+    plan->epoch_stat = -1;
+    goto fn_exit;
+}
+
+/* Issue the operation through the normal translation path. */
+static int plan_issue_normal(MTCORE_Plan * plan)
+{
+    if (plan->type == MTCORE_PLAN_PUT)
+        return MPI_Put(plan->origin_addr, plan->origin_count, plan->origin_datatype,
+                       plan->target_rank, plan->target_disp, plan->target_count,
+                       plan->target_datatype, plan->win);
+    return MPI_Accumulate(plan->origin_addr, plan->origin_count, plan->origin_datatype,
+                          plan->target_rank, plan->target_disp, plan->target_count,
+                          plan->target_datatype, plan->op, plan->win);
+}
+
+/* Check decisions of the normal path which change between epochs of the same type. */
+static inline int plan_is_normal_required(MTCORE_Plan * plan)
+{
+    MTCORE_Win *uh_win = plan->uh_win;
+
+#ifdef MTCORE_ENABLE_LOCAL_LOCK_OPT
+    if (plan->type == MTCORE_PLAN_PUT && plan->is_self &&
+        MTCORE_Atomic_load(&uh_win->is_self_locked))
+        return 1;
+#endif
+    if (plan->type == MTCORE_PLAN_ACC &&
+        (MTCORE_Shm_acc_is_supported(plan->origin_count, plan->origin_datatype,
+                                     plan->target_count, plan->target_datatype, plan->op,
+                                     plan->target_rank, uh_win) ||
+         (plan->op == MPI_REPLACE && MTCORE_Acc_is_rewritable(plan->target_rank, uh_win))))
+        return 1;
+    return 0;
+}
+
+int MPIX_Put_init(const void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+                  int target_rank, MPI_Aint target_disp, int target_count,
+                  MPI_Datatype target_datatype, MPI_Win win, void **plan)
+{
+    return plan_init(MTCORE_PLAN_PUT, origin_addr, origin_count, origin_datatype, target_rank,
+                     target_disp, target_count, target_datatype, MPI_OP_NULL, win, plan);
+}
+
+int MPIX_Accumulate_init(const void *origin_addr, int origin_count,
+                         MPI_Datatype origin_datatype, int target_rank, MPI_Aint target_disp,
+                         int target_count, MPI_Datatype target_datatype, MPI_Op op,
+                         MPI_Win win, void **plan)
+{
+    return plan_init(MTCORE_PLAN_ACC, origin_addr, origin_count, origin_datatype, target_rank,
+                     target_disp, target_count, target_datatype, op, win, plan);
+}
+
+int MPIX_Start(void *plan_ptr)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Plan *plan = (MTCORE_Plan *) plan_ptr;
+    MTCORE_Win *uh_win = plan->uh_win;
+    int epoch_stat, i;
+
+    if (uh_win == NULL) {
+        /* normal window */
+        if (plan->type == MTCORE_PLAN_PUT)
+            return PMPI_Put(plan->origin_addr, plan->origin_count, plan->origin_datatype,
+                            plan->target_rank, plan->target_disp, plan->target_count,
+                            plan->target_datatype, plan->win);
+        return PMPI_Accumulate(plan->origin_addr, plan->origin_count, plan->origin_datatype,
+                               plan->target_rank, plan->target_disp, plan->target_count,
+                               plan->target_datatype, plan->op, plan->win);
+    }
+
+    if (!plan->is_translatable || plan_is_normal_required(plan))
+        return plan_issue_normal(plan);
+
+    epoch_stat = MTCORE_Atomic_load(&uh_win->epoch_stat);
+    if (epoch_stat != plan->epoch_stat) {
+        mpi_errno = plan_build(plan, epoch_stat);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
+    if (plan->num_ops == 0)
+        return plan_issue_normal(plan);
+
+    if (plan->type == MTCORE_PLAN_ACC)
+        MTCORE_Shm_acc_mark_remote(plan->target_rank, uh_win);
+
+    for (i = 0; i < plan->num_ops; i++) {
+        MTCORE_Plan_op *plan_op = &plan->ops[i];
+
+        if (plan->type == MTCORE_PLAN_PUT)
+            mpi_errno = PMPI_Put(plan_op->origin_addr, plan_op->origin_count,
+                                 plan_op->origin_datatype, plan_op->target_h_rank_in_uh,
+                                 plan_op->uh_target_disp, plan_op->target_count,
+                                 plan_op->target_datatype, plan_op->uh_win);
+        else
+            mpi_errno = PMPI_Accumulate(plan_op->origin_addr, plan_op->origin_count,
+                                        plan_op->origin_datatype, plan_op->target_h_rank_in_uh,
+                                        plan_op->uh_target_disp, plan_op->target_count,
+                                        plan_op->target_datatype, plan->op, plan_op->uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
+
+  fn_exit:
+    return mpi_errno;
+
+  fn_fail:
+    goto fn_exit;
+}
+
+int MPIX_Plan_free(void **plan_ptr)
+{
+    MTCORE_Plan *plan = (MTCORE_Plan *) (*plan_ptr);
+
+    if (plan == NULL)
+        return MPI_SUCCESS;
+
+    if (plan->ops)
+        free(plan->ops);
+    free(plan);
+    *plan_ptr = NULL;
+
+    return MPI_SUCCESS;
+}
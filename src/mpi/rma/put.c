@@ -10,14 +10,20 @@ static int MTCORE_Put_shared_impl(const void *origin_addr, int origin_count,
 {
     int mpi_errno = MPI_SUCCESS;
     MPI_Win *win_ptr = &uh_win->my_uh_win;
+    MPI_Aint uh_target_disp = target_disp;
 
     MTCORE_Get_epoch_local_win(uh_win, win_ptr);
 
+    /* A window host exposes the whole node segment as helper. */
+    if (MTCORE_Is_win_host(uh_win, target_rank))
+        uh_target_disp = uh_win->targets[target_rank].base_h_offsets[0]
+            + uh_win->targets[target_rank].disp_unit * target_disp;
+
     /* Issue operation to the target through local shared window, because shared
      * communication is fully handled by local process.
      */
     mpi_errno = PMPI_Put(origin_addr, origin_count, origin_datatype,
-                         uh_win->my_rank_in_uh_comm, target_disp,
+                         uh_win->my_rank_in_uh_comm, uh_target_disp,
                          target_count, target_datatype, *win_ptr);
     MTCORE_DBG_PRINT("MTCORE PUT to self(%d, in local win 0x%x)\n",
                      uh_win->my_rank_in_uh_comm, *win_ptr);
@@ -58,13 +64,21 @@ static int MTCORE_Put_segment_impl(const void *origin_addr, int origin_count,
         MPI_Aint target_h_offset = 0;
         MPI_Aint uh_target_disp = 0;
         int seg_off = decoded_ops[i].target_seg_off;
-        MPI_Win seg_uh_win = uh_win->targets[target_rank].segs[seg_off].uh_win;
+        MPI_Win *seg_win_ptr = &uh_win->targets[target_rank].segs[seg_off].uh_win;
+        MPI_Win seg_uh_win = *MTCORE_Get_ep_uh_win_ptr(uh_win, seg_win_ptr);
 
         mpi_errno = MTCORE_Get_helper_rank(target_rank, seg_off, 0, decoded_ops[i].target_dtsize,
                                            uh_win, &target_h_rank_in_uh, &target_h_offset);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
 
+        /* The segment is bound to its helper, thus it is flushed once out of credits. */
+        mpi_errno = MTCORE_Credit_acquire(target_rank, 1, decoded_ops[i].target_count,
+                                          decoded_ops[i].target_datatype, seg_uh_win, uh_win,
+                                          &target_h_rank_in_uh, &target_h_offset);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
         uh_target_disp = target_h_offset
             + uh_win->targets[target_rank].disp_unit * decoded_ops[i].target_disp;
 
@@ -109,7 +123,7 @@ static int MTCORE_Put_impl(const void *origin_addr, int origin_count,
 
     PMPI_Comm_rank(uh_win->user_comm, &rank);
 #ifdef MTCORE_ENABLE_LOCAL_LOCK_OPT
-    if (target_rank == rank && uh_win->is_self_locked) {
+    if (target_rank == rank && MTCORE_Atomic_load(&uh_win->is_self_locked)) {
         /* If target is itself, we do not need translate it to any Helpers because
          * win_lock(self) will force lock(helper) to be granted so that it is safe
          * to send operations to the real target.
@@ -128,7 +142,7 @@ static int MTCORE_Put_impl(const void *origin_addr, int origin_count,
          * 2. overhead of data range checking and division */
         if (MTCORE_ENV.lock_binding == MTCORE_LOCK_BINDING_SEGMENT &&
             uh_win->targets[target_rank].num_segs > 1 &&
-            uh_win->epoch_stat == MTCORE_WIN_EPOCH_LOCK) {
+            MTCORE_Atomic_load(&uh_win->epoch_stat) == MTCORE_WIN_EPOCH_LOCK) {
             mpi_errno = MTCORE_Put_segment_impl(origin_addr, origin_count,
                                                 origin_datatype, target_rank, target_disp,
                                                 target_count, target_datatype, win, uh_win);
@@ -151,6 +165,14 @@ static int MTCORE_Put_impl(const void *origin_addr, int origin_count,
 
             MTCORE_Get_epoch_win(target_rank, 0, uh_win, win_ptr);
 
+            /* Large contiguous operation is issued to all helpers of target. */
+            if (MTCORE_Stripe_is_supported(origin_count, origin_datatype, target_rank,
+                                           target_count, target_datatype, uh_win)) {
+                mpi_errno = MTCORE_Stripe_put(origin_addr, origin_count, origin_datatype,
+                                              target_rank, target_disp, *win_ptr, uh_win);
+                goto fn_exit;
+            }
+
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
             if (MTCORE_ENV.load_opt == MTCORE_LOAD_BYTE_COUNTING) {
                 PMPI_Type_size(origin_datatype, &data_size);
@@ -162,6 +184,12 @@ static int MTCORE_Put_impl(const void *origin_addr, int origin_count,
             if (mpi_errno != MPI_SUCCESS)
                 goto fn_fail;
 
+            mpi_errno = MTCORE_Credit_acquire(target_rank, 0, target_count, target_datatype,
+                                              *win_ptr, uh_win, &target_h_rank_in_uh,
+                                              &target_h_offset);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+
             uh_target_disp = target_h_offset + uh_win->targets[target_rank].disp_unit * target_disp;
 
             /* Issue operation to the helper process in corresponding uh-window of target process. */
@@ -186,6 +214,22 @@ static int MTCORE_Put_impl(const void *origin_addr, int origin_count,
     goto fn_exit;
 }
 
+/* Put on mtcore window, also issues accumulates rewritten into put. */
+int MTCORE_Put(const void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+               int target_rank, MPI_Aint target_disp, int target_count,
+               MPI_Datatype target_datatype, MPI_Win win, MTCORE_Win * uh_win)
+{
+    if (MTCORE_AM_is_supported(origin_count, origin_datatype, target_count, target_datatype,
+                               MPI_OP_NULL, uh_win)) {
+        /* active-message transport */
+        return MTCORE_AM_put(origin_addr, origin_count, origin_datatype, target_rank,
+                             target_disp, uh_win);
+    }
+
+    return MTCORE_Put_impl(origin_addr, origin_count, origin_datatype, target_rank, target_disp,
+                           target_count, target_datatype, win, uh_win);
+}
+
 int MPI_Put(const void *origin_addr, int origin_count,
             MPI_Datatype origin_datatype,
             int target_rank, MPI_Aint target_disp,
@@ -201,9 +245,8 @@ int MPI_Put(const void *origin_addr, int origin_count,
 
     if (uh_win) {
         /* mtcore window */
-        mpi_errno = MTCORE_Put_impl(origin_addr, origin_count,
-                                    origin_datatype, target_rank, target_disp, target_count,
-                                    target_datatype, win, uh_win);
+        mpi_errno = MTCORE_Put(origin_addr, origin_count, origin_datatype, target_rank,
+                               target_disp, target_count, target_datatype, win, uh_win);
     }
     else {
         /* normal window */
@@ -0,0 +1,305 @@
+/*
+ * shm_acc.c
+ *  <FILE_DESC>
+ *
+ *  Shared-memory accumulate for same-node targets. Accumulates are normally
+ *  redirected to a helper, because concurrent accumulates from other origins
+ *  must be atomic. When the origin holds an exclusive lock on the target, no
+ *  other origin can access it, thus contiguous accumulates on predefined
+ *  datatypes are applied directly on the shared segment of the target by
+ *  vectorizable kernels.
+ *
+ *  Author: Min Si
+ */
+
+/* Kernels are simple loops on restrict pointers, enable loop vectorization
+ * of this file also at -O2 (clang vectorizes by default). */
+#if defined(__GNUC__) && !defined(__clang__) && !defined(__INTEL_COMPILER)
+#pragma GCC optimize ("tree-vectorize")
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "mtcore.h"
+
+/* Build AVX2 clones of kernels on x86-64, selected at load time by CPU. */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && defined(__linux__)
+#define MTCORE_SHM_ACC_TARGET __attribute__((target_clones("avx2", "default")))
+#else
+#define MTCORE_SHM_ACC_TARGET
+#endif
+
+typedef void (*MTCORE_Shm_acc_kernel) (void *target, const void *origin, int count);
+
+#define MTCORE_SHM_ACC_SUM(a, b) ((a) + (b))
+#define MTCORE_SHM_ACC_PROD(a, b) ((a) * (b))
+#define MTCORE_SHM_ACC_MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MTCORE_SHM_ACC_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MTCORE_SHM_ACC_BAND(a, b) ((a) & (b))
+#define MTCORE_SHM_ACC_BOR(a, b) ((a) | (b))
+
+#define MTCORE_SHM_ACC_DEF_KERNEL(op_name, type_name, type)                     \
+MTCORE_SHM_ACC_TARGET                                                           \
+static void shm_acc_ ## op_name ## _ ## type_name(void *target, const void *origin, int count) \
+{                                                                               \
+    type *restrict t = (type *) target;                                         \
+    const type *restrict o = (const type *) origin;                             \
+    int i;                                                                      \
+    for (i = 0; i < count; i++)                                                 \
+        t[i] = MTCORE_SHM_ACC_ ## op_name(t[i], o[i]);                          \
+}
+
+#define MTCORE_SHM_ACC_DEF_ARITH_KERNELS(type_name, type)   \
+    MTCORE_SHM_ACC_DEF_KERNEL(SUM, type_name, type)         \
+    MTCORE_SHM_ACC_DEF_KERNEL(PROD, type_name, type)        \
+    MTCORE_SHM_ACC_DEF_KERNEL(MAX, type_name, type)         \
+    MTCORE_SHM_ACC_DEF_KERNEL(MIN, type_name, type)
+
+#define MTCORE_SHM_ACC_DEF_INT_KERNELS(type_name, type)     \
+    MTCORE_SHM_ACC_DEF_ARITH_KERNELS(type_name, type)       \
+    MTCORE_SHM_ACC_DEF_KERNEL(BAND, type_name, type)        \
+    MTCORE_SHM_ACC_DEF_KERNEL(BOR, type_name, type)
+
+MTCORE_SHM_ACC_DEF_INT_KERNELS(short, short)
+MTCORE_SHM_ACC_DEF_INT_KERNELS(ushort, unsigned short)
+MTCORE_SHM_ACC_DEF_INT_KERNELS(int, int)
+MTCORE_SHM_ACC_DEF_INT_KERNELS(uint, unsigned int)
+MTCORE_SHM_ACC_DEF_INT_KERNELS(long, long)
+MTCORE_SHM_ACC_DEF_INT_KERNELS(ulong, unsigned long)
+MTCORE_SHM_ACC_DEF_INT_KERNELS(llong, long long)
+MTCORE_SHM_ACC_DEF_INT_KERNELS(ullong, unsigned long long)
+MTCORE_SHM_ACC_DEF_INT_KERNELS(int32, int32_t)
+MTCORE_SHM_ACC_DEF_INT_KERNELS(uint32, uint32_t)
+MTCORE_SHM_ACC_DEF_INT_KERNELS(int64, int64_t)
+MTCORE_SHM_ACC_DEF_INT_KERNELS(uint64, uint64_t)
+MTCORE_SHM_ACC_DEF_ARITH_KERNELS(float, float)
+MTCORE_SHM_ACC_DEF_ARITH_KERNELS(double, double)
+
+#define MTCORE_SHM_ACC_INT_KERNELS(type_name) {             \
+        shm_acc_SUM_ ## type_name, shm_acc_PROD_ ## type_name,  \
+        shm_acc_MAX_ ## type_name, shm_acc_MIN_ ## type_name,   \
+        shm_acc_BAND_ ## type_name, shm_acc_BOR_ ## type_name }
+
+#define MTCORE_SHM_ACC_ARITH_KERNELS(type_name) {           \
+        shm_acc_SUM_ ## type_name, shm_acc_PROD_ ## type_name,  \
+        shm_acc_MAX_ ## type_name, shm_acc_MIN_ ## type_name,   \
+        NULL, NULL }
+
+/* Supported operations, the order matches the columns of kernel table.
+ * MPI_REPLACE is handled by memcpy for every supported datatype. */
+#define MTCORE_SHM_ACC_NUM_OPS 6
+static MPI_Op shm_acc_ops[MTCORE_SHM_ACC_NUM_OPS] = {
+    MPI_SUM, MPI_PROD, MPI_MAX, MPI_MIN, MPI_BAND, MPI_BOR
+};
+
+static MPI_Datatype shm_acc_dtypes[] = {
+    MPI_SHORT, MPI_UNSIGNED_SHORT, MPI_INT, MPI_UNSIGNED,
+    MPI_LONG, MPI_UNSIGNED_LONG, MPI_LONG_LONG, MPI_UNSIGNED_LONG_LONG,
+    MPI_INT32_T, MPI_UINT32_T, MPI_INT64_T, MPI_UINT64_T,
+    MPI_FLOAT, MPI_DOUBLE
+};
+
+static const MTCORE_Shm_acc_kernel shm_acc_kernels[][MTCORE_SHM_ACC_NUM_OPS] = {
+    MTCORE_SHM_ACC_INT_KERNELS(short), MTCORE_SHM_ACC_INT_KERNELS(ushort),
+    MTCORE_SHM_ACC_INT_KERNELS(int), MTCORE_SHM_ACC_INT_KERNELS(uint),
+    MTCORE_SHM_ACC_INT_KERNELS(long), MTCORE_SHM_ACC_INT_KERNELS(ulong),
+    MTCORE_SHM_ACC_INT_KERNELS(llong), MTCORE_SHM_ACC_INT_KERNELS(ullong),
+    MTCORE_SHM_ACC_INT_KERNELS(int32), MTCORE_SHM_ACC_INT_KERNELS(uint32),
+    MTCORE_SHM_ACC_INT_KERNELS(int64), MTCORE_SHM_ACC_INT_KERNELS(uint64),
+    MTCORE_SHM_ACC_ARITH_KERNELS(float), MTCORE_SHM_ACC_ARITH_KERNELS(double)
+};
+
+static const int shm_acc_num_dtypes = sizeof(shm_acc_dtypes) / sizeof(MPI_Datatype);
+
+static inline int get_dtype_idx(MPI_Datatype datatype)
+{
+    int i;
+    for (i = 0; i < shm_acc_num_dtypes; i++) {
+        if (shm_acc_dtypes[i] == datatype)
+            return i;
+    }
+    return -1;
+}
+
+static inline int get_op_idx(MPI_Op op)
+{
+    int i;
+    for (i = 0; i < MTCORE_SHM_ACC_NUM_OPS; i++) {
+        if (shm_acc_ops[i] == op)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Check whether an accumulate can be applied on the shared segment of target.
+ * Only contiguous buffers of the same predefined datatype in an exclusive lock
+ * epoch are handled.
+ */
+int MTCORE_Shm_acc_is_supported(int origin_count, MPI_Datatype origin_datatype,
+                                int target_count, MPI_Datatype target_datatype,
+                                MPI_Op op, int target_rank, MTCORE_Win * uh_win)
+{
+    int dtype_idx, op_idx;
+
+    if (MTCORE_Atomic_load(&uh_win->targets[target_rank].shm_acc_stat) == MTCORE_SHM_ACC_DISABLED)
+        return 0;
+    if (origin_datatype != target_datatype || origin_count != target_count)
+        return 0;
+
+    dtype_idx = get_dtype_idx(origin_datatype);
+    if (dtype_idx < 0)
+        return 0;
+    if (op == MPI_REPLACE)
+        return 1;
+
+    op_idx = get_op_idx(op);
+    return op_idx >= 0 && shm_acc_kernels[dtype_idx][op_idx] != NULL;
+}
+
+/* Complete accumulate-class operations issued to helpers on this target. */
+static int flush_remote(int target_rank, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int k;
+
+    mpi_errno = MTCORE_AM_flush(target_rank, uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    for (k = 0; k < uh_win->num_h; k++) {
+        mpi_errno = PMPI_Win_flush(uh_win->targets[target_rank].h_ranks_in_uh[k],
+                                   uh_win->targets[target_rank].uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+
+    MTCORE_DBG_PRINT("shm acc: flushed remote operations to target %d\n", target_rank);
+    return mpi_errno;
+}
+
+int MTCORE_Shm_accumulate(const void *origin_addr, int origin_count,
+                          MPI_Datatype origin_datatype, int target_rank,
+                          MPI_Aint target_disp, MPI_Op op, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Win_target *target = &uh_win->targets[target_rank];
+    void *target_addr = (char *) target->shm_base + target->disp_unit * target_disp;
+    int dtsize = 0;
+
+    /* Locks on helpers are delayed by most MPI implementations, the exclusive
+     * lock must be granted before we access the target. */
+    if (MTCORE_Atomic_load(&target->shm_acc_stat) == MTCORE_SHM_ACC_ENABLED) {
+        mpi_errno = MTCORE_Win_grant_local_lock(target_rank, MPI_LOCK_EXCLUSIVE, 0, uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        MTCORE_Atomic_store(&target->shm_acc_stat, MTCORE_SHM_ACC_GRANTED);
+    }
+
+    if (MTCORE_Atomic_load(&target->shm_acc_remote_issued)) {
+        mpi_errno = flush_remote(target_rank, uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        MTCORE_Atomic_store(&target->shm_acc_remote_issued, 0);
+    }
+
+    if (op == MPI_REPLACE) {
+        PMPI_Type_size(origin_datatype, &dtsize);
+        memcpy(target_addr, origin_addr, (size_t) dtsize * origin_count);
+    }
+    else {
+        MTCORE_Shm_acc_kernel kernel =
+            shm_acc_kernels[get_dtype_idx(origin_datatype)][get_op_idx(op)];
+        kernel(target_addr, origin_addr, origin_count);
+    }
+
+    MTCORE_DBG_PRINT("MTCORE Accumulate to target %d in shared memory %p(%p + %d * %ld), "
+                     "count %d\n", target_rank, target_addr, target->shm_base,
+                     target->disp_unit, target_disp, origin_count);
+
+    return mpi_errno;
+}
+
+/**
+ * Enable shared-memory accumulate on a same-node target in a new lock epoch.
+ * Only an exclusive lock guarantees that no other origin concurrently updates
+ * the target through a helper.
+ */
+void MTCORE_Shm_acc_start(int target_rank, int lock_type, int assert, MTCORE_Win * uh_win)
+{
+    MTCORE_Win_target *target = &uh_win->targets[target_rank];
+    int stat = MTCORE_SHM_ACC_DISABLED;
+
+    /* Threads of the same process may concurrently accumulate on the target. In
+     * strategy all, locks are issued as lock_all, thus they are never exclusive. */
+    if (uh_win->info_args.sync_strategy == MTCORE_SYNC_HELPER && MTCORE_ENV.shm_acc &&
+        target->shm_base != NULL && lock_type == MPI_LOCK_EXCLUSIVE &&
+        MTCORE_THREAD_LEVEL != MPI_THREAD_MULTIPLE) {
+        int user_rank;
+        PMPI_Comm_rank(uh_win->user_comm, &user_rank);
+
+        /* No conflicting lock in NOCHECK epoch, and self lock may be already granted */
+        if ((assert & MPI_MODE_NOCHECK) ||
+            (user_rank == target_rank && MTCORE_Atomic_load(&uh_win->is_self_locked)))
+            stat = MTCORE_SHM_ACC_GRANTED;
+        else
+            stat = MTCORE_SHM_ACC_ENABLED;
+    }
+
+    MTCORE_Atomic_store(&target->shm_acc_remote_issued, 0);
+    MTCORE_Atomic_store(&target->shm_acc_stat, stat);
+}
+
+void MTCORE_Shm_acc_reset(int target_rank, MTCORE_Win * uh_win)
+{
+    MTCORE_Atomic_store(&uh_win->targets[target_rank].shm_acc_stat, MTCORE_SHM_ACC_DISABLED);
+    MTCORE_Atomic_store(&uh_win->targets[target_rank].shm_acc_remote_issued, 0);
+}
+
+/**
+ * Query shared segment of every same-node target on the shared window with
+ * local helpers.
+ */
+int MTCORE_Shm_acc_win_init(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int user_nprocs, i;
+
+    PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
+
+    for (i = 0; i < user_nprocs; i++) {
+        int rank_in_local_uh = MPI_UNDEFINED;
+        MPI_Aint size = 0;
+        int disp_unit = 0;
+
+        uh_win->targets[i].shm_base = NULL;
+        if (!MTCORE_ENV.shm_acc || uh_win->targets[i].node_id != uh_win->node_id)
+            continue;
+
+        mpi_errno = PMPI_Group_translate_ranks(MTCORE_GROUP_WORLD, 1,
+                                               &uh_win->targets[i].world_rank,
+                                               uh_win->local_uh_group, &rank_in_local_uh);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+        if (rank_in_local_uh == MPI_UNDEFINED)
+            continue;
+
+        mpi_errno = MTCORE_Shm_seg_query(uh_win->local_uh_win, uh_win->shm_seg,
+                                         rank_in_local_uh, &size, &disp_unit,
+                                         &uh_win->targets[i].shm_base);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+
+        /* The segment of a window host starts with the segment of helper 0. */
+        if (MTCORE_Is_win_host(uh_win, i))
+            uh_win->targets[i].shm_base = (char *) uh_win->targets[i].shm_base +
+                MTCORE_ROOT_H_SHARED_SG_SIZE;
+
+        MTCORE_DBG_PRINT("shm acc: target %d (local_uh %d) base %p, size %ld\n", i,
+                         rank_in_local_uh, uh_win->targets[i].shm_base, size);
+    }
+
+    return mpi_errno;
+}
@@ -0,0 +1,105 @@
+/*
+ * stripe.c
+ *  <FILE_DESC>
+ *
+ *  Striping of large contiguous put and get. Such an operation is divided
+ *  into one chunk per helper of the target, and the chunks are issued to all
+ *  helpers at once, thus a single transfer is progressed by every helper.
+ *  It is only safe when any helper can access the target (see
+ *  MTCORE_Is_any_helper_allowed). Each chunk is charged to the injection
+ *  credits of its helper (see credit.c).
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mtcore.h"
+
+/**
+ * Check if the operation can be striped over helpers of target. Only
+ * operations with the same contiguous datatype on both sides, at least one
+ * element per helper and no smaller than MTCORE_STRIPE_SIZE are striped.
+ */
+int MTCORE_Stripe_is_supported(int origin_count, MPI_Datatype origin_datatype,
+                               int target_rank, int target_count,
+                               MPI_Datatype target_datatype, MTCORE_Win * uh_win)
+{
+    int type_size = 0;
+    MPI_Aint lb = 0, extent = 0, true_lb = 0, true_extent = 0;
+
+    if (MTCORE_ENV.stripe_size == 0 || uh_win->num_h < 2 ||
+        origin_datatype != target_datatype || origin_count != target_count ||
+        target_count < uh_win->num_h)
+        return 0;
+
+    PMPI_Type_size(target_datatype, &type_size);
+    if ((MPI_Aint) type_size * target_count < MTCORE_ENV.stripe_size)
+        return 0;
+
+    PMPI_Type_get_extent(target_datatype, &lb, &extent);
+    PMPI_Type_get_true_extent(target_datatype, &true_lb, &true_extent);
+    if (lb != 0 || true_lb != 0 || extent != type_size || true_extent != type_size)
+        return 0;
+
+    return MTCORE_Is_any_helper_allowed(target_rank, uh_win);
+}
+
+static int stripe_issue(int is_put, void *origin_addr, int count, MPI_Datatype datatype,
+                        int target_rank, MPI_Aint target_disp, MPI_Win win,
+                        MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int k, chunk_count, chunk_off = 0;
+    MPI_Aint lb = 0, extent = 0, uh_target_disp = 0;
+    int num_h = uh_win->num_h;
+
+    PMPI_Type_get_extent(datatype, &lb, &extent);
+
+    for (k = 0; k < num_h; k++) {
+        int target_h_rank_in_uh = uh_win->targets[target_rank].h_ranks_in_uh[k];
+        MPI_Aint target_h_offset = uh_win->targets[target_rank].base_h_offsets[k];
+        char *chunk_addr = (char *) origin_addr + chunk_off * extent;
+
+        chunk_count = count / num_h + (k == num_h - 1 ? count % num_h : 0);
+
+        /* Every chunk takes credits of its own helper. Keep the chunk on that
+         * helper (flush it if credits ran out) so that the stripe stays spread. */
+        mpi_errno = MTCORE_Credit_acquire(target_rank, 1, chunk_count, datatype, win, uh_win,
+                                          &target_h_rank_in_uh, &target_h_offset);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+
+        uh_target_disp = target_h_offset
+            + uh_win->targets[target_rank].disp_unit * target_disp + chunk_off * extent;
+
+        if (is_put)
+            mpi_errno = PMPI_Put(chunk_addr, chunk_count, datatype, target_h_rank_in_uh,
+                                 uh_target_disp, chunk_count, datatype, win);
+        else
+            mpi_errno = PMPI_Get(chunk_addr, chunk_count, datatype, target_h_rank_in_uh,
+                                 uh_target_disp, chunk_count, datatype, win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+
+        chunk_off += chunk_count;
+    }
+
+    MTCORE_DBG_PRINT("MTCORE %s striped to %d helpers of target %d, disp 0x%lx, count %d\n",
+                     is_put ? "Put" : "Get", num_h, target_rank, target_disp, count);
+    return mpi_errno;
+}
+
+int MTCORE_Stripe_put(const void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+                      int target_rank, MPI_Aint target_disp, MPI_Win win, MTCORE_Win * uh_win)
+{
+    return stripe_issue(1, (void *) origin_addr, origin_count, origin_datatype, target_rank,
+                        target_disp, win, uh_win);
+}
+
+int MTCORE_Stripe_get(void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+                      int target_rank, MPI_Aint target_disp, MPI_Win win, MTCORE_Win * uh_win)
+{
+    return stripe_issue(0, origin_addr, origin_count, origin_datatype, target_rank,
+                        target_disp, win, uh_win);
+}
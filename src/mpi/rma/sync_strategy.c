@@ -0,0 +1,360 @@
+/*
+ * sync_strategy.c
+ *  <FILE_DESC>
+ *
+ *  Synchronization of helpers on internal windows. Every window selects one
+ *  of the following strategies in win_allocate (MTCORE_SYNC_STRATEGY or info
+ *  sync_strategy):
+ *   - helper: lock, unlock and flush only the helpers of a target.
+ *   - all: lock_all, unlock_all and flush_all on internal windows instead.
+ *     It is faster on MPI implementations that have optimized lock_all.
+ *     However, if an implementation issues lock messages for every target
+ *     even if it does not have any operation, this strategy could lose
+ *     performance and even lose asynchronous progress. Locks are always
+ *     shared, and the local target is synchronized together with helpers.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mtcore.h"
+
+/* Strategy helper: synchronize every helper of target separately. */
+
+static int helper_lock(int lock_type, int target_rank, int assert, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int k;
+
+    /* Lock every helper on every window.
+     * Note that a helper may be used on any window of this process for runtime
+     * load balancing whether it is binded to that segment or not. */
+    for (k = 0; k < uh_win->num_h; k++) {
+        int target_h_rank_in_uh = uh_win->targets[target_rank].h_ranks_in_uh[k];
+
+        MTCORE_DBG_PRINT("lock(Helper(%d), uh_wins 0x%x), instead of target rank %d\n",
+                         target_h_rank_in_uh, uh_win->targets[target_rank].uh_win, target_rank);
+
+        mpi_errno = PMPI_Win_lock(lock_type, target_h_rank_in_uh, assert,
+                                  uh_win->targets[target_rank].uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return mpi_errno;
+}
+
+static int helper_unlock(int target_rank, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int k;
+
+    for (k = 0; k < uh_win->num_h; k++) {
+        int target_h_rank_in_uh = uh_win->targets[target_rank].h_ranks_in_uh[k];
+
+        MTCORE_DBG_PRINT("unlock(Helper(%d), uh_win 0x%x), instead of target rank %d\n",
+                         target_h_rank_in_uh, uh_win->targets[target_rank].uh_win, target_rank);
+
+        mpi_errno = PMPI_Win_unlock(target_h_rank_in_uh, uh_win->targets[target_rank].uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return mpi_errno;
+}
+
+static int helper_flush(int target_rank, MPI_Win target_uh_win, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+#if !defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
+    int j;
+
+    /* RMA operations are only issued to the main helper, so we only flush it. */
+    /* TODO: track op issuing, only flush the helpers which receive ops. */
+    for (j = 0; j < uh_win->targets[target_rank].num_segs; j++) {
+        int main_h_off = uh_win->targets[target_rank].segs[j].main_h_off;
+        int target_h_rank_in_uh = uh_win->targets[target_rank].h_ranks_in_uh[main_h_off];
+        MPI_Win seg_uh_win = uh_win->ep_uh_wins ? target_uh_win :
+            uh_win->targets[target_rank].segs[j].uh_win;
+        MTCORE_DBG_PRINT("flush(Helper(%d), uh_wins 0x%x), instead of target rank %d seg %d\n",
+                         target_h_rank_in_uh, seg_uh_win, target_rank, j);
+
+        mpi_errno = PMPI_Win_flush(target_h_rank_in_uh, seg_uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+#else
+    int k;
+
+    /* RMA operations may be distributed to all helpers, so we should
+     * flush all helpers on all windows.
+     *
+     * Note that some flushes could be eliminated before the main lock of a
+     * segment granted (see above). However, we have to loop all the segments
+     * in order to check each lock status, and we may flush the same helper
+     * on the same window twice if the lock is granted on that segment.
+     * i.e., flush (H0, win0) and (H1, win0) twice for seg0 and seg1.
+     *
+     * Consider flush does nothing if no operations on that target in most
+     * MPI implementation, simpler code is better */
+    for (k = 0; k < uh_win->num_h; k++) {
+        int target_h_rank_in_uh = uh_win->targets[target_rank].h_ranks_in_uh[k];
+        MTCORE_DBG_PRINT("flush(Helper(%d), uh_wins 0x%x), instead of target rank %d\n",
+                         target_h_rank_in_uh, target_uh_win, target_rank);
+
+        mpi_errno = PMPI_Win_flush(target_h_rank_in_uh, target_uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+#endif
+    return mpi_errno;
+}
+
+static int helper_mixed_lock_all(int assert, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int user_nprocs, i;
+
+    PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
+
+    /* Lock every helper on every window for each target. */
+    for (i = 0; i < user_nprocs; i++) {
+        mpi_errno = helper_lock(MPI_LOCK_SHARED, i, assert, uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return mpi_errno;
+}
+
+static int helper_mixed_unlock_all(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int user_nprocs, i;
+
+    PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
+
+    for (i = 0; i < user_nprocs; i++) {
+        mpi_errno = helper_unlock(i, uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return mpi_errno;
+}
+
+static int helper_mixed_flush_all(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int user_nprocs, i;
+
+    PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
+
+    for (i = 0; i < user_nprocs; i++) {
+        mpi_errno = helper_flush(i, uh_win->targets[i].uh_win, uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return mpi_errno;
+}
+
+static int helper_flush_win(MPI_Win win, int flush_self, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int i;
+
+    /* Flush every helper once in the single window.
+     * TODO: track op issuing, only flush the helpers which receive ops. */
+    for (i = 0; i < uh_win->num_h_ranks_in_uh; i++) {
+        mpi_errno = PMPI_Win_flush(uh_win->h_ranks_in_uh[i], win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+
+#ifdef MTCORE_ENABLE_LOCAL_LOCK_OPT
+    if (flush_self) {
+        mpi_errno = PMPI_Win_flush(uh_win->my_rank_in_uh_comm, win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+#endif
+    return mpi_errno;
+}
+
+static int helper_lock_self(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int user_rank;
+
+    /* A window host is the helper of itself, which is already locked in the
+     * same window. */
+    PMPI_Comm_rank(uh_win->user_comm, &user_rank);
+    if (MTCORE_Is_win_host(uh_win, user_rank)) {
+        MTCORE_Atomic_store(&uh_win->is_self_locked, 1);
+        return mpi_errno;
+    }
+
+    MTCORE_DBG_PRINT("lock self(%d, local win 0x%x)\n", uh_win->my_rank_in_uh_comm,
+                     uh_win->my_uh_win);
+    mpi_errno = PMPI_Win_lock(MPI_LOCK_SHARED, uh_win->my_rank_in_uh_comm,
+                              MPI_MODE_NOCHECK, uh_win->my_uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    MTCORE_Atomic_store(&uh_win->is_self_locked, 1);
+    return mpi_errno;
+}
+
+static int helper_unlock_self(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int user_rank;
+
+    PMPI_Comm_rank(uh_win->user_comm, &user_rank);
+    if (MTCORE_Atomic_load(&uh_win->is_self_locked) && !MTCORE_Is_win_host(uh_win, user_rank)) {
+        MTCORE_DBG_PRINT("unlock self(%d, local win 0x%x)\n", uh_win->my_rank_in_uh_comm,
+                         uh_win->my_uh_win);
+        mpi_errno = PMPI_Win_unlock(uh_win->my_rank_in_uh_comm, uh_win->my_uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+
+    MTCORE_Atomic_store(&uh_win->is_self_locked, 0);
+    return mpi_errno;
+}
+
+static int helper_flush_self(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    if (MTCORE_Atomic_load(&uh_win->is_self_locked)) {
+        int ep, num_eps = uh_win->ep_uh_wins ? uh_win->info_args.num_thread_eps : 1;
+
+        /* Flush local window for local communication (self-target) on every endpoint. */
+        for (ep = 0; ep < num_eps; ep++) {
+            MPI_Win my_uh_win = uh_win->ep_uh_wins ? uh_win->ep_uh_wins[ep] : uh_win->my_uh_win;
+
+            MTCORE_DBG_PRINT("flush self(%d, local win 0x%x)\n", uh_win->my_rank_in_uh_comm,
+                             my_uh_win);
+            mpi_errno = PMPI_Win_flush(uh_win->my_rank_in_uh_comm, my_uh_win);
+            if (mpi_errno != MPI_SUCCESS)
+                return mpi_errno;
+        }
+    }
+    return mpi_errno;
+}
+
+/* Strategy all: synchronize all processes of an internal window at once. */
+
+static int all_lock(int lock_type, int target_rank, int assert, MTCORE_Win * uh_win)
+{
+    MTCORE_DBG_PRINT("lock_all(uh_win 0x%x), instead of target rank %d\n",
+                     uh_win->targets[target_rank].uh_win, target_rank);
+    return PMPI_Win_lock_all(assert, uh_win->targets[target_rank].uh_win);
+}
+
+static int all_unlock(int target_rank, MTCORE_Win * uh_win)
+{
+    MTCORE_DBG_PRINT("unlock_all(uh_win 0x%x), instead of target rank %d\n",
+                     uh_win->targets[target_rank].uh_win, target_rank);
+    return PMPI_Win_unlock_all(uh_win->targets[target_rank].uh_win);
+}
+
+static int all_flush(int target_rank, MPI_Win target_uh_win, MTCORE_Win * uh_win)
+{
+    MTCORE_DBG_PRINT("flush_all(uh_win 0x%x), instead of target rank %d\n", target_uh_win,
+                     target_rank);
+    return PMPI_Win_flush_all(target_uh_win);
+}
+
+static int all_mixed_lock_all(int assert, MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int i;
+
+    for (i = 0; i < uh_win->num_uh_wins; i++) {
+        MTCORE_DBG_PRINT("lock_all(uh_win 0x%x)\n", uh_win->uh_wins[i]);
+        mpi_errno = PMPI_Win_lock_all(assert, uh_win->uh_wins[i]);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return mpi_errno;
+}
+
+static int all_mixed_unlock_all(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int i;
+
+    for (i = 0; i < uh_win->num_uh_wins; i++) {
+        MTCORE_DBG_PRINT("unlock_all(uh_win 0x%x)\n", uh_win->uh_wins[i]);
+        mpi_errno = PMPI_Win_unlock_all(uh_win->uh_wins[i]);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return mpi_errno;
+}
+
+static int all_mixed_flush_all(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int i;
+
+    for (i = 0; i < uh_win->num_uh_wins; i++) {
+        MTCORE_DBG_PRINT("flush_all(uh_win 0x%x)\n", uh_win->uh_wins[i]);
+        mpi_errno = PMPI_Win_flush_all(uh_win->uh_wins[i]);
+        if (mpi_errno != MPI_SUCCESS)
+            return mpi_errno;
+    }
+    return mpi_errno;
+}
+
+static int all_flush_win(MPI_Win win, int flush_self, MTCORE_Win * uh_win)
+{
+    MTCORE_DBG_PRINT("flush_all(win 0x%x)\n", win);
+    return PMPI_Win_flush_all(win);
+}
+
+/* lock_all already locked window for local target */
+static int all_lock_self(MTCORE_Win * uh_win)
+{
+    MTCORE_Atomic_store(&uh_win->is_self_locked, 1);
+    return MPI_SUCCESS;
+}
+
+/* unlock_all already released window for local target */
+static int all_unlock_self(MTCORE_Win * uh_win)
+{
+    MTCORE_Atomic_store(&uh_win->is_self_locked, 0);
+    return MPI_SUCCESS;
+}
+
+/* flush_all already flushed local target */
+static int all_flush_self(MTCORE_Win * uh_win)
+{
+    return MPI_SUCCESS;
+}
+
+const MTCORE_Sync_fns MTCORE_SYNC_HELPER_FNS = {
+    helper_lock,
+    helper_unlock,
+    helper_flush,
+    helper_mixed_lock_all,
+    helper_mixed_unlock_all,
+    helper_mixed_flush_all,
+    helper_flush_win,
+    helper_lock_self,
+    helper_unlock_self,
+    helper_flush_self,
+};
+
+const MTCORE_Sync_fns MTCORE_SYNC_ALL_FNS = {
+    all_lock,
+    all_unlock,
+    all_flush,
+    all_mixed_lock_all,
+    all_mixed_unlock_all,
+    all_mixed_flush_all,
+    all_flush_win,
+    all_lock_self,
+    all_unlock_self,
+    all_flush_self,
+};
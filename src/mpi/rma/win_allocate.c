@@ -17,10 +17,22 @@ const char *MTCORE_Win_epoch_stat_name[4] = {
 static int read_win_info(MPI_Info info, MTCORE_Win * uh_win)
 {
     int mpi_errno = MPI_SUCCESS;
+    int i;
 
     uh_win->info_args.no_local_load_store = 0;
     uh_win->info_args.epoch_type = MTCORE_EPOCH_LOCK_ALL | MTCORE_EPOCH_LOCK |
         MTCORE_EPOCH_PSCW | MTCORE_EPOCH_FENCE;
+    uh_win->info_args.num_thread_eps = 1;
+    uh_win->info_args.rma_transport = MTCORE_ENV.rma_transport;
+    uh_win->info_args.huge_page = MTCORE_ENV.huge_page;
+    uh_win->info_args.no_acc_ordering = 0;
+    uh_win->info_args.acc_same_op_no_op = 0;
+    uh_win->info_args.sync_strategy = MTCORE_ENV.sync_strategy;
+
+    /* Use all helpers by default */
+    uh_win->num_h = MTCORE_ENV.num_h;
+    for (i = 0; i < MTCORE_ENV.num_h; i++)
+        uh_win->h_offs[i] = i;
 
     if (info != MPI_INFO_NULL) {
         int info_flag = 0;
@@ -69,10 +81,147 @@ static int read_win_info(MPI_Info info, MTCORE_Win * uh_win)
             if (user_epoch_type != 0)
                 uh_win->info_args.epoch_type = user_epoch_type;
         }
+
+        /* Check if user wants per-thread endpoint windows. Every thread issues
+         * operations and flushes on one of these windows. */
+        memset(info_value, 0, sizeof(info_value));
+        mpi_errno = PMPI_Info_get(info, "num_thread_endpoints", MPI_MAX_INFO_VAL,
+                                  info_value, &info_flag);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        if (info_flag == 1) {
+            int num_thread_eps = atoi(info_value);
+            if (num_thread_eps > 0)
+                uh_win->info_args.num_thread_eps = num_thread_eps;
+        }
+
+        /* Check if user wants helpers to execute operations as active messages
+         * (am), and aggregate inter-node ones on each node (agg). */
+        memset(info_value, 0, sizeof(info_value));
+        mpi_errno = PMPI_Info_get(info, "rma_transport", MPI_MAX_INFO_VAL,
+                                  info_value, &info_flag);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        if (info_flag == 1) {
+            if (!strncmp(info_value, "agg", strlen("agg")))
+                uh_win->info_args.rma_transport = MTCORE_RMA_TRANSPORT_AM_AGG;
+            else if (!strncmp(info_value, "am", strlen("am")))
+                uh_win->info_args.rma_transport = MTCORE_RMA_TRANSPORT_AM;
+            else if (!strncmp(info_value, "rma", strlen("rma")))
+                uh_win->info_args.rma_transport = MTCORE_RMA_TRANSPORT_RMA;
+        }
+
+        /* Check if user wants huge pages for the node shared segment. */
+        memset(info_value, 0, sizeof(info_value));
+        mpi_errno = PMPI_Info_get(info, "huge_page", MPI_MAX_INFO_VAL, info_value, &info_flag);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        if (info_flag == 1) {
+            if (!strncmp(info_value, "off", strlen("off")))
+                uh_win->info_args.huge_page = MTCORE_HUGE_PAGE_OFF;
+            else if (!strncmp(info_value, "thp", strlen("thp")))
+                uh_win->info_args.huge_page = MTCORE_HUGE_PAGE_THP;
+            else if (!strncmp(info_value, "hugetlb", strlen("hugetlb")))
+                uh_win->info_args.huge_page = MTCORE_HUGE_PAGE_HUGETLB;
+        }
+
+        /* Check how helpers are synchronized, see sync_strategy.c */
+        memset(info_value, 0, sizeof(info_value));
+        mpi_errno = PMPI_Info_get(info, "sync_strategy", MPI_MAX_INFO_VAL, info_value,
+                                  &info_flag);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        if (info_flag == 1) {
+            if (!strncmp(info_value, "helper", strlen("helper")))
+                uh_win->info_args.sync_strategy = MTCORE_SYNC_HELPER;
+            else if (!strncmp(info_value, "all", strlen("all")))
+                uh_win->info_args.sync_strategy = MTCORE_SYNC_ALL;
+        }
+
+        /* Check if accumulates need no ordering (none or empty), and if
+         * concurrent accumulates only use the same op or no_op. Both allow
+         * rewriting read-only and write-only accumulates into get and put. */
+        memset(info_value, 0, sizeof(info_value));
+        mpi_errno = PMPI_Info_get(info, "accumulate_ordering", MPI_MAX_INFO_VAL,
+                                  info_value, &info_flag);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        if (info_flag == 1) {
+            if (strlen(info_value) == 0 || !strncmp(info_value, "none", strlen("none")))
+                uh_win->info_args.no_acc_ordering = 1;
+        }
+
+        memset(info_value, 0, sizeof(info_value));
+        mpi_errno = PMPI_Info_get(info, "accumulate_ops", MPI_MAX_INFO_VAL, info_value,
+                                  &info_flag);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        if (info_flag == 1) {
+            if (!strncmp(info_value, "same_op_no_op", strlen("same_op_no_op")))
+                uh_win->info_args.acc_same_op_no_op = 1;
+        }
+
+        /* Check if user wants to use only the first num_helpers helpers on
+         * every node for this window. */
+        memset(info_value, 0, sizeof(info_value));
+        mpi_errno = PMPI_Info_get(info, "num_helpers", MPI_MAX_INFO_VAL, info_value, &info_flag);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        if (info_flag == 1) {
+            int num_h = atoi(info_value);
+            if (num_h > 0 && num_h <= MTCORE_ENV.num_h)
+                uh_win->num_h = num_h;
+        }
+
+        /* Check if user selects helpers by their local indices (e.g., "1,2"),
+         * overwrites num_helpers. Invalid or duplicate indices are ignored. */
+        memset(info_value, 0, sizeof(info_value));
+        mpi_errno = PMPI_Info_get(info, "helpers", MPI_MAX_INFO_VAL, info_value, &info_flag);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        if (info_flag == 1) {
+            int num_h = 0, h_idx, k;
+            char *token = strtok(info_value, ",");
+
+            while (token != NULL) {
+                h_idx = atoi(token);
+                for (k = 0; k < num_h && uh_win->h_offs[k] != h_idx; k++);
+                if (h_idx >= 0 && h_idx < MTCORE_ENV.num_h && k == num_h)
+                    uh_win->h_offs[num_h++] = h_idx;
+                token = strtok(NULL, ",");
+            }
+
+            if (num_h > 0) {
+                uh_win->num_h = num_h;
+            }
+            else {
+                MTCORE_WARN_PRINT("no valid helper index in info \"helpers\", "
+                                  "use all helpers\n");
+                for (i = 0; i < MTCORE_ENV.num_h; i++)
+                    uh_win->h_offs[i] = i;
+            }
+        }
     }
 
-    MTCORE_DBG_PRINT("no_local_load_store %d, epoch_type=%s|%s|%s|%s\n",
-                     uh_win->info_args.no_local_load_store,
+    /* Active messages are applied by helper processes. */
+    if (MTCORE_ENV.ghost_mode == MTCORE_GHOST_THREAD)
+        uh_win->info_args.rma_transport = MTCORE_RMA_TRANSPORT_RMA;
+
+    MTCORE_DBG_PRINT("no_local_load_store %d, num_thread_eps %d, rma_transport %d, "
+                     "huge_page %d, num_h %d, no_acc_ordering %d, acc_same_op_no_op %d, "
+                     "sync_strategy %d, epoch_type=%s|%s|%s|%s\n",
+                     uh_win->info_args.no_local_load_store, uh_win->info_args.num_thread_eps,
+                     uh_win->info_args.rma_transport, uh_win->info_args.huge_page, uh_win->num_h,
+                     uh_win->info_args.no_acc_ordering, uh_win->info_args.acc_same_op_no_op,
+                     uh_win->info_args.sync_strategy,
                      ((uh_win->info_args.epoch_type & MTCORE_EPOCH_LOCK_ALL) ? "lockall" : ""),
                      ((uh_win->info_args.epoch_type & MTCORE_EPOCH_LOCK) ? "lock" : ""),
                      ((uh_win->info_args.epoch_type & MTCORE_EPOCH_PSCW) ? "pscw" : ""),
@@ -91,45 +240,39 @@ static int gather_ranks(MTCORE_Win * win, int *num_helpers, int *helper_ranks_in
 {
     int mpi_errno = MPI_SUCCESS;
     int user_nprocs;
-    int *helper_bitmap = NULL;
-    int user_world_rank, tmp_num_helpers;
-    int i, j, helper_rank;
-    int world_nprocs;
+    int *user_ranks_in_world = NULL;
+    int user_world_rank;
+    int i, j;
 
-    PMPI_Comm_size(MPI_COMM_WORLD, &world_nprocs);
     PMPI_Comm_size(win->user_comm, &user_nprocs);
 
-    helper_bitmap = calloc(world_nprocs, sizeof(int));
-    if (helper_bitmap == NULL)
+    user_ranks_in_world = calloc(user_nprocs, sizeof(int));
+    if (user_ranks_in_world == NULL)
         goto fn_fail;
 
     /* Get helper ranks of each USER process.
      *
      * The helpers of user_world rank x are stored as x*num_h: (x+1)*num_h-1,
-     * it is used to catch helpers for a target rank in epoch.
-     * Unique helper ranks are only used for creating communicators.*/
-    tmp_num_helpers = 0;
+     * it is used to catch helpers for a target rank in epoch.*/
     for (i = 0; i < user_nprocs; i++) {
         user_world_rank = win->targets[i].user_world_rank;
+        user_ranks_in_world[i] = win->targets[i].world_rank;
 
         for (j = 0; j < MTCORE_ENV.num_h; j++) {
-            helper_rank = MTCORE_ALL_H_RANKS_IN_WORLD[user_world_rank * MTCORE_ENV.num_h + j];
-            helper_ranks_in_world[i * MTCORE_ENV.num_h + j] = helper_rank;
-
-            /* Unique helper ranks */
-            if (!helper_bitmap[helper_rank]) {
-                unique_helper_ranks_in_world[tmp_num_helpers++] = helper_rank;
-                helper_bitmap[helper_rank] = 1;
-
-                MTCORE_Assert(tmp_num_helpers <= MTCORE_NUM_NODES * MTCORE_ENV.num_h);
-            }
+            helper_ranks_in_world[i * MTCORE_ENV.num_h + j] =
+                MTCORE_ALL_H_RANKS_IN_WORLD[user_world_rank * MTCORE_ENV.num_h + j];
         }
     }
-    *num_helpers = tmp_num_helpers;
+
+    /* Unique helper ranks are only used for creating communicators, helpers
+     * derive the same list from user ranks. */
+    *num_helpers = MTCORE_Func_get_helper_ranks(user_nprocs, user_ranks_in_world,
+                                                unique_helper_ranks_in_world);
+    MTCORE_Assert(*num_helpers <= MTCORE_NUM_NODES * MTCORE_ENV.num_h);
 
   fn_exit:
-    if (helper_bitmap)
-        free(helper_bitmap);
+    if (user_ranks_in_world)
+        free(user_ranks_in_world);
     return mpi_errno;
 
   fn_fail:
@@ -157,7 +300,7 @@ static void specify_main_helper_binding_by_segments(int n_targets, int *local_ta
         max_t_size = max(max_t_size, uh_win->targets[t_rank].size);
     }
     /* Never divide less than segment unit */
-    size_per_helper = align(sum_size / MTCORE_ENV.num_h, MTCORE_SEGMENT_UNIT);
+    size_per_helper = align(sum_size / uh_win->num_h, MTCORE_SEGMENT_UNIT);
     max_t_num_seg = sum_size / size_per_helper + 3;
     t_seg_sizes = calloc(max_t_num_seg, sizeof(MPI_Aint));
 
@@ -181,7 +324,7 @@ static void specify_main_helper_binding_by_segments(int n_targets, int *local_ta
                 uh_win->targets[t_rank].segs[j].size = t_seg_sizes[j];
                 uh_win->targets[t_rank].segs[j].main_h_off = t_last_h_off + 1 - t_num_segs + j;
 
-                MTCORE_Assert(uh_win->targets[t_rank].segs[j].main_h_off < MTCORE_ENV.num_h);
+                MTCORE_Assert(uh_win->targets[t_rank].segs[j].main_h_off < uh_win->num_h);
 
                 prev_seg_base = uh_win->targets[t_rank].segs[j].base_offset;
                 prev_seg_size = uh_win->targets[t_rank].segs[j].size;
@@ -199,7 +342,7 @@ static void specify_main_helper_binding_by_segments(int n_targets, int *local_ta
         }
         /* finish this target if remaining size is small than seg_size or
          * it is already at the last helper. */
-        else if (t_size < seg_size || h_off == MTCORE_ENV.num_h - 1) {
+        else if (t_size < seg_size || h_off == uh_win->num_h - 1) {
             MTCORE_Assert(t_num_segs < max_t_num_seg);
 
             t_seg_sizes[t_num_segs++] = t_size;
@@ -225,9 +368,9 @@ static void specify_main_helper_binding_by_segments(int n_targets, int *local_ta
         /* next helper */
         if (seg_size == 0) {
             h_off++;
-            MTCORE_Assert(h_off <= MTCORE_ENV.num_h);
+            MTCORE_Assert(h_off <= uh_win->num_h);
             seg_size = size_per_helper
-                + (h_off == MTCORE_ENV.num_h - 1 ? (sum_size % MTCORE_ENV.num_h) : 0);
+                + (h_off == uh_win->num_h - 1 ? (sum_size % uh_win->num_h) : 0);
             /* make sure new segment size is aligned */
             seg_size = align(seg_size, MTCORE_SEGMENT_UNIT);
         }
@@ -247,7 +390,7 @@ static void specify_main_helper_binding_by_ranks(int n_targets, int *local_targe
 
     PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
 
-    np_per_helper = n_targets / MTCORE_ENV.num_h;
+    np_per_helper = n_targets / uh_win->num_h;
 
     int np = np_per_helper;
     i = 0;
@@ -259,15 +402,15 @@ static void specify_main_helper_binding_by_ranks(int n_targets, int *local_targe
             /* next helper */
             h_off++;
             np = np_per_helper +
-                ((h_off == MTCORE_ENV.num_h - 1) ? (n_targets % MTCORE_ENV.num_h) : 0);
+                ((h_off == uh_win->num_h - 1) ? (n_targets % uh_win->num_h) : 0);
         }
-        MTCORE_Assert(h_off <= MTCORE_ENV.num_h);
+        MTCORE_Assert(h_off <= uh_win->num_h);
 
         t_rank = local_targets[i];
         uh_win->targets[t_rank].num_segs = 1;
         uh_win->targets[t_rank].segs = calloc(1, sizeof(MTCORE_Win_target_seg));
         uh_win->targets[t_rank].segs[0].base_offset = 0;
-        uh_win->targets[t_rank].segs[0].size = uh_win->targets[i].size;
+        uh_win->targets[t_rank].segs[0].size = uh_win->targets[t_rank].size;
         uh_win->targets[t_rank].segs[0].main_h_off = h_off;
 
         /* next target */
@@ -276,6 +419,73 @@ static void specify_main_helper_binding_by_ranks(int n_targets, int *local_targe
     }
 }
 
+/* Bind every target to the least loaded helper in its own NUMA domain, or to
+ * the least loaded helper on the node if no helper shares its domain.
+ * Return 0 if the domains of the targets or helpers are unknown, or helpers
+ * are all in the same domain, then binding falls back to rank order. */
+static int specify_main_helper_binding_by_numa(int n_targets, int *local_targets,
+                                               MTCORE_Win * uh_win)
+{
+    int i, k, h_off, t_rank, t_numa_id, same_domain, applied = 0;
+    int *h_numa_ids = NULL, *h_loads = NULL;
+
+    h_numa_ids = calloc(uh_win->num_h, sizeof(int));
+    h_loads = calloc(uh_win->num_h, sizeof(int));
+
+    /* Helpers are common for all targets on the same node. */
+    t_rank = local_targets[0];
+    for (k = 0; k < uh_win->num_h; k++) {
+        int h_rank = MTCORE_ALL_H_RANKS_IN_WORLD[uh_win->targets[t_rank].user_world_rank *
+                                                 MTCORE_ENV.num_h + uh_win->h_offs[k]];
+        h_numa_ids[k] = MTCORE_ALL_NUMA_IDS[h_rank];
+        if (h_numa_ids[k] == MTCORE_TOPO_NUMA_UNKNOWN)
+            goto fn_exit;
+        if (h_numa_ids[k] != h_numa_ids[0])
+            applied = 1;
+    }
+    for (i = 0; i < n_targets; i++) {
+        if (MTCORE_ALL_NUMA_IDS[uh_win->targets[local_targets[i]].world_rank] ==
+            MTCORE_TOPO_NUMA_UNKNOWN)
+            applied = 0;
+    }
+    if (!applied)
+        goto fn_exit;
+
+    for (i = 0; i < n_targets; i++) {
+        t_rank = local_targets[i];
+        t_numa_id = MTCORE_ALL_NUMA_IDS[uh_win->targets[t_rank].world_rank];
+
+        same_domain = 0;
+        for (k = 0; k < uh_win->num_h; k++)
+            same_domain |= (h_numa_ids[k] == t_numa_id);
+
+        h_off = -1;
+        for (k = 0; k < uh_win->num_h; k++) {
+            if (same_domain && h_numa_ids[k] != t_numa_id)
+                continue;
+            if (h_off < 0 || h_loads[k] < h_loads[h_off])
+                h_off = k;
+        }
+        h_loads[h_off]++;
+
+        uh_win->targets[t_rank].num_segs = 1;
+        uh_win->targets[t_rank].segs = calloc(1, sizeof(MTCORE_Win_target_seg));
+        uh_win->targets[t_rank].segs[0].base_offset = 0;
+        uh_win->targets[t_rank].segs[0].size = uh_win->targets[t_rank].size;
+        uh_win->targets[t_rank].segs[0].main_h_off = h_off;
+
+        MTCORE_DBG_PRINT("target %d in numa %d bound to helper %d in numa %d\n",
+                         t_rank, t_numa_id, h_off, h_numa_ids[h_off]);
+    }
+
+  fn_exit:
+    if (h_numa_ids)
+        free(h_numa_ids);
+    if (h_loads)
+        free(h_loads);
+    return applied;
+}
+
 static void specify_main_helper_binding(MTCORE_Win * uh_win)
 {
     int i, j, h_off, user_nprocs;
@@ -307,6 +517,9 @@ static void specify_main_helper_binding(MTCORE_Win * uh_win)
             int s_rank = local_targets[s_off];
             int n_targets = uh_win->targets[s_rank].local_user_nprocs;
 
+            if (MTCORE_ENV.h_placement == MTCORE_H_PLACEMENT_NUMA &&
+                specify_main_helper_binding_by_numa(n_targets, &local_targets[s_off], uh_win))
+                continue;
             specify_main_helper_binding_by_ranks(n_targets, &local_targets[s_off], uh_win);
         }
     }
@@ -314,7 +527,7 @@ static void specify_main_helper_binding(MTCORE_Win * uh_win)
 #ifdef DEBUG
     for (i = 0; i < user_nprocs; i++) {
         MTCORE_DBG_PRINT("\t target[%d] .num_segs %d\n", i, uh_win->targets[i].num_segs);
-        for (j = 0; j < MTCORE_ENV.num_h; j++) {
+        for (j = 0; j < uh_win->num_h; j++) {
             MTCORE_DBG_PRINT("\t\t .h_rank[%d] %d, offset[%d] 0x%lx \n",
                              j, uh_win->targets[i].h_ranks_in_uh[j],
                              j, uh_win->targets[i].base_h_offsets[j]);
@@ -361,7 +574,8 @@ static int create_uh_comm(int num_helpers, int *helper_ranks_in_world, MTCORE_Wi
     MTCORE_Assert(num_uh_ranks <= world_nprocs);
 
     PMPI_Group_incl(MTCORE_GROUP_WORLD, num_uh_ranks, uh_ranks_in_world, &win->uh_group);
-    mpi_errno = PMPI_Comm_create_group(MPI_COMM_WORLD, win->uh_group, 0, &win->uh_comm);
+    mpi_errno = PMPI_Comm_create_group(MPI_COMM_WORLD, win->uh_group, win->req_id,
+                                       &win->uh_comm);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
 
@@ -384,40 +598,118 @@ static int create_uh_comm(int num_helpers, int *helper_ranks_in_world, MTCORE_Wi
     goto fn_exit;
 }
 
+/* Create communicators in thread ghost mode on a user communicator other than
+ * the user world. The first local user of the window serves as helper of its node,
+ * which is local rank 0 of the world (see has_ghost_hosts), and uh_comm only
+ * duplicates the user communicator. */
+static int create_host_communicators(MTCORE_Win * uh_win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int user_nprocs, i, node_id;
+    int *node_h_ranks = NULL;
+
+    PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
+
+    mpi_errno = PMPI_Comm_dup(uh_win->user_comm, &uh_win->uh_comm);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+    PMPI_Comm_group(uh_win->uh_comm, &uh_win->uh_group);
+
+    mpi_errno = PMPI_Comm_split_type(uh_win->uh_comm, MPI_COMM_TYPE_SHARED, 0,
+                                     MPI_INFO_NULL, &uh_win->local_uh_comm);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+    PMPI_Comm_group(uh_win->local_uh_comm, &uh_win->local_uh_group);
+
+    /* Ranks in uh_comm are the same as in user communicator, and local users are
+     * ordered by rank. */
+    node_h_ranks = calloc(uh_win->num_nodes, sizeof(int));
+    for (i = 0; i < uh_win->num_nodes; i++)
+        node_h_ranks[i] = -1;
+    for (i = 0; i < user_nprocs; i++) {
+        node_id = uh_win->targets[i].node_id;
+        if (node_h_ranks[node_id] < 0) {
+            node_h_ranks[node_id] = i;
+            uh_win->h_ranks_in_uh[node_id] = i;
+        }
+        uh_win->targets[i].h_ranks_in_uh[0] = node_h_ranks[node_id];
+    }
+
+  fn_exit:
+    if (node_h_ranks)
+        free(node_h_ranks);
+    return mpi_errno;
+
+  fn_fail:
+    goto fn_exit;
+}
+
+/* In thread ghost mode, whether the first local user of every node owns the ghost
+ * thread of its node. Otherwise RMA to that node only progresses when its host
+ * enters MPI. Collective over the user communicator. */
+static int has_ghost_hosts(MTCORE_Win * uh_win, int *has_hosts)
+{
+    int user_local_rank, is_valid_host;
+
+    PMPI_Comm_rank(uh_win->local_user_comm, &user_local_rank);
+    is_valid_host = (user_local_rank != 0 || MTCORE_Ghost_thread_is_started());
+
+    return PMPI_Allreduce(&is_valid_host, has_hosts, 1, MPI_INT, MPI_MIN, uh_win->user_comm);
+}
+
+/* Start helpers by a single message packing all the parameters of the window,
+ * helpers derive the others locally. Only called by user root. */
+static int start_helpers(MTCORE_Win * uh_win, int user_nprocs, int user_local_nprocs,
+                         int comm_key)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Func_win_allocate_param *param = NULL;
+    int *user_ranks_in_world;
+    int param_size, i;
+
+    /* User ranks are only needed if helpers create new communicators. */
+    param_size = sizeof(MTCORE_Func_win_allocate_param);
+    if (uh_win->user_comm != MTCORE_COMM_USER_WORLD && uh_win->comm_cache == NULL)
+        param_size += sizeof(int) * user_nprocs;
+
+    param = calloc(1, param_size);
+    param->is_user_world = (uh_win->user_comm == MTCORE_COMM_USER_WORLD);
+    param->max_local_user_nprocs = uh_win->max_local_user_nprocs;
+    param->epoch_type = uh_win->info_args.epoch_type;
+    param->num_thread_eps = uh_win->info_args.num_thread_eps;
+    param->rma_transport = uh_win->info_args.rma_transport;
+    if (param_size > sizeof(MTCORE_Func_win_allocate_param)) {
+        param->num_user_ranks = user_nprocs;
+        user_ranks_in_world = (int *) (param + 1);
+        for (i = 0; i < user_nprocs; i++)
+            user_ranks_in_world[i] = uh_win->targets[i].world_rank;
+    }
+
+    MTCORE_DBG_PRINT(" Send parameters: is_user_world %d, max_local_user_nprocs %d, "
+                     "epoch_type %d, num_thread_eps %d, rma_transport %d, num_user_ranks %d\n",
+                     param->is_user_world, param->max_local_user_nprocs, param->epoch_type,
+                     param->num_thread_eps, param->rma_transport, param->num_user_ranks);
+
+    mpi_errno = MTCORE_Func_start(MTCORE_FUNC_WIN_ALLOCATE, user_nprocs, user_local_nprocs,
+                                  uh_win->req_id, comm_key, param, param_size);
+    free(param);
+    return mpi_errno;
+}
+
 static int create_communicators(MTCORE_Win * uh_win)
 {
     int mpi_errno = MPI_SUCCESS;
-    int *func_params = NULL, func_param_size = 0;
-    int *user_ranks_in_world = NULL;
     int *helper_ranks_in_world = NULL;
-    int num_helpers = 0, max_num_helpers;
-    int user_nprocs, user_local_rank;
+    int num_helpers = 0;
+    int user_nprocs;
     int *helper_ranks_in_uh = NULL;
     int i;
 
     PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
-    max_num_helpers = MTCORE_ENV.num_h * MTCORE_NUM_NODES;
-    func_param_size = user_nprocs + max_num_helpers + 2;
-
-    PMPI_Comm_rank(uh_win->local_user_comm, &user_local_rank);
     uh_win->num_h_ranks_in_uh = MTCORE_ENV.num_h * uh_win->num_nodes;
 
     /* Optimization for user world communicator */
     if (uh_win->user_comm == MTCORE_COMM_USER_WORLD) {
-        if (user_local_rank == 0) {
-            func_params = calloc(func_param_size, sizeof(int));
-
-            /* Set parameters to local Helpers
-             *  [0]: is_comm_user_world
-             */
-            func_params[0] = 1;
-
-            mpi_errno = MTCORE_Func_set_param((char *) func_params, sizeof(int) * func_param_size,
-                                              uh_win->ur_h_comm);
-            if (mpi_errno != MPI_SUCCESS)
-                goto fn_fail;
-        }
-
         /* Create communicators
          *  local_uh_comm: including local USER and Helper processes
          *  uh_comm: including all USER and Helper processes
@@ -435,6 +727,11 @@ static int create_communicators(MTCORE_Win * uh_win)
                    &MTCORE_ALL_H_RANKS_IN_WORLD[i * MTCORE_ENV.num_h],
                    sizeof(int) * MTCORE_ENV.num_h);
     }
+    else if (MTCORE_ENV.ghost_mode == MTCORE_GHOST_THREAD) {
+        mpi_errno = create_host_communicators(uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
     else {
         /* helper ranks for every user process, used for helper fetching in epoch */
         helper_ranks_in_world = calloc(MTCORE_ENV.num_h * user_nprocs, sizeof(int));
@@ -446,65 +743,48 @@ static int create_communicators(MTCORE_Win * uh_win)
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
 
-        if (user_local_rank == 0) {
-
-            user_ranks_in_world = calloc(user_nprocs, sizeof(int));
-            for (i = 0; i < user_nprocs; i++) {
-                user_ranks_in_world[i] = uh_win->targets[i].world_rank;
-            }
-
-            /* Set parameters to local Helpers
-             *  [0]: is_comm_user_world
-             *  [1]: num_helpers
-             *  [2:N+1]: user ranks in comm_world
-             *  [N+2:]: helper ranks in comm_world
+        if (uh_win->comm_cache) {
+            /* Reuse cached communicators, local helpers reuse theirs as well. */
+            uh_win->uh_comm = uh_win->comm_cache->uh_comm;
+            uh_win->uh_group = uh_win->comm_cache->uh_group;
+            uh_win->local_uh_comm = uh_win->comm_cache->local_uh_comm;
+            uh_win->local_uh_group = uh_win->comm_cache->local_uh_group;
+        }
+        else {
+            /* Create communicators
+             *  uh_comm: including all USER and Helper processes
+             *  local_uh_comm: including local USER and Helper processes
              */
-            int pidx;
-            func_params = calloc(func_param_size, sizeof(int));
-
-            func_params[0] = 0;
-            func_params[1] = num_helpers;
-            pidx = 2;
-            memcpy(&func_params[pidx], user_ranks_in_world, user_nprocs * sizeof(int));
-            pidx += user_nprocs;
-            memcpy(&func_params[pidx], uh_win->h_ranks_in_uh, num_helpers * sizeof(int));
-            mpi_errno = MTCORE_Func_set_param((char *) func_params, sizeof(int) * func_param_size,
-                                              uh_win->ur_h_comm);
+            mpi_errno = create_uh_comm(num_helpers, uh_win->h_ranks_in_uh, uh_win);
             if (mpi_errno != MPI_SUCCESS)
                 goto fn_fail;
-        }
-
-        /* Create communicators
-         *  uh_comm: including all USER and Helper processes
-         *  local_uh_comm: including local USER and Helper processes
-         */
-        mpi_errno = create_uh_comm(num_helpers, uh_win->h_ranks_in_uh, uh_win);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
 
 #ifdef DEBUG
-        {
-            int uh_rank, uh_nprocs;
-            PMPI_Comm_rank(uh_win->uh_comm, &uh_rank);
-            PMPI_Comm_size(uh_win->uh_comm, &uh_nprocs);
-            MTCORE_DBG_PRINT("created uh_comm, my rank %d/%d\n", uh_rank, uh_nprocs);
-        }
+            {
+                int uh_rank, uh_nprocs;
+                PMPI_Comm_rank(uh_win->uh_comm, &uh_rank);
+                PMPI_Comm_size(uh_win->uh_comm, &uh_nprocs);
+                MTCORE_DBG_PRINT("created uh_comm, my rank %d/%d\n", uh_rank, uh_nprocs);
+            }
 #endif
 
-        mpi_errno = PMPI_Comm_split_type(uh_win->uh_comm, MPI_COMM_TYPE_SHARED, 0,
-                                         MPI_INFO_NULL, &uh_win->local_uh_comm);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
+            mpi_errno = PMPI_Comm_split_type(uh_win->uh_comm, MPI_COMM_TYPE_SHARED, 0,
+                                             MPI_INFO_NULL, &uh_win->local_uh_comm);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
 
 #ifdef DEBUG
-        {
-            int uh_rank, uh_nprocs;
-            PMPI_Comm_rank(uh_win->local_uh_comm, &uh_rank);
-            PMPI_Comm_size(uh_win->local_uh_comm, &uh_nprocs);
-            MTCORE_DBG_PRINT("created local_uh_comm, my rank %d/%d\n", uh_rank, uh_nprocs);
-        }
+            {
+                int uh_rank, uh_nprocs;
+                PMPI_Comm_rank(uh_win->local_uh_comm, &uh_rank);
+                PMPI_Comm_size(uh_win->local_uh_comm, &uh_nprocs);
+                MTCORE_DBG_PRINT("created local_uh_comm, my rank %d/%d\n", uh_rank, uh_nprocs);
+            }
 #endif
 
+            PMPI_Comm_group(uh_win->local_uh_comm, &uh_win->local_uh_group);
+        }
+
         /* Get all Helper rank in uh communicator */
         mpi_errno = PMPI_Group_translate_ranks(MTCORE_GROUP_WORLD, user_nprocs * MTCORE_ENV.num_h,
                                                helper_ranks_in_world, uh_win->uh_group,
@@ -512,8 +792,6 @@ static int create_communicators(MTCORE_Win * uh_win)
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
 
-        PMPI_Comm_group(uh_win->local_uh_comm, &uh_win->local_uh_group);
-
         for (i = 0; i < user_nprocs; i++)
             memcpy(uh_win->targets[i].h_ranks_in_uh, &helper_ranks_in_uh[i * MTCORE_ENV.num_h],
                    sizeof(int) * MTCORE_ENV.num_h);
@@ -529,10 +807,6 @@ static int create_communicators(MTCORE_Win * uh_win)
 #endif
 
   fn_exit:
-    if (func_params)
-        free(func_params);
-    if (user_ranks_in_world)
-        free(user_ranks_in_world);
     if (helper_ranks_in_world)
         free(helper_ranks_in_world);
     if (helper_ranks_in_uh)
@@ -578,14 +852,8 @@ static int gather_base_offsets(MPI_Aint size, MTCORE_Win * uh_win)
     /* Note that all the helpers start the window from baseptr of helper 0.
      * Hence all the local helpers use the same offset of user buffers */
 
-    /* Calculate the window size of helper 0, because it contains extra space
-     * for sync. */
-    int root_h_size = MTCORE_HELPER_SHARED_SG_SIZE;
-#ifdef MTCORE_ENABLE_GRANT_LOCK_HIDDEN_BYTE
-    root_h_size = max(root_h_size, sizeof(MTCORE_GRANT_LOCK_DATATYPE));
-#endif
-
-    tmp_u_offsets += root_h_size;
+    /* The window of helper 0 contains extra space for sync. */
+    tmp_u_offsets += MTCORE_ROOT_H_SHARED_SG_SIZE;
     tmp_u_offsets += MTCORE_HELPER_SHARED_SG_SIZE * (MTCORE_ENV.num_h - 1);
 
     for (j = 0; j < MTCORE_ENV.num_h; j++) {
@@ -617,7 +885,55 @@ static int gather_base_offsets(MPI_Aint size, MTCORE_Win * uh_win)
     goto fn_exit;
 }
 
-static int create_lock_windows(MPI_Aint size, int disp_unit, MPI_Info info, MTCORE_Win * uh_win)
+/* Keep only the helpers selected for this window in the per-target arrays,
+ * thus h_off indexes the selected helpers in every epoch, and rebuild the
+ * unique helper list used by lockall-like synchronization. All helpers are
+ * still included in uh_comm and the internal windows. */
+static void select_helpers(MTCORE_Win * uh_win)
+{
+    int i, k, user_nprocs;
+    int *node_done = NULL, *h_ranks = NULL;
+    MPI_Aint *h_offsets = NULL;
+
+    PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
+
+    node_done = calloc(uh_win->num_nodes, sizeof(int));
+    h_ranks = calloc(MTCORE_ENV.num_h, sizeof(int));
+    h_offsets = calloc(MTCORE_ENV.num_h, sizeof(MPI_Aint));
+
+    uh_win->num_h_ranks_in_uh = 0;
+    for (i = 0; i < user_nprocs; i++) {
+        MTCORE_Win_target *target = &uh_win->targets[i];
+
+        memcpy(h_ranks, target->h_ranks_in_uh, sizeof(int) * MTCORE_ENV.num_h);
+        memcpy(h_offsets, target->base_h_offsets, sizeof(MPI_Aint) * MTCORE_ENV.num_h);
+        for (k = 0; k < uh_win->num_h; k++) {
+            target->h_ranks_in_uh[k] = h_ranks[uh_win->h_offs[k]];
+            target->base_h_offsets[k] = h_offsets[uh_win->h_offs[k]];
+        }
+
+        /* Targets on the same node share helpers. */
+        if (node_done[target->node_id])
+            continue;
+        node_done[target->node_id] = 1;
+        for (k = 0; k < uh_win->num_h; k++)
+            uh_win->h_ranks_in_uh[uh_win->num_h_ranks_in_uh++] = target->h_ranks_in_uh[k];
+    }
+
+#ifdef DEBUG
+    MTCORE_DBG_PRINT("selected %d helpers per node, %d unique h_ranks:\n", uh_win->num_h,
+                     uh_win->num_h_ranks_in_uh);
+    for (i = 0; i < uh_win->num_h_ranks_in_uh; i++)
+        MTCORE_DBG_PRINT("\t[%d] %d\n", i, uh_win->h_ranks_in_uh[i]);
+#endif
+
+    free(node_done);
+    free(h_ranks);
+    free(h_offsets);
+}
+
+static int create_lock_windows(void *base, MPI_Aint size, int disp_unit, MPI_Info info,
+                               MTCORE_Win * uh_win)
 {
     int mpi_errno = MPI_SUCCESS;
     int i, j;
@@ -637,7 +953,7 @@ static int create_lock_windows(MPI_Aint size, int disp_unit, MPI_Info info, MTCO
 
     uh_win->uh_wins = calloc(uh_win->num_uh_wins, sizeof(MPI_Win));
     for (i = 0; i < uh_win->num_uh_wins; i++) {
-        mpi_errno = PMPI_Win_create(uh_win->base, size, disp_unit, info,
+        mpi_errno = PMPI_Win_create(base, size, disp_unit, info,
                                     uh_win->uh_comm, &uh_win->uh_wins[i]);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
@@ -665,6 +981,25 @@ static int create_lock_windows(MPI_Aint size, int disp_unit, MPI_Info info, MTCO
     /* Setup window for local target */
     uh_win->my_uh_win = uh_win->targets[user_rank].segs[0].uh_win;
 
+    /* Duplicate the single lock_all window for per-thread endpoints.
+     * It is only allowed in lock_all only epoch, because lock_all is shared
+     * thus it does not need any permission control among different windows.
+     * A lock window may also have a single internal window, but per-target locks
+     * are never acquired on endpoints. */
+    if (uh_win->info_args.num_thread_eps > 1 && uh_win->num_uh_wins == 1 &&
+        !(uh_win->info_args.epoch_type & MTCORE_EPOCH_LOCK)) {
+        uh_win->ep_uh_wins = calloc(uh_win->info_args.num_thread_eps, sizeof(MPI_Win));
+        uh_win->ep_uh_wins[0] = uh_win->uh_wins[0];
+        for (i = 1; i < uh_win->info_args.num_thread_eps; i++) {
+            mpi_errno = PMPI_Win_create(base, size, disp_unit, info,
+                                        uh_win->uh_comm, &uh_win->ep_uh_wins[i]);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
+        MTCORE_DBG_PRINT("[%d] Created %d endpoint uh windows\n", user_rank,
+                         uh_win->info_args.num_thread_eps);
+    }
+
   fn_exit:
     return mpi_errno;
 
@@ -672,10 +1007,10 @@ static int create_lock_windows(MPI_Aint size, int disp_unit, MPI_Info info, MTCO
     goto fn_exit;
 }
 
-int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
-                     MPI_Comm user_comm, void *baseptr, MPI_Win * win)
+int MTCORE_Win_allocate_impl(MPI_Aint size, int disp_unit, MPI_Info info,
+                             MPI_Comm user_comm, int user_comm_dup, void *baseptr, MPI_Win * win)
 {
-    static const char FCNAME[] = "MPI_Win_allocate";
+    static const char FCNAME[] = "MTCORE_Win_allocate_impl";
     int mpi_errno = MPI_SUCCESS;
     MPI_Group uh_group;
     int uh_rank, uh_nprocs, user_nprocs, user_rank, user_world_rank, world_rank,
@@ -687,10 +1022,15 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
     MPI_Aint *tmp_gather_buf = NULL;
     ;
     int tmp_bcast_buf[2];
+    int comm_key;
+    void *uh_base;
+    MPI_Aint uh_size, shm_size;
+    int uh_disp_unit;
 
     MTCORE_DBG_PRINT_FCNAME();
 
     uh_win = calloc(1, sizeof(MTCORE_Win));
+    uh_win->user_comm_dup = user_comm_dup;
 
     /* If user specifies comm_world directly, use user comm_world instead;
      * else this communicator directly, because it should be created from user comm_world */
@@ -704,33 +1044,58 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
         uh_win->user_comm = user_comm;
     }
     else {
-        mpi_errno = PMPI_Comm_split_type(user_comm, MPI_COMM_TYPE_SHARED, 0,
-                                         MPI_INFO_NULL, &uh_win->local_user_comm);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
-
         uh_win->user_comm = user_comm;
 
-        /* Create a user root communicator in order to figure out node_id and
-         * num_nodes of this user communicator */
-        PMPI_Comm_rank(uh_win->local_user_comm, &user_local_rank);
-        mpi_errno = PMPI_Comm_split(uh_win->user_comm,
-                                    user_local_rank == 0, 1, &uh_win->user_root_comm);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
+        /* Reuse internal communicators of previous windows on the same group. */
+        if (MTCORE_ENV.comm_cache) {
+            mpi_errno = MTCORE_Comm_cache_get(user_comm, &uh_win->comm_cache);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
 
-        if (user_local_rank == 0) {
-            int node_id, num_nodes;
-            PMPI_Comm_size(uh_win->user_root_comm, &num_nodes);
-            PMPI_Comm_rank(uh_win->user_root_comm, &node_id);
+        if (uh_win->comm_cache) {
+            uh_win->local_user_comm = uh_win->comm_cache->local_user_comm;
+            uh_win->user_root_comm = uh_win->comm_cache->user_root_comm;
+            uh_win->node_id = uh_win->comm_cache->node_id;
+            uh_win->num_nodes = uh_win->comm_cache->num_nodes;
+        }
+        else {
+            mpi_errno = PMPI_Comm_split_type(user_comm, MPI_COMM_TYPE_SHARED, 0,
+                                             MPI_INFO_NULL, &uh_win->local_user_comm);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+
+            /* Create a user root communicator in order to figure out node_id and
+             * num_nodes of this user communicator */
+            PMPI_Comm_rank(uh_win->local_user_comm, &user_local_rank);
+            mpi_errno = PMPI_Comm_split(uh_win->user_comm,
+                                        user_local_rank == 0, 1, &uh_win->user_root_comm);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+
+            if (user_local_rank == 0) {
+                int node_id, num_nodes;
+                PMPI_Comm_size(uh_win->user_root_comm, &num_nodes);
+                PMPI_Comm_rank(uh_win->user_root_comm, &node_id);
+
+                tmp_bcast_buf[0] = node_id;
+                tmp_bcast_buf[1] = num_nodes;
+            }
 
-            tmp_bcast_buf[0] = node_id;
-            tmp_bcast_buf[1] = num_nodes;
+            PMPI_Bcast(tmp_bcast_buf, 2, MPI_INT, 0, uh_win->local_user_comm);
+            uh_win->node_id = tmp_bcast_buf[0];
+            uh_win->num_nodes = tmp_bcast_buf[1];
         }
 
-        PMPI_Bcast(tmp_bcast_buf, 2, MPI_INT, 0, uh_win->local_user_comm);
-        uh_win->node_id = tmp_bcast_buf[0];
-        uh_win->num_nodes = tmp_bcast_buf[1];
+        if (MTCORE_ENV.ghost_mode == MTCORE_GHOST_THREAD) {
+            int has_hosts = 0;
+
+            mpi_errno = has_ghost_hosts(uh_win, &has_hosts);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+            if (!has_hosts)
+                goto fn_noasync;
+        }
     }
 
     PMPI_Comm_group(user_comm, &uh_win->user_group);
@@ -742,34 +1107,48 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
     PMPI_Comm_rank(MTCORE_COMM_USER_WORLD, &user_world_rank);
 
     uh_win->h_ranks_in_uh = calloc(MTCORE_ENV.num_h * uh_win->num_nodes, sizeof(MPI_Aint));
+    uh_win->h_offs = calloc(MTCORE_ENV.num_h, sizeof(int));
     uh_win->targets = calloc(user_nprocs, sizeof(MTCORE_Win_target));
     for (i = 0; i < user_nprocs; i++) {
         uh_win->targets[i].base_h_offsets = calloc(MTCORE_ENV.num_h, sizeof(MPI_Aint));
         uh_win->targets[i].h_ranks_in_uh = calloc(MTCORE_ENV.num_h, sizeof(MPI_Aint));
     }
 
-    /* Gather users' disp_unit, size, ranks and node_id */
-    tmp_gather_buf = calloc(user_nprocs * 7, sizeof(MPI_Aint));
-    tmp_gather_buf[7 * user_rank] = (MPI_Aint) disp_unit;
-    tmp_gather_buf[7 * user_rank + 1] = size;   /* MPI_Aint, size in bytes */
-    tmp_gather_buf[7 * user_rank + 2] = (MPI_Aint) user_local_rank;
-    tmp_gather_buf[7 * user_rank + 3] = (MPI_Aint) world_rank;
-    tmp_gather_buf[7 * user_rank + 4] = (MPI_Aint) user_world_rank;
-    tmp_gather_buf[7 * user_rank + 5] = (MPI_Aint) uh_win->node_id;
-    tmp_gather_buf[7 * user_rank + 6] = (MPI_Aint) user_local_nprocs;
+    /* Gather users' disp_unit, size, ranks and node_id, the request id
+     * generated by user rank 0 for tagging this allocation on all nodes, and
+     * the key of cached communicators decided by user rank 0. */
+    tmp_gather_buf = calloc(user_nprocs * 9, sizeof(MPI_Aint));
+    tmp_gather_buf[9 * user_rank] = (MPI_Aint) disp_unit;
+    tmp_gather_buf[9 * user_rank + 1] = size;   /* MPI_Aint, size in bytes */
+    tmp_gather_buf[9 * user_rank + 2] = (MPI_Aint) user_local_rank;
+    tmp_gather_buf[9 * user_rank + 3] = (MPI_Aint) world_rank;
+    tmp_gather_buf[9 * user_rank + 4] = (MPI_Aint) user_world_rank;
+    tmp_gather_buf[9 * user_rank + 5] = (MPI_Aint) uh_win->node_id;
+    tmp_gather_buf[9 * user_rank + 6] = (MPI_Aint) user_local_nprocs;
+    tmp_gather_buf[9 * user_rank + 7] = (MPI_Aint) (user_rank == 0 ?
+                                                     MTCORE_Func_new_req_id() : 0);
+    tmp_gather_buf[9 * user_rank + 8] = (MPI_Aint) MTCORE_COMM_CACHE_NONE;
+    if (user_rank == 0) {
+        if (uh_win->comm_cache)
+            tmp_gather_buf[8] = (MPI_Aint) uh_win->comm_cache->key;
+        else if (MTCORE_ENV.comm_cache && user_comm != MTCORE_COMM_USER_WORLD)
+            tmp_gather_buf[8] = (MPI_Aint) MTCORE_Comm_cache_new_key();
+    }
 
     mpi_errno = PMPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
-                               tmp_gather_buf, 7, MPI_AINT, user_comm);
+                               tmp_gather_buf, 9, MPI_AINT, user_comm);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
+    uh_win->req_id = (int) tmp_gather_buf[7];
+    comm_key = (int) tmp_gather_buf[8];
     for (i = 0; i < user_nprocs; i++) {
-        uh_win->targets[i].disp_unit = (int) tmp_gather_buf[7 * i];
-        uh_win->targets[i].size = tmp_gather_buf[7 * i + 1];
-        uh_win->targets[i].local_user_rank = (int) tmp_gather_buf[7 * i + 2];
-        uh_win->targets[i].world_rank = (int) tmp_gather_buf[7 * i + 3];
-        uh_win->targets[i].user_world_rank = (int) tmp_gather_buf[7 * i + 4];
-        uh_win->targets[i].node_id = (int) tmp_gather_buf[7 * i + 5];
-        uh_win->targets[i].local_user_nprocs = (int) tmp_gather_buf[7 * i + 6];
+        uh_win->targets[i].disp_unit = (int) tmp_gather_buf[9 * i];
+        uh_win->targets[i].size = tmp_gather_buf[9 * i + 1];
+        uh_win->targets[i].local_user_rank = (int) tmp_gather_buf[9 * i + 2];
+        uh_win->targets[i].world_rank = (int) tmp_gather_buf[9 * i + 3];
+        uh_win->targets[i].user_world_rank = (int) tmp_gather_buf[9 * i + 4];
+        uh_win->targets[i].node_id = (int) tmp_gather_buf[9 * i + 5];
+        uh_win->targets[i].local_user_nprocs = (int) tmp_gather_buf[9 * i + 6];
 
         /* Calculate the maximum number of processes per node */
         uh_win->max_local_user_nprocs = max(uh_win->max_local_user_nprocs,
@@ -777,9 +1156,9 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
     }
 
 #ifdef DEBUG
-    MTCORE_DBG_PRINT("my user local rank %d/%d, max_local_user_nprocs=%d, num_nodes=%d\n",
-                     user_local_rank, user_local_nprocs, uh_win->max_local_user_nprocs,
-                     uh_win->num_nodes);
+    MTCORE_DBG_PRINT("my user local rank %d/%d, max_local_user_nprocs=%d, num_nodes=%d, "
+                     "req_id=%d\n", user_local_rank, user_local_nprocs,
+                     uh_win->max_local_user_nprocs, uh_win->num_nodes, uh_win->req_id);
     for (i = 0; i < user_nprocs; i++) {
         MTCORE_DBG_PRINT("\t targets[%d].disp_unit=%d, size=%ld, local_user_rank=%d, "
                          "world_rank=%d, user_world_rank=%d, node_id=%d, local_user_nprocs=%d\n",
@@ -794,14 +1173,12 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
 
-    /* Notify Helpers start and create user root + helpers communicator for
-     * internal information exchange between users and helpers. */
-    if (user_local_rank == 0) {
-        mpi_errno = MTCORE_Func_start(MTCORE_FUNC_WIN_ALLOCATE, user_nprocs, user_local_nprocs);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
+    uh_win->sync = uh_win->info_args.sync_strategy == MTCORE_SYNC_ALL ?
+        &MTCORE_SYNC_ALL_FNS : &MTCORE_SYNC_HELPER_FNS;
 
-        mpi_errno = MTCORE_Func_new_ur_h_comm(&uh_win->ur_h_comm);
+    /* Notify Helpers start with all the parameters they need. */
+    if (user_local_rank == 0 && MTCORE_ENV.ghost_mode == MTCORE_GHOST_PROCESS) {
+        mpi_errno = start_helpers(uh_win, user_nprocs, user_local_nprocs, comm_key);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
     }
@@ -814,6 +1191,13 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
 
+    /* Cache communicators created for this window with the new key. */
+    if (uh_win->comm_cache == NULL && comm_key != MTCORE_COMM_CACHE_NONE) {
+        mpi_errno = MTCORE_Comm_cache_add(uh_win, comm_key);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
+
     PMPI_Comm_rank(uh_win->local_uh_comm, &uh_local_rank);
     PMPI_Comm_size(uh_win->local_uh_comm, &uh_local_nprocs);
     PMPI_Comm_size(uh_win->uh_comm, &uh_nprocs);
@@ -827,39 +1211,72 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
     uh_win->h_bytes_counts = calloc(uh_nprocs, sizeof(unsigned long));
 #endif
 
-    /* Allocate a shared window with local Helpers */
-    mpi_errno = PMPI_Win_allocate_shared(size, disp_unit, info, uh_win->local_uh_comm,
-                                         &uh_win->base, &uh_win->local_uh_win);
+    if (MTCORE_ENV.h_credit_ops > 0 || MTCORE_ENV.h_credit_bytes > 0 ||
+        MTCORE_ENV.h_credit_stat) {
+        mpi_errno = MTCORE_Credit_alloc(uh_nprocs, uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
+
+    /* Allocate a shared window with local Helpers. A window host allocates the
+     * segment of helper 0 in front of its buffer, thus offsets of users are the
+     * same as in the process mode. */
+    shm_size = size;
+    if (MTCORE_Is_win_host(uh_win, user_rank))
+        shm_size += MTCORE_ROOT_H_SHARED_SG_SIZE;
+    mpi_errno = MTCORE_Shm_seg_allocate(shm_size, disp_unit, info, uh_win->local_uh_comm,
+                                        uh_win->info_args.huge_page, &uh_win->base,
+                                        &uh_win->local_uh_win, &uh_win->shm_seg);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
+    if (MTCORE_Is_win_host(uh_win, user_rank))
+        uh_win->base = (char *) uh_win->base + MTCORE_ROOT_H_SHARED_SG_SIZE;
     MTCORE_DBG_PRINT("[%d] allocate shared base = %p\n", user_rank, uh_win->base);
 
+    /* Place my segment on my NUMA domain before any local process accesses it.
+     * Helpers only access it after the collective creation of internal windows. */
+    if (MTCORE_ENV.shm_numa_bind && size > 0 &&
+        MTCORE_Topo_place_memory(uh_win->base, size,
+                                 MTCORE_ALL_NUMA_IDS[MTCORE_MY_RANK_IN_WORLD]) != 0) {
+        MTCORE_DBG_PRINT("[%d] cannot bind shared segment to numa %d, only first-touched\n",
+                         user_rank, MTCORE_ALL_NUMA_IDS[MTCORE_MY_RANK_IN_WORLD]);
+    }
+
     /* Gather user offsets on corresponding helper processes */
     mpi_errno = gather_base_offsets(size, uh_win);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
 
-    specify_main_helper_binding(uh_win);
+    select_helpers(uh_win);
 
-    /* Create windows using shared buffers. */
+    /* Query shared segments of same-node targets for shared-memory accumulate */
+    mpi_errno = MTCORE_Shm_acc_win_init(uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
 
-    /* Send information to helpers */
-    if (user_local_rank == 0) {
-        int func_params[2];
-        func_params[0] = uh_win->max_local_user_nprocs;
-        func_params[1] = uh_win->info_args.epoch_type;
-        mpi_errno = MTCORE_Func_set_param((char *) func_params, sizeof(func_params),
-                                          uh_win->ur_h_comm);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
-        MTCORE_DBG_PRINT(" Send parameters: max_local_user_nprocs %d, epoch_type %d \n",
-                         uh_win->max_local_user_nprocs, uh_win->info_args.epoch_type);
+    specify_main_helper_binding(uh_win);
+
+    /* Create windows using shared buffers.
+     * A window host exposes the whole node segment in bytes as helper 0. */
+    uh_base = uh_win->base;
+    uh_size = size;
+    uh_disp_unit = disp_unit;
+    if (MTCORE_Is_win_host(uh_win, user_rank)) {
+        uh_base = (char *) uh_win->base - MTCORE_ROOT_H_SHARED_SG_SIZE;
+        uh_size = MTCORE_ROOT_H_SHARED_SG_SIZE;
+        for (i = 0; i < user_nprocs; i++) {
+            if (uh_win->targets[i].node_id == uh_win->node_id)
+                uh_size += uh_win->targets[i].size;
+        }
+        uh_disp_unit = 1;
+        MTCORE_DBG_PRINT("[%d] expose node segment base %p, size %ld as helper\n", user_rank,
+                         uh_base, uh_size);
     }
 
     if ((uh_win->info_args.epoch_type & MTCORE_EPOCH_LOCK) ||
         (uh_win->info_args.epoch_type & MTCORE_EPOCH_LOCK_ALL)) {
 
-        mpi_errno = create_lock_windows(size, disp_unit, info, uh_win);
+        mpi_errno = create_lock_windows(uh_base, uh_size, uh_disp_unit, info, uh_win);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
     }
@@ -867,7 +1284,7 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
     /* - Create global active window */
     if ((uh_win->info_args.epoch_type & MTCORE_EPOCH_FENCE) ||
         (uh_win->info_args.epoch_type & MTCORE_EPOCH_PSCW)) {
-        mpi_errno = PMPI_Win_create(uh_win->base, size, disp_unit, info,
+        mpi_errno = PMPI_Win_create(uh_base, uh_size, uh_disp_unit, info,
                                     uh_win->uh_comm, &uh_win->active_win);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
@@ -882,10 +1299,35 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
         uh_win->start_counter = 0;
+
+        /* Duplicate active window for per-thread endpoints. */
+        if (uh_win->info_args.num_thread_eps > 1) {
+            uh_win->ep_active_wins = calloc(uh_win->info_args.num_thread_eps, sizeof(MPI_Win));
+            uh_win->ep_active_wins[0] = uh_win->active_win;
+            for (i = 1; i < uh_win->info_args.num_thread_eps; i++) {
+                mpi_errno = PMPI_Win_create(uh_base, uh_size, uh_disp_unit, info,
+                                            uh_win->uh_comm, &uh_win->ep_active_wins[i]);
+                if (mpi_errno != MPI_SUCCESS)
+                    goto fn_fail;
+
+                mpi_errno = PMPI_Win_lock_all(MPI_MODE_NOCHECK, uh_win->ep_active_wins[i]);
+                if (mpi_errno != MPI_SUCCESS)
+                    goto fn_fail;
+            }
+            MTCORE_DBG_PRINT("[%d] Created %d endpoint active windows\n", user_rank,
+                             uh_win->info_args.num_thread_eps);
+        }
+    }
+
+    /* - Create active-message transport */
+    if (uh_win->info_args.rma_transport != MTCORE_RMA_TRANSPORT_RMA) {
+        mpi_errno = MTCORE_AM_win_init(uh_win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
     }
 
     /* Track epoch status for redirecting RMA to different window. */
-    uh_win->epoch_stat = MTCORE_WIN_NO_EPOCH;
+    MTCORE_Atomic_store(&uh_win->epoch_stat, MTCORE_WIN_NO_EPOCH);
 
     /* - Only expose user window in order to hide helpers in all non-wrapped window functions */
     mpi_errno = PMPI_Win_create(uh_win->base, size, disp_unit, info,
@@ -898,16 +1340,21 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
     *win = uh_win->win;
     *base_pp = uh_win->base;
 
-    /* Gather the handle of Helpers' win. User root is always rank num_h in user
-     * root + helpers communicator */
+    /* Receive the handles of Helpers' win, which is the only reply of helpers. */
     /* TODO:
      * How about use handler on user root ?
      * How to solve the case that different processes may have the same handler ? */
-    if (user_local_rank == 0) {
-        unsigned long tmp_send_buf;
-        uh_win->h_win_handles = calloc(MTCORE_ENV.num_h + 1, sizeof(unsigned long));
-        mpi_errno = PMPI_Gather(&tmp_send_buf, 1, MPI_UNSIGNED_LONG, uh_win->h_win_handles,
-                                1, MPI_UNSIGNED_LONG, MTCORE_ENV.num_h, uh_win->ur_h_comm);
+    if (user_local_rank == 0 && MTCORE_ENV.ghost_mode == MTCORE_GHOST_PROCESS) {
+        uh_win->h_win_handles = calloc(MTCORE_ENV.num_h, sizeof(unsigned long));
+        mpi_errno = MTCORE_Func_wait_reply(uh_win->req_id, uh_win->h_win_handles,
+                                           sizeof(unsigned long) * MTCORE_ENV.num_h);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
+
+    /* All local users need the handles for offloading point-to-point and collectives. */
+    if (MTCORE_P2P_is_enabled()) {
+        mpi_errno = MTCORE_P2P_register_win(uh_win);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
     }
@@ -925,9 +1372,11 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
 
     /* Caching is the last possible error, so we do not need remove
      * cache here. */
+    if (MTCORE_P2P_is_enabled())
+        MTCORE_P2P_unregister_win(uh_win);
 
     if (uh_win->local_uh_win)
-        PMPI_Win_free(&uh_win->local_uh_win);
+        MTCORE_Shm_seg_free(&uh_win->local_uh_win, &uh_win->shm_seg);
     if (uh_win->win)
         PMPI_Win_free(&uh_win->win);
     if (uh_win->active_win)
@@ -938,24 +1387,42 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
                 PMPI_Win_free(&uh_win->uh_wins[i]);
         }
     }
+    if (uh_win->ep_uh_wins) {
+        for (i = 1; i < uh_win->info_args.num_thread_eps; i++) {
+            if (uh_win->ep_uh_wins[i])
+                PMPI_Win_free(&uh_win->ep_uh_wins[i]);
+        }
+        free(uh_win->ep_uh_wins);
+    }
+    if (uh_win->ep_active_wins) {
+        for (i = 1; i < uh_win->info_args.num_thread_eps; i++) {
+            if (uh_win->ep_active_wins[i])
+                PMPI_Win_free(&uh_win->ep_active_wins[i]);
+        }
+        free(uh_win->ep_active_wins);
+    }
+
+    if (uh_win->am)
+        MTCORE_AM_win_destroy(uh_win);
+
+    if (uh_win->comm_cache) {
+        MTCORE_Comm_cache_release(uh_win->comm_cache);
+    }
+    else {
+        if (uh_win->local_uh_comm && uh_win->local_uh_comm != MTCORE_COMM_LOCAL)
+            PMPI_Comm_free(&uh_win->local_uh_comm);
+        if (uh_win->uh_comm != MPI_COMM_NULL)
+            PMPI_Comm_free(&uh_win->uh_comm);
+        if (uh_win->uh_group != MPI_GROUP_NULL)
+            PMPI_Group_free(&uh_win->uh_group);
+        if (uh_win->local_user_comm && uh_win->local_user_comm != MTCORE_COMM_USER_LOCAL)
+            PMPI_Comm_free(&uh_win->local_user_comm);
+        if (uh_win->user_root_comm && uh_win->user_root_comm != MTCORE_COMM_UR_WORLD)
+            PMPI_Comm_free(&uh_win->user_root_comm);
+        if (uh_win->local_uh_group != MPI_GROUP_NULL)
+            PMPI_Group_free(&uh_win->local_uh_group);
+    }
 
-    if (uh_win->ur_h_comm && uh_win->ur_h_comm != MPI_COMM_NULL)
-        PMPI_Comm_free(&uh_win->ur_h_comm);
-    if (uh_win->local_uh_comm && uh_win->local_uh_comm != MTCORE_COMM_LOCAL)
-        PMPI_Comm_free(&uh_win->local_uh_comm);
-    if (uh_win->uh_comm != MPI_COMM_NULL)
-        PMPI_Comm_free(&uh_win->uh_comm);
-    if (uh_win->uh_group != MPI_GROUP_NULL)
-        PMPI_Group_free(&uh_win->uh_group);
-    if (uh_win->local_user_comm && uh_win->local_user_comm != MTCORE_COMM_USER_LOCAL)
-        PMPI_Comm_free(&uh_win->local_user_comm);
-    if (uh_win->user_root_comm && uh_win->user_root_comm != MTCORE_COMM_UR_WORLD)
-        PMPI_Comm_free(&uh_win->user_root_comm);
-
-    if (uh_win->local_uh_group != MPI_GROUP_NULL)
-        PMPI_Group_free(&uh_win->local_uh_group);
-    if (uh_win->uh_group != MPI_GROUP_NULL)
-        PMPI_Group_free(&uh_win->uh_group);
     if (uh_win->user_group != MPI_GROUP_NULL)
         PMPI_Group_free(&uh_win->user_group);
 
@@ -965,6 +1432,7 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
     if (uh_win->h_bytes_counts)
         free(uh_win->h_bytes_counts);
 #endif
+    MTCORE_Credit_free(uh_win);
 
     if (uh_win->targets) {
         for (i = 0; i < user_nprocs; i++) {
@@ -979,6 +1447,8 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
     }
     if (uh_win->h_ranks_in_uh)
         free(uh_win->h_ranks_in_uh);
+    if (uh_win->h_offs)
+        free(uh_win->h_offs);
     if (uh_win->h_win_handles)
         free(uh_win->h_win_handles);
     if (uh_win->uh_wins)
@@ -990,4 +1460,36 @@ int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
     *base_pp = NULL;
 
     goto fn_exit;
+
+  fn_noasync:
+    /* Local rank 0 of the world is not the first local user of every node, thus
+     * the window is a normal MPI window. */
+    PMPI_Comm_free(&uh_win->local_user_comm);
+    PMPI_Comm_free(&uh_win->user_root_comm);
+    free(uh_win);
+
+    /* The window keeps its own reference, thus a duplicated communicator is not
+     * needed once it is allocated. */
+    mpi_errno = PMPI_Win_allocate(size, disp_unit, info, user_comm, baseptr, win);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+    if (user_comm_dup)
+        PMPI_Comm_free(&user_comm);
+
+    MTCORE_WARN_PRINT("called PMPI_Win_allocate, no asynchronous progress on win 0x%x\n", *win);
+    goto fn_exit;
+}
+
+int MPI_Win_allocate(MPI_Aint size, int disp_unit, MPI_Info info,
+                     MPI_Comm user_comm, void *baseptr, MPI_Win * win)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    /* Helpers serve control-plane functions of this process in order, thus
+     * complete window allocations still in flight before starting a new one. */
+    mpi_errno = MTCORE_Win_iallocate_wait_all();
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    return MTCORE_Win_allocate_impl(size, disp_unit, info, user_comm, 0, baseptr, win);
 }
@@ -60,46 +60,40 @@ static int MTCORE_Send_pscw_complete_msg(int start_grp_size, MTCORE_Win * uh_win
 static int MTCORE_Complete_flush(int start_grp_size, MTCORE_Win * uh_win)
 {
     int mpi_errno = MPI_SUCCESS;
-    int user_rank, user_nprocs;
-    int i, j, k;
+    int user_rank;
+    int i, ep, num_eps = 1, flush_self = 0;
+    MPI_Win active_win;
 
     MTCORE_DBG_PRINT_FCNAME();
 
     PMPI_Comm_rank(uh_win->user_comm, &user_rank);
 
-    /* Flush helpers to finish the sequence of locally issued RMA operations */
-#ifdef MTCORE_ENABLE_SYNC_ALL_OPT
+#ifdef MTCORE_ENABLE_LOCAL_LOCK_OPT
+    /* Need flush local target */
+    for (i = 0; i < start_grp_size; i++) {
+        if (uh_win->start_ranks_in_win_group[i] == user_rank)
+            flush_self = 1;
+    }
+#endif
 
-    /* Optimization for MPI implementations that have optimized lock_all.
-     * However, user should be noted that, if MPI implementation issues lock messages
-     * for every target even if it does not have any operation, this optimization
-     * could lose performance and even lose asynchronous! */
-    MTCORE_DBG_PRINT("[%d]flush_all(active_win 0x%x)\n", user_rank, uh_win->active_win);
-    mpi_errno = PMPI_Win_flush_all(uh_win->active_win);
+    mpi_errno = MTCORE_AM_flush_all(uh_win);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
-#else
 
-    /* Flush every helper once in the single window.
-     * TODO: track op issuing, only flush the helpers which receive ops. */
-    for (i = 0; i < uh_win->num_h_ranks_in_uh; i++) {
-        mpi_errno = PMPI_Win_flush(uh_win->h_ranks_in_uh[i], uh_win->active_win);
+    /* Complete finishes operations issued by all threads on every endpoint. */
+    if (uh_win->ep_active_wins)
+        num_eps = uh_win->info_args.num_thread_eps;
+
+    for (ep = 0; ep < num_eps; ep++) {
+        active_win = uh_win->ep_active_wins ? uh_win->ep_active_wins[ep] : uh_win->active_win;
+
+        /* Flush helpers to finish the sequence of locally issued RMA operations */
+        mpi_errno = uh_win->sync->flush_win(active_win, flush_self, uh_win);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
     }
 
-#ifdef MTCORE_ENABLE_LOCAL_LOCK_OPT
-    /* Need flush local target */
-    for (i = 0; i < start_grp_size; i++) {
-        if (uh_win->start_ranks_in_win_group[i] == user_rank) {
-            mpi_errno = PMPI_Win_flush(uh_win->my_rank_in_uh_comm, uh_win->active_win);
-            if (mpi_errno != MPI_SUCCESS)
-                goto fn_fail;
-        }
-    }
-#endif
-
-#endif
+    MTCORE_Credit_reset_all(uh_win);
 
     /* TODO: All the operations which we have not wrapped up will be failed, because they
      * are issued to user window. We need wrap up all operations.
@@ -117,7 +111,6 @@ int MPI_Win_complete(MPI_Win win)
     MTCORE_Win *uh_win;
     int mpi_errno = MPI_SUCCESS;
     int start_grp_size = 0;
-    int i;
 
     MTCORE_DBG_PRINT_FCNAME();
 
@@ -147,7 +140,7 @@ int MPI_Win_complete(MPI_Win win)
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
 
-    uh_win->is_self_locked = 0;
+    MTCORE_Atomic_store(&uh_win->is_self_locked, 0);
 
     mpi_errno = MTCORE_Send_pscw_complete_msg(start_grp_size, uh_win);
     if (mpi_errno != MPI_SUCCESS)
@@ -157,7 +150,7 @@ int MPI_Win_complete(MPI_Win win)
      * after the start counter decreases to 0 .*/
     uh_win->start_counter--;
     if (uh_win->start_counter == 0) {
-        uh_win->epoch_stat = MTCORE_WIN_NO_EPOCH;
+        MTCORE_Atomic_store(&uh_win->epoch_stat, MTCORE_WIN_NO_EPOCH);
     }
 
     MTCORE_DBG_PRINT("Complete done\n");
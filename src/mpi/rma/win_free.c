@@ -2,64 +2,38 @@
 #include <stdlib.h>
 #include "mtcore.h"
 
-int MPI_Win_free(MPI_Win * win)
+/**
+ * Release internal resources of a freed window. Only the user window is freed
+ * in MPI_Win_free, the internal windows and communicators are freed here,
+ * collectively with helpers. It is either called at the end of MPI_Win_free,
+ * or deferred to the allocation thread (see MTCORE_Win_release_defer).
+ */
+int MTCORE_Win_release(MTCORE_Win * uh_win, int user_nprocs)
 {
-    static const char FCNAME[] = "MTCORE_Win_free";
     int mpi_errno = MPI_SUCCESS;
-    MTCORE_Win *uh_win;
-    int user_rank, user_nprocs, user_local_rank, user_local_nprocs;
-    int i, j;
-    MPI_Request *reqs = NULL;
-    MPI_Status *stats = NULL;
-
-    MTCORE_DBG_PRINT_FCNAME();
-
-    MTCORE_Fetch_uh_win_from_cache(*win, uh_win);
-
-    if (uh_win == NULL) {
-        /* normal window */
-        return PMPI_Win_free(win);
-    }
-
-    /* mtcore window starts */
+    int user_local_rank, user_local_nprocs;
+    int i;
 
-    PMPI_Comm_rank(uh_win->user_comm, &user_rank);
-    PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
     PMPI_Comm_rank(uh_win->local_user_comm, &user_local_rank);
     PMPI_Comm_size(uh_win->local_user_comm, &user_local_nprocs);
 
-    /* First unlock global active window */
-    if ((uh_win->info_args.epoch_type & MTCORE_EPOCH_FENCE) ||
-        (uh_win->info_args.epoch_type & MTCORE_EPOCH_PSCW)) {
-
-        MTCORE_DBG_PRINT("[%d]unlock_all(active_win 0x%x)\n", user_rank, uh_win->active_win);
-
-        /* Since all processes must be in win_free, we do not need worry
-         * the possibility losing asynchronous progress. */
-        mpi_errno = PMPI_Win_unlock_all(uh_win->active_win);
+    /* Notify helpers with the handles of their windows in the start message. It
+     * is noted that helpers cannot fetch the corresponding window without handlers.
+     * No reply is needed, because the window free is collective with helpers. */
+    if (user_local_rank == 0 && MTCORE_ENV.ghost_mode == MTCORE_GHOST_PROCESS) {
+        mpi_errno = MTCORE_Func_start(MTCORE_FUNC_WIN_FREE, user_nprocs, user_local_nprocs,
+                                      uh_win->req_id, MTCORE_Comm_cache_key(uh_win),
+                                      uh_win->h_win_handles,
+                                      sizeof(unsigned long) * MTCORE_ENV.num_h);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
     }
 
-    if (user_local_rank == 0) {
-        MTCORE_Func_start(MTCORE_FUNC_WIN_FREE, user_nprocs, user_local_nprocs);
-    }
-
-    /* Notify the handle of target Helper win. It is noted that helpers cannot
-     * fetch the corresponding window without handlers so that only global communicator
-     * can be used here.*/
-    if (user_local_rank == 0) {
-        reqs = calloc(MTCORE_ENV.num_h, sizeof(MPI_Request));
-        stats = calloc(MTCORE_ENV.num_h, sizeof(MPI_Status));
-
-        for (j = 0; j < MTCORE_ENV.num_h; j++) {
-            mpi_errno = PMPI_Isend(&uh_win->h_win_handles[j], 1, MPI_UNSIGNED_LONG,
-                                   MTCORE_H_RANKS_IN_LOCAL[j], 0, MTCORE_COMM_LOCAL, &reqs[j]);
-        }
-        mpi_errno = PMPI_Waitall(MTCORE_ENV.num_h, reqs, stats);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
-    }
+    /* Free active-message transport, all operations have been completed
+     * in the last epoch. */
+    mpi_errno = MTCORE_AM_win_destroy(uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
 
     /* Free uh_win before local_uh_win, because all the incoming operations
      * should be done before free shared buffers.
@@ -79,6 +53,24 @@ int MPI_Win_free(MPI_Win * win)
         }
     }
 
+    if (uh_win->ep_uh_wins) {
+        MTCORE_DBG_PRINT("\t free endpoint uh windows\n");
+        for (i = 1; i < uh_win->info_args.num_thread_eps; i++) {
+            mpi_errno = PMPI_Win_free(&uh_win->ep_uh_wins[i]);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
+    }
+
+    if (uh_win->ep_active_wins) {
+        MTCORE_DBG_PRINT("\t free endpoint active windows\n");
+        for (i = 1; i < uh_win->info_args.num_thread_eps; i++) {
+            mpi_errno = PMPI_Win_free(&uh_win->ep_active_wins[i]);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
+    }
+
     if (uh_win->active_win) {
         MTCORE_DBG_PRINT("\t free active window\n");
         mpi_errno = PMPI_Win_free(&uh_win->active_win);
@@ -88,7 +80,7 @@ int MPI_Win_free(MPI_Win * win)
 
     if (uh_win->local_uh_win) {
         MTCORE_DBG_PRINT("\t free shared window\n");
-        mpi_errno = PMPI_Win_free(&uh_win->local_uh_win);
+        mpi_errno = MTCORE_Shm_seg_free(&uh_win->local_uh_win, &uh_win->shm_seg);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
     }
@@ -99,66 +91,67 @@ int MPI_Win_free(MPI_Win * win)
             goto fn_fail;
     }
 
-    if (uh_win->ur_h_comm && uh_win->ur_h_comm != MPI_COMM_NULL) {
-        MTCORE_DBG_PRINT("\t free user root + helpers communicator\n");
-        mpi_errno = PMPI_Comm_free(&uh_win->ur_h_comm);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
-    }
-
-    if (uh_win->local_uh_comm && uh_win->local_uh_comm != MTCORE_COMM_LOCAL) {
-        MTCORE_DBG_PRINT("\t free shared communicator\n");
-        mpi_errno = PMPI_Comm_free(&uh_win->local_uh_comm);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
-    }
-    if (uh_win->local_uh_group != MPI_GROUP_NULL) {
-        mpi_errno = PMPI_Group_free(&uh_win->local_uh_group);
+    /* Cached communicators are freed when all windows and user communicators
+     * referring the cache are freed. */
+    if (uh_win->comm_cache) {
+        MTCORE_DBG_PRINT("\t release communicator cache\n");
+        mpi_errno = MTCORE_Comm_cache_release(uh_win->comm_cache);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
     }
+    else {
+        if (uh_win->local_uh_comm && uh_win->local_uh_comm != MTCORE_COMM_LOCAL) {
+            MTCORE_DBG_PRINT("\t free shared communicator\n");
+            mpi_errno = PMPI_Comm_free(&uh_win->local_uh_comm);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
+        if (uh_win->local_uh_group != MPI_GROUP_NULL) {
+            mpi_errno = PMPI_Group_free(&uh_win->local_uh_group);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
 
-    if (uh_win->uh_comm != MPI_COMM_NULL && uh_win->uh_comm != MPI_COMM_WORLD) {
-        MTCORE_DBG_PRINT("\t free uh communicator\n");
-        mpi_errno = PMPI_Comm_free(&uh_win->uh_comm);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
-    }
-    if (uh_win->uh_group != MPI_GROUP_NULL) {
-        mpi_errno = PMPI_Group_free(&uh_win->uh_group);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
-    }
+        if (uh_win->uh_comm != MPI_COMM_NULL && uh_win->uh_comm != MPI_COMM_WORLD) {
+            MTCORE_DBG_PRINT("\t free uh communicator\n");
+            mpi_errno = PMPI_Comm_free(&uh_win->uh_comm);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
+        if (uh_win->uh_group != MPI_GROUP_NULL) {
+            mpi_errno = PMPI_Group_free(&uh_win->uh_group);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
 
-    if (uh_win->local_user_comm && uh_win->local_user_comm != MTCORE_COMM_USER_LOCAL) {
-        MTCORE_DBG_PRINT("\t free local USER communicator\n");
-        mpi_errno = PMPI_Comm_free(&uh_win->local_user_comm);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
-    }
+        if (uh_win->local_user_comm && uh_win->local_user_comm != MTCORE_COMM_USER_LOCAL) {
+            MTCORE_DBG_PRINT("\t free local USER communicator\n");
+            mpi_errno = PMPI_Comm_free(&uh_win->local_user_comm);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
 
-    if (uh_win->user_root_comm && uh_win->user_root_comm != MTCORE_COMM_UR_WORLD) {
-        MTCORE_DBG_PRINT("\t free ur communicator\n");
-        mpi_errno = PMPI_Comm_free(&uh_win->user_root_comm);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
+        if (uh_win->user_root_comm && uh_win->user_root_comm != MTCORE_COMM_UR_WORLD) {
+            MTCORE_DBG_PRINT("\t free ur communicator\n");
+            mpi_errno = PMPI_Comm_free(&uh_win->user_root_comm);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
     }
 
-    MTCORE_DBG_PRINT("\t free window cache\n");
-    MTCORE_Remove_uh_win_from_cache(*win);
-
-    MTCORE_DBG_PRINT("\t free user window\n");
-    mpi_errno = PMPI_Win_free(win);
-    if (mpi_errno != MPI_SUCCESS)
-        goto fn_fail;
-
     /* free PSCW array in case use does not call complete/wait. */
     if (uh_win->start_ranks_in_win_group)
         free(uh_win->start_ranks_in_win_group);
     if (uh_win->post_ranks_in_win_group)
         free(uh_win->post_ranks_in_win_group);
 
-    /* uh_win->user_comm is created by user, will be freed by user. */
+    /* uh_win->user_comm is created by user, will be freed by user, unless it
+     * is duplicated in MTCORE_Win_iallocate. */
+    if (uh_win->user_comm_dup) {
+        mpi_errno = PMPI_Comm_free(&uh_win->user_comm);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
 
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
     if (uh_win->h_ops_counts)
@@ -166,6 +159,7 @@ int MPI_Win_free(MPI_Win * win)
     if (uh_win->h_bytes_counts)
         free(uh_win->h_bytes_counts);
 #endif
+    MTCORE_Credit_free(uh_win);
 
     if (uh_win->targets) {
         for (i = 0; i < user_nprocs; i++) {
@@ -180,23 +174,118 @@ int MPI_Win_free(MPI_Win * win)
     }
     if (uh_win->h_ranks_in_uh)
         free(uh_win->h_ranks_in_uh);
+    if (uh_win->h_offs)
+        free(uh_win->h_offs);
     if (uh_win->h_win_handles)
         free(uh_win->h_win_handles);
     if (uh_win->uh_wins)
         free(uh_win->uh_wins);
+    if (uh_win->ep_uh_wins)
+        free(uh_win->ep_uh_wins);
+    if (uh_win->ep_active_wins)
+        free(uh_win->ep_active_wins);
 
+    MTCORE_DBG_PRINT("Released MTCORE window %p\n", uh_win);
     free(uh_win);
 
-    MTCORE_DBG_PRINT("Freed MTCORE window 0x%x\n", *win);
-
   fn_exit:
-    if (reqs)
-        free(reqs);
-    if (stats)
-        free(stats);
     return mpi_errno;
 
   fn_fail:
+    goto fn_exit;
+}
+
+int MPI_Win_free(MPI_Win * win)
+{
+    static const char FCNAME[] = "MTCORE_Win_free";
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Win *uh_win;
+    int user_rank, user_nprocs, defer = 0;
+    int i;
+
+    MTCORE_DBG_PRINT_FCNAME();
+
+    MTCORE_Fetch_uh_win_from_cache(*win, uh_win);
+
+    if (uh_win == NULL) {
+        /* normal window */
+        return PMPI_Win_free(win);
+    }
+
+    /* mtcore window starts */
+
+    /* Deferred releases are issued by the allocation thread in the order of
+     * calls, after window allocations in flight. Otherwise helpers serve
+     * control-plane functions of this process in order, thus complete window
+     * allocations still in flight before freeing. */
+    defer = MTCORE_ENV.win_free_defer && MTCORE_THREAD_LEVEL == MPI_THREAD_MULTIPLE;
+    if (!defer) {
+        mpi_errno = MTCORE_Win_iallocate_wait_all();
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
 
+    PMPI_Comm_rank(uh_win->user_comm, &user_rank);
+    PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
+
+    /* First unlock global active window */
+    if ((uh_win->info_args.epoch_type & MTCORE_EPOCH_FENCE) ||
+        (uh_win->info_args.epoch_type & MTCORE_EPOCH_PSCW)) {
+
+        MTCORE_DBG_PRINT("[%d]unlock_all(active_win 0x%x)\n", user_rank, uh_win->active_win);
+
+        /* Since all processes must be in win_free, we do not need worry
+         * the possibility losing asynchronous progress. */
+        mpi_errno = PMPI_Win_unlock_all(uh_win->active_win);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+
+        if (uh_win->ep_active_wins) {
+            for (i = 1; i < uh_win->info_args.num_thread_eps; i++) {
+                mpi_errno = PMPI_Win_unlock_all(uh_win->ep_active_wins[i]);
+                if (mpi_errno != MPI_SUCCESS)
+                    goto fn_fail;
+            }
+        }
+    }
+
+    /* Helpers stop applying active messages once the window is freed, thus
+     * wait until all users complete their last epoch (i.e., the operations to
+     * any helper have been acknowledged). */
+    if (uh_win->am) {
+        mpi_errno = PMPI_Barrier(uh_win->user_comm);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
+
+    MTCORE_Credit_report(uh_win);
+
+    /* Buffers in this window cannot be offloaded anymore. */
+    if (MTCORE_P2P_is_enabled())
+        MTCORE_P2P_unregister_win(uh_win);
+
+    MTCORE_DBG_PRINT("\t free window cache\n");
+    MTCORE_Remove_uh_win_from_cache(*win);
+
+    /* The user window is freed collectively by users, thus all of them have
+     * completed their epochs and the handle is invalid once it returns. */
+    MTCORE_DBG_PRINT("\t free user window\n");
+    mpi_errno = PMPI_Win_free(win);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    if (defer)
+        mpi_errno = MTCORE_Win_release_defer(uh_win, user_nprocs);
+    else
+        mpi_errno = MTCORE_Win_release(uh_win, user_nprocs);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    MTCORE_DBG_PRINT("Freed MTCORE window 0x%x%s\n", *win, defer ? ", release deferred" : "");
+
+  fn_exit:
+    return mpi_errno;
+
+  fn_fail:
     goto fn_exit;
 }
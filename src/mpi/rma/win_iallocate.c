@@ -0,0 +1,334 @@
+/*
+ * win_iallocate.c
+ *  <FILE_DESC>
+ *
+ *  Nonblocking window allocation. MPIX_Win_iallocate returns a generalized
+ *  request, and the allocation is issued by an allocation thread, thus the user
+ *  can overlap window setup (communicator creation with helpers, shared segment
+ *  allocation and internal windows) with its own initialization.
+ *
+ *  Requests are issued in the order of calls, which is the same on all the
+ *  processes of a communicator as required for collective calls. Since helpers
+ *  serve control-plane functions of a user root one by one, blocking window
+ *  allocation and window free wait for all requests in flight.
+ *
+ *  The same thread also releases the internal resources of freed windows
+ *  (MTCORE_WIN_FREE_DEFER), which is collective with helpers and the most
+ *  expensive part of MPI_Win_free. A release is enqueued as a request without
+ *  generalized request, thus it is drained by the next blocking allocation or
+ *  at finalize.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "mtcore.h"
+
+typedef struct MTCORE_Win_ialloc_req {
+    MPI_Aint size;
+    int disp_unit;
+    MPI_Info info;              /* duplicated user info */
+    MPI_Comm comm;              /* duplicated user communicator */
+    MPI_Request dup_req;
+    void *baseptr;
+    MPI_Win *win;
+    MPI_Request greq;           /* MPI_REQUEST_NULL in release */
+    MTCORE_Win *release_win;    /* window to release, otherwise NULL */
+    int release_user_nprocs;
+    int mpi_errno;
+    struct MTCORE_Win_ialloc_req *next;
+} MTCORE_Win_ialloc_req;
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* signaled when a request is enqueued or completed */
+    MTCORE_Win_ialloc_req *head;
+    MTCORE_Win_ialloc_req *tail;
+    int num_pending;            /* number of enqueued but not completed requests */
+    int started;
+    int exiting;
+    int release_errno;          /* first error of deferred releases */
+} ialloc_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int ialloc_query_fn(void *extra_state, MPI_Status * status)
+{
+    MTCORE_Win_ialloc_req *req = (MTCORE_Win_ialloc_req *) extra_state;
+
+    PMPI_Status_set_elements(status, MPI_BYTE, 0);
+    PMPI_Status_set_cancelled(status, 0);
+    status->MPI_SOURCE = MPI_UNDEFINED;
+    status->MPI_TAG = MPI_UNDEFINED;
+
+    /* Error of the allocation is returned by the completion call. */
+    return req->mpi_errno;
+}
+
+static int ialloc_free_fn(void *extra_state)
+{
+    free(extra_state);
+    return MPI_SUCCESS;
+}
+
+static int ialloc_cancel_fn(void *extra_state, int complete)
+{
+    /* An allocation is collective, thus it cannot be cancelled. */
+    return MPI_SUCCESS;
+}
+
+static int ialloc_issue(MTCORE_Win_ialloc_req * req)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    mpi_errno = PMPI_Wait(&req->dup_req, MPI_STATUS_IGNORE);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    mpi_errno = MTCORE_Win_allocate_impl(req->size, req->disp_unit, req->info, req->comm, 1,
+                                         req->baseptr, req->win);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+  fn_exit:
+    if (req->info != MPI_INFO_NULL)
+        PMPI_Info_free(&req->info);
+    return mpi_errno;
+
+  fn_fail:
+    /* The window owns the duplicated communicator only if it is allocated. */
+    if (req->comm != MPI_COMM_NULL)
+        PMPI_Comm_free(&req->comm);
+    goto fn_exit;
+}
+
+static void *ialloc_thread_fn(void *arg)
+{
+    MTCORE_Win_ialloc_req *req;
+    MPI_Request greq;
+
+    pthread_mutex_lock(&ialloc_queue.lock);
+    while (1) {
+        while (ialloc_queue.head == NULL && !ialloc_queue.exiting)
+            pthread_cond_wait(&ialloc_queue.cond, &ialloc_queue.lock);
+        if (ialloc_queue.head == NULL)
+            break;
+
+        /* Keep the request in queue until completed, so that new requests are
+         * only appended after it. */
+        req = ialloc_queue.head;
+        pthread_mutex_unlock(&ialloc_queue.lock);
+
+        if (req->release_win) {
+            req->mpi_errno = MTCORE_Win_release(req->release_win, req->release_user_nprocs);
+            MTCORE_DBG_PRINT("issued window release %p, mpi_errno %d\n", req->release_win,
+                             req->mpi_errno);
+        }
+        else {
+            req->mpi_errno = ialloc_issue(req);
+            MTCORE_DBG_PRINT("issued window allocation %p, win 0x%x, mpi_errno %d\n",
+                             req, *req->win, req->mpi_errno);
+        }
+
+        pthread_mutex_lock(&ialloc_queue.lock);
+        ialloc_queue.head = req->next;
+        if (ialloc_queue.head == NULL)
+            ialloc_queue.tail = NULL;
+        ialloc_queue.num_pending--;
+        if (req->release_win && req->mpi_errno != MPI_SUCCESS &&
+            ialloc_queue.release_errno == MPI_SUCCESS)
+            ialloc_queue.release_errno = req->mpi_errno;
+        pthread_cond_broadcast(&ialloc_queue.cond);
+        pthread_mutex_unlock(&ialloc_queue.lock);
+
+        /* req can be freed by the user after completion. */
+        greq = req->greq;
+        if (greq != MPI_REQUEST_NULL)
+            PMPI_Grequest_complete(greq);
+        else
+            free(req);
+
+        pthread_mutex_lock(&ialloc_queue.lock);
+    }
+    pthread_mutex_unlock(&ialloc_queue.lock);
+
+    return NULL;
+}
+
+/* Start the allocation thread if not yet, called with the queue locked. */
+static int ialloc_thread_start(void)
+{
+    if (ialloc_queue.started)
+        return MPI_SUCCESS;
+
+    if (pthread_create(&ialloc_queue.thread, NULL, ialloc_thread_fn, NULL) != 0) {
+        MTCORE_ERR_PRINT("Cannot create window allocation thread\n");
+        return MPI_ERR_INTERN;
+    }
+    ialloc_queue.started = 1;
+    return MPI_SUCCESS;
+}
+
+/* Append a request, called with the queue locked. */
+static void ialloc_enqueue(MTCORE_Win_ialloc_req * req)
+{
+    if (ialloc_queue.tail)
+        ialloc_queue.tail->next = req;
+    else
+        ialloc_queue.head = req;
+    ialloc_queue.tail = req;
+    ialloc_queue.num_pending++;
+    pthread_cond_broadcast(&ialloc_queue.cond);
+}
+
+int MPIX_Win_iallocate(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm,
+                       void *baseptr, MPI_Win * win, MPI_Request * request)
+{
+    static const char FCNAME[] = "MPIX_Win_iallocate";
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Win_ialloc_req *req = NULL;
+
+    MTCORE_DBG_PRINT_FCNAME();
+
+    req = calloc(1, sizeof(MTCORE_Win_ialloc_req));
+    req->size = size;
+    req->disp_unit = disp_unit;
+    req->info = MPI_INFO_NULL;
+    req->comm = MPI_COMM_NULL;
+    req->dup_req = MPI_REQUEST_NULL;
+    req->baseptr = baseptr;
+    req->win = win;
+    req->greq = MPI_REQUEST_NULL;
+
+    /* The allocation thread cannot issue MPI calls without MPI_THREAD_MULTIPLE,
+     * thus the window is allocated before return and the request is completed. */
+    if (MTCORE_THREAD_LEVEL != MPI_THREAD_MULTIPLE) {
+        mpi_errno = PMPI_Grequest_start(ialloc_query_fn, ialloc_free_fn, ialloc_cancel_fn,
+                                        req, &req->greq);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+        *request = req->greq;
+
+        req->mpi_errno = MTCORE_Win_allocate_impl(size, disp_unit, info, comm, 0, baseptr, win);
+        return PMPI_Grequest_complete(req->greq);
+    }
+
+    /* The allocation is issued concurrently with user communication, thus it
+     * uses a duplicated communicator, whose creation is ordered with other
+     * collectives on the user communicator. */
+    if (comm == MPI_COMM_WORLD)
+        comm = MTCORE_COMM_USER_WORLD;
+    mpi_errno = PMPI_Comm_idup(comm, &req->comm, &req->dup_req);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    if (info != MPI_INFO_NULL) {
+        mpi_errno = PMPI_Info_dup(info, &req->info);
+        if (mpi_errno != MPI_SUCCESS)
+            goto fn_fail;
+    }
+
+    pthread_mutex_lock(&ialloc_queue.lock);
+    mpi_errno = ialloc_thread_start();
+    if (mpi_errno != MPI_SUCCESS) {
+        pthread_mutex_unlock(&ialloc_queue.lock);
+        goto fn_fail;
+    }
+
+    mpi_errno = PMPI_Grequest_start(ialloc_query_fn, ialloc_free_fn, ialloc_cancel_fn,
+                                    req, &req->greq);
+    if (mpi_errno != MPI_SUCCESS) {
+        pthread_mutex_unlock(&ialloc_queue.lock);
+        goto fn_fail;
+    }
+    *request = req->greq;
+
+    ialloc_enqueue(req);
+    pthread_mutex_unlock(&ialloc_queue.lock);
+
+    MTCORE_DBG_PRINT("enqueued window allocation %p, size %ld\n", req, (long) size);
+
+  fn_exit:
+    return mpi_errno;
+
+  fn_fail:
+    if (req->dup_req != MPI_REQUEST_NULL)
+        PMPI_Wait(&req->dup_req, MPI_STATUS_IGNORE);
+    if (req->comm != MPI_COMM_NULL)
+        PMPI_Comm_free(&req->comm);
+    if (req->info != MPI_INFO_NULL)
+        PMPI_Info_free(&req->info);
+    free(req);
+    *request = MPI_REQUEST_NULL;
+    goto fn_exit;
+}
+
+/**
+ * Release the internal resources of a freed window in the allocation thread.
+ * Only called with MPI_THREAD_MULTIPLE, after the user window is freed.
+ */
+int MTCORE_Win_release_defer(MTCORE_Win * uh_win, int user_nprocs)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Win_ialloc_req *req = NULL;
+
+    req = calloc(1, sizeof(MTCORE_Win_ialloc_req));
+    req->greq = MPI_REQUEST_NULL;
+    req->release_win = uh_win;
+    req->release_user_nprocs = user_nprocs;
+
+    pthread_mutex_lock(&ialloc_queue.lock);
+    mpi_errno = ialloc_thread_start();
+    if (mpi_errno == MPI_SUCCESS)
+        ialloc_enqueue(req);
+    pthread_mutex_unlock(&ialloc_queue.lock);
+
+    /* Release it here if it cannot be deferred. */
+    if (mpi_errno != MPI_SUCCESS) {
+        free(req);
+        return MTCORE_Win_release(uh_win, user_nprocs);
+    }
+
+    MTCORE_DBG_PRINT("enqueued window release %p\n", uh_win);
+    return mpi_errno;
+}
+
+/* Wait until all window allocations and releases in flight are completed. The
+ * first error of deferred releases is returned, since no request reports it. */
+int MTCORE_Win_iallocate_wait_all(void)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    pthread_mutex_lock(&ialloc_queue.lock);
+    while (ialloc_queue.num_pending > 0)
+        pthread_cond_wait(&ialloc_queue.cond, &ialloc_queue.lock);
+    mpi_errno = ialloc_queue.release_errno;
+    ialloc_queue.release_errno = MPI_SUCCESS;
+    pthread_mutex_unlock(&ialloc_queue.lock);
+
+    return mpi_errno;
+}
+
+int MTCORE_Win_iallocate_finalize(void)
+{
+    pthread_mutex_lock(&ialloc_queue.lock);
+    if (!ialloc_queue.started) {
+        pthread_mutex_unlock(&ialloc_queue.lock);
+        return MPI_SUCCESS;
+    }
+
+    /* The thread exits after all requests in queue are completed. */
+    ialloc_queue.exiting = 1;
+    pthread_cond_broadcast(&ialloc_queue.cond);
+    pthread_mutex_unlock(&ialloc_queue.lock);
+
+    pthread_join(ialloc_queue.thread, NULL);
+    ialloc_queue.started = 0;
+    ialloc_queue.exiting = 0;
+
+    return MPI_SUCCESS;
+}
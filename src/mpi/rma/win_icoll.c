@@ -0,0 +1,136 @@
+/*
+ * win_icoll.c
+ *  <FILE_DESC>
+ *
+ *  Nonblocking collectives on window memory, progressed by helpers (see
+ *  mtcore_p2p.h). Every user process of the window specifies the same
+ *  displacement in its own window segment, the collective is done in place on
+ *  that buffer. The buffer must not be accessed until the request completes.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mtcore.h"
+
+static inline int get_dtype_idx(MPI_Datatype datatype)
+{
+    int i;
+    for (i = 0; i < MTCORE_AM_NUM_DTYPES; i++) {
+        if (MTCORE_AM_DTYPES[i] == datatype)
+            return i;
+    }
+    return -1;
+}
+
+static inline int get_op_idx(MPI_Op op)
+{
+    int i;
+
+    /* Replace and no_op are not reduction operations. */
+    if (op == MPI_REPLACE || op == MPI_NO_OP)
+        return -1;
+    for (i = 0; i < MTCORE_AM_NUM_OPS; i++) {
+        if (MTCORE_AM_OPS[i] == op)
+            return i;
+    }
+    return -1;
+}
+
+/* Check that the buffer lies in the segment of every user of the window. The
+ * result only depends on arguments that are the same on all processes and on
+ * window attributes known by all, thus no process returns an error while others
+ * start the collective. */
+static int check_coll_args(MPI_Aint target_disp, int count, int dtsize, int root,
+                           MTCORE_P2P_cmd_type type, MTCORE_Win * uh_win)
+{
+    int user_nprocs = 0, i;
+    MPI_Aint offset;
+
+    PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
+    if (count < 0)
+        return MPI_ERR_COUNT;
+    if (type == MTCORE_P2P_CMD_BCAST && (root < 0 || root >= user_nprocs))
+        return MPI_ERR_ROOT;
+
+    for (i = 0; i < user_nprocs; i++) {
+        offset = target_disp * uh_win->targets[i].disp_unit;
+        if (offset < 0 || offset + (MPI_Aint) count * dtsize > uh_win->targets[i].size)
+            return MPI_ERR_DISP;
+    }
+    return MPI_SUCCESS;
+}
+
+static int start_coll(MTCORE_P2P_cmd_type type, MPI_Aint target_disp, int count,
+                      MPI_Datatype datatype, MPI_Op op, int root, MPI_Win win,
+                      MPI_Request * request)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Win *uh_win = NULL;
+    MTCORE_P2P_cmd cmd;
+    MPI_Aint offset;
+    void *buf = NULL;
+    int user_rank = 0, dtsize = 0;
+
+    MTCORE_Fetch_uh_win_from_cache(win, uh_win);
+    if (uh_win == NULL)
+        return MPI_ERR_WIN;
+
+    PMPI_Type_size(datatype, &dtsize);
+    mpi_errno = check_coll_args(target_disp, count, dtsize, root, type, uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    PMPI_Comm_rank(uh_win->user_comm, &user_rank);
+    offset = target_disp * uh_win->targets[user_rank].disp_unit;
+    buf = (char *) uh_win->base + offset;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.dtype_idx = get_dtype_idx(datatype);
+    cmd.op_idx = type == MTCORE_P2P_CMD_ALLREDUCE ? get_op_idx(op) : -1;
+
+    /* Unsupported collectives are issued by users. The decision only depends
+     * on arguments that are the same on all processes. */
+    if (!MTCORE_ENV.coll_offload || cmd.dtype_idx < 0 ||
+        (type == MTCORE_P2P_CMD_ALLREDUCE && cmd.op_idx < 0)) {
+        if (type == MTCORE_P2P_CMD_ALLREDUCE)
+            return PMPI_Iallreduce(MPI_IN_PLACE, buf, count, datatype, op, uh_win->user_comm,
+                                   request);
+        return PMPI_Ibcast(buf, count, datatype, root, uh_win->user_comm, request);
+    }
+
+    cmd.type = type;
+    cmd.h_win_handle = uh_win->h_win_handles[0];
+    cmd.h_offset = uh_win->targets[user_rank].base_h_offsets[0] + offset;
+    cmd.size = count * dtsize;
+    cmd.count = count;
+    cmd.seq = MTCORE_Atomic_fetch_add(&uh_win->coll_seq, 1);
+    if (type == MTCORE_P2P_CMD_BCAST) {
+        cmd.root_node = MTCORE_ALL_NODE_IDS[uh_win->targets[root].world_rank];
+        cmd.is_root = (root == user_rank);
+    }
+
+    mpi_errno = MTCORE_P2P_start_cmd(&cmd, request);
+
+    MTCORE_DBG_PRINT("offload %s seq %u, disp 0x%lx, count %d, dtype_idx %d, op_idx %d\n",
+                     type == MTCORE_P2P_CMD_ALLREDUCE ? "allreduce" : "bcast", cmd.seq,
+                     target_disp, count, cmd.dtype_idx, cmd.op_idx);
+    return mpi_errno;
+}
+
+int MPIX_Win_iallreduce(MPI_Aint target_disp, int count, MPI_Datatype datatype, MPI_Op op,
+                        MPI_Win win, MPI_Request * request)
+{
+    MTCORE_DBG_PRINT_FCNAME();
+    return start_coll(MTCORE_P2P_CMD_ALLREDUCE, target_disp, count, datatype, op, 0, win,
+                      request);
+}
+
+int MPIX_Win_ibcast(MPI_Aint target_disp, int count, MPI_Datatype datatype, int root,
+                    MPI_Win win, MPI_Request * request)
+{
+    MTCORE_DBG_PRINT_FCNAME();
+    return start_coll(MTCORE_P2P_CMD_BCAST, target_disp, count, datatype, MPI_OP_NULL, root,
+                      win, request);
+}
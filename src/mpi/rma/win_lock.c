@@ -2,32 +2,11 @@
 #include <stdlib.h>
 #include "mtcore.h"
 
-static inline int MTCORE_Win_lock_self_impl(MTCORE_Win * uh_win)
-{
-    int mpi_errno = MPI_SUCCESS;
-    int user_rank;
-
-#ifdef MTCORE_ENABLE_SYNC_ALL_OPT
-    /* lockall already locked window for local target */
-#else
-    MTCORE_DBG_PRINT("[%d]lock self(%d, local win 0x%x)\n", user_rank,
-                     uh_win->my_rank_in_uh_comm, uh_win->my_uh_win);
-    mpi_errno = PMPI_Win_lock(MPI_LOCK_SHARED, uh_win->my_rank_in_uh_comm,
-                              MPI_MODE_NOCHECK, uh_win->my_uh_win);
-    if (mpi_errno != MPI_SUCCESS)
-        return mpi_errno;
-#endif
-
-    uh_win->is_self_locked = 1;
-    return mpi_errno;
-}
-
 int MPI_Win_lock(int lock_type, int target_rank, int assert, MPI_Win win)
 {
     MTCORE_Win *uh_win;
     int mpi_errno = MPI_SUCCESS;
     int user_rank;
-    int k;
 
     MTCORE_DBG_PRINT_FCNAME();
 
@@ -46,44 +25,26 @@ int MPI_Win_lock(int lock_type, int target_rank, int assert, MPI_Win win)
     PMPI_Comm_rank(uh_win->user_comm, &user_rank);
 
     uh_win->targets[target_rank].remote_lock_assert = assert;
+    /* Locks are always shared on helpers in strategy all. */
+    uh_win->targets[target_rank].remote_lock_exclusive = (lock_type == MPI_LOCK_EXCLUSIVE &&
+                                                          uh_win->info_args.sync_strategy ==
+                                                          MTCORE_SYNC_HELPER);
+    MTCORE_AM_reset_lock(target_rank, uh_win);
     MTCORE_DBG_PRINT("[%d]lock(%d), MPI_MODE_NOCHECK %d(assert %d)\n", user_rank,
                      target_rank, (assert & MPI_MODE_NOCHECK) != 0, assert);
 
     /* Lock Helper processes in corresponding uh-window of target process. */
-#ifdef MTCORE_ENABLE_SYNC_ALL_OPT
-    /* Optimization for MPI implementations that have optimized lock_all.
-     * However, user should be noted that, if MPI implementation issues lock messages
-     * for every target even if it does not have any operation, this optimization
-     * could lose performance and even lose asynchronous! */
-
-    MTCORE_DBG_PRINT("[%d]lock_all(uh_win 0x%x), instead of target rank %d\n",
-                     user_rank, uh_win->targets[target_rank].uh_win, target_rank);
-    mpi_errno = PMPI_Win_lock_all(assert, uh_win->targets[target_rank].uh_win);
+    mpi_errno = uh_win->sync->lock(lock_type, target_rank, assert, uh_win);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
-#else
-    /* Lock every helper on every window.
-     * Note that a helper may be used on any window of this process for runtime
-     * load balancing whether it is binded to that segment or not. */
-    for (k = 0; k < MTCORE_ENV.num_h; k++) {
-        int target_h_rank_in_uh = uh_win->targets[target_rank].h_ranks_in_uh[k];
-
-        MTCORE_DBG_PRINT("[%d]lock(Helper(%d), uh_wins 0x%x), instead of "
-                         "target rank %d\n", user_rank, target_h_rank_in_uh,
-                         uh_win->targets[target_rank].uh_win, target_rank);
-
-        mpi_errno = PMPI_Win_lock(lock_type, target_h_rank_in_uh, assert,
-                                  uh_win->targets[target_rank].uh_win);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
-    }
-#endif
-
-    uh_win->is_self_locked = 0;
 
     if (user_rank == target_rank) {
         int is_local_lock_granted = 0;
 
+        /* Only reset in the self epoch, other threads may hold the self lock while
+         * this thread locks a remote target. */
+        MTCORE_Atomic_store(&uh_win->is_self_locked, 0);
+
         /* If target is itself, we need grant this lock before return.
          * However, the actual locked processes are the Helpers whose locks may be delayed by
          * most MPI implementation, thus we need a flush to force the lock to be granted.
@@ -107,17 +68,22 @@ int MPI_Win_lock(int lock_type, int target_rank, int assert, MPI_Win win)
          * 2. there is no concurrent epochs, hence it is safe to get local lock.*/
         if (is_local_lock_granted ||
             (uh_win->targets[target_rank].remote_lock_assert & MPI_MODE_NOCHECK)) {
-            mpi_errno = MTCORE_Win_lock_self_impl(uh_win);
+            mpi_errno = uh_win->sync->lock_self(uh_win);
             if (mpi_errno != MPI_SUCCESS)
                 goto fn_fail;
         }
 #endif
     }
 
+    /* Accumulates to a same-node target can be applied in shared memory in
+     * an exclusive lock epoch. */
+    MTCORE_Shm_acc_start(target_rank, lock_type, assert, uh_win);
+
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
     int j;
     for (j = 0; j < uh_win->targets[target_rank].num_segs; j++) {
-        uh_win->targets[target_rank].segs[j].main_lock_stat = MTCORE_MAIN_LOCK_RESET;
+        MTCORE_Atomic_store(&uh_win->targets[target_rank].segs[j].main_lock_stat,
+                            MTCORE_MAIN_LOCK_RESET);
         MTCORE_Reset_win_target_load_opt(target_rank, uh_win);
     }
 #endif
@@ -125,8 +91,7 @@ int MPI_Win_lock(int lock_type, int target_rank, int assert, MPI_Win win)
 
     /* Indicate epoch status, later operations will be redirected to uh_wins
      * until lock/lockall counters decrease to 0 .*/
-    uh_win->epoch_stat = MTCORE_WIN_EPOCH_LOCK;
-    uh_win->lock_counter++;
+    MTCORE_Win_epoch_lock_inc(&uh_win->lock_counter, uh_win);
 
     /* TODO: All the operations which we have not wrapped up will be failed, because they
      * are issued to user window. We need wrap up all operations.
@@ -140,17 +140,17 @@ int MPI_Win_start(MPI_Group group, int assert, MPI_Win win)
             goto fn_fail;
     }
 
-    uh_win->is_self_locked = 0;
+    MTCORE_Atomic_store(&uh_win->is_self_locked, 0);
 #ifdef MTCORE_ENABLE_LOCAL_LOCK_OPT
     /* During pscw epoch, it is allowed to access local target directly.
      * Note that user may do wrong RMA call such as access the local target
      * without start-post on local window. But we do not check it. */
-    uh_win->is_self_locked = 1;
+    MTCORE_Atomic_store(&uh_win->is_self_locked, 1);
 #endif
 
     /* Indicate epoch status, later operations will be redirected to active_win
      * until start counter decreases to 0 .*/
-    uh_win->epoch_stat = MTCORE_WIN_EPOCH_PSCW;
+    MTCORE_Atomic_store(&uh_win->epoch_stat, MTCORE_WIN_EPOCH_PSCW);
     uh_win->start_counter++;
 
     MTCORE_DBG_PRINT("Start done\n");
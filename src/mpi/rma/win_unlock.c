@@ -2,37 +2,11 @@
 #include <stdlib.h>
 #include "mtcore.h"
 
-static inline int MTCORE_Win_unlock_self_impl(MTCORE_Win * uh_win)
-{
-    int mpi_errno = MPI_SUCCESS;
-
-#ifdef MTCORE_ENABLE_SYNC_ALL_OPT
-    /* unlockall already released window for local target */
-#else
-    int user_rank;
-    PMPI_Comm_rank(uh_win->user_comm, &user_rank);
-
-    if (uh_win->is_self_locked) {
-        /* We need also release the lock of local rank */
-
-        MTCORE_DBG_PRINT("[%d]unlock self(%d, local win 0x%x)\n", user_rank,
-                         uh_win->my_rank_in_uh_comm, uh_win->my_uh_win);
-        mpi_errno = PMPI_Win_unlock(uh_win->my_rank_in_uh_comm, uh_win->my_uh_win);
-        if (mpi_errno != MPI_SUCCESS)
-            return mpi_errno;
-    }
-#endif
-
-    uh_win->is_self_locked = 0;
-    return mpi_errno;
-}
-
 int MPI_Win_unlock(int target_rank, MPI_Win win)
 {
     MTCORE_Win *uh_win;
     int mpi_errno = MPI_SUCCESS;
     int user_rank;
-    int j, k;
 
     MTCORE_DBG_PRINT_FCNAME();
 
@@ -50,59 +24,42 @@ int MPI_Win_unlock(int target_rank, MPI_Win win)
 
     PMPI_Comm_rank(uh_win->user_comm, &user_rank);
 
+    /* Complete active messages before releasing locks on helpers. */
+    mpi_errno = MTCORE_AM_flush(target_rank, uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
     uh_win->targets[target_rank].remote_lock_assert = 0;
+    uh_win->targets[target_rank].remote_lock_exclusive = 0;
+    MTCORE_Shm_acc_reset(target_rank, uh_win);
 
     /* Unlock all helper processes in every uh-window of target process. */
-    j = 0;
-#ifdef MTCORE_ENABLE_SYNC_ALL_OPT
-
-    /* Optimization for MPI implementations that have optimized lock_all.
-     * However, user should be noted that, if MPI implementation issues lock messages
-     * for every target even if it does not have any operation, this optimization
-     * could lose performance and even lose asynchronous! */
-
-    MTCORE_DBG_PRINT("[%d]unlock_all(uh_win 0x%x), instead of target rank %d\n",
-                     user_rank, uh_win->targets[target_rank].uh_win, target_rank);
-    mpi_errno = PMPI_Win_unlock_all(uh_win->targets[target_rank].uh_win);
+    mpi_errno = uh_win->sync->unlock(target_rank, uh_win);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
-#else
-    for (k = 0; k < MTCORE_ENV.num_h; k++) {
-        int target_h_rank_in_uh = uh_win->targets[target_rank].h_ranks_in_uh[k];
-
-        MTCORE_DBG_PRINT("[%d]unlock(Helper(%d), uh_win 0x%x), instead of "
-                         "target rank %d\n", user_rank, target_h_rank_in_uh,
-                         uh_win->targets[target_rank].uh_win, target_rank);
-
-        mpi_errno = PMPI_Win_unlock(target_h_rank_in_uh, uh_win->targets[target_rank].uh_win);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
-    }
-#endif
-
 
 #ifdef MTCORE_ENABLE_LOCAL_LOCK_OPT
     /* If target is itself, we need also release the lock of local rank  */
-    if (user_rank == target_rank && uh_win->is_self_locked) {
-        mpi_errno = MTCORE_Win_unlock_self_impl(uh_win);
+    if (user_rank == target_rank && MTCORE_Atomic_load(&uh_win->is_self_locked)) {
+        mpi_errno = uh_win->sync->unlock_self(uh_win);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
     }
 #endif
 
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
+    int j;
     for (j = 0; j < uh_win->targets[target_rank].num_segs; j++) {
-        uh_win->targets[target_rank].segs[j].main_lock_stat = MTCORE_MAIN_LOCK_RESET;
+        MTCORE_Atomic_store(&uh_win->targets[target_rank].segs[j].main_lock_stat,
+                            MTCORE_MAIN_LOCK_RESET);
     }
 #endif
 
     /* Decrease lock/lockall counter, change epoch status only when counter
      * become 0. */
-    uh_win->lock_counter--;
-    if (uh_win->lockall_counter == 0 && uh_win->lock_counter == 0) {
-        MTCORE_DBG_PRINT("all locks are cleared ! no epoch now\n");
-        uh_win->epoch_stat = MTCORE_WIN_NO_EPOCH;
-    }
+    MTCORE_Win_epoch_lock_dec(&uh_win->lock_counter, uh_win);
+
+    MTCORE_Credit_reset_target(target_rank, uh_win->targets[target_rank].uh_win, uh_win);
 
     /* TODO: All the operations which we have not wrapped up will be failed, because they
      * are issued to user window. We need wrap up all operations.
@@ -2,69 +2,17 @@
 #include <stdlib.h>
 #include "mtcore.h"
 
-static inline int MTCORE_Win_unlock_self_impl(MTCORE_Win * uh_win)
-{
-    int mpi_errno = MPI_SUCCESS;
-
-#ifdef MTCORE_ENABLE_SYNC_ALL_OPT
-    /* unlockall already released window for local target */
-#else
-    int user_rank;
-    PMPI_Comm_rank(uh_win->user_comm, &user_rank);
-
-    if (uh_win->is_self_locked) {
-        /* We need also release the lock of local rank */
-
-        MTCORE_DBG_PRINT("[%d]unlock self(%d, local win 0x%x)\n", user_rank,
-                         uh_win->my_rank_in_uh_comm, uh_win->my_uh_win);
-        mpi_errno = PMPI_Win_unlock(uh_win->my_rank_in_uh_comm, uh_win->my_uh_win);
-        if (mpi_errno != MPI_SUCCESS)
-            return mpi_errno;
-    }
-#endif
-
-    uh_win->is_self_locked = 0;
-    return mpi_errno;
-}
-
 static int MTCORE_Win_mixed_unlock_all_impl(MPI_Win win, MTCORE_Win * uh_win)
 {
     int mpi_errno = MPI_SUCCESS;
-    int user_rank, user_nprocs;
-    int i, j, k;
-
-    PMPI_Comm_rank(uh_win->user_comm, &user_rank);
-    PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
-
-#ifdef MTCORE_ENABLE_SYNC_ALL_OPT
-
-    /* Optimization for MPI implementations that have optimized lock_all.
-     * However, user should be noted that, if MPI implementation issues lock messages
-     * for every target even if it does not have any operation, this optimization
-     * could lose performance and even lose asynchronous! */
-    for (i = 0; i < uh_win->num_uh_wins; i++) {
-        MTCORE_DBG_PRINT("[%d]unlock_all(uh_win 0x%x)\n", user_rank, uh_win->uh_wins[i]);
-        mpi_errno = PMPI_Win_unlock_all(uh_win->uh_wins[i]);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
-    }
-#else
-    for (i = 0; i < user_nprocs; i++) {
-        for (k = 0; k < MTCORE_ENV.num_h; k++) {
-            int target_h_rank_in_uh = uh_win->targets[i].h_ranks_in_uh[k];
 
-            MTCORE_DBG_PRINT("[%d]unlock(Helper(%d), uh_win 0x%x), instead of "
-                             "target rank %d\n", user_rank, target_h_rank_in_uh,
-                             uh_win->targets[i].uh_win, i);
-            mpi_errno = PMPI_Win_unlock(target_h_rank_in_uh, uh_win->targets[i].uh_win);
-            if (mpi_errno != MPI_SUCCESS)
-                goto fn_fail;
-        }
-    }
-#endif
+    /* Unlock every helper on every window for each target. */
+    mpi_errno = uh_win->sync->mixed_unlock_all(uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
 
 #ifdef MTCORE_ENABLE_LOCAL_LOCK_OPT
-    mpi_errno = MTCORE_Win_unlock_self_impl(uh_win);
+    mpi_errno = uh_win->sync->unlock_self(uh_win);
     if (mpi_errno != MPI_SUCCESS)
         goto fn_fail;
 #endif
@@ -81,7 +29,7 @@ int MPI_Win_unlock_all(MPI_Win win)
     MTCORE_Win *uh_win;
     int mpi_errno = MPI_SUCCESS;
     int user_rank, user_nprocs;
-    int i, j, k;
+    int i;
 
     MTCORE_DBG_PRINT_FCNAME();
 
@@ -100,6 +48,11 @@ int MPI_Win_unlock_all(MPI_Win win)
     PMPI_Comm_rank(uh_win->user_comm, &user_rank);
     PMPI_Comm_size(uh_win->user_comm, &user_nprocs);
 
+    /* Complete active messages before releasing locks on helpers. */
+    mpi_errno = MTCORE_AM_flush_all(uh_win);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
     for (i = 0; i < user_nprocs; i++) {
         uh_win->targets[i].remote_lock_assert = 0;
     }
@@ -107,18 +60,6 @@ int MPI_Win_unlock_all(MPI_Win win)
     if (!(uh_win->info_args.epoch_type & MTCORE_EPOCH_LOCK)) {
 
         /* In lock_all only epoch, unlock all helpers on the single window. */
-
-#ifdef MTCORE_ENABLE_SYNC_ALL_OPT
-
-        /* Optimization for MPI implementations that have optimized lock_all.
-         * However, user should be noted that, if MPI implementation issues lock messages
-         * for every target even if it does not have any operation, this optimization
-         * could lose performance and even lose asynchronous! */
-        MTCORE_DBG_PRINT("[%d]unlock_all(uh_win 0x%x)\n", user_rank, uh_win->uh_wins[0]);
-        mpi_errno = PMPI_Win_unlock_all(uh_win->uh_wins[0]);
-        if (mpi_errno != MPI_SUCCESS)
-            goto fn_fail;
-#else
         mpi_errno = PMPI_Win_unlock_all(uh_win->uh_wins[0]);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
@@ -129,15 +70,24 @@ int MPI_Win_unlock_all(MPI_Win win)
                 goto fn_fail;
         }
 #endif
-#endif
+
+        /* Unlock all per-thread endpoint windows, thus operations issued by
+         * every thread are completed. */
+        if (uh_win->ep_uh_wins) {
+            for (i = 1; i < uh_win->info_args.num_thread_eps; i++) {
+                mpi_errno = PMPI_Win_unlock_all(uh_win->ep_uh_wins[i]);
+                if (mpi_errno != MPI_SUCCESS)
+                    goto fn_fail;
+            }
+        }
 
 #ifdef MTCORE_ENABLE_LOCAL_LOCK_OPT
 #if 0   /* segmentation fault */
-        mpi_errno = MTCORE_Win_unlock_self_impl(uh_win);
+        mpi_errno = uh_win->sync->unlock_self(uh_win);
         if (mpi_errno != MPI_SUCCESS)
             goto fn_fail;
 #else
-        uh_win->is_self_locked = 0;
+        MTCORE_Atomic_store(&uh_win->is_self_locked, 0);
 #endif
 #endif
     }
@@ -150,20 +100,20 @@ int MPI_Win_unlock_all(MPI_Win win)
     }
 
 #if defined(MTCORE_ENABLE_RUNTIME_LOAD_OPT)
+    int j;
     for (i = 0; i < user_nprocs; i++) {
         for (j = 0; j < uh_win->targets[i].num_segs; j++) {
-            uh_win->targets[i].segs[j].main_lock_stat = MTCORE_MAIN_LOCK_RESET;
+            MTCORE_Atomic_store(&uh_win->targets[i].segs[j].main_lock_stat,
+                                MTCORE_MAIN_LOCK_RESET);
         }
     }
 #endif
 
     /* Decrease lock/lockall counter, change epoch status only when counter
      * become 0. */
-    uh_win->lockall_counter--;
-    if (uh_win->lockall_counter == 0 && uh_win->lock_counter == 0) {
-        MTCORE_DBG_PRINT("all locks are cleared ! no epoch now\n");
-        uh_win->epoch_stat = MTCORE_WIN_NO_EPOCH;
-    }
+    MTCORE_Win_epoch_lock_dec(&uh_win->lockall_counter, uh_win);
+
+    MTCORE_Credit_reset_all(uh_win);
 
     /* TODO: All the operations which we have not wrapped up will be failed, because they
      * are issued to user window. We need wrap up all operations.
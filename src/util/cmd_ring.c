@@ -0,0 +1,175 @@
+/*
+ * cmd_ring.c
+ *  <FILE_DESC>
+ *
+ *  Bounded multi-producer single-consumer ring with a sequence number per
+ *  slot, thus producers only contend on the head position and never wait for
+ *  each other to complete their copies. The segment is allocated by
+ *  MPI_Win_allocate_shared, and the futex is process-shared on it.
+ *
+ *  Author: Min Si
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#ifdef SYS_futex
+#include <linux/futex.h>
+#endif
+#include "mtcore.h"
+
+int MTCORE_Cmd_ring_create(MPI_Comm comm, MTCORE_Cmd_ring ** ring_ptr, MPI_Win * win)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Cmd_ring *ring = NULL;
+    MPI_Aint r_size = 0;
+    int rank, r_disp_unit, i;
+
+    PMPI_Comm_rank(comm, &rank);
+
+    mpi_errno = PMPI_Win_allocate_shared(rank == 0 ? sizeof(MTCORE_Cmd_ring) : 0, 1,
+                                         MPI_INFO_NULL, comm, &ring, win);
+    if (mpi_errno != MPI_SUCCESS)
+        return mpi_errno;
+
+    mpi_errno = PMPI_Win_shared_query(*win, 0, &r_size, &r_disp_unit, &ring);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    if (rank == 0) {
+        memset(ring, 0, sizeof(MTCORE_Cmd_ring));
+        for (i = 0; i < MTCORE_CMD_RING_NUM_SLOTS; i++)
+            ring->slots[i].seq = i;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+
+    /* Nobody can touch the ring before it is initialized. */
+    mpi_errno = PMPI_Barrier(comm);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    *ring_ptr = ring;
+    MTCORE_DBG_PRINT("created command ring %p, %d slots\n", ring, MTCORE_CMD_RING_NUM_SLOTS);
+
+  fn_exit:
+    return mpi_errno;
+
+  fn_fail:
+    PMPI_Win_free(win);
+    goto fn_exit;
+}
+
+int MTCORE_Cmd_ring_free(MTCORE_Cmd_ring ** ring, MPI_Win * win)
+{
+    *ring = NULL;
+    if (*win == MPI_WIN_NULL)
+        return MPI_SUCCESS;
+    return PMPI_Win_free(win);
+}
+
+/* Wait until *addr != val, wake up or timeout. Sleep for the timeout if futex
+ * is unavailable. */
+static inline void futex_wait(int *addr, int val, long timeout_ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = timeout_ns / 1000000000L;
+    ts.tv_nsec = timeout_ns % 1000000000L;
+#ifdef SYS_futex
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+#else
+    nanosleep(&ts, NULL);
+#endif
+}
+
+static inline void futex_wake(int *addr)
+{
+#ifdef SYS_futex
+    syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+}
+
+void MTCORE_Cmd_ring_enqueue(MTCORE_Cmd_ring * ring, int src, const void *cmd, int size)
+{
+    MTCORE_Cmd_slot *slot;
+    unsigned long pos, seq;
+    long diff;
+
+    pos = MTCORE_Atomic_load(&ring->head);
+    while (1) {
+        slot = &ring->slots[pos & (MTCORE_CMD_RING_NUM_SLOTS - 1)];
+        seq = MTCORE_Atomic_load(&slot->seq);
+        diff = (long) seq - (long) pos;
+
+        if (diff == 0) {
+            if (MTCORE_Atomic_cas(&ring->head, pos, pos + 1))
+                break;
+            pos = MTCORE_Atomic_load(&ring->head);
+        }
+        else if (diff < 0) {
+            /* Full, wait for the consumer. */
+            sched_yield();
+            pos = MTCORE_Atomic_load(&ring->head);
+        }
+        else {
+            /* Taken by another producer. */
+            pos = MTCORE_Atomic_load(&ring->head);
+        }
+    }
+
+    slot->src = src;
+    slot->size = size;
+    memcpy(slot->data, cmd, size);
+    MTCORE_Atomic_store_seq(&slot->seq, pos + 1);
+
+    /* Either the consumer sees the command before sleeping, or we see it
+     * sleeping and wake it up. */
+    MTCORE_Cmd_ring_wake(ring);
+}
+
+void MTCORE_Cmd_ring_wake(MTCORE_Cmd_ring * ring)
+{
+    if (MTCORE_Atomic_load_seq(&ring->sleeping)) {
+        MTCORE_Atomic_incr_fetch(&ring->wake_seq);
+        futex_wake(&ring->wake_seq);
+    }
+}
+
+int MTCORE_Cmd_ring_dequeue(MTCORE_Cmd_ring * ring, void *cmd, int *src, int *size)
+{
+    MTCORE_Cmd_slot *slot;
+    unsigned long pos = ring->tail;
+
+    slot = &ring->slots[pos & (MTCORE_CMD_RING_NUM_SLOTS - 1)];
+    if (MTCORE_Atomic_load_seq(&slot->seq) != pos + 1)
+        return 0;
+
+    *src = slot->src;
+    *size = slot->size;
+    memcpy(cmd, slot->data, slot->size);
+    MTCORE_Atomic_store(&slot->seq, pos + MTCORE_CMD_RING_NUM_SLOTS);
+    ring->tail = pos + 1;
+
+    return 1;
+}
+
+void MTCORE_Cmd_ring_sleep(MTCORE_Cmd_ring * ring, long timeout_ns)
+{
+    MTCORE_Cmd_slot *slot;
+    unsigned long pos = ring->tail;
+    int wake_seq;
+
+    slot = &ring->slots[pos & (MTCORE_CMD_RING_NUM_SLOTS - 1)];
+    wake_seq = MTCORE_Atomic_load_seq(&ring->wake_seq);
+    MTCORE_Atomic_store_seq(&ring->sleeping, 1);
+
+    if (MTCORE_Atomic_load_seq(&slot->seq) != pos + 1)
+        futex_wait(&ring->wake_seq, wake_seq, timeout_ns);
+
+    MTCORE_Atomic_store_seq(&ring->sleeping, 0);
+}
@@ -0,0 +1,110 @@
+/*
+ * p2p.c
+ *  <FILE_DESC>
+ *
+ *  Channel of helper-progressed point-to-point, shared by users and helpers.
+ *  Every user process owns MTCORE_P2P_MAX_REQS completion slots in a node
+ *  shared segment, and the root helper (local rank 0) consumes commands from
+ *  a command ring separate from the one of control-plane functions, so that
+ *  commands are served while the helper waits inside any function.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mtcore.h"
+
+MTCORE_P2P_channel MTCORE_P2P = {
+    MPI_COMM_NULL, 0, 0, MPI_KEYVAL_INVALID, NULL, MPI_WIN_NULL, MPI_WIN_NULL, NULL, NULL
+};
+
+int MTCORE_P2P_init(void)
+{
+    int mpi_errno = MPI_SUCCESS;
+    int local_rank, local_nprocs, world_nprocs, flag = 0, r_disp_unit, i;
+    int *tag_ub = NULL;
+    MPI_Aint r_size = 0;
+    MTCORE_P2P_slot *slots = NULL;
+
+    PMPI_Comm_rank(MTCORE_COMM_LOCAL, &local_rank);
+    PMPI_Comm_size(MTCORE_COMM_LOCAL, &local_nprocs);
+    PMPI_Comm_size(MPI_COMM_WORLD, &world_nprocs);
+
+    mpi_errno = PMPI_Comm_dup(MPI_COMM_WORLD, &MTCORE_P2P.comm);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    /* User tags are carried in headers, the channel needs a data tag per source
+     * and a reply tag per slot. World always has id 0. */
+    PMPI_Comm_get_attr(MPI_COMM_WORLD, MPI_TAG_UB, &tag_ub, &flag);
+    MTCORE_P2P.tag_ub = *tag_ub;
+    MTCORE_P2P.comm_ids = 1;
+    if (MTCORE_ENV.p2p_offload && (MTCORE_P2P_data_tag(world_nprocs - 1) > *tag_ub ||
+                                   MTCORE_P2P_reply_tag(MTCORE_P2P_MAX_REQS - 1) > *tag_ub)) {
+        if (MTCORE_MY_RANK_IN_WORLD == 0)
+            fprintf(stderr, "MTCORE_P2P_OFFLOAD is disabled, MPI_TAG_UB %d is too small "
+                    "for %d processes\n", *tag_ub, world_nprocs);
+        MTCORE_ENV.p2p_offload = 0;
+    }
+
+    mpi_errno = MTCORE_Cmd_ring_create(MTCORE_COMM_LOCAL, &MTCORE_P2P.ring,
+                                       &MTCORE_P2P.ring_win);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    /* Helpers (the first num_h local ranks) do not own any slot. */
+    mpi_errno = PMPI_Win_allocate_shared(local_rank >= MTCORE_ENV.num_h ?
+                                         sizeof(MTCORE_P2P_slot) * MTCORE_P2P_MAX_REQS : 0,
+                                         sizeof(MTCORE_P2P_slot), MPI_INFO_NULL,
+                                         MTCORE_COMM_LOCAL, &slots, &MTCORE_P2P.slot_win);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    if (local_rank >= MTCORE_ENV.num_h) {
+        memset(slots, 0, sizeof(MTCORE_P2P_slot) * MTCORE_P2P_MAX_REQS);
+        MTCORE_P2P.slots = slots;
+    }
+    else {
+        MTCORE_P2P.local_slots = calloc(local_nprocs, sizeof(MTCORE_P2P_slot *));
+        for (i = MTCORE_ENV.num_h; i < local_nprocs; i++) {
+            mpi_errno = PMPI_Win_shared_query(MTCORE_P2P.slot_win, i, &r_size, &r_disp_unit,
+                                              &MTCORE_P2P.local_slots[i]);
+            if (mpi_errno != MPI_SUCCESS)
+                goto fn_fail;
+        }
+    }
+
+    /* Slots are initialized before any command. */
+    mpi_errno = PMPI_Barrier(MTCORE_COMM_LOCAL);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    MTCORE_DBG_PRINT("created p2p offload channel, tag_ub %d, %d slots\n",
+                     MTCORE_P2P.tag_ub, MTCORE_P2P_MAX_REQS);
+
+  fn_exit:
+    return mpi_errno;
+
+  fn_fail:
+    MTCORE_P2P_destroy();
+    goto fn_exit;
+}
+
+int MTCORE_P2P_destroy(void)
+{
+    MTCORE_Cmd_ring_free(&MTCORE_P2P.ring, &MTCORE_P2P.ring_win);
+    if (MTCORE_P2P.slot_win != MPI_WIN_NULL)
+        PMPI_Win_free(&MTCORE_P2P.slot_win);
+    if (MTCORE_P2P.comm != MPI_COMM_NULL)
+        PMPI_Comm_free(&MTCORE_P2P.comm);
+    if (MTCORE_P2P.local_slots)
+        free(MTCORE_P2P.local_slots);
+    if (MTCORE_P2P.comm_keyval != MPI_KEYVAL_INVALID)
+        PMPI_Comm_free_keyval(&MTCORE_P2P.comm_keyval);
+
+    MTCORE_P2P.slots = NULL;
+    MTCORE_P2P.local_slots = NULL;
+    return MPI_SUCCESS;
+}
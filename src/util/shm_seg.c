@@ -0,0 +1,238 @@
+/*
+ * shm_seg.c
+ *  <FILE_DESC>
+ *
+ *  The segment is a memfd created by rank 0 of the communicator. Other
+ *  processes open it through /proc/<pid>/fd of rank 0, thus no named file
+ *  needs to be created or cleaned up. The mapping is aligned to the huge page
+ *  size, which is required by hugetlbfs and allows transparent huge pages to
+ *  back the whole segment.
+ *
+ *  Author: Min Si
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "mtcore.h"
+
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+#ifndef MFD_HUGE_2MB
+#define MFD_HUGE_2MB (21U << 26)
+#endif
+
+static int create_memfd(int hugetlb)
+{
+#ifdef SYS_memfd_create
+    unsigned int flags = hugetlb ? (MFD_HUGETLB | MFD_HUGE_2MB) : 0;
+
+    return (int) syscall(SYS_memfd_create, "mtcore_win", flags);
+#else
+    return -1;
+#endif
+}
+
+/* Map size bytes of fd at an address aligned to the huge page size. */
+static void *map_aligned(int fd, size_t size)
+{
+    size_t resv_size = size + MTCORE_HUGE_PAGE_SIZE;
+    char *resv = NULL, *aligned = NULL;
+    void *addr = NULL;
+
+    /* Reserve a larger range to find an aligned address, then release the rest. */
+    resv = mmap(NULL, resv_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (resv == MAP_FAILED)
+        return NULL;
+
+    aligned = (char *) align((uintptr_t) resv, (uintptr_t) MTCORE_HUGE_PAGE_SIZE);
+    addr = mmap(aligned, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    if (addr == MAP_FAILED) {
+        munmap(resv, resv_size);
+        return NULL;
+    }
+
+    if (aligned > resv)
+        munmap(resv, aligned - resv);
+    if (resv + resv_size > aligned + size)
+        munmap(aligned + size, resv + resv_size - (aligned + size));
+
+    return addr;
+}
+
+static void free_segment(MTCORE_Shm_seg * seg)
+{
+    if (seg->map_base)
+        munmap(seg->map_base, seg->map_size);
+    free(seg->sizes);
+    free(seg->offsets);
+    free(seg->disp_units);
+    free(seg);
+}
+
+/* Create and map the segment on rank 0, return the kind of mapped pages. */
+static MTCORE_Huge_page create_segment(MTCORE_Huge_page huge_page, MTCORE_Shm_seg * seg,
+                                       int *fd)
+{
+    if (huge_page == MTCORE_HUGE_PAGE_HUGETLB) {
+        *fd = create_memfd(1);
+        if (*fd >= 0 && ftruncate(*fd, seg->map_size) == 0 &&
+            (seg->map_base = map_aligned(*fd, seg->map_size)) != NULL)
+            return MTCORE_HUGE_PAGE_HUGETLB;
+
+        MTCORE_DBG_PRINT("hugetlbfs pages unavailable, fall back to transparent huge pages\n");
+        if (*fd >= 0)
+            close(*fd);
+    }
+
+    *fd = create_memfd(0);
+    if (*fd >= 0 && ftruncate(*fd, seg->map_size) == 0 &&
+        (seg->map_base = map_aligned(*fd, seg->map_size)) != NULL)
+        return MTCORE_HUGE_PAGE_THP;
+
+    if (*fd >= 0)
+        close(*fd);
+    *fd = -1;
+    return MTCORE_HUGE_PAGE_OFF;
+}
+
+int MTCORE_Shm_seg_allocate(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm,
+                            int huge_page, void **base, MPI_Win * win, MTCORE_Shm_seg ** seg_ptr)
+{
+    int mpi_errno = MPI_SUCCESS;
+    MTCORE_Shm_seg *seg = NULL;
+    MPI_Aint *tmp_gather_buf = NULL, total_size = 0;
+    int rank, nprocs, i, fd = -1, mapped = 0, all_mapped = 0;
+    int tmp_bcast_buf[3];       /* pid, fd, kind of pages of rank 0 */
+    int request = -1;
+
+    *seg_ptr = NULL;
+    *win = MPI_WIN_NULL;
+
+    PMPI_Comm_rank(comm, &rank);
+    PMPI_Comm_size(comm, &nprocs);
+
+    /* Exchange [size, disp_unit, huge page request] */
+    tmp_gather_buf = calloc(nprocs * 3, sizeof(MPI_Aint));
+    tmp_gather_buf[rank * 3] = size;
+    tmp_gather_buf[rank * 3 + 1] = (MPI_Aint) disp_unit;
+    tmp_gather_buf[rank * 3 + 2] = (MPI_Aint) huge_page;
+    mpi_errno = PMPI_Allgather(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                               tmp_gather_buf, 3, MPI_AINT, comm);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    for (i = 0; i < nprocs; i++)
+        request = max(request, (int) tmp_gather_buf[i * 3 + 2]);
+    if (request <= MTCORE_HUGE_PAGE_OFF)
+        goto alloc_by_mpi;
+
+    seg = calloc(1, sizeof(MTCORE_Shm_seg));
+    seg->nprocs = nprocs;
+    seg->sizes = calloc(nprocs, sizeof(MPI_Aint));
+    seg->offsets = calloc(nprocs, sizeof(MPI_Aint));
+    seg->disp_units = calloc(nprocs, sizeof(int));
+    for (i = 0; i < nprocs; i++) {
+        seg->sizes[i] = tmp_gather_buf[i * 3];
+        seg->disp_units[i] = (int) tmp_gather_buf[i * 3 + 1];
+        seg->offsets[i] = total_size;
+        total_size += seg->sizes[i];
+    }
+    seg->map_size = align((size_t) max(total_size, (MPI_Aint) 1),
+                          (size_t) MTCORE_HUGE_PAGE_SIZE);
+
+    if (rank == 0) {
+        tmp_bcast_buf[0] = (int) getpid();
+        tmp_bcast_buf[2] = create_segment(request, seg, &fd);
+        tmp_bcast_buf[1] = fd;
+    }
+    mpi_errno = PMPI_Bcast(tmp_bcast_buf, 3, MPI_INT, 0, comm);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+    if (tmp_bcast_buf[2] == MTCORE_HUGE_PAGE_OFF)
+        goto alloc_by_mpi;
+    seg->huge_page = tmp_bcast_buf[2];
+
+    if (rank == 0) {
+        mapped = 1;
+    }
+    else {
+        char path[64];
+
+        snprintf(path, sizeof(path), "/proc/%d/fd/%d", tmp_bcast_buf[0], tmp_bcast_buf[1]);
+        fd = open(path, O_RDWR);
+        if (fd >= 0 && (seg->map_base = map_aligned(fd, seg->map_size)) != NULL)
+            mapped = 1;
+    }
+
+    /* Rank 0 keeps its fd open until all processes have mapped the segment. */
+    mpi_errno = PMPI_Allreduce(&mapped, &all_mapped, 1, MPI_INT, MPI_MIN, comm);
+    if (fd >= 0)
+        close(fd);
+    if (mpi_errno != MPI_SUCCESS)
+        goto fn_fail;
+
+    if (!all_mapped) {
+        MTCORE_DBG_PRINT("cannot map shared segment on all processes, fall back to MPI\n");
+        goto alloc_by_mpi;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (seg->huge_page == MTCORE_HUGE_PAGE_THP)
+        madvise(seg->map_base, seg->map_size, MADV_HUGEPAGE);
+#endif
+
+    *base = (char *) seg->map_base + seg->offsets[rank];
+    *seg_ptr = seg;
+    seg = NULL;
+    MTCORE_DBG_PRINT("mapped shared segment %p, size %ld, huge_page %d\n",
+                     (*seg_ptr)->map_base, (long) (*seg_ptr)->map_size, (*seg_ptr)->huge_page);
+    goto fn_exit;
+
+  alloc_by_mpi:
+    mpi_errno = PMPI_Win_allocate_shared(size, disp_unit, info, comm, base, win);
+
+  fn_exit:
+    if (tmp_gather_buf)
+        free(tmp_gather_buf);
+    if (seg)
+        free_segment(seg);
+    return mpi_errno;
+
+  fn_fail:
+    goto fn_exit;
+}
+
+int MTCORE_Shm_seg_query(MPI_Win win, MTCORE_Shm_seg * seg, int rank, MPI_Aint * size,
+                         int *disp_unit, void *base)
+{
+    if (seg == NULL)
+        return PMPI_Win_shared_query(win, rank, size, disp_unit, base);
+
+    *size = seg->sizes[rank];
+    *disp_unit = seg->disp_units[rank];
+    *(void **) base = (char *) seg->map_base + seg->offsets[rank];
+    return MPI_SUCCESS;
+}
+
+int MTCORE_Shm_seg_free(MPI_Win * win, MTCORE_Shm_seg ** seg)
+{
+    int mpi_errno = MPI_SUCCESS;
+
+    if (*seg) {
+        free_segment(*seg);
+        *seg = NULL;
+    }
+
+    if (*win != MPI_WIN_NULL)
+        mpi_errno = PMPI_Win_free(win);
+
+    return mpi_errno;
+}
@@ -0,0 +1,260 @@
+/*
+ * topo.c
+ *  <FILE_DESC>
+ *
+ *  Author: Min Si
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include "mtcore_topo.h"
+
+#define MTCORE_TOPO_SYS_NODE_PATH "/sys/devices/system/node"
+#define MTCORE_TOPO_SYS_CPU_PATH "/sys/devices/system/cpu"
+
+/* Policy constants of mbind(2), thus libnuma is not required. */
+#define MTCORE_TOPO_MPOL_BIND 2
+#define MTCORE_TOPO_MPOL_MF_MOVE (1 << 1)
+#define MTCORE_TOPO_MAX_NUMA 1024
+
+/* Parse a kernel cpu list such as "0-3,8,10-11" into set. */
+static int parse_cpulist(const char *str, cpu_set_t * set)
+{
+    const char *p = str;
+    char *end = NULL;
+    long first, last, c;
+
+    CPU_ZERO(set);
+    while (*p && *p != '\n') {
+        first = strtol(p, &end, 10);
+        if (end == p || first < 0)
+            return -1;
+        last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return -1;
+            p = end;
+        }
+        for (c = first; c <= last && c < CPU_SETSIZE; c++)
+            CPU_SET(c, set);
+        if (*p == ',')
+            p++;
+    }
+    return 0;
+}
+
+static int read_cpulist(const char *path, cpu_set_t * set)
+{
+    char buf[4096];
+    FILE *fp = NULL;
+    int ret = -1;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    if (fgets(buf, sizeof(buf), fp) != NULL)
+        ret = parse_cpulist(buf, set);
+    fclose(fp);
+    return ret;
+}
+
+static int read_node_cpulist(int node, cpu_set_t * set)
+{
+    char path[256];
+
+    snprintf(path, sizeof(path), MTCORE_TOPO_SYS_NODE_PATH "/node%d/cpulist", node);
+    return read_cpulist(path, set);
+}
+
+static int read_sibling_cpulist(int cpu, cpu_set_t * set)
+{
+    char path[256];
+
+    snprintf(path, sizeof(path), MTCORE_TOPO_SYS_CPU_PATH "/cpu%d/topology/thread_siblings_list",
+             cpu);
+    return read_cpulist(path, set);
+}
+
+int MTCORE_Topo_get_numa_id(void)
+{
+    cpu_set_t bound, node_set, common;
+    DIR *dir = NULL;
+    struct dirent *ent = NULL;
+    int node, count, max_count = 0, numa_id = MTCORE_TOPO_NUMA_UNKNOWN;
+    int num_max = 0;
+
+    if (sched_getaffinity(0, sizeof(bound), &bound) != 0)
+        return MTCORE_TOPO_NUMA_UNKNOWN;
+
+    dir = opendir(MTCORE_TOPO_SYS_NODE_PATH);
+    if (dir == NULL)
+        return MTCORE_TOPO_NUMA_UNKNOWN;
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (strncmp(ent->d_name, "node", strlen("node")) ||
+            sscanf(ent->d_name + strlen("node"), "%d", &node) != 1)
+            continue;
+        if (read_node_cpulist(node, &node_set) != 0)
+            continue;
+
+        CPU_AND(&common, &bound, &node_set);
+        count = CPU_COUNT(&common);
+        if (count > max_count) {
+            max_count = count;
+            numa_id = node;
+            num_max = 1;
+        }
+        else if (count > 0 && count == max_count) {
+            num_max++;
+        }
+    }
+    closedir(dir);
+
+    /* An unbound process may run on any of these domains. */
+    if (num_max != 1)
+        return MTCORE_TOPO_NUMA_UNKNOWN;
+    return numa_id;
+}
+
+void MTCORE_Topo_select_helpers(int num_h, int local_nprocs, const int *local_numa_ids,
+                                int *h_ranks_in_local)
+{
+    int *domains = NULL, *picked = NULL;
+    int num_domains = 0;
+    int i, j, d, k;
+
+    for (i = 0; i < num_h; i++)
+        h_ranks_in_local[i] = i;
+
+    /* Collect distinct domains in ascending order. */
+    domains = calloc(local_nprocs, sizeof(int));
+    for (i = 0; i < local_nprocs; i++) {
+        if (local_numa_ids[i] == MTCORE_TOPO_NUMA_UNKNOWN)
+            goto fn_exit;
+        for (j = 0; j < num_domains && domains[j] < local_numa_ids[i]; j++);
+        if (j < num_domains && domains[j] == local_numa_ids[i])
+            continue;
+        memmove(&domains[j + 1], &domains[j], (num_domains - j) * sizeof(int));
+        domains[j] = local_numa_ids[i];
+        num_domains++;
+    }
+    if (num_domains < 2)
+        goto fn_exit;
+
+    picked = calloc(local_nprocs, sizeof(int));
+    for (i = 0; i < num_h; i++) {
+        int rank = -1;
+
+        /* Round-robin over domains, skip domains without remaining processes. */
+        for (k = 0; k < num_domains && rank < 0; k++) {
+            d = domains[(i + k) % num_domains];
+            for (j = 0; j < local_nprocs; j++) {
+                if (!picked[j] && local_numa_ids[j] == d) {
+                    rank = j;
+                    break;
+                }
+            }
+        }
+        picked[rank] = 1;
+        h_ranks_in_local[i] = rank;
+    }
+
+  fn_exit:
+    if (domains)
+        free(domains);
+    if (picked)
+        free(picked);
+}
+
+int MTCORE_Topo_get_home_cpu(void)
+{
+    cpu_set_t bound, siblings;
+    int cpu, home_cpu = -1;
+
+    if (sched_getaffinity(0, sizeof(bound), &bound) != 0)
+        return -1;
+
+    for (cpu = 0; cpu < CPU_SETSIZE && home_cpu < 0; cpu++) {
+        if (CPU_ISSET(cpu, &bound))
+            home_cpu = cpu;
+    }
+    if (home_cpu < 0 || read_sibling_cpulist(home_cpu, &siblings) != 0)
+        return -1;
+
+    /* Not bound to a core, the process may run anywhere. */
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &bound) && !CPU_ISSET(cpu, &siblings))
+            return -1;
+    }
+    return home_cpu;
+}
+
+int MTCORE_Topo_get_free_sibling(int cpu, const int *used_cpus, int num_used)
+{
+    cpu_set_t siblings;
+    int c, i;
+
+    if (cpu < 0 || read_sibling_cpulist(cpu, &siblings) != 0)
+        return -1;
+
+    for (c = 0; c < CPU_SETSIZE; c++) {
+        if (c == cpu || !CPU_ISSET(c, &siblings))
+            continue;
+        for (i = 0; i < num_used && used_cpus[i] != c; i++);
+        if (i == num_used)
+            return c;
+    }
+    return -1;
+}
+
+int MTCORE_Topo_bind_cpu(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int MTCORE_Topo_place_memory(void *addr, size_t size, int numa_id)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start, end, p;
+    int ret = -1;
+
+    start = ((uintptr_t) addr + page_size - 1) & ~((uintptr_t) page_size - 1);
+    end = ((uintptr_t) addr + size) & ~((uintptr_t) page_size - 1);
+    if (end <= start)
+        return -1;
+
+#ifdef SYS_mbind
+    if (numa_id >= 0 && numa_id < MTCORE_TOPO_MAX_NUMA) {
+        unsigned long nodemask[MTCORE_TOPO_MAX_NUMA / (8 * sizeof(unsigned long))];
+        int bits = 8 * sizeof(unsigned long);
+
+        memset(nodemask, 0, sizeof(nodemask));
+        nodemask[numa_id / bits] |= 1UL << (numa_id % bits);
+        if (syscall(SYS_mbind, start, end - start, MTCORE_TOPO_MPOL_BIND, nodemask,
+                    (unsigned long) numa_id + 2, MTCORE_TOPO_MPOL_MF_MOVE) == 0)
+            ret = 0;
+    }
+#endif
+
+    /* Touch every page without changing its content. */
+    for (p = start; p < end; p += page_size) {
+        volatile char *c = (volatile char *) p;
+        *c = *c;
+    }
+
+    return ret;
+}
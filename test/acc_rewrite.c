@@ -0,0 +1,162 @@
+/*
+ * acc_rewrite.c
+ *  <FILE_DESC>
+ *
+ *  Check write-only accumulates (MPI_REPLACE) and read-only accumulates
+ *  (MPI_Get_accumulate and MPI_Fetch_and_op with MPI_NO_OP), which are issued
+ *  as put and get on windows with accumulate_ordering=none, either with
+ *  accumulate_ops=same_op_no_op in lock_all epochs or in exclusive lock
+ *  epochs. Every process replaces its own slots on all targets and reads
+ *  back the slots of all processes.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define NUM_OPS 4
+#define ITER 4
+
+int rank, nprocs;
+
+static void reset_win(MPI_Win win, double *winbuf)
+{
+    int i;
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+    for (i = 0; i < NUM_OPS * nprocs; i++)
+        winbuf[i] = -1.0;
+    MPI_Win_unlock(rank, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+static int check_slots(const char *name, int x, int dst, double *buf)
+{
+    int i, errs = 0;
+
+    for (i = 0; i < NUM_OPS * nprocs; i++) {
+        double expected = (double) ((i / NUM_OPS) * NUM_OPS + i % NUM_OPS + x);
+        if (buf[i] != expected) {
+            fprintf(stderr, "[%d] iter %d %s from %d [%d] %.1lf != %.1lf\n", rank, x, name,
+                    dst, i, buf[i], expected);
+            errs++;
+        }
+    }
+    return errs;
+}
+
+/* Replace my slots on every target, then read all slots back. */
+static int run_test(MPI_Win win, double *winbuf, int exclusive, int x)
+{
+    int i, dst, errs = 0;
+    double locbuf[NUM_OPS], *resbuf = NULL;
+
+    resbuf = calloc(NUM_OPS * nprocs, sizeof(double));
+    for (i = 0; i < NUM_OPS; i++)
+        locbuf[i] = (double) (rank * NUM_OPS + i + x);
+
+    reset_win(win, winbuf);
+
+    if (exclusive) {
+        for (dst = 0; dst < nprocs; dst++) {
+            MPI_Win_lock(MPI_LOCK_EXCLUSIVE, dst, 0, win);
+            MPI_Accumulate(locbuf, NUM_OPS, MPI_DOUBLE, dst, rank * NUM_OPS, NUM_OPS,
+                           MPI_DOUBLE, MPI_REPLACE, win);
+            MPI_Win_unlock(dst, win);
+        }
+    }
+    else {
+        MPI_Win_lock_all(0, win);
+        for (dst = 0; dst < nprocs; dst++)
+            MPI_Accumulate(locbuf, NUM_OPS, MPI_DOUBLE, dst, rank * NUM_OPS, NUM_OPS,
+                           MPI_DOUBLE, MPI_REPLACE, win);
+        MPI_Win_unlock_all(win);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    for (dst = 0; dst < nprocs; dst++) {
+        if (exclusive)
+            MPI_Win_lock(MPI_LOCK_EXCLUSIVE, dst, 0, win);
+        else
+            MPI_Win_lock_all(0, win);
+
+        for (i = 0; i < NUM_OPS * nprocs; i++)
+            resbuf[i] = -2.0;
+        MPI_Get_accumulate(NULL, 0, MPI_DOUBLE, resbuf, NUM_OPS * nprocs, MPI_DOUBLE, dst, 0,
+                           NUM_OPS * nprocs, MPI_DOUBLE, MPI_NO_OP, win);
+        if (exclusive)
+            MPI_Win_flush(dst, win);
+        else
+            MPI_Win_flush_all(win);
+        errs += check_slots("get_accumulate", x, dst, resbuf);
+
+        for (i = 0; i < NUM_OPS * nprocs; i++) {
+            resbuf[i] = -2.0;
+            MPI_Fetch_and_op(NULL, &resbuf[i], MPI_DOUBLE, dst, i, MPI_NO_OP, win);
+        }
+
+        if (exclusive)
+            MPI_Win_unlock(dst, win);
+        else
+            MPI_Win_unlock_all(win);
+        errs += check_slots("fetch_and_op", x, dst, resbuf);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    free(resbuf);
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int x, errs = 0, errs_total = 0;
+    double *winbuf = NULL;
+    MPI_Win win = MPI_WIN_NULL;
+    MPI_Info info = MPI_INFO_NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    /* same_op_no_op in lock_all epochs */
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "epoch_type", "lock|lockall");
+    MPI_Info_set(info, "accumulate_ordering", "none");
+    MPI_Info_set(info, "accumulate_ops", "same_op_no_op");
+    MPI_Win_allocate(sizeof(double) * NUM_OPS * nprocs, sizeof(double), info, MPI_COMM_WORLD,
+                     &winbuf, &win);
+    MPI_Info_free(&info);
+
+    for (x = 0; x < ITER; x++)
+        errs += run_test(win, winbuf, 0, x);
+    MPI_Win_free(&win);
+
+    /* exclusive lock epochs */
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "epoch_type", "lock");
+    MPI_Info_set(info, "accumulate_ordering", "none");
+    MPI_Win_allocate(sizeof(double) * NUM_OPS * nprocs, sizeof(double), info, MPI_COMM_WORLD,
+                     &winbuf, &win);
+    MPI_Info_free(&info);
+
+    for (x = 0; x < ITER; x++)
+        errs += run_test(win, winbuf, 1, x);
+    MPI_Win_free(&win);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * am_aggregate.c
+ *  <FILE_DESC>
+ *
+ *  Check operations issued through the active-message transport with
+ *  node-level aggregation (info rma_transport=agg). Small accumulates and
+ *  puts to other nodes are forwarded in batches by local helpers, large ones
+ *  are sent directly, and fetch_and_op must observe all previous accumulates
+ *  of the same origin. Every process also fetches and increments a counter,
+ *  whose updates are combined on each node with MTCORE_FOP_COMBINE=on, and
+ *  every fetched value must be unique. Small accumulates must not overtake
+ *  large ones issued before to the same location.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define NUM_OPS 64
+#define LARGE_COUNT 512         /* larger than aggregated operations */
+#define ORDER_COUNT 16384       /* sent in rendezvous protocol on most networks */
+#define ITER 20
+
+double *winbuf = NULL;
+double locbuf[LARGE_COUNT];
+int rank, nprocs;
+MPI_Win win = MPI_WIN_NULL;
+long *counter_buf = NULL;
+MPI_Win counter_win = MPI_WIN_NULL;
+
+/* winbuf layout:
+ *  [0]: accumulated by everyone with small operations
+ *  [1 : 1 + LARGE_COUNT]: accumulated by everyone with large operations
+ *  [1 + LARGE_COUNT : 1 + LARGE_COUNT + nprocs]: put by every rank */
+#define LARGE_OFF 1
+#define PUT_OFF (1 + LARGE_COUNT)
+#define WIN_SIZE(n) (1 + LARGE_COUNT + (n))
+
+static int check_val(const char *name, double val, double expected)
+{
+    if (val != expected) {
+        fprintf(stderr, "[%d] %s %.1lf != %.1lf\n", rank, name, val, expected);
+        return 1;
+    }
+    return 0;
+}
+
+/* Accumulate and put in lockall epoch, and fetch in between */
+static int run_test1(void)
+{
+    int i, x, dst, errs = 0;
+    double val = 0.0, result = 0.0;
+
+    MPI_Win_lock_all(0, win);
+    for (x = 0; x < ITER; x++) {
+        for (dst = 0; dst < nprocs; dst++) {
+            for (i = 0; i < NUM_OPS; i++) {
+                MPI_Accumulate(&locbuf[i], 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+            }
+            MPI_Accumulate(locbuf, LARGE_COUNT, MPI_DOUBLE, dst, LARGE_OFF, LARGE_COUNT,
+                           MPI_DOUBLE, MPI_SUM, win);
+            val = (double) (rank + x);
+            MPI_Put(&val, 1, MPI_DOUBLE, dst, PUT_OFF + rank, 1, MPI_DOUBLE, win);
+        }
+
+        /* Ordered after all the accumulates above */
+        dst = (rank + x) % nprocs;
+        MPI_Fetch_and_op(NULL, &result, MPI_DOUBLE, dst, 0, MPI_NO_OP, win);
+        MPI_Win_flush(dst, win);
+        if (result < 1.0 * NUM_OPS * (x + 1)) {
+            fprintf(stderr, "[%d] fetch from %d %.1lf < %.1lf\n", rank, dst, result,
+                    1.0 * NUM_OPS * (x + 1));
+            errs++;
+        }
+
+        /* Puts to the same location are ordered only by flush */
+        MPI_Win_flush_all(win);
+    }
+    MPI_Win_unlock_all(win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, win);
+    errs += check_val("small acc", winbuf[0], 1.0 * NUM_OPS * ITER * nprocs);
+    for (i = 0; i < LARGE_COUNT; i++)
+        errs += check_val("large acc", winbuf[LARGE_OFF + i], 1.0 * ITER * nprocs);
+    for (i = 0; i < nprocs; i++)
+        errs += check_val("put", winbuf[PUT_OFF + i], (double) (i + ITER - 1));
+    MPI_Win_unlock(rank, win);
+
+    return errs;
+}
+
+/* Accumulate in fence epoch */
+static int run_test2(void)
+{
+    int i, dst, errs = 0;
+
+    MPI_Win_fence(0, win);
+    for (dst = 0; dst < nprocs; dst++) {
+        for (i = 0; i < NUM_OPS; i++) {
+            MPI_Accumulate(&locbuf[i], 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+        }
+    }
+    MPI_Win_fence(MPI_MODE_NOSUCCEED, win);
+
+    errs += check_val("fence acc", winbuf[0], 1.0 * NUM_OPS * (ITER + 1) * nprocs);
+
+    return errs;
+}
+
+/* Fetch and increment a counter on rank 0 */
+static int run_test3(void)
+{
+    int x, i, errs = 0;
+    long one = 1, results[ITER], *all_results = NULL;
+    char *seen = NULL;
+
+    MPI_Win_lock_all(0, counter_win);
+    for (x = 0; x < ITER; x++) {
+        MPI_Fetch_and_op(&one, &results[x], MPI_LONG, 0, 0, MPI_SUM, counter_win);
+        /* two updates in flight */
+        if (x % 2 == 1)
+            MPI_Win_flush(0, counter_win);
+    }
+    MPI_Win_unlock_all(counter_win);
+
+    if (rank == 0) {
+        all_results = malloc(sizeof(long) * ITER * nprocs);
+        seen = calloc(ITER * nprocs, sizeof(char));
+    }
+    MPI_Gather(results, ITER, MPI_LONG, all_results, ITER, MPI_LONG, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        for (i = 0; i < ITER * nprocs; i++) {
+            if (all_results[i] < 0 || all_results[i] >= ITER * nprocs || seen[all_results[i]]) {
+                fprintf(stderr, "[%d] counter %ld from %d is wrong or duplicated\n", rank,
+                        all_results[i], i / ITER);
+                errs++;
+                continue;
+            }
+            seen[all_results[i]] = 1;
+        }
+        errs += check_val("counter", (double) counter_buf[0], 1.0 * ITER * nprocs);
+        free(all_results);
+        free(seen);
+    }
+
+    return errs;
+}
+
+/* Large accumulate is sent directly, the following small one to the same
+ * location is queued, but must still be applied after the large one. */
+static int run_test4(void)
+{
+    int i, x, dst, errs = 0;
+    double *order_buf = NULL, *large = NULL, small;
+    MPI_Win order_win = MPI_WIN_NULL;
+    MPI_Info win_info = MPI_INFO_NULL;
+
+    MPI_Info_create(&win_info);
+    MPI_Info_set(win_info, "rma_transport", "agg");
+    MPI_Win_allocate(sizeof(double) * ORDER_COUNT * nprocs, sizeof(double), win_info,
+                     MPI_COMM_WORLD, &order_buf, &order_win);
+    MPI_Info_free(&win_info);
+
+    large = malloc(sizeof(double) * ORDER_COUNT);
+    MPI_Win_lock_all(0, order_win);
+    for (x = 0; x < ITER; x++) {
+        for (i = 0; i < ORDER_COUNT; i++)
+            large[i] = (double) x;
+        small = (double) -(x + 1);
+        for (dst = 0; dst < nprocs; dst++) {
+            MPI_Accumulate(large, ORDER_COUNT, MPI_DOUBLE, dst, ORDER_COUNT * rank,
+                           ORDER_COUNT, MPI_DOUBLE, MPI_REPLACE, order_win);
+            MPI_Accumulate(&small, 1, MPI_DOUBLE, dst, ORDER_COUNT * rank, 1, MPI_DOUBLE,
+                           MPI_REPLACE, order_win);
+        }
+    }
+    MPI_Win_unlock_all(order_win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, order_win);
+    for (i = 0; i < nprocs; i++) {
+        errs += check_val("ordered acc", order_buf[ORDER_COUNT * i], (double) -ITER);
+        errs += check_val("ordered large acc", order_buf[ORDER_COUNT * i + 1],
+                          (double) (ITER - 1));
+    }
+    MPI_Win_unlock(rank, order_win);
+
+    MPI_Win_free(&order_win);
+    free(large);
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, errs = 0, errs_total = 0;
+    MPI_Info win_info = MPI_INFO_NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    for (i = 0; i < LARGE_COUNT; i++) {
+        locbuf[i] = 1.0;
+    }
+
+    MPI_Info_create(&win_info);
+    MPI_Info_set(win_info, "rma_transport", "agg");
+
+    MPI_Win_allocate(sizeof(double) * WIN_SIZE(nprocs), sizeof(double), win_info,
+                     MPI_COMM_WORLD, &winbuf, &win);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+    for (i = 0; i < WIN_SIZE(nprocs); i++) {
+        winbuf[i] = 0.0;
+    }
+    MPI_Win_unlock(rank, win);
+
+    MPI_Win_allocate(sizeof(long), sizeof(long), win_info, MPI_COMM_WORLD, &counter_buf,
+                     &counter_win);
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, counter_win);
+    counter_buf[0] = 0;
+    MPI_Win_unlock(rank, counter_win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    errs += run_test1();
+    errs += run_test2();
+    errs += run_test3();
+    errs += run_test4();
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    if (win_info != MPI_INFO_NULL)
+        MPI_Info_free(&win_info);
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+    if (counter_win != MPI_WIN_NULL)
+        MPI_Win_free(&counter_win);
+
+    MPI_Finalize();
+
+    return 0;
+}
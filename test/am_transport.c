@@ -0,0 +1,244 @@
+/*
+ * am_transport.c
+ *  <FILE_DESC>
+ *
+ *  Check operations issued through the active-message transport of helpers
+ *  (info rma_transport=am), including mutual exclusion of exclusive locks,
+ *  and the fallback to MPI RMA for derived datatypes, which must be ordered
+ *  with operations through helpers. Get_accumulate is issued through helpers
+ *  as well.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#define NUM_OPS 10
+#define CHECK
+#define OUTPUT_FAIL_DETAIL
+
+double *winbuf = NULL;
+double locbuf[NUM_OPS];
+int rank, nprocs;
+MPI_Win win = MPI_WIN_NULL;
+int ITER = 20;
+
+/* winbuf layout:
+ *  [0]: accumulated by everyone in lockall epoch
+ *  [1]: counter updated by get+put in exclusive lock epoch on rank 0
+ *  [2]: counter updated by fetch_and_op in fence epoch
+ *  [3 : 3 + nprocs]: put by every rank */
+#define WIN_SIZE(n) (3 + (n))
+
+static int check_val(const char *name, double val, double expected)
+{
+    if (val != expected) {
+        fprintf(stderr, "[%d] %s %.1lf != %.1lf\n", rank, name, val, expected);
+        return 1;
+    }
+    return 0;
+}
+
+/* Accumulate, put and get in lockall epoch */
+static int run_test1(void)
+{
+    int i, x, dst, errs = 0;
+    double val[1] = { 0.0 };
+    MPI_Datatype derived_type;
+
+    /* A derived datatype is issued through MPI RMA instead */
+    MPI_Type_contiguous(1, MPI_DOUBLE, &derived_type);
+    MPI_Type_commit(&derived_type);
+
+    MPI_Win_lock_all(0, win);
+    for (x = 0; x < ITER; x++) {
+        for (dst = 0; dst < nprocs; dst++) {
+            for (i = 0; i < NUM_OPS; i++) {
+                MPI_Accumulate(&locbuf[i], 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+            }
+            val[0] = (double) rank;
+            MPI_Put(&val[0], 1, MPI_DOUBLE, dst, 3 + rank, 1, MPI_DOUBLE, win);
+        }
+        MPI_Win_flush_all(win);
+    }
+    MPI_Win_unlock_all(win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock_all(0, win);
+    dst = (rank + 1) % nprocs;
+    MPI_Get(val, 1, derived_type, dst, 3 + rank, 1, derived_type, win);
+    MPI_Win_flush(dst, win);
+    errs += check_val("get derived", val[0], (double) rank);
+
+    MPI_Get(&val[0], 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, win);
+    MPI_Win_unlock_all(win);
+    errs += check_val("get acc", val[0], 1.0 * NUM_OPS * ITER * nprocs);
+
+    MPI_Type_free(&derived_type);
+    return errs;
+}
+
+/* Read-modify-write by get and put, only correct if exclusive locks exclude
+ * each other on helpers. */
+static int run_test2(void)
+{
+    int x, errs = 0;
+    double val = 0.0;
+
+    for (x = 0; x < ITER; x++) {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
+        MPI_Get(&val, 1, MPI_DOUBLE, 0, 1, 1, MPI_DOUBLE, win);
+        MPI_Win_flush(0, win);
+        val += 1.0;
+        MPI_Put(&val, 1, MPI_DOUBLE, 0, 1, 1, MPI_DOUBLE, win);
+        MPI_Win_unlock(0, win);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
+    MPI_Get(&val, 1, MPI_DOUBLE, 0, 1, 1, MPI_DOUBLE, win);
+    MPI_Win_unlock(0, win);
+    errs += check_val("exclusive counter", val, 1.0 * ITER * nprocs);
+
+    return errs;
+}
+
+/* Fetch_and_op in fence epoch */
+static int run_test3(void)
+{
+    int x, errs = 0;
+    double one = 1.0, result = 0.0;
+
+    MPI_Win_fence(0, win);
+    for (x = 0; x < ITER; x++) {
+        MPI_Fetch_and_op(&one, &result, MPI_DOUBLE, nprocs - 1, 2, MPI_SUM, win);
+    }
+    MPI_Win_fence(0, win);
+
+    if (rank == nprocs - 1)
+        errs += check_val("fence counter", winbuf[2], 1.0 * ITER * nprocs);
+
+    MPI_Fetch_and_op(NULL, &result, MPI_DOUBLE, nprocs - 1, 2, MPI_NO_OP, win);
+    MPI_Win_fence(MPI_MODE_NOSUCCEED, win);
+    errs += check_val("fence fetch", result, 1.0 * ITER * nprocs);
+
+    return errs;
+}
+
+/* Replace through MPI RMA and through helpers to the same location, and
+ * get_accumulate of several elements, every origin updates its own slots. */
+static int run_test4(void)
+{
+    int i, x, dst, errs = 0;
+    double *order_buf = NULL, val, ones[2] = { 1.0, 1.0 }, results[2];
+    MPI_Win order_win = MPI_WIN_NULL;
+    MPI_Info win_info = MPI_INFO_NULL;
+    MPI_Datatype derived_type;
+
+    MPI_Type_contiguous(1, MPI_DOUBLE, &derived_type);
+    MPI_Type_commit(&derived_type);
+
+    /* [0 : nprocs]: replaced by every rank, [nprocs : 3 * nprocs]: get_accumulate */
+    MPI_Info_create(&win_info);
+    MPI_Info_set(win_info, "rma_transport", "am");
+    MPI_Win_allocate(sizeof(double) * 3 * nprocs, sizeof(double), win_info, MPI_COMM_WORLD,
+                     &order_buf, &order_win);
+    MPI_Info_free(&win_info);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, order_win);
+    for (i = 0; i < 3 * nprocs; i++)
+        order_buf[i] = 0.0;
+    MPI_Win_unlock(rank, order_win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock_all(0, order_win);
+    for (x = 0; x < ITER; x++) {
+        for (dst = 0; dst < nprocs; dst++) {
+            val = (double) x;
+            MPI_Accumulate(&val, 1, derived_type, dst, rank, 1, derived_type, MPI_REPLACE,
+                           order_win);
+            val = (double) -(x + 1);
+            MPI_Accumulate(&val, 1, MPI_DOUBLE, dst, rank, 1, MPI_DOUBLE, MPI_REPLACE,
+                           order_win);
+            val = (double) x;
+            MPI_Accumulate(&val, 1, derived_type, dst, rank, 1, derived_type, MPI_REPLACE,
+                           order_win);
+
+            MPI_Get_accumulate(ones, 2, MPI_DOUBLE, results, 2, MPI_DOUBLE, dst,
+                               nprocs + 2 * rank, 2, MPI_DOUBLE, MPI_SUM, order_win);
+            MPI_Win_flush(dst, order_win);
+            for (i = 0; i < 2; i++)
+                errs += check_val("get_accumulate result", results[i], (double) x);
+        }
+    }
+    MPI_Win_unlock_all(order_win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, order_win);
+    for (i = 0; i < nprocs; i++) {
+        errs += check_val("ordered replace", order_buf[i], (double) (ITER - 1));
+        errs += check_val("get_accumulate", order_buf[nprocs + 2 * i], (double) ITER);
+        errs += check_val("get_accumulate", order_buf[nprocs + 2 * i + 1], (double) ITER);
+    }
+    MPI_Win_unlock(rank, order_win);
+
+    MPI_Win_free(&order_win);
+    MPI_Type_free(&derived_type);
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, errs = 0, errs_total = 0;
+    MPI_Info win_info = MPI_INFO_NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    for (i = 0; i < NUM_OPS; i++) {
+        locbuf[i] = 1.0;
+    }
+
+    MPI_Info_create(&win_info);
+    MPI_Info_set(win_info, "rma_transport", "am");
+
+    MPI_Win_allocate(sizeof(double) * WIN_SIZE(nprocs), sizeof(double), win_info,
+                     MPI_COMM_WORLD, &winbuf, &win);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+    for (i = 0; i < WIN_SIZE(nprocs); i++) {
+        winbuf[i] = 0.0;
+    }
+    MPI_Win_unlock(rank, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    errs += run_test1();
+    errs += run_test2();
+    errs += run_test3();
+    errs += run_test4();
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    if (win_info != MPI_INFO_NULL)
+        MPI_Info_free(&win_info);
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+
+    MPI_Finalize();
+
+    return 0;
+}
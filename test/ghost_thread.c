@@ -0,0 +1,165 @@
+/*
+ * ghost_thread.c
+ *  <FILE_DESC>
+ *
+ *  Check the thread ghost mode (MTCORE_GHOST_MODE=thread), which can run with
+ *  a single process per node. Every process accumulates to all the others in
+ *  lock_all, lock and fence epochs, while the targets compute without calling
+ *  MPI, and then checks its local buffer. Windows are allocated on the world,
+ *  on a duplicated world, whose first local user owns the ghost thread, and
+ *  on a reversed sub-communicator, whose first local user does not and thus
+ *  falls back to a normal MPI window. A created window is also checked.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define COUNT 1024
+#define NUM_OPS 16
+
+int rank, nprocs;
+
+static void compute(double sec)
+{
+    double t0 = MPI_Wtime();
+    while (MPI_Wtime() - t0 < sec);
+}
+
+static int check_result(MPI_Win win, double *winbuf, MPI_Comm comm, double expected,
+                        const char *name, const char *epoch)
+{
+    int i, errs = 0, comm_rank;
+
+    MPI_Comm_rank(comm, &comm_rank);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, comm_rank, 0, win);
+    for (i = 0; i < COUNT; i++) {
+        if (winbuf[i] != expected) {
+            fprintf(stderr, "[%d] %s %s winbuf[%d] %.1lf != %.1lf\n", rank, name, epoch, i,
+                    winbuf[i], expected);
+            errs++;
+            break;
+        }
+    }
+    MPI_Win_unlock(comm_rank, win);
+    MPI_Barrier(comm);
+
+    return errs;
+}
+
+static int run_test(MPI_Win win, double *winbuf, MPI_Comm comm, const char *name)
+{
+    int i, x, dst, errs = 0;
+    int comm_rank, comm_nprocs;
+    double one = 1.0, ones[COUNT], tmp[COUNT];
+
+    MPI_Comm_rank(comm, &comm_rank);
+    MPI_Comm_size(comm, &comm_nprocs);
+    for (i = 0; i < COUNT; i++)
+        ones[i] = 1.0;
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, comm_rank, 0, win);
+    for (i = 0; i < COUNT; i++)
+        winbuf[i] = 0.0;
+    MPI_Win_unlock(comm_rank, win);
+    MPI_Barrier(comm);
+
+    /* lock_all */
+    MPI_Win_lock_all(0, win);
+    for (x = 0; x < NUM_OPS; x++) {
+        for (dst = 0; dst < comm_nprocs; dst++) {
+            for (i = 0; i < COUNT; i++)
+                MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, i, 1, MPI_DOUBLE, MPI_SUM, win);
+        }
+        MPI_Win_flush_all(win);
+        compute(0.001);
+    }
+    MPI_Win_unlock_all(win);
+    MPI_Barrier(comm);
+    errs += check_result(win, winbuf, comm, (double) (comm_nprocs * NUM_OPS), name,
+                         "lockall");
+
+    /* lock, the local target is also accessed through the node helper */
+    for (dst = 0; dst < comm_nprocs; dst++) {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, dst, 0, win);
+        MPI_Accumulate(ones, COUNT, MPI_DOUBLE, dst, 0, COUNT, MPI_DOUBLE, MPI_SUM, win);
+        MPI_Win_unlock(dst, win);
+    }
+    compute(0.001);
+    MPI_Barrier(comm);
+    errs += check_result(win, winbuf, comm, (double) (comm_nprocs * (NUM_OPS + 1)), name,
+                         "lock");
+
+    /* fence, put and get the local target */
+    MPI_Win_fence(0, win);
+    for (dst = 0; dst < comm_nprocs; dst++)
+        MPI_Accumulate(ones, COUNT, MPI_DOUBLE, dst, 0, COUNT, MPI_DOUBLE, MPI_SUM, win);
+    MPI_Win_fence(0, win);
+    MPI_Get(tmp, COUNT, MPI_DOUBLE, comm_rank, 0, COUNT, MPI_DOUBLE, win);
+    MPI_Win_fence(0, win);
+    MPI_Put(tmp, COUNT, MPI_DOUBLE, comm_rank, 0, COUNT, MPI_DOUBLE, win);
+    MPI_Win_fence(0, win);
+    errs += check_result(win, winbuf, comm, (double) (comm_nprocs * (NUM_OPS + 2)), name,
+                         "fence");
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int provided = 0, errs = 0, errs_total = 0;
+    double *winbuf = NULL, *create_buf = NULL;
+    MPI_Win win = MPI_WIN_NULL;
+    MPI_Comm sub_comm = MPI_COMM_NULL;
+
+    setenv("MTCORE_GHOST_MODE", "thread", 0);
+
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SINGLE, &provided);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    MPI_Win_allocate(sizeof(double) * COUNT, sizeof(double), MPI_INFO_NULL,
+                     MPI_COMM_WORLD, &winbuf, &win);
+    errs += run_test(win, winbuf, MPI_COMM_WORLD, "allocated");
+    MPI_Win_free(&win);
+
+    MPI_Comm_dup(MPI_COMM_WORLD, &sub_comm);
+    MPI_Win_allocate(sizeof(double) * COUNT, sizeof(double), MPI_INFO_NULL,
+                     sub_comm, &winbuf, &win);
+    errs += run_test(win, winbuf, sub_comm, "dup-comm");
+    MPI_Win_free(&win);
+    MPI_Comm_free(&sub_comm);
+
+    /* Reverse ranks so that the first local user differs from the world. */
+    MPI_Comm_split(MPI_COMM_WORLD, 0, nprocs - rank, &sub_comm);
+    MPI_Win_allocate(sizeof(double) * COUNT, sizeof(double), MPI_INFO_NULL,
+                     sub_comm, &winbuf, &win);
+    errs += run_test(win, winbuf, sub_comm, "sub-comm");
+    MPI_Win_free(&win);
+    MPI_Comm_free(&sub_comm);
+
+    MPI_Alloc_mem(sizeof(double) * COUNT, MPI_INFO_NULL, &create_buf);
+    MPI_Win_create(create_buf, sizeof(double) * COUNT, sizeof(double), MPI_INFO_NULL,
+                   MPI_COMM_WORLD, &win);
+    errs += run_test(win, create_buf, MPI_COMM_WORLD, "created");
+    MPI_Win_free(&win);
+    MPI_Free_mem(create_buf);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    MPI_Finalize();
+
+    return 0;
+}
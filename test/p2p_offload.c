@@ -0,0 +1,252 @@
+/*
+ * p2p_offload.c
+ *  <FILE_DESC>
+ *
+ *  Check helper-progressed point-to-point (MPIX_Isend_offload and
+ *  MPIX_Irecv_offload with MTCORE_P2P_OFFLOAD=on). Every process exchanges
+ *  large messages with its neighbors in a ring on buffers in its window, which
+ *  are posted by helpers, and small messages on malloc buffers, which are
+ *  posted directly. Requests are completed by waitall or by test loop, and the
+ *  received data and statuses are checked. Then messages of mixed sizes with
+ *  the same tag are checked to arrive in order, messages with the same tag on
+ *  world and on a duplicated communicator must not cross, a small message is
+ *  received with a large count, and a vector datatype is sent and received.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define LARGE_COUNT (64 * 1024)
+#define SMALL_COUNT 16
+#define ITER 10
+
+extern int MPIX_Isend_offload(const void *buf, int count, MPI_Datatype datatype, int dest,
+                              int tag, MPI_Comm comm, MPI_Request * request);
+extern int MPIX_Irecv_offload(void *buf, int count, MPI_Datatype datatype, int source, int tag,
+                              MPI_Comm comm, MPI_Request * request);
+
+double *winbuf = NULL, *dup_winbuf = NULL;
+double small_sbuf[SMALL_COUNT], small_rbuf[SMALL_COUNT];
+double *priv_sbuf = NULL, *priv_rbuf = NULL;
+int rank, nprocs;
+MPI_Win win = MPI_WIN_NULL, dup_win = MPI_WIN_NULL;
+MPI_Comm dup_comm = MPI_COMM_NULL;
+
+static int check_status(MPI_Status * status, int source, int tag, int count)
+{
+    int c = 0;
+
+    MPI_Get_count(status, MPI_DOUBLE, &c);
+    if (status->MPI_SOURCE != source || status->MPI_TAG != tag || c != count) {
+        fprintf(stderr, "[%d] status source %d tag %d count %d != %d, %d, %d\n", rank,
+                status->MPI_SOURCE, status->MPI_TAG, c, source, tag, count);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_buf(const char *name, int x, double *buf, int count, int peer)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (buf[i] != (double) (peer * ITER + x + i)) {
+            fprintf(stderr, "[%d] iter %d %s[%d] %.1lf != %.1lf\n", rank, x, name, i,
+                    buf[i], (double) (peer * ITER + x + i));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int run_test(int x)
+{
+    double *sbuf = winbuf, *rbuf = winbuf + LARGE_COUNT;
+    int i, flag = 0, errs = 0;
+    int left = (rank + nprocs - 1) % nprocs, right = (rank + 1) % nprocs;
+    MPI_Request reqs[6];
+    MPI_Status statuses[6];
+
+    for (i = 0; i < LARGE_COUNT; i++) {
+        sbuf[i] = priv_sbuf[i] = (double) (rank * ITER + x + i);
+        rbuf[i] = priv_rbuf[i] = -1.0;
+    }
+    for (i = 0; i < SMALL_COUNT; i++) {
+        small_sbuf[i] = (double) (rank * ITER + x + i);
+        small_rbuf[i] = -1.0;
+    }
+
+    MPIX_Irecv_offload(rbuf, LARGE_COUNT, MPI_DOUBLE, left, x, MPI_COMM_WORLD, &reqs[0]);
+    MPIX_Irecv_offload(priv_rbuf, LARGE_COUNT, MPI_DOUBLE, right, ITER + x, MPI_COMM_WORLD,
+                       &reqs[1]);
+    MPIX_Irecv_offload(small_rbuf, SMALL_COUNT, MPI_DOUBLE, right, 2 * ITER + x,
+                       MPI_COMM_WORLD, &reqs[2]);
+    MPIX_Isend_offload(sbuf, LARGE_COUNT, MPI_DOUBLE, right, x, MPI_COMM_WORLD, &reqs[3]);
+    MPIX_Isend_offload(priv_sbuf, LARGE_COUNT, MPI_DOUBLE, left, ITER + x, MPI_COMM_WORLD,
+                       &reqs[4]);
+    MPIX_Isend_offload(small_sbuf, SMALL_COUNT, MPI_DOUBLE, left, 2 * ITER + x, MPI_COMM_WORLD,
+                       &reqs[5]);
+
+    if (x % 2 == 0) {
+        MPI_Waitall(6, reqs, statuses);
+    }
+    else {
+        while (!flag)
+            MPI_Testall(6, reqs, &flag, statuses);
+    }
+
+    errs += check_status(&statuses[0], left, x, LARGE_COUNT);
+    errs += check_status(&statuses[1], right, ITER + x, LARGE_COUNT);
+    errs += check_status(&statuses[2], right, 2 * ITER + x, SMALL_COUNT);
+    errs += check_buf("window rbuf", x, rbuf, LARGE_COUNT, left);
+    errs += check_buf("private rbuf", x, priv_rbuf, LARGE_COUNT, right);
+    errs += check_buf("small rbuf", x, small_rbuf, SMALL_COUNT, right);
+
+    return errs;
+}
+
+static void fill_buf(double *buf, int count, int peer, int x)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        buf[i] = (double) (peer * ITER + x + i);
+}
+
+static int run_match_test(int x)
+{
+    double *sbuf = winbuf, *rbuf = winbuf + LARGE_COUNT;
+    double small_vbuf[SMALL_COUNT * 2];
+    int i, errs = 0, tag = 3 * ITER + x;
+    int left = (rank + nprocs - 1) % nprocs, right = (rank + 1) % nprocs;
+    MPI_Datatype vtype;
+    MPI_Request reqs[10];
+    MPI_Status statuses[10];
+
+    /* Large from window, small, large from private buffer, all on one tag and
+     * received with the large count. Their content tells the order. */
+    fill_buf(sbuf, LARGE_COUNT, rank, x);
+    fill_buf(small_sbuf, SMALL_COUNT, rank, x + 1);
+    fill_buf(priv_sbuf, LARGE_COUNT, rank, x + 2);
+    for (i = 0; i < LARGE_COUNT; i++)
+        rbuf[i] = priv_rbuf[i] = -1.0;
+
+    MPIX_Irecv_offload(rbuf, LARGE_COUNT, MPI_DOUBLE, left, tag, MPI_COMM_WORLD, &reqs[0]);
+    MPIX_Irecv_offload(small_rbuf, LARGE_COUNT, MPI_DOUBLE, left, tag, MPI_COMM_WORLD,
+                       &reqs[1]);
+    MPIX_Irecv_offload(priv_rbuf, LARGE_COUNT, MPI_DOUBLE, left, tag, MPI_COMM_WORLD, &reqs[2]);
+    MPIX_Isend_offload(sbuf, LARGE_COUNT, MPI_DOUBLE, right, tag, MPI_COMM_WORLD, &reqs[3]);
+    MPIX_Isend_offload(small_sbuf, SMALL_COUNT, MPI_DOUBLE, right, tag, MPI_COMM_WORLD,
+                       &reqs[4]);
+    MPIX_Isend_offload(priv_sbuf, LARGE_COUNT, MPI_DOUBLE, right, tag, MPI_COMM_WORLD,
+                       &reqs[5]);
+    MPI_Waitall(6, reqs, statuses);
+
+    errs += check_status(&statuses[0], left, tag, LARGE_COUNT);
+    errs += check_status(&statuses[1], left, tag, SMALL_COUNT);
+    errs += check_status(&statuses[2], left, tag, LARGE_COUNT);
+    errs += check_buf("ordered 1st", x, rbuf, LARGE_COUNT, left);
+    errs += check_buf("ordered 2nd", x + 1, small_rbuf, SMALL_COUNT, left);
+    errs += check_buf("ordered 3rd", x + 2, priv_rbuf, LARGE_COUNT, left);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    /* The same tag on two communicators, the message on the duplicate is sent
+     * first but must only match the receive on the duplicate. */
+    fill_buf(small_sbuf, SMALL_COUNT, rank, x);
+    fill_buf(priv_sbuf, SMALL_COUNT, rank, x + 1);
+    for (i = 0; i < SMALL_COUNT; i++)
+        small_rbuf[i] = priv_rbuf[i] = -1.0;
+
+    MPIX_Irecv_offload(small_rbuf, SMALL_COUNT, MPI_DOUBLE, left, tag, MPI_COMM_WORLD,
+                       &reqs[0]);
+    MPIX_Irecv_offload(priv_rbuf, SMALL_COUNT, MPI_DOUBLE, left, tag, dup_comm, &reqs[1]);
+    MPIX_Isend_offload(priv_sbuf, SMALL_COUNT, MPI_DOUBLE, right, tag, dup_comm, &reqs[2]);
+    MPIX_Isend_offload(small_sbuf, SMALL_COUNT, MPI_DOUBLE, right, tag, MPI_COMM_WORLD,
+                       &reqs[3]);
+    MPI_Waitall(4, reqs, statuses);
+
+    errs += check_buf("world", x, small_rbuf, SMALL_COUNT, left);
+    errs += check_buf("dup comm", x + 1, priv_rbuf, SMALL_COUNT, left);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    /* Every other element of a vector. */
+    MPI_Type_vector(SMALL_COUNT, 1, 2, MPI_DOUBLE, &vtype);
+    MPI_Type_commit(&vtype);
+    for (i = 0; i < SMALL_COUNT * 2; i++)
+        small_vbuf[i] = (double) (rank * ITER + x + i / 2);
+    for (i = 0; i < SMALL_COUNT * 2; i++)
+        priv_rbuf[i] = -1.0;
+
+    MPIX_Irecv_offload(priv_rbuf, 1, vtype, left, tag, MPI_COMM_WORLD, &reqs[0]);
+    MPIX_Isend_offload(small_vbuf, 1, vtype, right, tag, MPI_COMM_WORLD, &reqs[1]);
+    MPI_Type_free(&vtype);
+    MPI_Waitall(2, reqs, statuses);
+
+    for (i = 0; i < SMALL_COUNT; i++) {
+        if (priv_rbuf[i * 2] != (double) (left * ITER + x + i) || priv_rbuf[i * 2 + 1] != -1.0) {
+            fprintf(stderr, "[%d] iter %d vector[%d] %.1lf %.1lf\n", rank, x, i,
+                    priv_rbuf[i * 2], priv_rbuf[i * 2 + 1]);
+            errs++;
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int x, errs = 0, errs_total = 0;
+
+    /* Offloading is opt-in, enable it unless specified. */
+    setenv("MTCORE_P2P_OFFLOAD", "on", 0);
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    priv_sbuf = malloc(sizeof(double) * LARGE_COUNT);
+    priv_rbuf = malloc(sizeof(double) * LARGE_COUNT);
+
+    MPI_Win_allocate(sizeof(double) * LARGE_COUNT * 2, sizeof(double), MPI_INFO_NULL,
+                     MPI_COMM_WORLD, &winbuf, &win);
+
+    /* A window gives the duplicate its own id on the offload channel. */
+    MPI_Comm_dup(MPI_COMM_WORLD, &dup_comm);
+    MPI_Win_allocate(sizeof(double), sizeof(double), MPI_INFO_NULL, dup_comm, &dup_winbuf,
+                     &dup_win);
+
+    for (x = 0; x < ITER; x++)
+        errs += run_test(x);
+    for (x = 0; x < ITER; x++)
+        errs += run_match_test(x);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+    if (dup_win != MPI_WIN_NULL)
+        MPI_Win_free(&dup_win);
+    if (dup_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&dup_comm);
+    if (priv_sbuf)
+        free(priv_sbuf);
+    if (priv_rbuf)
+        free(priv_rbuf);
+
+    MPI_Finalize();
+
+    return 0;
+}
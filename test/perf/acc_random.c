@@ -0,0 +1,172 @@
+/*
+ * acc_random.c
+ *
+ *  This benchmark evaluates accumulates at random displacements of a large
+ *  window, whose performance on helpers is sensitive to TLB misses on the node
+ *  shared segment.
+ *
+ *  Every process issues NOP MPI_SUM accumulates of a single double at random
+ *  displacements on random targets in a lockall epoch, then flushes all. With
+ *  Manticore, compare the segment backed by normal pages (huge_page=off) with
+ *  huge pages (huge_page=thp or hugetlb), which can be set by the huge_page
+ *  argument or by MTCORE_WIN_HUGE_PAGE.
+ *
+ *  Usage: mtcore_acc_random [nh] [huge_page] [window size in MB per process] [nop]
+ *         acc_random [window size in MB per process] [nop]
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#define ITER 10
+#define SKIP 2
+
+double *winbuf = NULL;
+int rank, nprocs;
+MPI_Win win = MPI_WIN_NULL;
+long WIN_SIZE = 256L * 1024 * 1024 / sizeof(double);
+int NOP = 100000;
+int *dsts = NULL;
+MPI_Aint *disps = NULL;
+
+#ifdef MTCORE
+extern int MTCORE_NUM_H;
+#endif
+
+static void do_acc_loop(int iter)
+{
+    double one = 1.0;
+    int i, x;
+
+    for (x = 0; x < iter; x++) {
+        for (i = 0; i < NOP; i++) {
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dsts[i], disps[i], 1, MPI_DOUBLE, MPI_SUM, win);
+        }
+        MPI_Win_flush_all(win);
+    }
+}
+
+static int run_test(const char *huge_page)
+{
+    int i, errs = 0;
+    double t0, t_total = 0.0, avg_total_time = 0.0, sum = 0.0, sum_total = 0.0;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock_all(0, win);
+    do_acc_loop(SKIP);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+    do_acc_loop(ITER);
+    t_total = (MPI_Wtime() - t0) * 1000 * 1000 / ITER / NOP;   /*us */
+    MPI_Win_unlock_all(win);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    /* check the total of all accumulates */
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, win);
+    for (i = 0; i < WIN_SIZE; i++)
+        sum += winbuf[i];
+    MPI_Win_unlock(rank, win);
+
+    MPI_Reduce(&t_total, &avg_total_time, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&sum, &sum_total, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        avg_total_time /= nprocs;
+        if (sum_total != (double) nprocs * NOP * (ITER + SKIP)) {
+            fprintf(stderr, "sum %.1lf != %.1lf\n", sum_total,
+                    (double) nprocs * NOP * (ITER + SKIP));
+            errs++;
+        }
+#ifdef MTCORE
+        fprintf(stdout, "mtcore: huge_page %s win_size %ld MB num_op %d nprocs %d nh %d "
+                "op_time %.3lf\n", huge_page, WIN_SIZE * sizeof(double) / 1024 / 1024, NOP,
+                nprocs, MTCORE_NUM_H, avg_total_time);
+#else
+        fprintf(stdout, "orig: win_size %ld MB num_op %d nprocs %d op_time %.3lf\n",
+                WIN_SIZE * sizeof(double) / 1024 / 1024, NOP, nprocs, avg_total_time);
+#endif
+    }
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, errs = 0;
+    const char *huge_page = NULL;
+    MPI_Info win_info = MPI_INFO_NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+#ifdef MTCORE
+    /* first argv is nh */
+    if (argc >= 3) {
+        huge_page = argv[2];
+    }
+    if (argc >= 4) {
+        WIN_SIZE = atol(argv[3]) * 1024 * 1024 / sizeof(double);
+    }
+    if (argc >= 5) {
+        NOP = atoi(argv[4]);
+    }
+#else
+    if (argc >= 2) {
+        WIN_SIZE = atol(argv[1]) * 1024 * 1024 / sizeof(double);
+    }
+    if (argc >= 3) {
+        NOP = atoi(argv[2]);
+    }
+#endif
+
+    if (nprocs < 2) {
+        if (rank == 0)
+            fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    /* Generate random targets and displacements before the measurement. */
+    dsts = calloc(NOP, sizeof(int));
+    disps = calloc(NOP, sizeof(MPI_Aint));
+    srand(rank + 1);
+    for (i = 0; i < NOP; i++) {
+        dsts[i] = rand() % nprocs;
+        disps[i] = (MPI_Aint) (((double) rand() / RAND_MAX) * (WIN_SIZE - 1));
+    }
+
+    MPI_Info_create(&win_info);
+    MPI_Info_set(win_info, (char *) "epoch_type", (char *) "lockall");
+    if (huge_page)
+        MPI_Info_set(win_info, (char *) "huge_page", (char *) huge_page);
+
+    MPI_Win_allocate(sizeof(double) * WIN_SIZE, sizeof(double), win_info, MPI_COMM_WORLD,
+                     &winbuf, &win);
+    memset(winbuf, 0, sizeof(double) * WIN_SIZE);
+
+    errs = run_test(huge_page ? huge_page : "default");
+
+    if (rank == 0 && errs > 0)
+        fprintf(stdout, "%d errors\n", errs);
+
+  exit:
+    if (win_info != MPI_INFO_NULL)
+        MPI_Info_free(&win_info);
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+    if (dsts)
+        free(dsts);
+    if (disps)
+        free(disps);
+    MPI_Finalize();
+
+    return 0;
+}
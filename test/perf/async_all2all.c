@@ -145,9 +145,14 @@ static int run_test(int time)
     if (rank == 0) {
         avg_total_time = avg_total_time / nprocs * 1000 * 1000;
 #ifdef MTCORE
+        /* Run with MTCORE_RMA_TRANSPORT=agg to aggregate inter-node operations
+         * on each node through local helpers. */
+        const char *transport = getenv("MTCORE_RMA_TRANSPORT");
         fprintf(stdout,
-                "mtcore: %s iter %d comp_size %d num_op %d nprocs %d nh %d total_time %.2lf\n",
-                OP_TYPE_NM[OP_TYPE], ITER, time, NOP, nprocs, MTCORE_NUM_H, avg_total_time);
+                "mtcore: %s iter %d comp_size %d num_op %d nprocs %d nh %d transport %s "
+                "total_time %.2lf\n", OP_TYPE_NM[OP_TYPE], ITER, time, NOP, nprocs,
+                MTCORE_NUM_H, (transport && strlen(transport)) ? transport : "rma",
+                avg_total_time);
 #else
         const char *async_th = getenv("MPIR_CVAR_ASYNC_PROGRESS");
         int async_th_val = 0;
@@ -8,7 +8,7 @@
 #include <assert.h>
 #include <sched.h>
 #include <pthread.h>
-#include <sched.h>
+#include <sys/sysinfo.h>
 
 #define D_SLEEP_TIME 100        // 100us
 
@@ -43,6 +43,41 @@ MPI_Win win = MPI_WIN_NULL;
 int ITER = ITER_S;
 int NOP = 100;
 
+/* Number of user threads issuing operations in every fence epoch, and number
+ * of helper-window endpoints requested through the "num_thread_endpoints"
+ * info key. */
+int NUM_WORKERS = 1;
+int NUM_EPS = 1;
+static pthread_barrier_t worker_barrier;
+static volatile int worker_exit = 0;
+
+/* Every worker issues operations to a disjoint subset of targets. */
+static void issue_ops(int tid)
+{
+    int i, dst;
+
+    for (dst = tid; dst < nprocs; dst += NUM_WORKERS) {
+        for (i = 1; i < NOP; i++) {
+            MPI_Accumulate(&locbuf[i], 1, MPI_DOUBLE, dst, rank, 1, MPI_DOUBLE, MPI_SUM, win);
+        }
+    }
+}
+
+static void *worker_fn(void *arg)
+{
+    int tid = *(int *) arg;
+
+    while (1) {
+        /* wait for the epoch opened by main thread */
+        pthread_barrier_wait(&worker_barrier);
+        if (worker_exit)
+            break;
+        issue_ops(tid);
+        pthread_barrier_wait(&worker_barrier);
+    }
+    return NULL;
+}
+
 static int usleep_by_count(unsigned long us)
 {
     double start = MPI_Wtime() * 1000 * 1000;
@@ -52,12 +87,8 @@ static int usleep_by_count(unsigned long us)
 
 static int run_test(int time)
 {
-    int i, x, errs = 0, errs_total = 0;
-    MPI_Status stat;
-    int dst;
-    int winbuf_offset = 0;
+    int x, errs = 0, errs_total = 0;
     double t0, avg_total_time = 0.0, t_total = 0.0;
-    double sum = 0.0;
 
     if (nprocs < NPROCS_M) {
         ITER = ITER_S;
@@ -75,11 +106,12 @@ static int run_test(int time)
 
         usleep_by_count(time);
 
-        for (dst = 0; dst < nprocs; dst++) {
-            for (i = 1; i < NOP; i++) {
-                MPI_Accumulate(&locbuf[i], 1, MPI_DOUBLE, dst, rank, 1, MPI_DOUBLE, MPI_SUM, win);
-            }
-        }
+        if (NUM_WORKERS > 1)
+            pthread_barrier_wait(&worker_barrier);
+        issue_ops(0);
+        if (NUM_WORKERS > 1)
+            pthread_barrier_wait(&worker_barrier);
+
         MPI_Win_fence(MPI_MODE_NOSUCCEED, win);
     }
     t_total = MPI_Wtime() - t0;
@@ -92,12 +124,13 @@ static int run_test(int time)
         avg_total_time = avg_total_time / nprocs * 1000 * 1000;
 #ifdef MTCORE
         fprintf(stdout,
-                "mtcore: iter %d comp_size %d num_op %d nprocs %d nh %d total_time %.2lf\n",
-                ITER, time, NOP, nprocs, MTCORE_NUM_H, avg_total_time);
+                "mtcore: iter %d comp_size %d num_op %d nprocs %d nh %d nthreads %d neps %d "
+                "total_time %.2lf\n", ITER, time, NOP, nprocs, MTCORE_NUM_H, NUM_WORKERS,
+                NUM_EPS, avg_total_time);
 #else
         fprintf(stdout,
-                "orig: iter %d comp_size %d num_op %d nprocs %d total_time %.2lf\n",
-                ITER, time, NOP, nprocs, avg_total_time);
+                "orig: iter %d comp_size %d num_op %d nprocs %d nthreads %d total_time %.2lf\n",
+                ITER, time, NOP, nprocs, NUM_WORKERS, avg_total_time);
 #endif
     }
 
@@ -255,6 +288,9 @@ int main(int argc, char *argv[])
     int i, errs;
     int min_time = D_SLEEP_TIME, max_time = D_SLEEP_TIME, iter_time = 2, time;
     int provided;
+    MPI_Info win_info = MPI_INFO_NULL;
+    pthread_t *workers = NULL;
+    int *worker_ids = NULL;
 
     MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
 
@@ -283,6 +319,12 @@ int main(int argc, char *argv[])
     if (argc >= 6) {
         NOP = atoi(argv[5]);
     }
+    if (argc >= 7) {
+        NUM_WORKERS = atoi(argv[6]);
+    }
+    if (argc >= 8) {
+        NUM_EPS = atoi(argv[7]);
+    }
 #else
     if (argc >= 4) {
         min_time = atoi(argv[1]);
@@ -292,18 +334,45 @@ int main(int argc, char *argv[])
     if (argc >= 5) {
         NOP = atoi(argv[4]);
     }
+    if (argc >= 6) {
+        NUM_WORKERS = atoi(argv[5]);
+    }
 #endif
+    if (NUM_WORKERS < 1)
+        NUM_WORKERS = 1;
 
     locbuf = malloc(sizeof(double) * NOP);
     for (i = 0; i < NOP; i++) {
         locbuf[i] = 1.0;
     }
 
+    if (NUM_EPS > 1) {
+        char eps_str[16];
+        sprintf(eps_str, "%d", NUM_EPS);
+        MPI_Info_create(&win_info);
+        MPI_Info_set(win_info, "epoch_type", "fence");
+        MPI_Info_set(win_info, "num_thread_endpoints", eps_str);
+    }
+
     // size in byte
-    MPI_Win_allocate(sizeof(double) * nprocs, sizeof(double), MPI_INFO_NULL,
+    MPI_Win_allocate(sizeof(double) * nprocs, sizeof(double), win_info,
                      MPI_COMM_WORLD, &winbuf, &win);
     debug_printf("[%d]win_allocate done\n", rank);
 
+    if (win_info != MPI_INFO_NULL)
+        MPI_Info_free(&win_info);
+
+    /* the main thread works as worker 0 */
+    if (NUM_WORKERS > 1) {
+        workers = malloc(sizeof(pthread_t) * NUM_WORKERS);
+        worker_ids = malloc(sizeof(int) * NUM_WORKERS);
+        pthread_barrier_init(&worker_barrier, NULL, NUM_WORKERS);
+        for (i = 1; i < NUM_WORKERS; i++) {
+            worker_ids[i] = i;
+            pthread_create(&workers[i], NULL, worker_fn, &worker_ids[i]);
+        }
+    }
+
     init_async_thread();
     MPI_Barrier(MPI_COMM_WORLD);
 
@@ -318,6 +387,17 @@ int main(int argc, char *argv[])
             break;
     }
 
+    if (NUM_WORKERS > 1) {
+        worker_exit = 1;
+        pthread_barrier_wait(&worker_barrier);
+        for (i = 1; i < NUM_WORKERS; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        pthread_barrier_destroy(&worker_barrier);
+        free(workers);
+        free(worker_ids);
+    }
+
     check_cpu_binding();
 
   exit:
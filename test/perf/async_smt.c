@@ -0,0 +1,199 @@
+/*
+ * async_smt.c
+ *  <FILE_DESC>
+ *
+ *  This benchmark evaluates the placement of helpers on SMT siblings of user
+ *  cores (MTCORE_HELPER_PLACEMENT=smt) against helpers on dedicated cores
+ *  (MTCORE_HELPER_PLACEMENT=first) using 2 user processes bound to cores.
+ *
+ *  Rank 0 issues NOP accumulates followed by a flush to rank 1 in every
+ *  iteration, while rank 1 keeps computing. The communication time reflects the
+ *  latency of asynchronous progress, and the compute time of rank 1 compared
+ *  with the time measured without communication reflects the slowdown caused
+ *  by a helper sharing its core.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#define COMP_SIZE 10000
+#define ITER 2000
+#define SKIP 100
+
+#ifdef MTCORE
+extern int MTCORE_NUM_H;
+#endif
+
+MPI_Win win = MPI_WIN_NULL;
+double *winbuf = NULL, locbuf[1];
+int rank, nprocs;
+int NOP = 1;
+volatile double comp_result = 0.0;
+
+/* Floating point work whose time only depends on the speed of the core. */
+static void compute(int size)
+{
+    double c = comp_result;
+    int i;
+
+    for (i = 0; i < size; i++)
+        c = c * 0.999999 + 0.5;
+    comp_result = c;
+}
+
+static double run_comp_alone(int size)
+{
+    double t0, t_comp;
+    int x;
+
+    for (x = 0; x < SKIP; x++)
+        compute(size);
+
+    t0 = MPI_Wtime();
+    for (x = 0; x < ITER; x++)
+        compute(size);
+    t_comp = (MPI_Wtime() - t0) * 1000 * 1000 / ITER;       /*us */
+
+    return t_comp;
+}
+
+static int run_test(int size)
+{
+    int i, x, errs = 0, flag = 0;
+    int buf[1];
+    double t0, t_comm = 0.0, t_comp = 0.0, t_comp_alone = 0.0;
+    MPI_Request request = MPI_REQUEST_NULL;
+    MPI_Status status;
+
+    /* Compute time without communication */
+    if (rank == 1)
+        t_comp_alone = run_comp_alone(size);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        buf[0] = 99;
+        MPI_Win_lock_all(0, win);
+        for (x = 0; x < SKIP; x++) {
+            for (i = 0; i < NOP; i++)
+                MPI_Accumulate(&locbuf[0], 1, MPI_DOUBLE, 1, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+            MPI_Win_flush(1, win);
+        }
+
+        t0 = MPI_Wtime();
+        for (x = 0; x < ITER; x++) {
+            for (i = 0; i < NOP; i++)
+                MPI_Accumulate(&locbuf[0], 1, MPI_DOUBLE, 1, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+            MPI_Win_flush(1, win);
+        }
+        t_comm = (MPI_Wtime() - t0) * 1000 * 1000 / ITER;   /*us */
+
+        MPI_Win_unlock_all(win);
+        MPI_Send(buf, 1, MPI_INT, 1, 0, MPI_COMM_WORLD);
+    }
+    else if (rank == 1) {
+        buf[0] = 0;
+        MPI_Irecv(buf, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, &request);
+
+        /* Compute time with communication */
+        t0 = MPI_Wtime();
+        for (x = 0; x < ITER; x++) {
+            compute(size);
+            MPI_Test(&request, &flag, &status);
+        }
+        t_comp = (MPI_Wtime() - t0) * 1000 * 1000 / ITER;   /*us */
+
+        if (!flag)
+            MPI_Wait(&request, &status);
+        if (buf[0] != 99) {
+            fprintf(stderr, "[%d]error: recv data %d != %d\n", rank, buf[0], 99);
+            errs++;
+        }
+    }
+
+    MPI_Bcast(&t_comp, 1, MPI_DOUBLE, 1, MPI_COMM_WORLD);
+    MPI_Bcast(&t_comp_alone, 1, MPI_DOUBLE, 1, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+#ifdef MTCORE
+        fprintf(stdout, "mtcore: comp_size %d num_op %d nprocs %d nh %d comm_time %.2lf "
+                "comp_alone_time %.2lf comp_time %.2lf slowdown %.3lf\n", size, NOP, nprocs,
+                MTCORE_NUM_H, t_comm, t_comp_alone, t_comp, t_comp / t_comp_alone);
+#else
+        fprintf(stdout, "orig: comp_size %d num_op %d nprocs %d comm_time %.2lf "
+                "comp_alone_time %.2lf comp_time %.2lf slowdown %.3lf\n", size, NOP, nprocs,
+                t_comm, t_comp_alone, t_comp, t_comp / t_comp_alone);
+#endif
+    }
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int size, errs = 0;
+    int min_size = COMP_SIZE, max_size = COMP_SIZE, iter_size = 2;
+    MPI_Info win_info = MPI_INFO_NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+#ifdef MTCORE
+    /* first argv is nh */
+    if (argc >= 5) {
+        min_size = atoi(argv[2]);
+        max_size = atoi(argv[3]);
+        iter_size = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        NOP = atoi(argv[5]);
+    }
+#else
+    if (argc >= 4) {
+        min_size = atoi(argv[1]);
+        max_size = atoi(argv[2]);
+        iter_size = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        NOP = atoi(argv[4]);
+    }
+#endif
+
+    if (2 != nprocs) {
+        if (rank == 0)
+            fprintf(stderr, "Please run using 2 processes\n");
+        goto exit;
+    }
+
+    locbuf[0] = 1.0;
+
+    MPI_Info_create(&win_info);
+    MPI_Info_set(win_info, (char *) "epoch_type", (char *) "lockall");
+
+    MPI_Win_allocate(sizeof(double), sizeof(double), win_info, MPI_COMM_WORLD, &winbuf, &win);
+    winbuf[0] = 0.0;
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    for (size = min_size; size <= max_size; size *= iter_size) {
+        errs += run_test(size);
+        if (iter_size <= 1)
+            break;
+    }
+
+    if (errs > 0)
+        fprintf(stdout, "[%d] %d errors\n", rank, errs);
+
+  exit:
+    if (win_info != MPI_INFO_NULL)
+        MPI_Info_free(&win_info);
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+
+    MPI_Finalize();
+
+    return 0;
+}
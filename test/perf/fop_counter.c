@@ -0,0 +1,165 @@
+/*
+ * fop_counter.c
+ *  <FILE_DESC>
+ *
+ *  This benchmark evaluates a global counter updated by all processes, as
+ *  used in work stealing and dynamic load balancing. Every process repeatedly
+ *  fetches and increments the counter on rank 0 by MPI_Fetch_and_op(MPI_SUM)
+ *  followed by flush, and computes for comp_size us between updates. It
+ *  reports the average time per update, and checks that every fetched value
+ *  is unique.
+ *
+ *  With Manticore, run with MTCORE_RMA_TRANSPORT=agg and MTCORE_FOP_COMBINE=on
+ *  to combine concurrent updates of each node through the local helper.
+ *
+ *  Usage: mtcore_fop_counter [nh] [comp_size] [iter]
+ *         fop_counter [comp_size] [iter]
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#define CHECK
+
+#ifdef MTCORE
+extern int MTCORE_NUM_H;
+#endif
+
+long *winbuf = NULL;
+long *results = NULL;
+int rank, nprocs;
+MPI_Win win = MPI_WIN_NULL;
+int ITER = 1000;
+int COMP_SIZE = 0;
+
+static int usleep_by_count(unsigned long us)
+{
+    double start = MPI_Wtime() * 1000 * 1000;
+    while (MPI_Wtime() * 1000 * 1000 - start < (double) us);
+    return 0;
+}
+
+static int check_results(void)
+{
+    long *all_results = NULL;
+    char *seen = NULL;
+    long i, total = (long) ITER * nprocs;
+    int errs = 0;
+
+    if (rank == 0) {
+        all_results = malloc(sizeof(long) * total);
+        seen = calloc(total, sizeof(char));
+    }
+    MPI_Gather(results, ITER, MPI_LONG, all_results, ITER, MPI_LONG, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        for (i = 0; i < total; i++) {
+            if (all_results[i] < 0 || all_results[i] >= total || seen[all_results[i]]) {
+                if (errs++ < 10)
+                    fprintf(stderr, "fetched value %ld from rank %ld is wrong or duplicated\n",
+                            all_results[i], i / ITER);
+                continue;
+            }
+            seen[all_results[i]] = 1;
+        }
+        free(all_results);
+        free(seen);
+    }
+
+    return errs;
+}
+
+static int run_test(void)
+{
+    int x, errs = 0;
+    long one = 1;
+    double t0, t_total = 0.0, avg_total_time = 0.0;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+
+    MPI_Win_lock_all(0, win);
+    for (x = 0; x < ITER; x++) {
+        MPI_Fetch_and_op(&one, &results[x], MPI_LONG, 0, 0, MPI_SUM, win);
+        MPI_Win_flush(0, win);
+        usleep_by_count(COMP_SIZE);
+    }
+    MPI_Win_unlock_all(win);
+
+    t_total = (MPI_Wtime() - t0) / ITER;
+    MPI_Reduce(&t_total, &avg_total_time, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+#ifdef CHECK
+    errs = check_results();
+#endif
+
+    if (rank == 0) {
+        avg_total_time = avg_total_time / nprocs * 1000 * 1000;
+#ifdef MTCORE
+        const char *combine = getenv("MTCORE_FOP_COMBINE");
+        fprintf(stdout, "mtcore: iter %d comp_size %d nprocs %d nh %d combine %s "
+                "total_time %.2lf errs %d\n", ITER, COMP_SIZE, nprocs, MTCORE_NUM_H,
+                (combine && strlen(combine)) ? combine : "off", avg_total_time, errs);
+#else
+        fprintf(stdout, "orig: iter %d comp_size %d nprocs %d total_time %.2lf errs %d\n",
+                ITER, COMP_SIZE, nprocs, avg_total_time, errs);
+#endif
+    }
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Info win_info = MPI_INFO_NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+#ifdef MTCORE
+    /* first argv is nh */
+    if (argc >= 3)
+        COMP_SIZE = atoi(argv[2]);
+    if (argc >= 4)
+        ITER = atoi(argv[3]);
+#else
+    if (argc >= 2)
+        COMP_SIZE = atoi(argv[1]);
+    if (argc >= 3)
+        ITER = atoi(argv[2]);
+#endif
+
+    if (nprocs < 2) {
+        if (rank == 0)
+            fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    results = calloc(ITER, sizeof(long));
+
+    MPI_Info_create(&win_info);
+    MPI_Info_set(win_info, (char *) "epoch_type", (char *) "lockall");
+
+    MPI_Win_allocate(sizeof(long), sizeof(long), win_info, MPI_COMM_WORLD, &winbuf, &win);
+    winbuf[0] = 0;
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    run_test();
+
+  exit:
+    if (win_info != MPI_INFO_NULL)
+        MPI_Info_free(&win_info);
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+    if (results)
+        free(results);
+
+    MPI_Finalize();
+
+    return 0;
+}
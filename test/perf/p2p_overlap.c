@@ -0,0 +1,146 @@
+/*
+ * p2p_overlap.c
+ *  <FILE_DESC>
+ *
+ *  This benchmark evaluates the overlap of large nonblocking point-to-point
+ *  with computation. Processes are paired, every process sends a message of
+ *  size bytes to its partner and receives one from it, computes for comp_size
+ *  us, then waits for both transfers. It reports the time of communication
+ *  alone, computation alone, and both overlapped. Rendezvous transfers only
+ *  make progress when the partner enters MPI, thus the overlapped time of the
+ *  original version is close to the sum.
+ *
+ *  With Manticore, buffers are allocated in a window and transfers are issued
+ *  by MPIX_Isend_offload/MPIX_Irecv_offload, run with MTCORE_P2P_OFFLOAD=on to
+ *  hand them to helpers.
+ *
+ *  Usage: mtcore_p2p_overlap [nh] [comp_size] [size]
+ *         p2p_overlap [comp_size] [size]
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define ITER 20
+
+#ifdef MTCORE
+extern int MTCORE_NUM_H;
+extern int MPIX_Isend_offload(const void *buf, int count, MPI_Datatype datatype, int dest,
+                              int tag, MPI_Comm comm, MPI_Request * request);
+extern int MPIX_Irecv_offload(void *buf, int count, MPI_Datatype datatype, int source, int tag,
+                              MPI_Comm comm, MPI_Request * request);
+#endif
+
+int rank, nprocs, partner;
+int COMP_SIZE = 10000, SIZE = 4 * 1024 * 1024;
+char *winbuf = NULL;
+MPI_Win win = MPI_WIN_NULL;
+
+static int usleep_by_count(unsigned long us)
+{
+    double start = MPI_Wtime() * 1000 * 1000;
+    while (MPI_Wtime() * 1000 * 1000 - start < (double) us);
+    return 0;
+}
+
+static void start_comm(MPI_Request * reqs)
+{
+#ifdef MTCORE
+    MPIX_Irecv_offload(winbuf + SIZE, SIZE, MPI_CHAR, partner, 0, MPI_COMM_WORLD, &reqs[0]);
+    MPIX_Isend_offload(winbuf, SIZE, MPI_CHAR, partner, 0, MPI_COMM_WORLD, &reqs[1]);
+#else
+    MPI_Irecv(winbuf + SIZE, SIZE, MPI_CHAR, partner, 0, MPI_COMM_WORLD, &reqs[0]);
+    MPI_Isend(winbuf, SIZE, MPI_CHAR, partner, 0, MPI_COMM_WORLD, &reqs[1]);
+#endif
+}
+
+static void run_test(void)
+{
+    int x;
+    MPI_Request reqs[2];
+    double t0, t_comm = 0.0, t_comp = 0.0, t_overlap = 0.0;
+    double t_comm_max = 0.0, t_comp_max = 0.0, t_overlap_max = 0.0;
+
+    for (x = 0; x < ITER; x++) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        t0 = MPI_Wtime();
+        start_comm(reqs);
+        MPI_Waitall(2, reqs, MPI_STATUSES_IGNORE);
+        t_comm += MPI_Wtime() - t0;
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        t0 = MPI_Wtime();
+        usleep_by_count(COMP_SIZE);
+        t_comp += MPI_Wtime() - t0;
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        t0 = MPI_Wtime();
+        start_comm(reqs);
+        usleep_by_count(COMP_SIZE);
+        MPI_Waitall(2, reqs, MPI_STATUSES_IGNORE);
+        t_overlap += MPI_Wtime() - t0;
+    }
+
+    t_comm = t_comm * 1000 * 1000 / ITER;       /*us */
+    t_comp = t_comp * 1000 * 1000 / ITER;
+    t_overlap = t_overlap * 1000 * 1000 / ITER;
+
+    MPI_Reduce(&t_comm, &t_comm_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&t_comp, &t_comp_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&t_overlap, &t_overlap_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+#ifdef MTCORE
+        fprintf(stdout, "mtcore: comp_size %d size %d nprocs %d nh %d comm_time %.2lf "
+                "comp_time %.2lf overlap_time %.2lf\n", COMP_SIZE, SIZE, nprocs, MTCORE_NUM_H,
+                t_comm_max, t_comp_max, t_overlap_max);
+#else
+        fprintf(stdout, "orig: comp_size %d size %d nprocs %d comm_time %.2lf "
+                "comp_time %.2lf overlap_time %.2lf\n", COMP_SIZE, SIZE, nprocs,
+                t_comm_max, t_comp_max, t_overlap_max);
+#endif
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+#ifdef MTCORE
+    /* first argv is nh */
+    if (argc >= 3)
+        COMP_SIZE = atoi(argv[2]);
+    if (argc >= 4)
+        SIZE = atoi(argv[3]);
+#else
+    if (argc >= 2)
+        COMP_SIZE = atoi(argv[1]);
+    if (argc >= 3)
+        SIZE = atoi(argv[2]);
+#endif
+
+    if (nprocs < 2 || nprocs % 2 != 0) {
+        if (rank == 0)
+            fprintf(stderr, "Please run using an even number of processes\n");
+        goto exit;
+    }
+    partner = rank % 2 == 0 ? rank + 1 : rank - 1;
+
+    /* send buffer followed by receive buffer */
+    MPI_Win_allocate(SIZE * 2, 1, MPI_INFO_NULL, MPI_COMM_WORLD, &winbuf, &win);
+
+    run_test();
+
+  exit:
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+
+    MPI_Finalize();
+
+    return 0;
+}
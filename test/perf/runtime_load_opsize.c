@@ -38,6 +38,7 @@ extern int MTCORE_NUM_H;
 int OPSIZE_MAX = 1, OPSIZE_MIN = 1, OPSIZE = 1, OPSIZE_ITER = 2;        /* us */
 unsigned long SLEEP_TIME = 100;
 int NOP = 1;
+int LOCK_ASSERT = 0;            /* MPI_MODE_NOCHECK lets large puts be striped over helpers */
 int *target_opsizes = NULL;
 
 static int target_computation()
@@ -67,7 +68,7 @@ static int run_test()
     }
 
     for (x = 0; x < SKIP; x++) {
-        MPI_Win_lock_all(0, win);
+        MPI_Win_lock_all(LOCK_ASSERT, win);
         for (dst = 0; dst < nprocs; dst++) {
             MPI_Put(&locbuf[0], 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, win);
         }
@@ -78,7 +79,7 @@ static int run_test()
 
     t0 = MPI_Wtime();
     for (x = 0; x < ITER; x++) {
-        MPI_Win_lock_all(0, win);
+        MPI_Win_lock_all(LOCK_ASSERT, win);
 
         for (dst = 0; dst < nprocs; dst++) {
             MPI_Put(&locbuf[0], 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, win);
@@ -107,14 +108,18 @@ static int run_test()
         const char *load_opt = getenv("MTCORE_RUMTIME_LOAD_OPT");
 
 #ifdef MTCORE
+        const char *stripe_size = getenv("MTCORE_STRIPE_SIZE");
         fprintf(stdout,
-                "mtcore-%s: iter %d comp_size %d op_size %d %d num_op %d nprocs %d nh %d total_time %.2lf\n",
+                "mtcore-%s: iter %d comp_size %d op_size %d %d num_op %d nprocs %d nh %d "
+                "nocheck %d stripe_size %s total_time %.2lf\n",
                 load_opt, ITER, SLEEP_TIME, OPSIZE_MIN, OPSIZE, NOP, nprocs, MTCORE_NUM_H,
+                LOCK_ASSERT == MPI_MODE_NOCHECK, stripe_size ? stripe_size : "default",
                 avg_total_time);
 #else
         fprintf(stdout,
-                "orig: iter %d comp_size %d op_size %d %d num_op %d nprocs %d total_time %.2lf\n",
-                ITER, SLEEP_TIME, OPSIZE_MIN, OPSIZE, NOP, nprocs, avg_total_time);
+                "orig: iter %d comp_size %d op_size %d %d num_op %d nprocs %d nocheck %d "
+                "total_time %.2lf\n", ITER, SLEEP_TIME, OPSIZE_MIN, OPSIZE, NOP, nprocs,
+                LOCK_ASSERT == MPI_MODE_NOCHECK, avg_total_time);
 #endif
     }
 
@@ -167,6 +172,9 @@ int main(int argc, char *argv[])
     if (argc >= 7) {
         NOP = atoi(argv[6]);
     }
+    if (argc >= 8 && atoi(argv[7])) {
+        LOCK_ASSERT = MPI_MODE_NOCHECK;
+    }
 #else
     if (argc >= 4) {
         OPSIZE_MIN = atoi(argv[1]);
@@ -179,6 +187,9 @@ int main(int argc, char *argv[])
     if (argc >= 6) {
         NOP = atoi(argv[5]);
     }
+    if (argc >= 7 && atoi(argv[6])) {
+        LOCK_ASSERT = MPI_MODE_NOCHECK;
+    }
 #endif
 
     target_opsizes = calloc(nprocs, sizeof(int));
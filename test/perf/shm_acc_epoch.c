@@ -0,0 +1,159 @@
+/*
+ * shm_acc_epoch.c
+ *
+ *  This benchmark evaluates exclusive lock epochs of accumulate between
+ *  processes on the same node.
+ *
+ *  Every process locks its neighbor exclusively, issues NOP MPI_SUM accumulates
+ *  of OP_SIZE doubles and unlocks it. With Manticore, compare the accumulates
+ *  applied on shared memory (MTCORE_SHM_ACC=on) with the accumulates redirected
+ *  to helpers (MTCORE_SHM_ACC=off).
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#define ITER 2000
+#define SKIP 100
+
+double *winbuf = NULL;
+double *locbuf = NULL;
+int rank, nprocs;
+MPI_Win win = MPI_WIN_NULL;
+int NOP = 1;
+int OP_SIZE = 1;
+
+#ifdef MTCORE
+extern int MTCORE_NUM_H;
+#endif
+
+static void do_epoch_loop(int dst, int iter)
+{
+    int i, x;
+
+    for (x = 0; x < iter; x++) {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, dst, 0, win);
+        for (i = 0; i < NOP; i++)
+            MPI_Accumulate(locbuf, OP_SIZE, MPI_DOUBLE, dst, 0, OP_SIZE, MPI_DOUBLE, MPI_SUM, win);
+        MPI_Win_unlock(dst, win);
+    }
+}
+
+static int run_test()
+{
+    int i, errs = 0, errs_total = 0;
+    int dst = (rank + 1) % nprocs;
+    double t0, t_total = 0.0, avg_total_time = 0.0;
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+    for (i = 0; i < OP_SIZE; i++)
+        winbuf[i] = 0.0;
+    MPI_Win_unlock(rank, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    do_epoch_loop(dst, SKIP);
+
+    t0 = MPI_Wtime();
+    do_epoch_loop(dst, ITER);
+    t_total = (MPI_Wtime() - t0) * 1000 * 1000 / ITER;  /*us */
+
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    /* check result of the last element */
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, win);
+    if (winbuf[OP_SIZE - 1] != locbuf[OP_SIZE - 1] * NOP * (ITER + SKIP)) {
+        fprintf(stderr, "[%d] winbuf[%d] %.1lf != %.1lf\n", rank, OP_SIZE - 1,
+                winbuf[OP_SIZE - 1], locbuf[OP_SIZE - 1] * NOP * (ITER + SKIP));
+        errs++;
+    }
+    MPI_Win_unlock(rank, win);
+
+    MPI_Reduce(&t_total, &avg_total_time, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        avg_total_time /= nprocs;
+#ifdef MTCORE
+        fprintf(stdout, "mtcore: iter %d num_op %d opsize %d nprocs %d nh %d total_time %.2lf\n",
+                ITER, NOP, OP_SIZE, nprocs, MTCORE_NUM_H, avg_total_time);
+#else
+        fprintf(stdout, "orig: iter %d num_op %d opsize %d nprocs %d total_time %.2lf\n",
+                ITER, NOP, OP_SIZE, nprocs, avg_total_time);
+#endif
+    }
+
+    return errs_total;
+}
+
+int main(int argc, char *argv[])
+{
+    int errs = 0;
+    int i, OP_SIZE_MIN = 1, OP_SIZE_MAX = 1, OP_SIZE_ITER = 2;
+    MPI_Comm shm_comm = MPI_COMM_NULL;
+    int shm_nprocs = 0;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+#ifdef MTCORE
+    /* first argv is nh */
+    if (argc >= 5) {
+        OP_SIZE_MIN = atoi(argv[2]);
+        OP_SIZE_MAX = atoi(argv[3]);
+        OP_SIZE_ITER = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        NOP = atoi(argv[5]);
+    }
+#else
+    if (argc >= 4) {
+        OP_SIZE_MIN = atoi(argv[1]);
+        OP_SIZE_MAX = atoi(argv[2]);
+        OP_SIZE_ITER = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        NOP = atoi(argv[4]);
+    }
+#endif
+
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &shm_comm);
+    MPI_Comm_size(shm_comm, &shm_nprocs);
+    if (nprocs < 2 || shm_nprocs != nprocs) {
+        if (rank == 0)
+            fprintf(stderr, "Requires at least 2 processes on a single node, %d/shm %d\n",
+                    nprocs, shm_nprocs);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    locbuf = calloc(OP_SIZE_MAX, sizeof(double));
+    for (i = 0; i < OP_SIZE_MAX; i++)
+        locbuf[i] = 1.0;
+
+    MPI_Win_allocate(sizeof(double) * OP_SIZE_MAX, sizeof(double), MPI_INFO_NULL, MPI_COMM_WORLD,
+                     &winbuf, &win);
+
+    for (OP_SIZE = OP_SIZE_MIN; OP_SIZE <= OP_SIZE_MAX; OP_SIZE *= OP_SIZE_ITER) {
+        errs += run_test();
+
+        if (OP_SIZE == OP_SIZE_MAX || OP_SIZE_ITER == 1)
+            break;
+    }
+
+    if (rank == 0 && errs > 0)
+        fprintf(stdout, "%d errors\n", errs);
+
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+    if (shm_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&shm_comm);
+    if (locbuf)
+        free(locbuf);
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * shm_acc_kernel.c
+ *
+ *  This benchmark evaluates the kernel cost of accumulate on a self target
+ *  using 2 user processes (only rank 0 is used, but window requires at least 2 processes).
+ *
+ *  Rank 0 locks itself exclusively and issues ITER MPI_SUM accumulates of
+ *  OP_SIZE doubles followed by a single flush. With Manticore, this accumulate is applied
+ *  directly on shared memory (MTCORE_SHM_ACC=on). The same reduction is also
+ *  measured by MPI_Reduce_local as the reference kernel of MPI.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#define ITER 10000
+#define SKIP 100
+
+double *winbuf = NULL;
+double *locbuf = NULL;
+int rank, nprocs;
+MPI_Win win = MPI_WIN_NULL;
+int OP_SIZE = 1;
+
+#ifdef MTCORE
+extern int MTCORE_NUM_H;
+#endif
+
+static void do_acc_loop(int dst, int iter)
+{
+    int x;
+
+    for (x = 0; x < iter; x++) {
+        MPI_Accumulate(locbuf, OP_SIZE, MPI_DOUBLE, dst, 0, OP_SIZE, MPI_DOUBLE, MPI_SUM, win);
+    }
+    MPI_Win_flush(dst, win);
+}
+
+static void do_reduce_local_loop(int iter)
+{
+    int x;
+
+    for (x = 0; x < iter; x++) {
+        MPI_Reduce_local(locbuf, winbuf, OP_SIZE, MPI_DOUBLE, MPI_SUM);
+    }
+}
+
+static void run_test()
+{
+    int dst = 0;
+    double t0, t_acc = 0.0, t_reduce = 0.0;
+
+    if (rank == 0) {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, dst, 0, win);
+        do_acc_loop(dst, SKIP);
+
+        t0 = MPI_Wtime();
+        do_acc_loop(dst, ITER);
+        t_acc = (MPI_Wtime() - t0) * 1000 * 1000 / ITER;        /*us */
+
+        do_reduce_local_loop(SKIP);
+        t0 = MPI_Wtime();
+        do_reduce_local_loop(ITER);
+        t_reduce = (MPI_Wtime() - t0) * 1000 * 1000 / ITER;     /*us */
+        MPI_Win_unlock(dst, win);
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    if (rank == 0) {
+#ifdef MTCORE
+        fprintf(stdout, "mtcore: iter %d opsize %d nprocs %d nh %d acc_time %.3lf "
+                "reduce_local_time %.3lf acc_bw %.2lf\n", ITER, OP_SIZE, nprocs, MTCORE_NUM_H,
+                t_acc, t_reduce, OP_SIZE * sizeof(double) / t_acc);
+#else
+        fprintf(stdout, "orig: iter %d opsize %d nprocs %d acc_time %.3lf "
+                "reduce_local_time %.3lf acc_bw %.2lf\n", ITER, OP_SIZE, nprocs,
+                t_acc, t_reduce, OP_SIZE * sizeof(double) / t_acc);
+#endif
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int i, OP_SIZE_MIN = 1, OP_SIZE_MAX = 1, OP_SIZE_ITER = 2;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+#ifdef MTCORE
+    /* first argv is nh */
+    if (argc >= 5) {
+        OP_SIZE_MIN = atoi(argv[2]);
+        OP_SIZE_MAX = atoi(argv[3]);
+        OP_SIZE_ITER = atoi(argv[4]);
+    }
+#else
+    if (argc >= 4) {
+        OP_SIZE_MIN = atoi(argv[1]);
+        OP_SIZE_MAX = atoi(argv[2]);
+        OP_SIZE_ITER = atoi(argv[3]);
+    }
+#endif
+
+    locbuf = calloc(OP_SIZE_MAX, sizeof(double));
+    MPI_Win_allocate(sizeof(double) * OP_SIZE_MAX, sizeof(double), MPI_INFO_NULL, MPI_COMM_WORLD,
+                     &winbuf, &win);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+    for (i = 0; i < OP_SIZE_MAX; i++) {
+        locbuf[i] = i * 1.0;
+        winbuf[i] = 0;
+    }
+    MPI_Win_unlock(rank, win);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (OP_SIZE = OP_SIZE_MIN; OP_SIZE <= OP_SIZE_MAX; OP_SIZE *= OP_SIZE_ITER) {
+        run_test();
+        MPI_Barrier(MPI_COMM_WORLD);
+
+        if (OP_SIZE == OP_SIZE_MAX || OP_SIZE_ITER == 1)
+            break;
+    }
+
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+    if (locbuf)
+        free(locbuf);
+    MPI_Finalize();
+
+    return 0;
+}
@@ -1,7 +1,66 @@
+/*
+ * shm_win_bw.c
+ *
+ *  This benchmark evaluates put time on a shared window between pairs of
+ *  local processes, and local load/store bandwidth of every rank on its own
+ *  segment of a window allocated by MPI_Win_allocate, which reflects the NUMA
+ *  placement of the segment (see MTCORE_SHM_NUMA_BIND with Manticore).
+ *
+ *  Usage: shm_win_bw [put size in bytes] [load/store size in bytes]
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
 int ITER = 100000;
+int BW_ITER = 20;
+
+/* Load/store bandwidth in MB/s on the local segment of a window. */
+static void measure_local_bw(int rank, int nprocs, size_t bw_size)
+{
+    MPI_Win bw_win = MPI_WIN_NULL;
+    double *bw_buf = NULL, sum = 0.0, t0, bw[2], *all_bw = NULL;
+    size_t n = bw_size / sizeof(double), i;
+    int x;
+
+    MPI_Win_allocate(bw_size, sizeof(double), MPI_INFO_NULL, MPI_COMM_WORLD, &bw_buf, &bw_win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, bw_win);
+
+    t0 = MPI_Wtime();
+    for (x = 0; x < BW_ITER; x++)
+        memset(bw_buf, x, n * sizeof(double));
+    bw[0] = (double) n * sizeof(double) * BW_ITER / ((MPI_Wtime() - t0) * 1000 * 1000);
+
+    t0 = MPI_Wtime();
+    for (x = 0; x < BW_ITER; x++) {
+        for (i = 0; i < n; i++)
+            sum += bw_buf[i];
+    }
+    bw[1] = (double) n * sizeof(double) * BW_ITER / ((MPI_Wtime() - t0) * 1000 * 1000);
+
+    MPI_Win_unlock(rank, bw_win);
+
+    if (rank == 0)
+        all_bw = calloc(nprocs * 2, sizeof(double));
+    MPI_Gather(bw, 2, MPI_DOUBLE, all_bw, 2, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        for (x = 0; x < nprocs; x++) {
+            printf("rank %d size %ld store_bw %.2f MB/s load_bw %.2f MB/s\n", x,
+                   (long) bw_size, all_bw[x * 2], all_bw[x * 2 + 1]);
+        }
+        free(all_bw);
+    }
+
+    /* Keep loads alive */
+    if (sum < 0)
+        printf("sum %f\n", sum);
+
+    MPI_Win_free(&bw_win);
+}
 
 int main(int argc, char *argv[])
 {
@@ -12,12 +71,16 @@ int main(int argc, char *argv[])
     char *winbuf = NULL;
     double t0, t, avgt;
     int size = 16, i, x;
+    size_t bw_size = 64 * 1024 * 1024;
     char *sbuf = NULL;
     MPI_Comm shm_comm = MPI_COMM_NULL;
 
     if (argc > 1) {
         size = atoi(argv[1]);
     }
+    if (argc > 2) {
+        bw_size = (size_t) atol(argv[2]);
+    }
 
     MPI_Init(&argc, &argv);
     MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
@@ -62,6 +125,9 @@ int main(int argc, char *argv[])
     }
 
     MPI_Win_free(&win);
+
+    measure_local_bw(rank, nprocs, bw_size);
+
     if (shm_comm)
         MPI_Comm_free(&shm_comm);
     free(sbuf);
@@ -0,0 +1,172 @@
+/*
+ * win_ialloc_overlap.c
+ *  <FILE_DESC>
+ *
+ *  This benchmark evaluates the overlap of window allocation with the
+ *  initialization of user processes by nonblocking allocation
+ *  (MPIX_Win_iallocate with Manticore).
+ *
+ *  Every process allocates NWIN windows then computes, which stands for the
+ *  initialization of the application. It reports the time of allocation alone,
+ *  computation alone, and both when the allocation is started before the
+ *  computation and completed after it. Without Manticore, windows are allocated
+ *  by blocking MPI_Win_allocate before the computation.
+ *
+ *  Usage: mtcore_win_ialloc_overlap [nh] [comp_size] [nwin]
+ *         win_ialloc_overlap [comp_size] [nwin]
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#define ITER 10
+#define MAX_NWIN 64
+
+#ifdef MTCORE
+extern int MTCORE_NUM_H;
+extern int MPIX_Win_iallocate(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm,
+                              void *baseptr, MPI_Win * win, MPI_Request * request);
+#endif
+
+int rank, nprocs;
+int COMP_SIZE = 1000000, NWIN = 4;
+double *winbufs[MAX_NWIN];
+MPI_Win wins[MAX_NWIN];
+MPI_Request reqs[MAX_NWIN];
+MPI_Info win_info = MPI_INFO_NULL;
+volatile double comp_result = 0.0;
+
+static void compute(int size)
+{
+    double c = comp_result;
+    int i;
+
+    for (i = 0; i < size; i++)
+        c = c * 0.999999 + 0.5;
+    comp_result = c;
+}
+
+static void start_alloc(void)
+{
+    int w;
+
+    for (w = 0; w < NWIN; w++) {
+#ifdef MTCORE
+        MPIX_Win_iallocate(sizeof(double), sizeof(double), win_info, MPI_COMM_WORLD,
+                           &winbufs[w], &wins[w], &reqs[w]);
+#else
+        MPI_Win_allocate(sizeof(double), sizeof(double), win_info, MPI_COMM_WORLD,
+                         &winbufs[w], &wins[w]);
+        reqs[w] = MPI_REQUEST_NULL;
+#endif
+    }
+}
+
+static void complete_alloc(void)
+{
+    int w;
+
+    MPI_Waitall(NWIN, reqs, MPI_STATUSES_IGNORE);
+    for (w = 0; w < NWIN; w++)
+        MPI_Win_free(&wins[w]);
+}
+
+static void run_test(void)
+{
+    int x;
+    double t0, t_alloc = 0.0, t_comp = 0.0, t_overlap = 0.0;
+    double t_alloc_max = 0.0, t_comp_max = 0.0, t_overlap_max = 0.0;
+
+    for (x = 0; x < ITER; x++) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        t0 = MPI_Wtime();
+        start_alloc();
+        MPI_Waitall(NWIN, reqs, MPI_STATUSES_IGNORE);
+        t_alloc += MPI_Wtime() - t0;
+        complete_alloc();
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        t0 = MPI_Wtime();
+        compute(COMP_SIZE);
+        t_comp += MPI_Wtime() - t0;
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        t0 = MPI_Wtime();
+        start_alloc();
+        compute(COMP_SIZE);
+        MPI_Waitall(NWIN, reqs, MPI_STATUSES_IGNORE);
+        t_overlap += MPI_Wtime() - t0;
+        complete_alloc();
+    }
+
+    t_alloc = t_alloc * 1000 * 1000 / ITER;     /*us */
+    t_comp = t_comp * 1000 * 1000 / ITER;
+    t_overlap = t_overlap * 1000 * 1000 / ITER;
+
+    MPI_Reduce(&t_alloc, &t_alloc_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&t_comp, &t_comp_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&t_overlap, &t_overlap_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+#ifdef MTCORE
+        fprintf(stdout, "mtcore: comp_size %d nwin %d nprocs %d nh %d alloc_time %.2lf "
+                "comp_time %.2lf overlap_time %.2lf\n", COMP_SIZE, NWIN, nprocs, MTCORE_NUM_H,
+                t_alloc_max, t_comp_max, t_overlap_max);
+#else
+        fprintf(stdout, "orig: comp_size %d nwin %d nprocs %d alloc_time %.2lf "
+                "comp_time %.2lf overlap_time %.2lf\n", COMP_SIZE, NWIN, nprocs,
+                t_alloc_max, t_comp_max, t_overlap_max);
+#endif
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int provided;
+
+    /* Nonblocking allocation is only overlapped with MPI_THREAD_MULTIPLE */
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+#ifdef MTCORE
+    /* first argv is nh */
+    if (argc >= 3)
+        COMP_SIZE = atoi(argv[2]);
+    if (argc >= 4)
+        NWIN = atoi(argv[3]);
+#else
+    if (argc >= 2)
+        COMP_SIZE = atoi(argv[1]);
+    if (argc >= 3)
+        NWIN = atoi(argv[2]);
+#endif
+
+    if (nprocs < 2) {
+        if (rank == 0)
+            fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+    if (NWIN <= 0 || NWIN > MAX_NWIN) {
+        if (rank == 0)
+            fprintf(stderr, "wrong nwin %d, must be in [1, %d]\n", NWIN, MAX_NWIN);
+        goto exit;
+    }
+
+    MPI_Info_create(&win_info);
+    MPI_Info_set(win_info, (char *) "epoch_type", (char *) "lockall");
+
+    run_test();
+
+  exit:
+    if (win_info != MPI_INFO_NULL)
+        MPI_Info_free(&win_info);
+
+    MPI_Finalize();
+
+    return 0;
+}
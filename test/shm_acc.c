@@ -0,0 +1,142 @@
+/*
+ * shm_acc.c
+ *  <FILE_DESC>
+ *
+ *  Check accumulates to same-node targets in exclusive lock epochs, which are
+ *  applied directly on shared memory, mixed with fetch_and_op and derived
+ *  datatype accumulates which are still issued to helpers.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#define NUM_OPS 10
+#define CHECK
+#define OUTPUT_FAIL_DETAIL
+
+/* winbuf layout:
+ *  [0]: SUM of double
+ *  [1]: MAX of double
+ *  [2]: REPLACE then SUM of double, ordered with fetch_and_op and derived datatype
+ *  [3]: BOR of int */
+#define WIN_SIZE 4
+
+double *winbuf = NULL;
+double locbuf[NUM_OPS];
+int rank, nprocs;
+MPI_Win win = MPI_WIN_NULL;
+int ITER = 20;
+
+static int check_val(const char *name, double val, double expected)
+{
+    if (val != expected) {
+        fprintf(stderr, "[%d] %s %.1lf != %.1lf\n", rank, name, val, expected);
+        return 1;
+    }
+    return 0;
+}
+
+static int run_test(void)
+{
+    int i, x, dst, errs = 0;
+    double one = 1.0, val = 0.0, result = 0.0;
+    int bits = 0;
+    MPI_Datatype derived_type;
+
+    MPI_Type_contiguous(1, MPI_DOUBLE, &derived_type);
+    MPI_Type_commit(&derived_type);
+
+    for (x = 0; x < ITER; x++) {
+        for (dst = 0; dst < nprocs; dst++) {
+            MPI_Win_lock(MPI_LOCK_EXCLUSIVE, dst, 0, win);
+            for (i = 0; i < NUM_OPS; i++) {
+                MPI_Accumulate(&locbuf[i], 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+            }
+
+            val = (double) (rank * ITER + x);
+            MPI_Accumulate(&val, 1, MPI_DOUBLE, dst, 1, 1, MPI_DOUBLE, MPI_MAX, win);
+
+            bits = 1 << rank;
+            MPI_Accumulate(&bits, 1, MPI_INT, dst, 3, 1, MPI_INT, MPI_BOR, win);
+            MPI_Win_unlock(dst, win);
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    /* Accumulates on the same location must be ordered: fetch_and_op and
+     * derived datatype are issued to helpers, the others are applied locally. */
+    if (rank == 0) {
+        for (dst = 0; dst < nprocs; dst++) {
+            MPI_Win_lock(MPI_LOCK_EXCLUSIVE, dst, 0, win);
+            val = 100.0;
+            MPI_Accumulate(&val, 1, MPI_DOUBLE, dst, 2, 1, MPI_DOUBLE, MPI_REPLACE, win);
+            MPI_Fetch_and_op(&one, &result, MPI_DOUBLE, dst, 2, MPI_SUM, win);
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, 2, 1, MPI_DOUBLE, MPI_SUM, win);
+            MPI_Accumulate(&one, 1, derived_type, dst, 2, 1, derived_type, MPI_SUM, win);
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, 2, 1, MPI_DOUBLE, MPI_SUM, win);
+            MPI_Win_unlock(dst, win);
+            errs += check_val("fetch", result, 100.0);
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, win);
+    errs += check_val("sum", winbuf[0], 1.0 * NUM_OPS * ITER * nprocs);
+    errs += check_val("max", winbuf[1], (double) ((nprocs - 1) * ITER + ITER - 1));
+    errs += check_val("ordered", winbuf[2], 104.0);
+    if (*(int *) &winbuf[3] != (1 << nprocs) - 1) {
+        fprintf(stderr, "[%d] bor 0x%x != 0x%x\n", rank, *(int *) &winbuf[3], (1 << nprocs) - 1);
+        errs++;
+    }
+    MPI_Win_unlock(rank, win);
+
+    MPI_Type_free(&derived_type);
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, errs = 0, errs_total = 0;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2 || nprocs > 16) {
+        fprintf(stderr, "Please run using 2 - 16 processes\n");
+        goto exit;
+    }
+
+    for (i = 0; i < NUM_OPS; i++) {
+        locbuf[i] = 1.0;
+    }
+
+    MPI_Win_allocate(sizeof(double) * WIN_SIZE, sizeof(double), MPI_INFO_NULL,
+                     MPI_COMM_WORLD, &winbuf, &win);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+    for (i = 0; i < WIN_SIZE; i++) {
+        winbuf[i] = 0.0;
+    }
+    MPI_Win_unlock(rank, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    errs = run_test();
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * thread_acc.c
+ *  <FILE_DESC>
+ *
+ *  Check concurrent lock/accumulate/unlock and lockall/accumulate/flush issued
+ *  by multiple threads of every process on the same window.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <mpi.h>
+
+#define NUM_THREADS 2
+#define NUM_OPS 10
+#define CHECK
+#define OUTPUT_FAIL_DETAIL
+
+double *winbuf = NULL;
+double locbuf[NUM_OPS];
+int rank, nprocs;
+MPI_Win win = MPI_WIN_NULL;
+int ITER = 100;
+
+/* Every thread locks a different target, because a process cannot lock the
+ * same target concurrently. */
+static void *lock_acc_fn(void *arg)
+{
+    int tid = *(int *) arg;
+    int i, x;
+    int dst = (rank + tid + 1) % nprocs;
+
+    for (x = 0; x < ITER; x++) {
+        MPI_Win_lock(MPI_LOCK_SHARED, dst, 0, win);
+        for (i = 0; i < NUM_OPS; i++) {
+            MPI_Accumulate(&locbuf[i], 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+        }
+        MPI_Win_unlock(dst, win);
+    }
+
+    return NULL;
+}
+
+static void *lockall_acc_fn(void *arg)
+{
+    int i, x, dst;
+
+    for (x = 0; x < ITER; x++) {
+        for (dst = 0; dst < nprocs; dst++) {
+            for (i = 0; i < NUM_OPS; i++) {
+                MPI_Accumulate(&locbuf[i], 1, MPI_DOUBLE, dst, 1, 1, MPI_DOUBLE, MPI_SUM, win);
+            }
+            MPI_Win_flush(dst, win);
+        }
+    }
+
+    return NULL;
+}
+
+static int check_data(int off, double expected)
+{
+    int errs = 0;
+
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, win);
+    if (winbuf[off] != expected) {
+        fprintf(stderr, "[%d]winbuf[%d] %.1lf != %.1lf\n", rank, off, winbuf[off], expected);
+        errs++;
+    }
+    MPI_Win_unlock(rank, win);
+
+    return errs;
+}
+
+static int run_test(void)
+{
+    int t, errs = 0, errs_total = 0;
+    pthread_t threads[NUM_THREADS];
+    int tids[NUM_THREADS];
+
+    /* concurrent lock epochs */
+    for (t = 0; t < NUM_THREADS; t++) {
+        tids[t] = t;
+        pthread_create(&threads[t], NULL, lock_acc_fn, &tids[t]);
+    }
+    for (t = 0; t < NUM_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    errs += check_data(0, 1.0 * NUM_OPS * ITER * NUM_THREADS);
+
+    /* concurrent operations and flushes in a single lockall epoch */
+    MPI_Win_lock_all(0, win);
+    for (t = 0; t < NUM_THREADS; t++) {
+        pthread_create(&threads[t], NULL, lockall_acc_fn, NULL);
+    }
+    for (t = 0; t < NUM_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    MPI_Win_unlock_all(win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    errs += check_data(1, 1.0 * NUM_OPS * ITER * NUM_THREADS * nprocs);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+    return errs_total;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, errs = 0;
+    int provided = 0;
+
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (provided != MPI_THREAD_MULTIPLE) {
+        if (rank == 0)
+            fprintf(stderr, "This test requires MPI_THREAD_MULTIPLE, but %d\n", provided);
+        goto exit;
+    }
+
+    if (nprocs < NUM_THREADS + 1) {
+        fprintf(stderr, "Please run using at least %d processes\n", NUM_THREADS + 1);
+        goto exit;
+    }
+
+    for (i = 0; i < NUM_OPS; i++) {
+        locbuf[i] = 1.0;
+    }
+
+    /* size in byte */
+    MPI_Win_allocate(sizeof(double) * 2, sizeof(double), MPI_INFO_NULL,
+                     MPI_COMM_WORLD, &winbuf, &win);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+    winbuf[0] = 0.0;
+    winbuf[1] = 0.0;
+    MPI_Win_unlock(rank, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    errs = run_test();
+
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs);
+    }
+
+  exit:
+
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * thread_ep.c
+ *  <FILE_DESC>
+ *
+ *  Check windows with per-thread endpoints (info num_thread_endpoints).
+ *  Threads of every process accumulate to all processes, and only the main
+ *  thread flushes, thus operations issued on the endpoints of other threads
+ *  must be completed by that flush as well. Lock epochs are also checked on
+ *  a window asking for endpoints.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <mpi.h>
+
+#define NUM_THREADS 4
+#define NUM_OPS 10
+#define ITER 10
+
+int rank, nprocs;
+double locbuf[NUM_OPS];
+
+static void *lockall_acc_fn(void *arg)
+{
+    MPI_Win win = *(MPI_Win *) arg;
+    int i, dst;
+
+    for (dst = 0; dst < nprocs; dst++) {
+        for (i = 0; i < NUM_OPS; i++) {
+            MPI_Accumulate(&locbuf[i], 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+        }
+    }
+
+    return NULL;
+}
+
+static int run_threads(MPI_Win win)
+{
+    int t;
+    pthread_t threads[NUM_THREADS];
+
+    for (t = 0; t < NUM_THREADS; t++) {
+        pthread_create(&threads[t], NULL, lockall_acc_fn, &win);
+    }
+    for (t = 0; t < NUM_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    return 0;
+}
+
+static int check_data(const char *name, MPI_Win win, double *winbuf, double expected)
+{
+    int errs = 0;
+
+    MPI_Win_sync(win);
+    if (winbuf[0] != expected) {
+        fprintf(stderr, "[%d] %s: winbuf %.1lf != %.1lf\n", rank, name, winbuf[0], expected);
+        errs++;
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    return errs;
+}
+
+static int run_lockall_test(MPI_Win win, double *winbuf)
+{
+    int x, dst, errs = 0;
+    double expected = 0.0;
+
+    MPI_Win_lock_all(0, win);
+    winbuf[0] = 0.0;
+    MPI_Win_sync(win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    for (x = 0; x < ITER; x++) {
+        /* flush_all from the main thread */
+        run_threads(win);
+        MPI_Win_flush_all(win);
+        MPI_Barrier(MPI_COMM_WORLD);
+
+        expected += 1.0 * NUM_OPS * NUM_THREADS * nprocs;
+        errs += check_data("flush_all", win, winbuf, expected);
+
+        /* flush from the main thread */
+        run_threads(win);
+        for (dst = 0; dst < nprocs; dst++)
+            MPI_Win_flush(dst, win);
+        MPI_Barrier(MPI_COMM_WORLD);
+
+        expected += 1.0 * NUM_OPS * NUM_THREADS * nprocs;
+        errs += check_data("flush", win, winbuf, expected);
+    }
+    MPI_Win_unlock_all(win);
+
+    return errs;
+}
+
+static int run_lock_test(MPI_Win win, double *winbuf)
+{
+    int x, dst, errs = 0;
+
+    for (x = 0; x < ITER; x++) {
+        for (dst = 0; dst < nprocs; dst++) {
+            MPI_Win_lock(MPI_LOCK_SHARED, dst, 0, win);
+            MPI_Accumulate(&locbuf[0], 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+            MPI_Win_unlock(dst, win);
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, win);
+    if (winbuf[0] != 1.0 * ITER * nprocs) {
+        fprintf(stderr, "[%d] lock: winbuf %.1lf != %.1lf\n", rank, winbuf[0],
+                1.0 * ITER * nprocs);
+        errs++;
+    }
+    MPI_Win_unlock(rank, win);
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, errs = 0, errs_total = 0;
+    int provided = 0;
+    double *winbuf = NULL, *lock_winbuf = NULL;
+    MPI_Win win = MPI_WIN_NULL, lock_win = MPI_WIN_NULL;
+    MPI_Info info = MPI_INFO_NULL;
+    char num_eps[16];
+
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (provided != MPI_THREAD_MULTIPLE) {
+        if (rank == 0)
+            fprintf(stderr, "This test requires MPI_THREAD_MULTIPLE, but %d\n", provided);
+        goto exit;
+    }
+
+    for (i = 0; i < NUM_OPS; i++) {
+        locbuf[i] = 1.0;
+    }
+
+    snprintf(num_eps, sizeof(num_eps), "%d", NUM_THREADS);
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "num_thread_endpoints", num_eps);
+    MPI_Info_set(info, "epoch_type", "lockall");
+    MPI_Win_allocate(sizeof(double), sizeof(double), info, MPI_COMM_WORLD, &winbuf, &win);
+    MPI_Info_set(info, "epoch_type", "lock|lockall");
+    MPI_Win_allocate(sizeof(double), sizeof(double), info, MPI_COMM_WORLD, &lock_winbuf,
+                     &lock_win);
+    MPI_Info_free(&info);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, lock_win);
+    lock_winbuf[0] = 0.0;
+    MPI_Win_unlock(rank, lock_win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    errs += run_lockall_test(win, winbuf);
+    errs += run_lock_test(lock_win, lock_winbuf);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+    if (lock_win != MPI_WIN_NULL)
+        MPI_Win_free(&lock_win);
+
+    MPI_Finalize();
+
+    return 0;
+}
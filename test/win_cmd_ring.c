@@ -0,0 +1,96 @@
+/*
+ * win_cmd_ring.c
+ *  <FILE_DESC>
+ *
+ *  Check windows allocated concurrently on disjoint communicators, whose root
+ *  processes start helper functions at the same time (through the command
+ *  ring with Manticore). Processes are split into even and odd ranks, every
+ *  communicator allocates and frees windows repeatedly without synchronizing
+ *  with the other one. Every process accumulates to all the others in its
+ *  communicator on each window and checks its local buffer.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define NUM_OPS 8
+#define ITER 16
+
+int rank, nprocs;
+
+static int alloc_check_free(MPI_Comm comm)
+{
+    int i, dst, errs = 0, comm_rank, comm_nprocs;
+    double one = 1.0, *winbuf = NULL;
+    MPI_Win win = MPI_WIN_NULL;
+
+    MPI_Comm_rank(comm, &comm_rank);
+    MPI_Comm_size(comm, &comm_nprocs);
+
+    MPI_Win_allocate(sizeof(double) * NUM_OPS, sizeof(double), MPI_INFO_NULL, comm,
+                     &winbuf, &win);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, comm_rank, 0, win);
+    for (i = 0; i < NUM_OPS; i++)
+        winbuf[i] = 0.0;
+    MPI_Win_unlock(comm_rank, win);
+    MPI_Barrier(comm);
+
+    MPI_Win_lock_all(0, win);
+    for (dst = 0; dst < comm_nprocs; dst++) {
+        for (i = 0; i < NUM_OPS; i++)
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, i, 1, MPI_DOUBLE, MPI_SUM, win);
+    }
+    MPI_Win_unlock_all(win);
+    MPI_Barrier(comm);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, comm_rank, 0, win);
+    for (i = 0; i < NUM_OPS; i++) {
+        if (winbuf[i] != (double) comm_nprocs) {
+            fprintf(stderr, "[%d] winbuf[%d] %.1lf != %.1lf\n", rank, i, winbuf[i],
+                    (double) comm_nprocs);
+            errs++;
+        }
+    }
+    MPI_Win_unlock(comm_rank, win);
+
+    MPI_Win_free(&win);
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int x, errs = 0, errs_total = 0;
+    MPI_Comm half_comm = MPI_COMM_NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 4) {
+        fprintf(stderr, "Please run using at least 4 processes\n");
+        goto exit;
+    }
+
+    MPI_Comm_split(MPI_COMM_WORLD, rank % 2, rank, &half_comm);
+
+    for (x = 0; x < ITER; x++)
+        errs += alloc_check_free(half_comm);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    if (half_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&half_comm);
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * win_comm_cache.c
+ *  <FILE_DESC>
+ *
+ *  Check windows allocated repeatedly on communicators with the same group,
+ *  whose internal communicators are reused with Manticore. Windows are
+ *  allocated on a communicator with reversed ranks, on its duplicate and on a
+ *  communicator with a different group in turn, and again after some of the
+ *  user communicators are freed. Every process accumulates to all the others on
+ *  each window and checks its local buffer.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define NUM_OPS 8
+#define ITER 4
+
+int rank, nprocs;
+
+static int check_win(MPI_Win win, double *winbuf, MPI_Comm comm)
+{
+    int i, dst, errs = 0, comm_rank, comm_nprocs;
+    double one = 1.0;
+
+    MPI_Comm_rank(comm, &comm_rank);
+    MPI_Comm_size(comm, &comm_nprocs);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, comm_rank, 0, win);
+    for (i = 0; i < NUM_OPS; i++)
+        winbuf[i] = 0.0;
+    MPI_Win_unlock(comm_rank, win);
+    MPI_Barrier(comm);
+
+    MPI_Win_lock_all(0, win);
+    for (dst = 0; dst < comm_nprocs; dst++) {
+        for (i = 0; i < NUM_OPS; i++)
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, i, 1, MPI_DOUBLE, MPI_SUM, win);
+    }
+    MPI_Win_unlock_all(win);
+    MPI_Barrier(comm);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, comm_rank, 0, win);
+    for (i = 0; i < NUM_OPS; i++) {
+        if (winbuf[i] != (double) comm_nprocs) {
+            fprintf(stderr, "[%d] winbuf[%d] %.1lf != %.1lf\n", rank, i, winbuf[i],
+                    (double) comm_nprocs);
+            errs++;
+        }
+    }
+    MPI_Win_unlock(comm_rank, win);
+
+    return errs;
+}
+
+static int alloc_check_free(MPI_Comm comm)
+{
+    int errs = 0;
+    double *winbuf = NULL;
+    MPI_Win win = MPI_WIN_NULL;
+
+    MPI_Win_allocate(sizeof(double) * NUM_OPS, sizeof(double), MPI_INFO_NULL, comm,
+                     &winbuf, &win);
+    errs += check_win(win, winbuf, comm);
+    MPI_Win_free(&win);
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int x, errs = 0, errs_total = 0;
+    MPI_Comm rev_comm = MPI_COMM_NULL, dup_comm = MPI_COMM_NULL, sub_comm = MPI_COMM_NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    MPI_Comm_split(MPI_COMM_WORLD, 0, nprocs - rank, &rev_comm);
+    /* A communicator with a different group, excluding the last process
+     * (only with more than 2 processes, single process window is not checked) */
+    MPI_Comm_split(MPI_COMM_WORLD, (nprocs > 2 && rank < nprocs - 1) ? 0 : MPI_UNDEFINED, rank,
+                   &sub_comm);
+
+    /* Allocate repeatedly on the same communicator */
+    for (x = 0; x < ITER; x++)
+        errs += alloc_check_free(rev_comm);
+
+    /* Allocate on congruent and different communicators in turn */
+    MPI_Comm_dup(rev_comm, &dup_comm);
+    for (x = 0; x < ITER; x++) {
+        errs += alloc_check_free(dup_comm);
+        if (sub_comm != MPI_COMM_NULL)
+            errs += alloc_check_free(sub_comm);
+        MPI_Barrier(MPI_COMM_WORLD);
+        errs += alloc_check_free(rev_comm);
+    }
+
+    /* Cached communicators are still used after one of the congruent user
+     * communicators is freed, and are released with the last one. */
+    MPI_Comm_free(&dup_comm);
+    errs += alloc_check_free(rev_comm);
+    MPI_Comm_free(&rev_comm);
+    MPI_Comm_split(MPI_COMM_WORLD, 0, nprocs - rank, &rev_comm);
+    errs += alloc_check_free(rev_comm);
+
+    if (sub_comm != MPI_COMM_NULL)
+        errs += alloc_check_free(sub_comm);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    if (rev_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&rev_comm);
+    if (dup_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&dup_comm);
+    if (sub_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&sub_comm);
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * win_credit.c
+ *  <FILE_DESC>
+ *
+ *  Check injection flow control with small helper credits
+ *  (MTCORE_H_CREDIT_OPS, MTCORE_H_CREDIT_BYTES). All processes issue many
+ *  puts and accumulates to rank 0 in lock, lock_all and fence epochs, thus
+ *  credits run out in every epoch and helpers are flushed or operations are
+ *  redirected to other helpers.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define NUM_OPS 64
+#define ITER 4
+
+int rank, nprocs;
+
+static int check_result(const char *name, int x, double *winbuf)
+{
+    int i, p, errs = 0;
+
+    for (p = 0; p < nprocs; p++) {
+        for (i = 0; i < NUM_OPS; i++) {
+            double expected = (double) (p * NUM_OPS + i + x);
+            if (winbuf[p * NUM_OPS + i] != expected) {
+                fprintf(stderr, "[%d] iter %d %s put [%d] %.1lf != %.1lf\n", rank, x, name,
+                        p * NUM_OPS + i, winbuf[p * NUM_OPS + i], expected);
+                errs++;
+            }
+        }
+    }
+    for (i = 0; i < NUM_OPS; i++) {
+        double expected = (double) (nprocs * 2);
+        if (winbuf[nprocs * NUM_OPS + i] != expected) {
+            fprintf(stderr, "[%d] iter %d %s acc [%d] %.1lf != %.1lf\n", rank, x, name, i,
+                    winbuf[nprocs * NUM_OPS + i], expected);
+            errs++;
+        }
+    }
+    return errs;
+}
+
+static void reset_win(MPI_Win win, double *winbuf)
+{
+    int i;
+
+    if (rank == 0) {
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, win);
+        for (i = 0; i < (nprocs + 1) * NUM_OPS; i++)
+            winbuf[i] = 0.0;
+        MPI_Win_unlock(0, win);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+/* Put my slots to rank 0 one by one and add twice to the shared slots. */
+static void issue_ops(MPI_Win win, double *locbuf)
+{
+    int i;
+    double one = 1.0;
+
+    for (i = 0; i < NUM_OPS; i++)
+        MPI_Put(&locbuf[i], 1, MPI_DOUBLE, 0, rank * NUM_OPS + i, 1, MPI_DOUBLE, win);
+    for (i = 0; i < NUM_OPS; i++) {
+        MPI_Accumulate(&one, 1, MPI_DOUBLE, 0, nprocs * NUM_OPS + i, 1, MPI_DOUBLE, MPI_SUM, win);
+        MPI_Accumulate(&one, 1, MPI_DOUBLE, 0, nprocs * NUM_OPS + i, 1, MPI_DOUBLE, MPI_SUM, win);
+    }
+}
+
+static int run_test(MPI_Win win, double *winbuf, int x)
+{
+    int i, errs = 0;
+    double locbuf[NUM_OPS];
+
+    for (i = 0; i < NUM_OPS; i++)
+        locbuf[i] = (double) (rank * NUM_OPS + i + x);
+
+    /* lock */
+    reset_win(win, winbuf);
+    MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
+    issue_ops(win, locbuf);
+    MPI_Win_unlock(0, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 0) {
+        MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
+        errs += check_result("lock", x, winbuf);
+        MPI_Win_unlock(0, win);
+    }
+
+    /* lock_all with nocheck, puts can be redirected */
+    reset_win(win, winbuf);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+    issue_ops(win, locbuf);
+    MPI_Win_unlock_all(win);
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 0) {
+        MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, win);
+        errs += check_result("lockall", x, winbuf);
+        MPI_Win_unlock(0, win);
+    }
+
+    /* fence */
+    MPI_Win_fence(0, win);
+    if (rank == 0) {
+        for (i = 0; i < (nprocs + 1) * NUM_OPS; i++)
+            winbuf[i] = 0.0;
+    }
+    MPI_Win_fence(0, win);
+    issue_ops(win, locbuf);
+    MPI_Win_fence(0, win);
+    if (rank == 0)
+        errs += check_result("fence", x, winbuf);
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int x, errs = 0, errs_total = 0;
+    double *winbuf = NULL;
+    MPI_Win win = MPI_WIN_NULL;
+    MPI_Info info = MPI_INFO_NULL;
+
+    /* Small credits unless set by user. */
+    setenv("MTCORE_H_CREDIT_OPS", "4", 0);
+    setenv("MTCORE_H_CREDIT_BYTES", "64", 0);
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "epoch_type", "lock|lockall|fence");
+    MPI_Win_allocate(sizeof(double) * (nprocs + 1) * NUM_OPS, sizeof(double), info,
+                     MPI_COMM_WORLD, &winbuf, &win);
+    MPI_Info_free(&info);
+
+    for (x = 0; x < ITER; x++)
+        errs += run_test(win, winbuf, x);
+
+    MPI_Win_free(&win);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    MPI_Finalize();
+
+    return 0;
+}
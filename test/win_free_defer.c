@@ -0,0 +1,120 @@
+/*
+ * win_free_defer.c
+ *  <FILE_DESC>
+ *
+ *  Check windows whose internal resources are released in background after
+ *  MPI_Win_free (MTCORE_WIN_FREE_DEFER=on with MPI_THREAD_MULTIPLE). Windows
+ *  with different epoch types and transports are allocated, accumulated to by
+ *  every process and freed back to back, thus multiple releases are in flight
+ *  when the next window is allocated. Windows on a duplicated communicator are
+ *  freed together with the communicator right after MPI_Win_free.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define NUM_OPS 8
+#define ITER 4
+#define NUM_KINDS 3
+
+int rank, nprocs;
+
+static const char *epoch_types[NUM_KINDS] = { "lockall", "lockall|fence", "lockall" };
+static const char *rma_transports[NUM_KINDS] = { "rma", "rma", "am" };
+
+static int check_win(MPI_Win win, double *winbuf, MPI_Comm comm)
+{
+    int i, dst, errs = 0, comm_rank, comm_nprocs;
+    double one = 1.0;
+
+    MPI_Comm_rank(comm, &comm_rank);
+    MPI_Comm_size(comm, &comm_nprocs);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, comm_rank, 0, win);
+    for (i = 0; i < NUM_OPS; i++)
+        winbuf[i] = 0.0;
+    MPI_Win_unlock(comm_rank, win);
+    MPI_Barrier(comm);
+
+    MPI_Win_lock_all(0, win);
+    for (dst = 0; dst < comm_nprocs; dst++) {
+        for (i = 0; i < NUM_OPS; i++)
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, i, 1, MPI_DOUBLE, MPI_SUM, win);
+    }
+    MPI_Win_unlock_all(win);
+    MPI_Barrier(comm);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, comm_rank, 0, win);
+    for (i = 0; i < NUM_OPS; i++) {
+        if (winbuf[i] != (double) comm_nprocs) {
+            fprintf(stderr, "[%d] winbuf[%d] %.1lf != %.1lf\n", rank, i, winbuf[i],
+                    (double) comm_nprocs);
+            errs++;
+        }
+    }
+    MPI_Win_unlock(comm_rank, win);
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int x, k, provided = 0, errs = 0, errs_total = 0;
+    double *winbufs[NUM_KINDS];
+    MPI_Win wins[NUM_KINDS];
+    MPI_Info infos[NUM_KINDS];
+    MPI_Comm dup_comm = MPI_COMM_NULL;
+
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+    if (provided != MPI_THREAD_MULTIPLE && rank == 0) {
+        fprintf(stderr, "MPI_THREAD_MULTIPLE is not provided, windows are released "
+                "in MPI_Win_free\n");
+    }
+
+    for (k = 0; k < NUM_KINDS; k++) {
+        MPI_Info_create(&infos[k]);
+        MPI_Info_set(infos[k], (char *) "epoch_type", (char *) epoch_types[k]);
+        MPI_Info_set(infos[k], (char *) "rma_transport", (char *) rma_transports[k]);
+    }
+
+    for (x = 0; x < ITER; x++) {
+        for (k = 0; k < NUM_KINDS; k++) {
+            MPI_Win_allocate(sizeof(double) * NUM_OPS, sizeof(double), infos[k],
+                             MPI_COMM_WORLD, &winbufs[k], &wins[k]);
+            errs += check_win(wins[k], winbufs[k], MPI_COMM_WORLD);
+        }
+        for (k = 0; k < NUM_KINDS; k++)
+            MPI_Win_free(&wins[k]);
+
+        /* The user communicator is not referred by the release. */
+        MPI_Comm_dup(MPI_COMM_WORLD, &dup_comm);
+        MPI_Win_allocate(sizeof(double) * NUM_OPS, sizeof(double), infos[x % NUM_KINDS],
+                         dup_comm, &winbufs[0], &wins[0]);
+        errs += check_win(wins[0], winbufs[0], dup_comm);
+        MPI_Win_free(&wins[0]);
+        MPI_Comm_free(&dup_comm);
+    }
+
+    for (k = 0; k < NUM_KINDS; k++)
+        MPI_Info_free(&infos[k]);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * win_helper_subset.c
+ *  <FILE_DESC>
+ *
+ *  Check windows using a subset of helpers (info num_helpers and helpers).
+ *  A latency window on one helper and two data windows on different helper
+ *  selections are allocated together, and every window is accumulated to and
+ *  checked through lock, lock_all and fence epochs while the others are in
+ *  use. Selections beyond the number of helpers fall back to all helpers.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define NUM_OPS 16
+#define ITER 4
+#define NUM_WINS 3
+
+int rank, nprocs;
+
+static const char *info_keys[NUM_WINS] = { "num_helpers", "helpers", "helpers" };
+static const char *info_vals[NUM_WINS] = { "1", "1,0", "2,1" };
+
+static int check_result(const char *name, double *winbuf, double expected)
+{
+    int i, errs = 0;
+
+    for (i = 0; i < NUM_OPS; i++) {
+        if (winbuf[i] != expected) {
+            fprintf(stderr, "[%d] %s winbuf[%d] %.1lf != %.1lf\n", rank, name, i, winbuf[i],
+                    expected);
+            errs++;
+        }
+    }
+    return errs;
+}
+
+static void reset_win(MPI_Win win, double *winbuf)
+{
+    int i;
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+    for (i = 0; i < NUM_OPS; i++)
+        winbuf[i] = 0.0;
+    MPI_Win_unlock(rank, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+static int run_test(MPI_Win win, double *winbuf, const char *name)
+{
+    int i, dst, errs = 0;
+    double one = 1.0;
+
+    /* lock epochs, flush before unlock */
+    reset_win(win, winbuf);
+    for (dst = 0; dst < nprocs; dst++) {
+        MPI_Win_lock(MPI_LOCK_SHARED, dst, 0, win);
+        for (i = 0; i < NUM_OPS; i++)
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, i, 1, MPI_DOUBLE, MPI_SUM, win);
+        MPI_Win_flush(dst, win);
+        MPI_Win_unlock(dst, win);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, win);
+    errs += check_result(name, winbuf, (double) nprocs);
+    MPI_Win_unlock(rank, win);
+
+    /* lock_all epoch */
+    reset_win(win, winbuf);
+    MPI_Win_lock_all(0, win);
+    for (dst = 0; dst < nprocs; dst++) {
+        for (i = 0; i < NUM_OPS; i++)
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, i, 1, MPI_DOUBLE, MPI_SUM, win);
+    }
+    MPI_Win_flush_all(win);
+    MPI_Win_unlock_all(win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, win);
+    errs += check_result(name, winbuf, (double) nprocs);
+    MPI_Win_unlock(rank, win);
+
+    /* fence epochs */
+    MPI_Win_fence(0, win);
+    for (i = 0; i < NUM_OPS; i++)
+        winbuf[i] = 0.0;
+    MPI_Win_fence(0, win);
+    for (dst = 0; dst < nprocs; dst++) {
+        for (i = 0; i < NUM_OPS; i++)
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, i, 1, MPI_DOUBLE, MPI_SUM, win);
+    }
+    MPI_Win_fence(0, win);
+    errs += check_result(name, winbuf, (double) nprocs);
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int x, k, errs = 0, errs_total = 0;
+    double *winbufs[NUM_WINS];
+    MPI_Win wins[NUM_WINS];
+    MPI_Info info = MPI_INFO_NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    for (k = 0; k < NUM_WINS; k++) {
+        MPI_Info_create(&info);
+        MPI_Info_set(info, "epoch_type", "lock|lockall|fence");
+        MPI_Info_set(info, (char *) info_keys[k], (char *) info_vals[k]);
+        MPI_Win_allocate(sizeof(double) * NUM_OPS, sizeof(double), info, MPI_COMM_WORLD,
+                         &winbufs[k], &wins[k]);
+        MPI_Info_free(&info);
+    }
+
+    for (x = 0; x < ITER; x++) {
+        for (k = 0; k < NUM_WINS; k++)
+            errs += run_test(wins[k], winbufs[k], info_vals[k]);
+    }
+
+    for (k = 0; k < NUM_WINS; k++)
+        MPI_Win_free(&wins[k]);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    MPI_Finalize();
+
+    return 0;
+}
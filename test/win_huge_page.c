@@ -0,0 +1,90 @@
+/*
+ * win_huge_page.c
+ *  <FILE_DESC>
+ *
+ *  Check a window whose node shared segment is backed by huge pages
+ *  (info huge_page=hugetlb, falls back to transparent huge pages if hugetlbfs
+ *  pages are unavailable). Every process accumulates to all the others at
+ *  scattered displacements spanning multiple huge pages, and checks its local
+ *  buffer by load.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#define WIN_SIZE (1024 * 1024)  /* doubles, 8 MB per process */
+#define NUM_OPS 64
+#define STRIDE (WIN_SIZE / NUM_OPS)
+
+double *winbuf = NULL;
+int rank, nprocs;
+MPI_Win win = MPI_WIN_NULL;
+
+int main(int argc, char *argv[])
+{
+    int i, dst, errs = 0, errs_total = 0;
+    double one = 1.0;
+    MPI_Info win_info = MPI_INFO_NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    MPI_Info_create(&win_info);
+    MPI_Info_set(win_info, (char *) "huge_page", (char *) "hugetlb");
+
+    MPI_Win_allocate(sizeof(double) * WIN_SIZE, sizeof(double), win_info,
+                     MPI_COMM_WORLD, &winbuf, &win);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+    for (i = 0; i < WIN_SIZE; i++)
+        winbuf[i] = 0.0;
+    MPI_Win_unlock(rank, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock_all(0, win);
+    for (dst = 0; dst < nprocs; dst++) {
+        for (i = 0; i < NUM_OPS; i++) {
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, i * STRIDE + rank, 1, MPI_DOUBLE,
+                           MPI_SUM, win);
+        }
+    }
+    MPI_Win_unlock_all(win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, win);
+    for (i = 0; i < NUM_OPS; i++) {
+        for (dst = 0; dst < nprocs; dst++) {
+            if (winbuf[i * STRIDE + dst] != one) {
+                fprintf(stderr, "[%d] winbuf[%d] %.1lf != %.1lf\n", rank, i * STRIDE + dst,
+                        winbuf[i * STRIDE + dst], one);
+                errs++;
+            }
+        }
+    }
+    MPI_Win_unlock(rank, win);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    if (win_info != MPI_INFO_NULL)
+        MPI_Info_free(&win_info);
+    if (win != MPI_WIN_NULL)
+        MPI_Win_free(&win);
+
+    MPI_Finalize();
+
+    return 0;
+}
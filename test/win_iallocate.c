@@ -0,0 +1,129 @@
+/*
+ * win_iallocate.c
+ *  <FILE_DESC>
+ *
+ *  Check nonblocking window allocation (MPIX_Win_iallocate). Every process
+ *  starts the allocation of two windows, one on the world communicator and one
+ *  on a communicator with reversed ranks, then performs its own collective
+ *  before waiting for both. Every process accumulates to all the others on
+ *  both windows and checks its local buffers. It is also checked that a
+ *  blocking allocation can be issued with nonblocking allocations in flight.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <mpi.h>
+
+#define NUM_OPS 8
+#define NUM_WINS 3
+
+extern int MPIX_Win_iallocate(MPI_Aint size, int disp_unit, MPI_Info info, MPI_Comm comm,
+                              void *baseptr, MPI_Win * win, MPI_Request * request);
+
+double *winbufs[NUM_WINS];
+MPI_Win wins[NUM_WINS];
+int rank, nprocs;
+
+static int check_win(int w, MPI_Comm comm)
+{
+    int i, dst, errs = 0, comm_rank, comm_nprocs;
+    double one = 1.0;
+
+    MPI_Comm_rank(comm, &comm_rank);
+    MPI_Comm_size(comm, &comm_nprocs);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, comm_rank, 0, wins[w]);
+    for (i = 0; i < NUM_OPS; i++)
+        winbufs[w][i] = 0.0;
+    MPI_Win_unlock(comm_rank, wins[w]);
+    MPI_Barrier(comm);
+
+    MPI_Win_lock_all(0, wins[w]);
+    for (dst = 0; dst < comm_nprocs; dst++) {
+        for (i = 0; i < NUM_OPS; i++)
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, i, 1, MPI_DOUBLE, MPI_SUM, wins[w]);
+    }
+    MPI_Win_unlock_all(wins[w]);
+    MPI_Barrier(comm);
+
+    MPI_Win_lock(MPI_LOCK_SHARED, comm_rank, 0, wins[w]);
+    for (i = 0; i < NUM_OPS; i++) {
+        if (winbufs[w][i] != (double) comm_nprocs) {
+            fprintf(stderr, "[%d] win %d winbuf[%d] %.1lf != %.1lf\n", rank, w, i,
+                    winbufs[w][i], (double) comm_nprocs);
+            errs++;
+        }
+    }
+    MPI_Win_unlock(comm_rank, wins[w]);
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, provided, sum = 0, errs = 0, errs_total = 0;
+    MPI_Comm rev_comm = MPI_COMM_NULL;
+    MPI_Request reqs[2];
+    MPI_Info win_info = MPI_INFO_NULL;
+
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    for (i = 0; i < NUM_WINS; i++)
+        wins[i] = MPI_WIN_NULL;
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    MPI_Comm_split(MPI_COMM_WORLD, 0, nprocs - rank, &rev_comm);
+
+    MPI_Info_create(&win_info);
+    MPI_Info_set(win_info, (char *) "epoch_type", (char *) "lock|lockall");
+
+    MPIX_Win_iallocate(sizeof(double) * NUM_OPS, sizeof(double), win_info, MPI_COMM_WORLD,
+                       &winbufs[0], &wins[0], &reqs[0]);
+    MPIX_Win_iallocate(sizeof(double) * NUM_OPS, sizeof(double), win_info, rev_comm,
+                       &winbufs[1], &wins[1], &reqs[1]);
+
+    /* The info and communicator can be used or freed by the user while the
+     * allocations are in flight. */
+    MPI_Info_free(&win_info);
+    MPI_Allreduce(&rank, &sum, 1, MPI_INT, MPI_SUM, rev_comm);
+    if (sum != nprocs * (nprocs - 1) / 2) {
+        fprintf(stderr, "[%d] allreduce %d != %d\n", rank, sum, nprocs * (nprocs - 1) / 2);
+        errs++;
+    }
+
+    /* Blocking allocation waits for the ones in flight */
+    MPI_Win_allocate(sizeof(double) * NUM_OPS, sizeof(double), MPI_INFO_NULL, MPI_COMM_WORLD,
+                     &winbufs[2], &wins[2]);
+
+    MPI_Waitall(2, reqs, MPI_STATUSES_IGNORE);
+
+    errs += check_win(0, MPI_COMM_WORLD);
+    errs += check_win(1, rev_comm);
+    errs += check_win(2, MPI_COMM_WORLD);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    for (i = 0; i < NUM_WINS; i++) {
+        if (wins[i] != MPI_WIN_NULL)
+            MPI_Win_free(&wins[i]);
+    }
+    if (rev_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&rev_comm);
+
+    MPI_Finalize();
+
+    return 0;
+}
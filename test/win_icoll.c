@@ -0,0 +1,192 @@
+/*
+ * win_icoll.c
+ *  <FILE_DESC>
+ *
+ *  Check window collectives progressed by helpers (MPIX_Win_iallreduce and
+ *  MPIX_Win_ibcast with MTCORE_COLL_OFFLOAD=on). Every iteration starts an
+ *  allreduce with MPI_SUM, an allreduce with MPI_MAX and a broadcast from a
+ *  different root on separate regions of the window, completes them together
+ *  by waitall or by test loop, and checks the results. The same is done on a
+ *  window of all processes except rank 0 (if at least 3 processes), and with
+ *  a datatype that is not offloaded. Finally, a broadcast out of the window
+ *  of only one process must fail on all processes instead of hanging.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define COUNT (16 * 1024)
+#define ITER 10
+
+extern int MPIX_Win_iallreduce(MPI_Aint target_disp, int count, MPI_Datatype datatype,
+                               MPI_Op op, MPI_Win win, MPI_Request * request);
+extern int MPIX_Win_ibcast(MPI_Aint target_disp, int count, MPI_Datatype datatype, int root,
+                           MPI_Win win, MPI_Request * request);
+
+int rank, nprocs;
+
+/* winbuf layout:
+ *  [0 : COUNT]: allreduce with MPI_SUM
+ *  [COUNT : 2 * COUNT]: allreduce with MPI_MAX
+ *  [2 * COUNT : 3 * COUNT]: broadcast */
+#define SUM_OFF 0
+#define MAX_OFF COUNT
+#define BCAST_OFF (2 * COUNT)
+#define WIN_SIZE (3 * COUNT)
+
+static int check_val(const char *name, int x, int i, double val, double expected)
+{
+    if (val != expected) {
+        fprintf(stderr, "[%d] iter %d %s[%d] %.1lf != %.1lf\n", rank, x, name, i, val,
+                expected);
+        return 1;
+    }
+    return 0;
+}
+
+static int run_test(MPI_Comm comm, MPI_Win win, double *winbuf, int x)
+{
+    int i, flag = 0, errs = 0, comm_rank, comm_nprocs, root;
+    MPI_Request reqs[3];
+
+    MPI_Comm_rank(comm, &comm_rank);
+    MPI_Comm_size(comm, &comm_nprocs);
+    root = x % comm_nprocs;
+
+    for (i = 0; i < COUNT; i++) {
+        winbuf[SUM_OFF + i] = (double) (comm_rank + x + i);
+        winbuf[MAX_OFF + i] = (double) (comm_rank * i);
+        winbuf[BCAST_OFF + i] = comm_rank == root ? (double) (x + i) : -1.0;
+    }
+
+    MPIX_Win_iallreduce(SUM_OFF, COUNT, MPI_DOUBLE, MPI_SUM, win, &reqs[0]);
+    MPIX_Win_ibcast(BCAST_OFF, COUNT, MPI_DOUBLE, root, win, &reqs[1]);
+    MPIX_Win_iallreduce(MAX_OFF, COUNT, MPI_DOUBLE, MPI_MAX, win, &reqs[2]);
+
+    if (x % 2 == 0) {
+        MPI_Waitall(3, reqs, MPI_STATUSES_IGNORE);
+    }
+    else {
+        while (!flag)
+            MPI_Testall(3, reqs, &flag, MPI_STATUSES_IGNORE);
+    }
+
+    for (i = 0; i < COUNT; i++) {
+        errs += check_val("sum", x, i, winbuf[SUM_OFF + i],
+                          (double) (comm_nprocs * (comm_nprocs - 1) / 2 +
+                                    comm_nprocs * (x + i)));
+        errs += check_val("max", x, i, winbuf[MAX_OFF + i], (double) ((comm_nprocs - 1) * i));
+        errs += check_val("bcast", x, i, winbuf[BCAST_OFF + i], (double) (x + i));
+        if (errs > 0)
+            break;
+    }
+
+    return errs;
+}
+
+/* Datatypes that are not offloaded are issued by users. */
+static int run_test_fallback(MPI_Win win, double *winbuf)
+{
+    int i, errs = 0;
+    MPI_Datatype contig;
+    MPI_Request req;
+
+    MPI_Type_contiguous(2, MPI_DOUBLE, &contig);
+    MPI_Type_commit(&contig);
+
+    for (i = 0; i < COUNT; i++)
+        winbuf[BCAST_OFF + i] = rank == 0 ? (double) i : -1.0;
+    MPIX_Win_ibcast(BCAST_OFF, COUNT / 2, contig, 0, win, &req);
+    MPI_Wait(&req, MPI_STATUS_IGNORE);
+
+    for (i = 0; i < COUNT; i++) {
+        errs += check_val("fallback bcast", 0, i, winbuf[BCAST_OFF + i], (double) i);
+        if (errs > 0)
+            break;
+    }
+
+    MPI_Type_free(&contig);
+    return errs;
+}
+
+/* The last process has a smaller window, thus every process must return the
+ * same error without starting the collective. */
+static int run_test_err(void)
+{
+    int errs = 0, err;
+    double *winbuf = NULL;
+    MPI_Win win = MPI_WIN_NULL;
+    MPI_Request req = MPI_REQUEST_NULL;
+    MPI_Aint size = sizeof(double) * (rank == nprocs - 1 ? COUNT : WIN_SIZE);
+
+    MPI_Win_allocate(size, sizeof(double), MPI_INFO_NULL, MPI_COMM_WORLD, &winbuf, &win);
+
+    err = MPIX_Win_ibcast(BCAST_OFF, COUNT, MPI_DOUBLE, 0, win, &req);
+    if (err != MPI_ERR_DISP) {
+        fprintf(stderr, "[%d] out of window bcast returned %d, expected %d\n", rank, err,
+                MPI_ERR_DISP);
+        errs++;
+        if (err == MPI_SUCCESS)
+            MPI_Wait(&req, MPI_STATUS_IGNORE);
+    }
+
+    MPI_Win_free(&win);
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int x, errs = 0, errs_total = 0;
+    double *winbuf = NULL;
+    MPI_Win win = MPI_WIN_NULL;
+    MPI_Comm sub_comm = MPI_COMM_NULL;
+
+    /* Offloading is opt-in, enable it unless specified. */
+    setenv("MTCORE_COLL_OFFLOAD", "on", 0);
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    MPI_Win_allocate(sizeof(double) * WIN_SIZE, sizeof(double), MPI_INFO_NULL,
+                     MPI_COMM_WORLD, &winbuf, &win);
+    for (x = 0; x < ITER; x++)
+        errs += run_test(MPI_COMM_WORLD, win, winbuf, x);
+    errs += run_test_fallback(win, winbuf);
+    MPI_Win_free(&win);
+
+    if (nprocs >= 3) {
+        MPI_Comm_split(MPI_COMM_WORLD, rank == 0 ? MPI_UNDEFINED : 0, rank, &sub_comm);
+        if (sub_comm != MPI_COMM_NULL) {
+            MPI_Win_allocate(sizeof(double) * WIN_SIZE, sizeof(double), MPI_INFO_NULL,
+                             sub_comm, &winbuf, &win);
+            for (x = 0; x < ITER; x++)
+                errs += run_test(sub_comm, win, winbuf, x);
+            MPI_Win_free(&win);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+
+    errs += run_test_err();
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    if (sub_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&sub_comm);
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * win_plan.c
+ *  <FILE_DESC>
+ *
+ *  Check persistent RMA operations (MPIX_Put_init, MPIX_Accumulate_init and
+ *  MPIX_Start) in a halo exchange. Every process puts its halo to both
+ *  neighbors and adds to a counter on its right neighbor with the same plans
+ *  in every iteration, alternating fence, lock_all and lock epochs so that
+ *  plans are rebuilt when the epoch type changes. The origin buffer is
+ *  updated between iterations.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define HALO 64
+#define ITER 12
+
+extern int MPIX_Put_init(const void *origin_addr, int origin_count, MPI_Datatype origin_datatype,
+                         int target_rank, MPI_Aint target_disp, int target_count,
+                         MPI_Datatype target_datatype, MPI_Win win, void **plan);
+extern int MPIX_Accumulate_init(const void *origin_addr, int origin_count,
+                                MPI_Datatype origin_datatype, int target_rank,
+                                MPI_Aint target_disp, int target_count,
+                                MPI_Datatype target_datatype, MPI_Op op, MPI_Win win,
+                                void **plan);
+extern int MPIX_Start(void *plan);
+extern int MPIX_Plan_free(void **plan);
+
+int rank, nprocs;
+
+/* winbuf layout:
+ *  [0 : HALO]: halo from left neighbor
+ *  [HALO : 2 * HALO]: halo from right neighbor
+ *  [2 * HALO]: counter added by left neighbor */
+#define LEFT_OFF 0
+#define RIGHT_OFF HALO
+#define CNT_OFF (2 * HALO)
+#define WIN_SIZE (2 * HALO + 1)
+
+static int check_halo(int x, double *winbuf, int left, int right)
+{
+    int i, errs = 0;
+
+    for (i = 0; i < HALO; i++) {
+        double expected_l = (double) (left * HALO + i + x);
+        double expected_r = (double) (right * HALO + i + x);
+        if (winbuf[LEFT_OFF + i] != expected_l || winbuf[RIGHT_OFF + i] != expected_r) {
+            fprintf(stderr, "[%d] iter %d halo [%d] %.1lf/%.1lf != %.1lf/%.1lf\n", rank, x, i,
+                    winbuf[LEFT_OFF + i], winbuf[RIGHT_OFF + i], expected_l, expected_r);
+            errs++;
+        }
+    }
+    if (winbuf[CNT_OFF] != (double) (x + 1)) {
+        fprintf(stderr, "[%d] iter %d counter %.1lf != %.1lf\n", rank, x, winbuf[CNT_OFF],
+                (double) (x + 1));
+        errs++;
+    }
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, x, errs = 0, errs_total = 0;
+    int left, right;
+    double *winbuf = NULL, locbuf[HALO], one = 1.0;
+    MPI_Win win = MPI_WIN_NULL;
+    MPI_Info info = MPI_INFO_NULL;
+    void *plans[3] = { NULL, NULL, NULL };
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    left = (rank + nprocs - 1) % nprocs;
+    right = (rank + 1) % nprocs;
+
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "epoch_type", "lock|lockall|fence");
+    MPI_Win_allocate(sizeof(double) * WIN_SIZE, sizeof(double), info, MPI_COMM_WORLD, &winbuf,
+                     &win);
+    MPI_Info_free(&info);
+
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+    for (i = 0; i < WIN_SIZE; i++)
+        winbuf[i] = 0.0;
+    MPI_Win_unlock(rank, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPIX_Put_init(locbuf, HALO, MPI_DOUBLE, right, LEFT_OFF, HALO, MPI_DOUBLE, win, &plans[0]);
+    MPIX_Put_init(locbuf, HALO, MPI_DOUBLE, left, RIGHT_OFF, HALO, MPI_DOUBLE, win, &plans[1]);
+    MPIX_Accumulate_init(&one, 1, MPI_DOUBLE, right, CNT_OFF, 1, MPI_DOUBLE, MPI_SUM, win,
+                         &plans[2]);
+
+    for (x = 0; x < ITER; x++) {
+        for (i = 0; i < HALO; i++)
+            locbuf[i] = (double) (rank * HALO + i + x);
+
+        switch (x % 3) {
+        case 0:
+            MPI_Win_fence(0, win);
+            for (i = 0; i < 3; i++)
+                MPIX_Start(plans[i]);
+            MPI_Win_fence(0, win);
+            break;
+        case 1:
+            MPI_Win_lock_all(0, win);
+            for (i = 0; i < 3; i++)
+                MPIX_Start(plans[i]);
+            MPI_Win_unlock_all(win);
+            break;
+        default:
+            MPI_Win_lock(MPI_LOCK_SHARED, right, 0, win);
+            MPIX_Start(plans[0]);
+            MPIX_Start(plans[2]);
+            MPI_Win_unlock(right, win);
+            MPI_Win_lock(MPI_LOCK_SHARED, left, 0, win);
+            MPIX_Start(plans[1]);
+            MPI_Win_unlock(left, win);
+            break;
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+
+        MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, win);
+        errs += check_halo(x, winbuf, left, right);
+        MPI_Win_unlock(rank, win);
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+
+    for (i = 0; i < 3; i++)
+        MPIX_Plan_free(&plans[i]);
+    MPI_Win_free(&win);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * win_stripe.c
+ *  <FILE_DESC>
+ *
+ *  Check large contiguous put and get striped over helpers of target. Every
+ *  process puts a buffer larger than MTCORE_STRIPE_SIZE to its right neighbor
+ *  and gets it back, in fence epochs, in lock_all epochs with
+ *  MPI_MODE_NOCHECK, and in lock epochs which are not striped unless the lock
+ *  is granted. The element count is not a multiple of the number of helpers.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define COUNT (512 * 1024 + 3)
+#define ITER 4
+
+int rank, nprocs;
+double *locbuf = NULL, *checkbuf = NULL;
+
+static int check_buf(const char *name, int x, double *buf, int owner)
+{
+    int i, errs = 0;
+
+    for (i = 0; i < COUNT; i++) {
+        double expected = (double) (owner * COUNT + i + x);
+        if (buf[i] != expected) {
+            fprintf(stderr, "[%d] iter %d %s [%d] %.1lf != %.1lf\n", rank, x, name, i, buf[i],
+                    expected);
+            errs++;
+            break;
+        }
+    }
+    return errs;
+}
+
+static void reset_bufs(int x)
+{
+    int i;
+
+    for (i = 0; i < COUNT; i++) {
+        locbuf[i] = (double) (rank * COUNT + i + x);
+        checkbuf[i] = -1.0;
+    }
+}
+
+static int run_test(MPI_Win win, double *winbuf, int x)
+{
+    int errs = 0, right, left;
+
+    right = (rank + 1) % nprocs;
+    left = (rank + nprocs - 1) % nprocs;
+
+    /* fence */
+    reset_bufs(x);
+    MPI_Win_fence(0, win);
+    MPI_Put(locbuf, COUNT, MPI_DOUBLE, right, 0, COUNT, MPI_DOUBLE, win);
+    MPI_Win_fence(0, win);
+    errs += check_buf("fence put", x, winbuf, left);
+    MPI_Get(checkbuf, COUNT, MPI_DOUBLE, right, 0, COUNT, MPI_DOUBLE, win);
+    MPI_Win_fence(0, win);
+    errs += check_buf("fence get", x, checkbuf, rank);
+
+    /* lock_all with nocheck */
+    reset_bufs(x + 1);
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+    MPI_Put(locbuf, COUNT, MPI_DOUBLE, right, 0, COUNT, MPI_DOUBLE, win);
+    MPI_Win_flush(right, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Get(checkbuf, COUNT, MPI_DOUBLE, right, 0, COUNT, MPI_DOUBLE, win);
+    MPI_Win_unlock_all(win);
+    errs += check_buf("lockall get", x + 1, checkbuf, rank);
+
+    /* lock */
+    reset_bufs(x + 2);
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Win_lock(MPI_LOCK_SHARED, right, 0, win);
+    MPI_Put(locbuf, COUNT, MPI_DOUBLE, right, 0, COUNT, MPI_DOUBLE, win);
+    MPI_Win_unlock(right, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Win_lock(MPI_LOCK_SHARED, right, 0, win);
+    MPI_Get(checkbuf, COUNT, MPI_DOUBLE, right, 0, COUNT, MPI_DOUBLE, win);
+    MPI_Win_unlock(right, win);
+    errs += check_buf("lock get", x + 2, checkbuf, rank);
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int x, errs = 0, errs_total = 0;
+    double *winbuf = NULL;
+    MPI_Win win = MPI_WIN_NULL;
+    MPI_Info info = MPI_INFO_NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    locbuf = calloc(COUNT, sizeof(double));
+    checkbuf = calloc(COUNT, sizeof(double));
+
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "epoch_type", "lock|lockall|fence");
+    MPI_Win_allocate(sizeof(double) * COUNT, sizeof(double), info, MPI_COMM_WORLD, &winbuf,
+                     &win);
+    MPI_Info_free(&info);
+
+    for (x = 0; x < ITER; x++)
+        errs += run_test(win, winbuf, x);
+
+    MPI_Win_free(&win);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    if (locbuf)
+        free(locbuf);
+    if (checkbuf)
+        free(checkbuf);
+
+    MPI_Finalize();
+
+    return 0;
+}
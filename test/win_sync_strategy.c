@@ -0,0 +1,144 @@
+/*
+ * win_sync_strategy.c
+ *  <FILE_DESC>
+ *
+ *  Check windows with different synchronization strategies (info
+ *  sync_strategy=helper|all) used at the same time. Every process
+ *  accumulates to all processes on both windows in lock, lock_all with
+ *  flush, fence and PSCW epochs.
+ *
+ *  Author: Min Si
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#define ITER 4
+#define NUM_WINS 2
+
+int rank, nprocs;
+
+static const char *strategies[NUM_WINS] = { "helper", "all" };
+
+static void reset_win(MPI_Win win, double *winbuf)
+{
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, rank, 0, win);
+    winbuf[0] = 0.0;
+    MPI_Win_unlock(rank, win);
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+static int check_result(const char *epoch, int w, MPI_Win win, double *winbuf, double expected)
+{
+    int errs = 0;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Win_lock(MPI_LOCK_SHARED, rank, 0, win);
+    if (winbuf[0] != expected) {
+        fprintf(stderr, "[%d] %s %s: %.1lf != %.1lf\n", rank, strategies[w], epoch, winbuf[0],
+                expected);
+        errs++;
+    }
+    MPI_Win_unlock(rank, win);
+    return errs;
+}
+
+static int run_test(int w, MPI_Win win, double *winbuf)
+{
+    int i, dst, errs = 0;
+    double one = 1.0;
+    MPI_Group world_group;
+
+    /* lock */
+    reset_win(win, winbuf);
+    for (i = 0; i < ITER; i++) {
+        for (dst = 0; dst < nprocs; dst++) {
+            MPI_Win_lock(i % 2 ? MPI_LOCK_SHARED : MPI_LOCK_EXCLUSIVE, dst, 0, win);
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+            MPI_Win_flush(dst, win);
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+            MPI_Win_unlock(dst, win);
+        }
+    }
+    errs += check_result("lock", w, win, winbuf, (double) (nprocs * ITER * 2));
+
+    /* lock_all */
+    reset_win(win, winbuf);
+    MPI_Win_lock_all(0, win);
+    for (i = 0; i < ITER; i++) {
+        for (dst = 0; dst < nprocs; dst++)
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+        MPI_Win_flush_all(win);
+    }
+    MPI_Win_unlock_all(win);
+    errs += check_result("lockall", w, win, winbuf, (double) (nprocs * ITER));
+
+    /* fence */
+    reset_win(win, winbuf);
+    MPI_Win_fence(0, win);
+    for (i = 0; i < ITER; i++) {
+        for (dst = 0; dst < nprocs; dst++)
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+        MPI_Win_fence(0, win);
+    }
+    errs += check_result("fence", w, win, winbuf, (double) (nprocs * ITER));
+
+    /* PSCW with all processes */
+    reset_win(win, winbuf);
+    MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+    for (i = 0; i < ITER; i++) {
+        MPI_Win_post(world_group, 0, win);
+        MPI_Win_start(world_group, 0, win);
+        for (dst = 0; dst < nprocs; dst++)
+            MPI_Accumulate(&one, 1, MPI_DOUBLE, dst, 0, 1, MPI_DOUBLE, MPI_SUM, win);
+        MPI_Win_complete(win);
+        MPI_Win_wait(win);
+    }
+    MPI_Group_free(&world_group);
+    errs += check_result("pscw", w, win, winbuf, (double) (nprocs * ITER));
+
+    return errs;
+}
+
+int main(int argc, char *argv[])
+{
+    int w, errs = 0, errs_total = 0;
+    double *winbufs[NUM_WINS] = { NULL, NULL };
+    MPI_Win wins[NUM_WINS] = { MPI_WIN_NULL, MPI_WIN_NULL };
+    MPI_Info info = MPI_INFO_NULL;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    if (nprocs < 2) {
+        fprintf(stderr, "Please run using at least 2 processes\n");
+        goto exit;
+    }
+
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "epoch_type", "lock|lockall|fence|pscw");
+    for (w = 0; w < NUM_WINS; w++) {
+        MPI_Info_set(info, "sync_strategy", (char *) strategies[w]);
+        MPI_Win_allocate(sizeof(double), sizeof(double), info, MPI_COMM_WORLD, &winbufs[w],
+                         &wins[w]);
+    }
+    MPI_Info_free(&info);
+
+    for (w = 0; w < NUM_WINS; w++)
+        errs += run_test(w, wins[w], winbufs[w]);
+
+    for (w = 0; w < NUM_WINS; w++)
+        MPI_Win_free(&wins[w]);
+
+    MPI_Allreduce(&errs, &errs_total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        fprintf(stdout, "%d errors\n", errs_total);
+    }
+
+  exit:
+    MPI_Finalize();
+
+    return 0;
+}